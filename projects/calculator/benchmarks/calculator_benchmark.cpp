@@ -0,0 +1,211 @@
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ast_builder.h"
+#include "batch.h"
+#include "bytecode.h"
+#include "env.h"
+#include "parser.h"
+#include "scanner.h"
+
+namespace {
+
+const char* const kExpressions[] = {
+    "2 * pi * r",
+    "a * x * x + b * x + c",
+    "sqrt(x * x + y * y) / (1 + r)",
+    "sin(x) * cos(y) + exp(-r) - log(1 + x * y)",
+    "1 + x - 2 * y + 3 * r - 4 / x + 5 * a - 6 * b + 7 * c - 8 / y + 9 * x * y",
+};
+
+// Parses one of kExpressions into a fresh Env that defines every variable it uses.
+struct Formula {
+    Formula(const benchmark::State& state, IAstBuilder& builder, bool simplify = true) {
+        for (const char* init : {"r = 1.5", "x = 3", "y = 4", "a = 0.5", "b = -2", "c = 7"}) {
+            std::istringstream line(init);
+            Scanner lineScanner(line);
+            Parser lineParser(lineScanner, builder, env);
+            lineParser.parse();
+            lineParser.calc();
+        }
+        input = std::make_unique<std::istringstream>(kExpressions[state.range(0)]);
+        scanner = std::make_unique<Scanner>(*input);
+        parser = std::make_unique<Parser>(*scanner, builder, env);
+        parser->setSimplify(simplify);
+        parser->parse();
+    }
+
+    Env env;
+    std::unique_ptr<std::istringstream> input;
+    std::unique_ptr<Scanner> scanner;
+    std::unique_ptr<Parser> parser;
+};
+
+void ExpressionArgs(benchmark::internal::Benchmark* bench) {
+    for (size_t i = 0; i < sizeof(kExpressions) / sizeof(kExpressions[0]); ++i) {
+        bench->Arg(static_cast<int64_t>(i));
+    }
+}
+
+// A long statement over kExpressions, so parsing is dominated by node construction.
+std::string LongExpression(int64_t repeats) {
+    std::string expression;
+    for (int64_t i = 0; i < repeats; ++i) {
+        for (const char* part : kExpressions) {
+            expression += expression.empty() ? "(" : " + (";
+            expression += part;
+            expression += ")";
+        }
+    }
+    return expression;
+}
+
+// Parses and drops the tree each iteration; Env holds every variable LongExpression uses.
+void ParseAndDiscard(benchmark::State& state, IAstBuilder& builder) {
+    Env env;
+    for (const char* init : {"r = 1.5", "x = 3", "y = 4", "a = 0.5", "b = -2", "c = 7"}) {
+        std::istringstream line(init);
+        Scanner lineScanner(line);
+        Parser lineParser(lineScanner, builder, env);
+        lineParser.parse();
+        lineParser.calc();
+    }
+    const std::string expression = LongExpression(state.range(0));
+    for (auto _ : state) {
+        std::istringstream input(expression);
+        Scanner scanner(input);
+        Parser parser(scanner, builder, env);
+        benchmark::DoNotOptimize(parser.parse());
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(expression.size()));
+}
+
+} // namespace
+
+static void BM_calculator_tree_walk(benchmark::State& state) {
+    BinaryAstBuilder builder;
+    Formula formula(state, builder);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(formula.parser->calc());
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(kExpressions[state.range(0)]);
+}
+BENCHMARK(BM_calculator_tree_walk)->Apply(ExpressionArgs);
+
+static void BM_calculator_tree_walk_unsimplified(benchmark::State& state) {
+    BinaryAstBuilder builder;
+    Formula formula(state, builder, false);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(formula.parser->calc());
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(kExpressions[state.range(0)]);
+}
+BENCHMARK(BM_calculator_tree_walk_unsimplified)->Apply(ExpressionArgs);
+
+static void BM_calculator_tree_walk_nary(benchmark::State& state) {
+    NaryAstBuilder builder;
+    Formula formula(state, builder);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(formula.parser->calc());
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(kExpressions[state.range(0)]);
+}
+BENCHMARK(BM_calculator_tree_walk_nary)->Apply(ExpressionArgs);
+
+static void BM_calculator_bytecode(benchmark::State& state) {
+    BinaryAstBuilder builder;
+    Formula formula(state, builder);
+    Bytecode program = formula.parser->compile();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(program.run());
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(kExpressions[state.range(0)]);
+}
+BENCHMARK(BM_calculator_bytecode)->Apply(ExpressionArgs);
+
+static void BM_calculator_compile(benchmark::State& state) {
+    BinaryAstBuilder builder;
+    Formula formula(state, builder);
+    for (auto _ : state) {
+        Bytecode program = formula.parser->compile();
+        benchmark::DoNotOptimize(program.code().data());
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(kExpressions[state.range(0)]);
+}
+BENCHMARK(BM_calculator_compile)->Apply(ExpressionArgs);
+
+// kExpressions over a million rows with x and y bound to columns; bytes count the output and
+// the columns the expression reads.
+void BatchEvaluate(benchmark::State& state, bool exactMath) {
+    BinaryAstBuilder builder;
+    Formula formula(state, builder);
+    Bytecode program = formula.parser->compile();
+    constexpr std::size_t kRows = 1 << 20;
+    std::vector<double> xs(kRows);
+    std::vector<double> ys(kRows);
+    std::vector<double> output(kRows);
+    for (std::size_t i = 0; i < kRows; ++i) {
+        xs[i] = 1 + static_cast<double>(i % 1000) / 100;
+        ys[i] = 2 + static_cast<double>(i % 777) / 100;
+    }
+    BatchEvaluator batch(program);
+    batch.bind("x", xs.data());
+    batch.bind("y", ys.data());
+    batch.setExactMath(exactMath);
+    for (auto _ : state) {
+        batch.run(output.data(), kRows);
+        benchmark::DoNotOptimize(output.data());
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(kRows));
+    std::size_t arrays = 1;
+    for (const std::string& symbol : program.symbols()) {
+        arrays += symbol == "x" || symbol == "y" ? 1 : 0;
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(arrays * kRows * sizeof(double)));
+    state.SetLabel(kExpressions[state.range(0)]);
+}
+
+static void BM_calculator_batch(benchmark::State& state) {
+    BatchEvaluate(state, false);
+}
+BENCHMARK(BM_calculator_batch)->Apply(ExpressionArgs);
+
+static void BM_calculator_batch_exact_math(benchmark::State& state) {
+    BatchEvaluate(state, true);
+}
+BENCHMARK(BM_calculator_batch_exact_math)->Apply(ExpressionArgs);
+
+static void BM_calculator_parse_heap(benchmark::State& state) {
+    BinaryAstBuilder builder(ENodeAllocation::Heap);
+    ParseAndDiscard(state, builder);
+}
+BENCHMARK(BM_calculator_parse_heap)->Arg(1)->Arg(16);
+
+static void BM_calculator_parse_arena(benchmark::State& state) {
+    BinaryAstBuilder builder(ENodeAllocation::Arena);
+    ParseAndDiscard(state, builder);
+}
+BENCHMARK(BM_calculator_parse_arena)->Arg(1)->Arg(16);
+
+static void BM_calculator_parse_heap_nary(benchmark::State& state) {
+    NaryAstBuilder builder(ENodeAllocation::Heap);
+    ParseAndDiscard(state, builder);
+}
+BENCHMARK(BM_calculator_parse_heap_nary)->Arg(1)->Arg(16);
+
+static void BM_calculator_parse_arena_nary(benchmark::State& state) {
+    NaryAstBuilder builder(ENodeAllocation::Arena);
+    ParseAndDiscard(state, builder);
+}
+BENCHMARK(BM_calculator_parse_arena_nary)->Arg(1)->Arg(16);
+
+BENCHMARK_MAIN();
@@ -5,58 +5,66 @@
 template <typename Op>
 struct OperationPart {
     Op op;
-    std::unique_ptr<Node> node;
+    NodePtr node;
 };
 
 using AdditivePart = OperationPart<EAdditiveOp>;
 using MultiplicativePart = OperationPart<EMultiplicativeOp>;
 
+/*
+In ENodeAllocation::Arena mode the Parser hands the builder a fresh NodeArena for each
+parse(); nodes built outside a parse, or with no arena set, come from the heap.
+*/
 class IAstBuilder {
 public:
+    explicit IAstBuilder(ENodeAllocation allocation = ENodeAllocation::Heap): allocation_(allocation) {}
     virtual ~IAstBuilder() = default;
 
-    virtual std::unique_ptr<Node> makeNumber(double value) const = 0;
-    virtual std::unique_ptr<Node> makeVariable(std::string symbol, Env& env) const = 0;
-    virtual std::unique_ptr<Node> makeFunction(std::unique_ptr<Node> child, FuncPtr func) const = 0;
-    virtual std::unique_ptr<Node> makeNegate(std::unique_ptr<Node> child) const = 0;
-    virtual std::unique_ptr<Node> makeAssign(std::unique_ptr<Node> left,
-                                             std::unique_ptr<Node> right) const = 0;
-    virtual std::unique_ptr<Node> makeAdditive(
-        std::unique_ptr<Node> first,
-        std::vector<AdditivePart> rest) const = 0;
-    virtual std::unique_ptr<Node> makeMultiplicative(
-        std::unique_ptr<Node> first,
-        std::vector<MultiplicativePart> rest) const = 0;
+    ENodeAllocation allocation() const { return allocation_; }
+    void setArena(NodeArena* arena) { arena_ = arena; }
+
+    virtual NodePtr makeNumber(double value) const = 0;
+    virtual NodePtr makeVariable(std::string symbol, Env& env) const = 0;
+    virtual NodePtr makeFunction(NodePtr child, FuncPtr func) const = 0;
+    virtual NodePtr makeNegate(NodePtr child) const = 0;
+    virtual NodePtr makeAssign(NodePtr left, NodePtr right) const = 0;
+    virtual NodePtr makeAdditive(NodePtr first, std::vector<AdditivePart> rest) const = 0;
+    virtual NodePtr makeMultiplicative(NodePtr first, std::vector<MultiplicativePart> rest) const = 0;
+
+protected:
+    template <typename T, typename... Args>
+    NodePtrOf<T> make(Args&&... args) const {
+        if (arena_) {
+            return arena_->create<T>(std::forward<Args>(args)...);
+        }
+        return NodePtrOf<T>(new T(std::forward<Args>(args)...));
+    }
+
+private:
+    ENodeAllocation allocation_;
+    NodeArena* arena_ = nullptr;
 };
 
 class BinaryAstBuilder : public IAstBuilder {
 public:
-    std::unique_ptr<Node> makeNumber(double value) const override;
-    std::unique_ptr<Node> makeVariable(std::string symbol, Env& env) const override;
-    std::unique_ptr<Node> makeFunction(std::unique_ptr<Node> child, FuncPtr func) const override;
-    std::unique_ptr<Node> makeNegate(std::unique_ptr<Node> child) const override;
-    std::unique_ptr<Node> makeAssign(std::unique_ptr<Node> left,
-                                     std::unique_ptr<Node> right) const override;
-    std::unique_ptr<Node> makeAdditive(
-        std::unique_ptr<Node> first,
-        std::vector<AdditivePart> rest) const override;
-    std::unique_ptr<Node> makeMultiplicative(
-        std::unique_ptr<Node> first,
-        std::vector<MultiplicativePart> rest) const override;
+    explicit BinaryAstBuilder(ENodeAllocation allocation = ENodeAllocation::Heap): IAstBuilder(allocation) {}
+    NodePtr makeNumber(double value) const override;
+    NodePtr makeVariable(std::string symbol, Env& env) const override;
+    NodePtr makeFunction(NodePtr child, FuncPtr func) const override;
+    NodePtr makeNegate(NodePtr child) const override;
+    NodePtr makeAssign(NodePtr left, NodePtr right) const override;
+    NodePtr makeAdditive(NodePtr first, std::vector<AdditivePart> rest) const override;
+    NodePtr makeMultiplicative(NodePtr first, std::vector<MultiplicativePart> rest) const override;
 };
 
 class NaryAstBuilder : public IAstBuilder {
 public:
-    std::unique_ptr<Node> makeNumber(double value) const override;
-    std::unique_ptr<Node> makeVariable(std::string symbol, Env& env) const override;
-    std::unique_ptr<Node> makeFunction(std::unique_ptr<Node> child, FuncPtr func) const override;
-    std::unique_ptr<Node> makeNegate(std::unique_ptr<Node> child) const override;
-    std::unique_ptr<Node> makeAssign(std::unique_ptr<Node> left,
-                                     std::unique_ptr<Node> right) const override;
-    std::unique_ptr<Node> makeAdditive(
-        std::unique_ptr<Node> first,
-        std::vector<AdditivePart> rest) const override;
-    std::unique_ptr<Node> makeMultiplicative(
-        std::unique_ptr<Node> first,
-        std::vector<MultiplicativePart> rest) const override;
+    explicit NaryAstBuilder(ENodeAllocation allocation = ENodeAllocation::Heap): IAstBuilder(allocation) {}
+    NodePtr makeNumber(double value) const override;
+    NodePtr makeVariable(std::string symbol, Env& env) const override;
+    NodePtr makeFunction(NodePtr child, FuncPtr func) const override;
+    NodePtr makeNegate(NodePtr child) const override;
+    NodePtr makeAssign(NodePtr left, NodePtr right) const override;
+    NodePtr makeAdditive(NodePtr first, std::vector<AdditivePart> rest) const override;
+    NodePtr makeMultiplicative(NodePtr first, std::vector<MultiplicativePart> rest) const override;
 };
@@ -0,0 +1,73 @@
+#pragma once
+/*
+block-wise evaluation of a compiled expression over columns of inputs.
+*/
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "batch_math.h"
+#include "bytecode.h"
+
+/*
+Evaluates a Bytecode program once per row, kBlockSize rows at a time: each instruction is one
+loop over the block, so arithmetic vectorizes and FuncTable functions use block kernels.
+Variables given a column with bind() read their row's value from it; the others are read once
+per run() from the program's Env, throwing as Bytecode::run() does.
+Compared with calling Bytecode::run() for every row:
+- arithmetic is bit-identical; functions may differ in the last bits unless setExactMath(true);
+- DivisionByZeroError is thrown if any row divides by zero, leaving output partly written;
+- an assignment leaves the variable holding the last row's value. Reading a variable before
+  the program assigns it would see the previous row, so run() rejects it with RuntimeError.
+*/
+class BatchEvaluator {
+public:
+    static constexpr std::size_t kBlockSize = 256;
+
+    // program and its Env must outlive the evaluator.
+    explicit BatchEvaluator(const Bytecode& program);
+
+    // values needs one entry per row passed to run(). Names the program does not use are ignored.
+    void bind(const std::string& symbol, const double* values);
+    // Calls FuncTable functions per value, so functions match Bytecode::run() bit for bit too.
+    void setExactMath(bool exact) { exactMath_ = exact; }
+    // Writes the program's result for row i of every bound column to output[i], i < count.
+    void run(double* output, std::size_t count);
+
+private:
+    // A block of values, or one value for every row when values is nullptr.
+    struct Operand {
+        const double* values;
+        double scalar;
+    };
+
+    void runBlock(std::size_t row, std::size_t count, double* output);
+    Operand binary(EOpCode op, const Operand& left, const Operand& right, double* out, std::size_t count) const;
+    Operand unary(const Instruction& ins, const Operand& value, double* out, std::size_t count) const;
+    void checkDivisor(const Operand& divisor, std::size_t count) const;
+    Operand load(unsigned int slot, std::size_t row, bool stored);
+    void store(unsigned int slot, const Operand& value, std::size_t count, bool last);
+    void checkAssignedBeforeRead() const;
+    void updateAssigned(std::size_t count);
+    double* buffer(std::size_t position) { return buffers_.data() + position * kBlockSize; }
+
+    const Bytecode& program_;
+    std::vector<BlockFunc> blockFuncs_;
+    // Per instruction: a Load that follows a Store of its slot in the same row.
+    std::vector<std::uint8_t> readsStored_;
+    // Per instruction: any other Load of a slot the program assigns later in the row.
+    std::vector<std::uint8_t> readsAssignedLater_;
+    // Instructions after this one are Stores only, so it may write to the output directly.
+    std::size_t resultIndex_ = 0;
+    bool exactMath_ = false;
+
+    // Per slot.
+    std::vector<const double*> columns_;
+    std::vector<Operand> variables_;
+    std::vector<std::uint8_t> resolved_;
+    std::vector<Operand> assigned_;
+    std::vector<double> assignedBuffers_;
+
+    std::vector<Operand> stack_;
+    std::vector<double> buffers_;
+};
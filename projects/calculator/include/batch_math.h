@@ -0,0 +1,19 @@
+#pragma once
+/*
+block kernels for FuncTable functions.
+*/
+#include <cstddef>
+#include "func_table.h"
+
+// Builds a kernel for the baseline ISA and for AVX2, picked at load time, where supported.
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define CALCULATOR_VECTOR_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define CALCULATOR_VECTOR_CLONES
+#endif
+
+using BlockFunc = void (*)(const double* in, double* out, std::size_t count);
+
+// Kernel applying func to count values, or nullptr when func has none. With glibc the kernels
+// call libmvec, whose results may differ from func in the last bits.
+BlockFunc FindBlockFunc(FuncPtr func);
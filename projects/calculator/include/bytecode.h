@@ -0,0 +1,122 @@
+#pragma once
+/*
+flat bytecode compiled from an AST and evaluated by a stack VM.
+*/
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "func_table.h"
+
+class Env;
+class Node;
+
+enum class EOpCode : std::uint8_t {
+    PushConst,     // push constants_[operand]
+    Load,          // push the variable bound to slot operand
+    Store,         // assign the top of stack to slot operand, leaving it on the stack
+    Add,
+    Subtract,
+    Multiply,
+    Divide,        // a b -> a / b, throws when b == 0
+    CheckDivisor,  // throws when the top of stack is 0
+    DivideInto,    // b a -> a / b; DivideNode evaluates its divisor first
+    Negate,
+    Call,          // top = funcs_[operand](top)
+};
+
+struct Instruction {
+    EOpCode op;
+    unsigned int operand;
+};
+
+/*
+Compiling walks the tree once; run() then evaluates the program without virtual calls.
+Variable slots bind to symbol ids on first use. When Storage::generation() moves (Env
+reloaded or cleared) run() drops the bindings first.
+
+code() is the plain stack program other passes read. run() executes a fused copy of it: an
+operand push followed by a binary operator becomes a single instruction working on the top
+of stack, which lives in a local. Once every slot is bound the copy carries symbol ids, so
+a variable operand is one read from the storage cells.
+*/
+class Bytecode {
+public:
+    Bytecode(const Node& root, Env& env);
+
+    // Same result and exceptions as root.calc(). Not reentrant: the value stack is reused.
+    double run();
+
+    void emit(EOpCode op);
+    void emitConst(double value);
+    void emitLoad(const std::string& symbol);
+    void emitStore(const std::string& symbol);
+    void emitCall(FuncPtr func);
+
+    const std::vector<Instruction>& code() const { return code_; }
+    const std::vector<double>& constants() const { return constants_; }
+    const std::vector<FuncPtr>& functions() const { return funcs_; }
+    // Variable name per slot.
+    const std::vector<std::string>& symbols() const { return symbols_; }
+    Env& env() const { return env_; }
+    std::size_t stackDepth() const { return maxDepth_; }
+
+private:
+    // Operands are constant indices or slots; bound_ replaces slots with symbol ids.
+    enum class EFusedOp : std::uint8_t {
+        PushConst,
+        PushVariable,
+        Store,
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        CheckDivisor,
+        DivideInto,
+        Negate,
+        Call,
+        AddConst,  // top op= operand
+        AddVariable,
+        SubtractConst,
+        SubtractVariable,
+        MultiplyConst,
+        MultiplyVariable,
+        DivideConst,  // throws when the operand is 0
+        DivideVariable,
+        DivideIntoConst,  // top = operand / top
+        DivideIntoVariable,
+        Return,  // ends every fused program
+    };
+
+    struct FusedInstruction {
+        EFusedOp op;
+        unsigned int operand;
+    };
+
+    static bool usesSlot(EFusedOp op);
+    void fuse();
+    void fuseBinary(EFusedOp op, EFusedOp withConst, EFusedOp withVariable);
+    double bindAndRun();
+    // Runs code_ one instruction at a time; used while some slot is not bound yet.
+    double runChecked();
+    unsigned int slotOf(const std::string& symbol);
+    unsigned int bind(unsigned int slot);
+    double load(unsigned int slot);
+    void store(unsigned int slot, double value);
+    void push(EOpCode op, unsigned int operand);
+
+    Env& env_;
+    std::vector<Instruction> code_;
+    std::vector<double> constants_;
+    std::vector<FuncPtr> funcs_;
+    std::vector<std::string> symbols_;
+    // Symbol id per slot; kInvalidSymbolId until the variable is seen defined and initialized.
+    std::vector<unsigned int> ids_;
+    std::uint64_t generation_ = 0;
+    std::vector<FusedInstruction> fused_;
+    // fused_ specialized to ids_; empty until every slot is bound in this generation.
+    std::vector<FusedInstruction> bound_;
+    std::vector<double> stack_;
+    std::size_t depth_ = 0;
+    std::size_t maxDepth_ = 0;
+};
@@ -6,6 +6,10 @@
 #include <utility>
 #include <vector>
 #include "func_table.h"
+#include "node_arena.h"
+
+class AstSimplifier;
+class Bytecode;
 
 enum class EAdditiveOp : std::uint8_t {
     Add,
@@ -29,93 +33,127 @@ public:
     virtual double calc() const = 0;
     virtual bool isLvalue() const { return false; }
     virtual void assign([[maybe_unused]] double value) { throw std::runtime_error("Not an lvalue"); }
+    // Appends code that leaves calc() on the VM stack, evaluating children in calc() order.
+    virtual void compile(Bytecode& out) const = 0;
+    // Appends code that assigns the top of the VM stack to this lvalue.
+    virtual void compileAssign([[maybe_unused]] Bytecode& out) const { throw std::runtime_error("Not an lvalue"); }
+    // Simplifies the children in place; returns the node replacing this one, or nullptr to keep it.
+    virtual NodePtr simplify([[maybe_unused]] AstSimplifier& pass) { return nullptr; }
 };
 
 class NumberNode : public Node {
 public:
     NumberNode(double value): value_(value) {}
+    double value() const { return value_; }
     double calc() const override;
+    void compile(Bytecode& out) const override;
 private:
     const double value_;
 };
 
 class BinaryNode : public Node {
 public:
-    BinaryNode(std::unique_ptr<Node> left, std::unique_ptr<Node> right)
+    BinaryNode(NodePtr left, NodePtr right)
         : left_(std::move(left)), right_(std::move(right)) {}
     ~BinaryNode() = default;
 protected:
-    std::unique_ptr<Node> left_;
-    std::unique_ptr<Node> right_;
+    // Simplifies both operands; true when both are now numbers, stored in left and right.
+    bool simplifyOperands(AstSimplifier& pass, double& left, double& right);
+    NodePtr left_;
+    NodePtr right_;
 };
 
 class UnaryNode : public Node {
 public:
-    UnaryNode(std::unique_ptr<Node> child): child_(std::move(child)) {}
+    UnaryNode(NodePtr child): child_(std::move(child)) {}
     ~UnaryNode() = default;
 protected:
-    std::unique_ptr<Node> child_;
+    NodePtr child_;
 };
 
 class Env;
+/*
+Caches the symbol id once the variable is defined and initialized, so later reads are one
+indexed load. Storage::generation() changes when Env is reloaded or cleared, which rebinds.
+*/
 class VariableNode : public Node {
 public:
-    VariableNode(std::string symbol, Env& env)
-        : symbol_(std::move(symbol)), env_(env) {}
+    VariableNode(std::string symbol, Env& env);
     double calc() const;
     bool isLvalue() const override { return true; }
     void assign(double value) override;
+    void compile(Bytecode& out) const override;
+    void compileAssign(Bytecode& out) const override;
+    NodePtr simplify(AstSimplifier& pass) override;
 private:
+    unsigned int bind() const;
+
     std::string symbol_;
     Env& env_;
+    mutable unsigned int id_;
+    mutable std::uint64_t generation_;
 };
 
 class AddNode : public BinaryNode {
 public:
-    AddNode(std::unique_ptr<Node> left, std::unique_ptr<Node> right)
+    AddNode(NodePtr left, NodePtr right)
         : BinaryNode(std::move(left), std::move(right)) {}
     double calc() const override;
+    void compile(Bytecode& out) const override;
+    NodePtr simplify(AstSimplifier& pass) override;
 };
 
 class SubtractNode : public BinaryNode {
 public:
-    SubtractNode(std::unique_ptr<Node> left, std::unique_ptr<Node> right)
+    SubtractNode(NodePtr left, NodePtr right)
         : BinaryNode(std::move(left), std::move(right)) {}
     double calc() const override;
+    void compile(Bytecode& out) const override;
+    NodePtr simplify(AstSimplifier& pass) override;
 };
 
 class MultiplyNode : public BinaryNode {
 public:
-    MultiplyNode(std::unique_ptr<Node> left, std::unique_ptr<Node> right)
+    MultiplyNode(NodePtr left, NodePtr right)
         : BinaryNode(std::move(left), std::move(right)) {}
     double calc() const override;
+    void compile(Bytecode& out) const override;
+    NodePtr simplify(AstSimplifier& pass) override;
 };
 
 class DivideNode : public BinaryNode {
 public:
-    DivideNode(std::unique_ptr<Node> left, std::unique_ptr<Node> right)
+    DivideNode(NodePtr left, NodePtr right)
         : BinaryNode(std::move(left), std::move(right)) {}
     double calc() const override;
+    void compile(Bytecode& out) const override;
+    NodePtr simplify(AstSimplifier& pass) override;
 };
 
 class AssignNode : public BinaryNode {
 public:
-    AssignNode(std::unique_ptr<Node> left, std::unique_ptr<Node> right)
+    AssignNode(NodePtr left, NodePtr right)
         : BinaryNode(std::move(left), std::move(right)) {}
     double calc() const override;
+    void compile(Bytecode& out) const override;
+    NodePtr simplify(AstSimplifier& pass) override;
 };
 
 class NegateNode : public UnaryNode {
 public:
-    explicit NegateNode(std::unique_ptr<Node> child): UnaryNode(std::move(child)) {}
+    explicit NegateNode(NodePtr child): UnaryNode(std::move(child)) {}
     double calc() const override;
+    void compile(Bytecode& out) const override;
+    NodePtr simplify(AstSimplifier& pass) override;
 };
 
 class FunNode : public UnaryNode {
 public:
-    explicit FunNode(std::unique_ptr<Node> child, FuncPtr pfunc)
+    explicit FunNode(NodePtr child, FuncPtr pfunc)
         : UnaryNode(std::move(child)), pfunc_(pfunc) {}
     double calc() const override;
+    void compile(Bytecode& out) const override;
+    NodePtr simplify(AstSimplifier& pass) override;
 
 private:
     FuncPtr pfunc_;
@@ -123,26 +161,33 @@ private:
 
 class NaryNode : public Node {
 public:
-    explicit NaryNode(std::unique_ptr<Node> child);
+    explicit NaryNode(NodePtr child);
 protected:
-    void appendChild(std::unique_ptr<Node> child);
-    std::vector<std::unique_ptr<Node>> children_;
+    void appendChild(NodePtr child);
+    void simplifyChildren(AstSimplifier& pass);
+    std::vector<NodePtr> children_;
 };
 
 class SumNode : public NaryNode {
 public:
-    explicit SumNode(std::unique_ptr<Node> child);
-    void addTerm(std::unique_ptr<Node> term, EAdditiveOp op);
+    explicit SumNode(NodePtr child);
+    void addTerm(NodePtr term, EAdditiveOp op);
     double calc() const override;
+    void compile(Bytecode& out) const override;
+    NodePtr simplify(AstSimplifier& pass) override;
 private:
+    void spliceLeadingSum();
     std::vector<EAdditiveOp> operations_;
 };
 
 class ProductNode : public NaryNode {
 public:
-    explicit ProductNode(std::unique_ptr<Node> child);
-    void addFactor(std::unique_ptr<Node> factor, EMultiplicativeOp op);
+    explicit ProductNode(NodePtr child);
+    void addFactor(NodePtr factor, EMultiplicativeOp op);
     double calc() const override;
+    void compile(Bytecode& out) const override;
+    NodePtr simplify(AstSimplifier& pass) override;
 private:
+    void spliceLeadingProduct();
     std::vector<EMultiplicativeOp> operations_;
 };
@@ -0,0 +1,47 @@
+#pragma once
+/*
+bump allocation for AST nodes.
+*/
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <utility>
+
+class Node;
+
+enum class ENodeAllocation : std::uint8_t {
+    Heap,   // one new/delete per node
+    Arena,  // nodes live in a NodeArena owned by the Parser and are freed with it
+};
+
+// Arena nodes are only destroyed; their memory goes away with the arena.
+struct NodeDeleter {
+    bool inArena = false;
+    void operator()(Node* node) const;
+};
+
+template <typename T>
+using NodePtrOf = std::unique_ptr<T, NodeDeleter>;
+using NodePtr = NodePtrOf<Node>;
+
+class NodeArena {
+public:
+    NodeArena(): resource_(kInitialBytes) {}
+    NodeArena(const NodeArena&) = delete;
+    NodeArena(NodeArena&&) = delete;
+    const NodeArena& operator=(const NodeArena&) = delete;
+    NodeArena& operator=(NodeArena&&) = delete;
+    ~NodeArena() = default;
+
+    template <typename T, typename... Args>
+    NodePtrOf<T> create(Args&&... args) {
+        void* memory = resource_.allocate(sizeof(T), alignof(T));
+        return NodePtrOf<T>(::new (memory) T(std::forward<Args>(args)...), NodeDeleter{true});
+    }
+
+private:
+    static constexpr std::size_t kInitialBytes = 4096;
+    std::pmr::monotonic_buffer_resource resource_;
+};
@@ -1,10 +1,11 @@
 #pragma once
 
 #include <memory>
+#include "node_arena.h"
 
+class Bytecode;
 class IAstBuilder;
 class Scanner;
-class Node;
 class Env;
 
 enum class EStatus {
@@ -21,16 +22,25 @@ public:
     Parser(Scanner& scanner, IAstBuilder& builder, Env& env);
     ~Parser();
     EStatus parse();
-    std::unique_ptr<Node> expr();
-    std::unique_ptr<Node> term();
-    std::unique_ptr<Node> factor();
+    NodePtr expr();
+    NodePtr term();
+    NodePtr factor();
     double calc() const;
+    // Compiles the parsed tree for repeated evaluation against this parser's Env.
+    Bytecode compile() const;
+    // Runs AstSimplifier over each parsed tree; on by default.
+    void setSimplify(bool enabled) { simplify_ = enabled; }
 private:
     std::unique_ptr<IAstBuilder> ownedBuilder_;
     std::unique_ptr<Env> ownedEnv_;
     IAstBuilder& builder_;
     Scanner& scanner_;
     Env& env_;
-    std::unique_ptr<Node> tree_;
+    // Holds tree_ in ENodeAllocation::Arena mode; declared first so the tree is destroyed first.
+    std::unique_ptr<NodeArena> arena_;
+    NodePtr tree_;
     EStatus status_;
+    bool simplify_;
+    // Set when the tree assigns, which may change a built-in constant while it runs.
+    bool assigns_;
 };
@@ -0,0 +1,37 @@
+#pragma once
+/*
+constant folding and algebraic simplification over the AST.
+*/
+#include <string>
+#include "node_arena.h"
+
+class Env;
+class IAstBuilder;
+
+/*
+Every rewrite keeps calc() bit-identical, including NaN, -0.0, infinities and which exception
+is thrown first:
+- subtrees of numbers, built-in constants and FuncTable functions fold to a NumberNode, except
+  a division by a constant zero, which still throws when evaluated;
+- x * 1, 1 * x, x / 1, x - 0 and x + (-0) drop the constant; x + 0 stays, as -0 + 0 is +0;
+- a SumNode or ProductNode that is the leading operand of another is spliced into it, and the
+  leading run of constants in a chain is folded. Other regroupings would change the rounding.
+Built-in constants fold to their initial value while they still hold it. Trees simplified
+before pi or e is reassigned, or the Env reloaded, keep the folded value.
+*/
+class AstSimplifier {
+public:
+    // New nodes come from builder, so they share the allocation of the tree being rewritten.
+    AstSimplifier(const IAstBuilder& builder, bool foldBuiltins);
+
+    // Returns node, or the node that replaces it.
+    NodePtr run(NodePtr node);
+
+    NodePtr makeNumber(double value) const;
+    // True, with the value, when symbol is a built-in constant that may be folded.
+    bool builtinConstant(const std::string& symbol, const Env& env, double& value) const;
+
+private:
+    const IAstBuilder& builder_;
+    bool foldBuiltins_;
+};
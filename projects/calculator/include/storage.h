@@ -23,12 +23,22 @@ public:
 public:
     bool isInit(unsigned int id) const;
     void addConstant(SymbolTable& tbl, const std::string& name, double value);
+    // Initial value of a constant the constructor seeds, e.g. pi.
+    static bool builtinConstant(const std::string& name, double& value);
     double getValue(unsigned int id) const;
     void setValue(unsigned int id, double value);
     void clear();
+    // Unchecked read for callers that verified isInit(id) in the current generation.
+    double valueAt(unsigned int id) const { return cells_[id]; }
+    // Same, for callers that index many ids. Valid until setValue() grows the cells.
+    const double* cells() const { return cells_.data(); }
+    // Bumped by clear() and deserialize(), after which cached ids may be stale or point past
+    // the cells. Cells never become uninitialized otherwise.
+    std::uint64_t generation() const { return generation_; }
     
 private:
     void addValue(unsigned int id, double value);
     std::vector<double> cells_;
     std::vector<std::uint8_t> inits_;
+    std::uint64_t generation_ = 0;
 };
@@ -1,99 +1,99 @@
 #include "ast_builder.h"
 
-std::unique_ptr<Node> BinaryAstBuilder::makeNumber(double value) const {
-    return std::make_unique<NumberNode>(value);
+NodePtr BinaryAstBuilder::makeNumber(double value) const {
+    return make<NumberNode>(value);
 }
 
-std::unique_ptr<Node> BinaryAstBuilder::makeVariable(std::string symbol, Env& env) const {
-    return std::make_unique<VariableNode>(std::move(symbol), env);
+NodePtr BinaryAstBuilder::makeVariable(std::string symbol, Env& env) const {
+    return make<VariableNode>(std::move(symbol), env);
 }
 
-std::unique_ptr<Node> BinaryAstBuilder::makeFunction(std::unique_ptr<Node> child, FuncPtr func) const {
-    return std::make_unique<FunNode>(std::move(child), func);
+NodePtr BinaryAstBuilder::makeFunction(NodePtr child, FuncPtr func) const {
+    return make<FunNode>(std::move(child), func);
 }
 
-std::unique_ptr<Node> BinaryAstBuilder::makeNegate(std::unique_ptr<Node> child) const {
-    return std::make_unique<NegateNode>(std::move(child));
+NodePtr BinaryAstBuilder::makeNegate(NodePtr child) const {
+    return make<NegateNode>(std::move(child));
 }
 
-std::unique_ptr<Node> BinaryAstBuilder::makeAssign(
-    std::unique_ptr<Node> left,
-    std::unique_ptr<Node> right) const {
-    return std::make_unique<AssignNode>(std::move(left), std::move(right));
+NodePtr BinaryAstBuilder::makeAssign(
+    NodePtr left,
+    NodePtr right) const {
+    return make<AssignNode>(std::move(left), std::move(right));
 }
 
-std::unique_ptr<Node> BinaryAstBuilder::makeAdditive(
-    std::unique_ptr<Node> first,
+NodePtr BinaryAstBuilder::makeAdditive(
+    NodePtr first,
     std::vector<AdditivePart> rest) const {
-    std::unique_ptr<Node> node = std::move(first);
+    NodePtr node = std::move(first);
     for (auto& part : rest) {
         if (part.op == EAdditiveOp::Add) {
-            node = std::make_unique<AddNode>(std::move(node), std::move(part.node));
+            node = make<AddNode>(std::move(node), std::move(part.node));
         } else {
-            node = std::make_unique<SubtractNode>(std::move(node), std::move(part.node));
+            node = make<SubtractNode>(std::move(node), std::move(part.node));
         }
     }
     return node;
 }
 
-std::unique_ptr<Node> BinaryAstBuilder::makeMultiplicative(
-    std::unique_ptr<Node> first,
+NodePtr BinaryAstBuilder::makeMultiplicative(
+    NodePtr first,
     std::vector<MultiplicativePart> rest) const {
-    std::unique_ptr<Node> node = std::move(first);
+    NodePtr node = std::move(first);
     for (auto& part : rest) {
         if (part.op == EMultiplicativeOp::Multiply) {
-            node = std::make_unique<MultiplyNode>(std::move(node), std::move(part.node));
+            node = make<MultiplyNode>(std::move(node), std::move(part.node));
         } else {
-            node = std::make_unique<DivideNode>(std::move(node), std::move(part.node));
+            node = make<DivideNode>(std::move(node), std::move(part.node));
         }
     }
     return node;
 }
 
-std::unique_ptr<Node> NaryAstBuilder::makeNumber(double value) const {
-    return std::make_unique<NumberNode>(value);
+NodePtr NaryAstBuilder::makeNumber(double value) const {
+    return make<NumberNode>(value);
 }
 
-std::unique_ptr<Node> NaryAstBuilder::makeVariable(std::string symbol, Env& env) const {
-    return std::make_unique<VariableNode>(std::move(symbol), env);
+NodePtr NaryAstBuilder::makeVariable(std::string symbol, Env& env) const {
+    return make<VariableNode>(std::move(symbol), env);
 }
 
-std::unique_ptr<Node> NaryAstBuilder::makeFunction(std::unique_ptr<Node> child, FuncPtr func) const {
-    return std::make_unique<FunNode>(std::move(child), func);
+NodePtr NaryAstBuilder::makeFunction(NodePtr child, FuncPtr func) const {
+    return make<FunNode>(std::move(child), func);
 }
 
-std::unique_ptr<Node> NaryAstBuilder::makeNegate(std::unique_ptr<Node> child) const {
-    return std::make_unique<NegateNode>(std::move(child));
+NodePtr NaryAstBuilder::makeNegate(NodePtr child) const {
+    return make<NegateNode>(std::move(child));
 }
 
-std::unique_ptr<Node> NaryAstBuilder::makeAssign(
-    std::unique_ptr<Node> left,
-    std::unique_ptr<Node> right) const {
-    return std::make_unique<AssignNode>(std::move(left), std::move(right));
+NodePtr NaryAstBuilder::makeAssign(
+    NodePtr left,
+    NodePtr right) const {
+    return make<AssignNode>(std::move(left), std::move(right));
 }
 
-std::unique_ptr<Node> NaryAstBuilder::makeAdditive(
-    std::unique_ptr<Node> first,
+NodePtr NaryAstBuilder::makeAdditive(
+    NodePtr first,
     std::vector<AdditivePart> rest) const {
     if (rest.empty()) {
         return first;
     }
 
-    auto node = std::make_unique<SumNode>(std::move(first));
+    auto node = make<SumNode>(std::move(first));
     for (auto& part : rest) {
         node->addTerm(std::move(part.node), part.op);
     }
     return node;
 }
 
-std::unique_ptr<Node> NaryAstBuilder::makeMultiplicative(
-    std::unique_ptr<Node> first,
+NodePtr NaryAstBuilder::makeMultiplicative(
+    NodePtr first,
     std::vector<MultiplicativePart> rest) const {
     if (rest.empty()) {
         return first;
     }
 
-    auto node = std::make_unique<ProductNode>(std::move(first));
+    auto node = make<ProductNode>(std::move(first));
     for (auto& part : rest) {
         node->addFactor(std::move(part.node), part.op);
     }
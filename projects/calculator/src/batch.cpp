@@ -0,0 +1,271 @@
+#include <algorithm>
+#include "batch.h"
+#include "env.h"
+#include "exception.h"
+
+namespace {
+
+template <typename Op>
+CALCULATOR_VECTOR_CLONES void ApplyBinary(const double* left, double leftScalar, const double* right, double rightScalar, double* out,
+                 std::size_t count, Op op) {
+    if (left && right) {
+        for (std::size_t i = 0; i < count; ++i) {
+            out[i] = op(left[i], right[i]);
+        }
+    } else if (left) {
+        for (std::size_t i = 0; i < count; ++i) {
+            out[i] = op(left[i], rightScalar);
+        }
+    } else {
+        for (std::size_t i = 0; i < count; ++i) {
+            out[i] = op(leftScalar, right[i]);
+        }
+    }
+}
+
+// Branch-free so the scan vectorizes.
+CALCULATOR_VECTOR_CLONES bool AnyZero(const double* values, std::size_t count) {
+    bool zero = false;
+    for (std::size_t i = 0; i < count; ++i) {
+        zero |= values[i] == 0;
+    }
+    return zero;
+}
+
+} // namespace
+
+BatchEvaluator::BatchEvaluator(const Bytecode& program)
+    : program_(program),
+      readsStored_(program.code().size(), 0),
+      readsAssignedLater_(program.code().size(), 0),
+      columns_(program.symbols().size(), nullptr),
+      variables_(program.symbols().size(), Operand{nullptr, 0}),
+      resolved_(program.symbols().size(), 0),
+      assigned_(program.symbols().size(), Operand{nullptr, 0}),
+      assignedBuffers_(program.symbols().size() * kBlockSize),
+      stack_(std::max<std::size_t>(program.stackDepth(), 1), Operand{nullptr, 0}),
+      buffers_(std::max<std::size_t>(program.stackDepth(), 1) * kBlockSize) {
+    for (FuncPtr func : program.functions()) {
+        blockFuncs_.push_back(FindBlockFunc(func));
+    }
+    const std::vector<Instruction>& code = program.code();
+    std::vector<std::uint8_t> stored(program.symbols().size(), 0);
+    for (std::size_t i = 0; i < code.size(); ++i) {
+        if (code[i].op == EOpCode::Store) {
+            stored[code[i].operand] = 1;
+        } else {
+            resultIndex_ = i;
+            if (code[i].op == EOpCode::Load) {
+                readsStored_[i] = stored[code[i].operand];
+            }
+        }
+    }
+    for (std::size_t i = 0; i < code.size(); ++i) {
+        if (code[i].op == EOpCode::Load && !readsStored_[i]) {
+            readsAssignedLater_[i] = stored[code[i].operand];
+        }
+    }
+}
+
+void BatchEvaluator::bind(const std::string& symbol, const double* values) {
+    const std::vector<std::string>& symbols = program_.symbols();
+    const auto it = std::find(symbols.begin(), symbols.end(), symbol);
+    if (it != symbols.end()) {
+        columns_[static_cast<std::size_t>(it - symbols.begin())] = values;
+    }
+}
+
+void BatchEvaluator::run(double* output, std::size_t count) {
+    checkAssignedBeforeRead();
+    std::fill(resolved_.begin(), resolved_.end(), 0);
+    std::size_t last = 0;
+    for (std::size_t row = 0; row < count; row += kBlockSize) {
+        last = std::min(kBlockSize, count - row);
+        runBlock(row, last, output + row);
+    }
+    if (count > 0) {
+        updateAssigned(last);
+    }
+}
+
+void BatchEvaluator::runBlock(std::size_t row, std::size_t count, double* output) {
+    const std::vector<Instruction>& code = program_.code();
+    std::size_t top = 0;
+    for (std::size_t i = 0; i < code.size(); ++i) {
+        const Instruction& ins = code[i];
+        switch (ins.op) {
+            case EOpCode::PushConst:
+                stack_[top++] = {nullptr, program_.constants()[ins.operand]};
+                break;
+            case EOpCode::Load:
+                stack_[top] = load(ins.operand, row, readsStored_[i]);
+                ++top;
+                break;
+            case EOpCode::Store:
+                store(ins.operand, stack_[top - 1], count, i > resultIndex_);
+                break;
+            case EOpCode::Add:
+            case EOpCode::Subtract:
+            case EOpCode::Multiply:
+            case EOpCode::Divide:
+            case EOpCode::DivideInto:
+                --top;
+                stack_[top - 1] = binary(ins.op, stack_[top - 1], stack_[top],
+                                         i == resultIndex_ ? output : buffer(top - 1), count);
+                break;
+            case EOpCode::CheckDivisor:
+                checkDivisor(stack_[top - 1], count);
+                break;
+            case EOpCode::Negate:
+            case EOpCode::Call:
+                stack_[top - 1] = unary(ins, stack_[top - 1], i == resultIndex_ ? output : buffer(top - 1), count);
+                break;
+        }
+    }
+    const Operand& result = stack_[0];
+    if (!result.values) {
+        std::fill_n(output, count, result.scalar);
+    } else if (result.values != output) {
+        std::copy_n(result.values, count, output);
+    }
+}
+
+BatchEvaluator::Operand BatchEvaluator::binary(EOpCode op, const Operand& left, const Operand& right, double* out,
+                                               std::size_t count) const {
+    if (op == EOpCode::Divide) {
+        checkDivisor(right, count);
+    }
+    if (!left.values && !right.values) {
+        switch (op) {
+            case EOpCode::Add:
+                return {nullptr, left.scalar + right.scalar};
+            case EOpCode::Subtract:
+                return {nullptr, left.scalar - right.scalar};
+            case EOpCode::Multiply:
+                return {nullptr, left.scalar * right.scalar};
+            case EOpCode::Divide:
+                return {nullptr, left.scalar / right.scalar};
+            default:
+                return {nullptr, right.scalar / left.scalar};
+        }
+    }
+    switch (op) {
+        case EOpCode::Add:
+            ApplyBinary(left.values, left.scalar, right.values, right.scalar, out, count,
+                        [](double a, double b) { return a + b; });
+            break;
+        case EOpCode::Subtract:
+            ApplyBinary(left.values, left.scalar, right.values, right.scalar, out, count,
+                        [](double a, double b) { return a - b; });
+            break;
+        case EOpCode::Multiply:
+            ApplyBinary(left.values, left.scalar, right.values, right.scalar, out, count,
+                        [](double a, double b) { return a * b; });
+            break;
+        case EOpCode::Divide:
+            ApplyBinary(left.values, left.scalar, right.values, right.scalar, out, count,
+                        [](double a, double b) { return a / b; });
+            break;
+        default:
+            // DivideInto: the divisor is below the dividend on the stack.
+            ApplyBinary(left.values, left.scalar, right.values, right.scalar, out, count,
+                        [](double b, double a) { return a / b; });
+            break;
+    }
+    return {out, 0};
+}
+
+BatchEvaluator::Operand BatchEvaluator::unary(const Instruction& ins, const Operand& value, double* out,
+                                              std::size_t count) const {
+    if (ins.op == EOpCode::Negate) {
+        if (!value.values) {
+            return {nullptr, -value.scalar};
+        }
+        for (std::size_t i = 0; i < count; ++i) {
+            out[i] = -value.values[i];
+        }
+        return {out, 0};
+    }
+    const FuncPtr func = program_.functions()[ins.operand];
+    if (!value.values) {
+        return {nullptr, (*func)(value.scalar)};
+    }
+    const BlockFunc block = blockFuncs_[ins.operand];
+    if (block && !exactMath_) {
+        block(value.values, out, count);
+    } else {
+        for (std::size_t i = 0; i < count; ++i) {
+            out[i] = (*func)(value.values[i]);
+        }
+    }
+    return {out, 0};
+}
+
+void BatchEvaluator::checkDivisor(const Operand& divisor, std::size_t count) const {
+    if (divisor.values ? AnyZero(divisor.values, count) : divisor.scalar == 0) {
+        throw DivisionByZeroError();
+    }
+}
+
+BatchEvaluator::Operand BatchEvaluator::load(unsigned int slot, std::size_t row, bool stored) {
+    if (stored) {
+        return assigned_[slot];
+    }
+    if (columns_[slot]) {
+        return {columns_[slot] + row, 0};
+    }
+    if (!resolved_[slot]) {
+        // Same checks and exceptions as Bytecode::run(), once per run().
+        const std::string& symbol = program_.symbols()[slot];
+        const Env& env = program_.env();
+        const unsigned int id = env.findSymbol(symbol);
+        if (id == SymbolTable::kInvalidSymbolId) {
+            throw UndefinedVariableError(symbol);
+        }
+        const Storage& storage = env.getStorage();
+        if (!storage.isInit(id)) {
+            throw UninitializedVariableError(symbol);
+        }
+        variables_[slot] = {nullptr, storage.valueAt(id)};
+        resolved_[slot] = 1;
+    }
+    return variables_[slot];
+}
+
+void BatchEvaluator::store(unsigned int slot, const Operand& value, std::size_t count, bool last) {
+    // Nothing overwrites the stack after the result, so the last Stores need no copy.
+    if (last || !value.values) {
+        assigned_[slot] = value;
+        return;
+    }
+    double* const cells = assignedBuffers_.data() + static_cast<std::size_t>(slot) * kBlockSize;
+    std::copy_n(value.values, count, cells);
+    assigned_[slot] = {cells, 0};
+}
+
+void BatchEvaluator::checkAssignedBeforeRead() const {
+    const std::vector<Instruction>& code = program_.code();
+    for (std::size_t i = 0; i < code.size(); ++i) {
+        if (readsAssignedLater_[i] && !columns_[code[i].operand]) {
+            throw RuntimeError("Batch rows would depend on each other: " + program_.symbols()[code[i].operand] +
+                               " is read before it is assigned");
+        }
+    }
+}
+
+// Leaves each assigned variable as a run() of the last row would.
+void BatchEvaluator::updateAssigned(std::size_t count) {
+    Env& env = program_.env();
+    for (const Instruction& ins : program_.code()) {
+        if (ins.op != EOpCode::Store) {
+            continue;
+        }
+        const std::string& symbol = program_.symbols()[ins.operand];
+        const Operand& value = assigned_[ins.operand];
+        unsigned int id = env.findSymbol(symbol);
+        if (id == SymbolTable::kInvalidSymbolId) {
+            id = env.addSymbol(symbol);
+        }
+        env.getStorage().setValue(id, value.values ? value.values[count - 1] : value.scalar);
+    }
+}
@@ -0,0 +1,85 @@
+#include <cmath>
+#include "batch_math.h"
+
+/*
+glibc only declares its libmvec variants under -ffast-math, which would also change NaN and
+signed-zero handling. Declaring them here lets this file, built with -O3 -fno-math-errno,
+vectorize the calls below and nothing else. Most of them need glibc 2.35.
+*/
+#if defined(__x86_64__) && defined(__GLIBC__) && defined(__GNUC__) && !defined(__clang__)
+#define CALCULATOR_SIMD __attribute__((simd("notinbranch")))
+extern "C" {
+double exp(double) noexcept CALCULATOR_SIMD;
+double log(double) noexcept CALCULATOR_SIMD;
+double sin(double) noexcept CALCULATOR_SIMD;
+double cos(double) noexcept CALCULATOR_SIMD;
+#if __GLIBC_PREREQ(2, 35)
+double log10(double) noexcept CALCULATOR_SIMD;
+double tan(double) noexcept CALCULATOR_SIMD;
+double asin(double) noexcept CALCULATOR_SIMD;
+double acos(double) noexcept CALCULATOR_SIMD;
+double atan(double) noexcept CALCULATOR_SIMD;
+double sinh(double) noexcept CALCULATOR_SIMD;
+double cosh(double) noexcept CALCULATOR_SIMD;
+double tanh(double) noexcept CALCULATOR_SIMD;
+#endif
+}
+#undef CALCULATOR_SIMD
+#endif
+
+namespace {
+
+#define CALCULATOR_BLOCK_FUNC(name)                                                   \
+    CALCULATOR_VECTOR_CLONES void Block_##name(const double* in, double* out, std::size_t count) { \
+        for (std::size_t i = 0; i < count; ++i) {                                     \
+            out[i] = std::name(in[i]);                                                \
+        }                                                                             \
+    }
+
+CALCULATOR_BLOCK_FUNC(log)
+CALCULATOR_BLOCK_FUNC(log10)
+CALCULATOR_BLOCK_FUNC(exp)
+CALCULATOR_BLOCK_FUNC(sqrt)
+CALCULATOR_BLOCK_FUNC(sin)
+CALCULATOR_BLOCK_FUNC(cos)
+CALCULATOR_BLOCK_FUNC(tan)
+CALCULATOR_BLOCK_FUNC(asin)
+CALCULATOR_BLOCK_FUNC(acos)
+CALCULATOR_BLOCK_FUNC(atan)
+CALCULATOR_BLOCK_FUNC(sinh)
+CALCULATOR_BLOCK_FUNC(cosh)
+CALCULATOR_BLOCK_FUNC(tanh)
+
+#undef CALCULATOR_BLOCK_FUNC
+
+struct BlockEntry {
+    FuncPtr func;
+    BlockFunc block;
+};
+
+const BlockEntry kBlockEntries[] = {
+    {static_cast<FuncPtr>(std::log), Block_log},
+    {static_cast<FuncPtr>(std::log10), Block_log10},
+    {static_cast<FuncPtr>(std::exp), Block_exp},
+    {static_cast<FuncPtr>(std::sqrt), Block_sqrt},
+    {static_cast<FuncPtr>(std::sin), Block_sin},
+    {static_cast<FuncPtr>(std::cos), Block_cos},
+    {static_cast<FuncPtr>(std::tan), Block_tan},
+    {static_cast<FuncPtr>(std::asin), Block_asin},
+    {static_cast<FuncPtr>(std::acos), Block_acos},
+    {static_cast<FuncPtr>(std::atan), Block_atan},
+    {static_cast<FuncPtr>(std::sinh), Block_sinh},
+    {static_cast<FuncPtr>(std::cosh), Block_cosh},
+    {static_cast<FuncPtr>(std::tanh), Block_tanh},
+};
+
+} // namespace
+
+BlockFunc FindBlockFunc(FuncPtr func) {
+    for (const BlockEntry& entry : kBlockEntries) {
+        if (entry.func == func) {
+            return entry.block;
+        }
+    }
+    return nullptr;
+}
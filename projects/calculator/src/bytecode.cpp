@@ -0,0 +1,397 @@
+#include <algorithm>
+#include "bytecode.h"
+#include "env.h"
+#include "exception.h"
+#include "node.h"
+
+namespace {
+
+int StackEffect(EOpCode op) {
+    switch (op) {
+        case EOpCode::PushConst:
+        case EOpCode::Load:
+            return 1;
+        case EOpCode::Add:
+        case EOpCode::Subtract:
+        case EOpCode::Multiply:
+        case EOpCode::Divide:
+        case EOpCode::DivideInto:
+            return -1;
+        default:
+            return 0;
+    }
+}
+
+} // namespace
+
+bool Bytecode::usesSlot(EFusedOp op) {
+    switch (op) {
+        case EFusedOp::PushVariable:
+        case EFusedOp::Store:
+        case EFusedOp::AddVariable:
+        case EFusedOp::SubtractVariable:
+        case EFusedOp::MultiplyVariable:
+        case EFusedOp::DivideVariable:
+        case EFusedOp::DivideIntoVariable:
+            return true;
+        default:
+            return false;
+    }
+}
+
+Bytecode::Bytecode(const Node& root, Env& env): env_(env), generation_(env.getStorage().generation()) {
+    root.compile(*this);
+    fuse();
+    stack_.resize(std::max<std::size_t>(maxDepth_, 1));
+}
+
+// Computed gotos are a GCC/Clang extension; the switch below is the portable fallback.
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+double Bytecode::run() {
+    Storage& storage = env_.getStorage();
+    if (generation_ != storage.generation()) {
+        std::fill(ids_.begin(), ids_.end(), SymbolTable::kInvalidSymbolId);
+        bound_.clear();
+        generation_ = storage.generation();
+    }
+    if (bound_.empty()) {
+        return bindAndRun();
+    }
+
+    // The top two stack entries live in locals, so a pushed operand never waits on a store
+    // and reload before the operator that consumes it. With computed gotos every handler
+    // jumps straight to the next one, which predicts far better than one shared switch.
+    const double* const constants = constants_.data();
+    const double* const cells = storage.cells();
+    FuncPtr const* const funcs = funcs_.data();
+    double* top = stack_.data();
+    double acc = 0;
+    double below = 0;
+    const FusedInstruction* ins = bound_.data();
+#if defined(__GNUC__)
+    static void* const kHandlers[] = {
+        &&PushConst,     &&PushVariable,     &&Store,           &&Add,
+        &&Subtract,      &&Multiply,         &&Divide,          &&CheckDivisor,
+        &&DivideInto,    &&Negate,           &&Call,            &&AddConst,
+        &&AddVariable,   &&SubtractConst,    &&SubtractVariable, &&MultiplyConst,
+        &&MultiplyVariable, &&DivideConst,   &&DivideVariable,  &&DivideIntoConst,
+        &&DivideIntoVariable, &&Return,
+    };
+#define VM_CASE(op) op:
+#define VM_NEXT() goto* kHandlers[static_cast<std::size_t>((++ins)->op)]
+    goto* kHandlers[static_cast<std::size_t>(ins->op)];
+#else
+#define VM_CASE(op) case EFusedOp::op:
+#define VM_NEXT() \
+    ++ins;        \
+    continue
+    for (;;) {
+        switch (ins->op) {
+#endif
+    VM_CASE(PushConst)
+        *top++ = below;
+        below = acc;
+        acc = constants[ins->operand];
+        VM_NEXT();
+    VM_CASE(PushVariable)
+        *top++ = below;
+        below = acc;
+        acc = cells[ins->operand];
+        VM_NEXT();
+    VM_CASE(Store)
+        storage.setValue(ins->operand, acc);
+        VM_NEXT();
+    VM_CASE(Add)
+        acc = below + acc;
+        below = *--top;
+        VM_NEXT();
+    VM_CASE(Subtract)
+        acc = below - acc;
+        below = *--top;
+        VM_NEXT();
+    VM_CASE(Multiply)
+        acc = below * acc;
+        below = *--top;
+        VM_NEXT();
+    VM_CASE(Divide)
+        if (acc == 0) {
+            throw DivisionByZeroError();
+        }
+        acc = below / acc;
+        below = *--top;
+        VM_NEXT();
+    VM_CASE(CheckDivisor)
+        if (acc == 0) {
+            throw DivisionByZeroError();
+        }
+        VM_NEXT();
+    VM_CASE(DivideInto)
+        acc = acc / below;
+        below = *--top;
+        VM_NEXT();
+    VM_CASE(Negate)
+        acc = -acc;
+        VM_NEXT();
+    VM_CASE(Call)
+        acc = (*funcs[ins->operand])(acc);
+        VM_NEXT();
+    VM_CASE(AddConst)
+        acc += constants[ins->operand];
+        VM_NEXT();
+    VM_CASE(AddVariable)
+        acc += cells[ins->operand];
+        VM_NEXT();
+    VM_CASE(SubtractConst)
+        acc -= constants[ins->operand];
+        VM_NEXT();
+    VM_CASE(SubtractVariable)
+        acc -= cells[ins->operand];
+        VM_NEXT();
+    VM_CASE(MultiplyConst)
+        acc *= constants[ins->operand];
+        VM_NEXT();
+    VM_CASE(MultiplyVariable)
+        acc *= cells[ins->operand];
+        VM_NEXT();
+    VM_CASE(DivideConst)
+        if (constants[ins->operand] == 0) {
+            throw DivisionByZeroError();
+        }
+        acc /= constants[ins->operand];
+        VM_NEXT();
+    VM_CASE(DivideVariable)
+        if (cells[ins->operand] == 0) {
+            throw DivisionByZeroError();
+        }
+        acc /= cells[ins->operand];
+        VM_NEXT();
+    VM_CASE(DivideIntoConst)
+        acc = constants[ins->operand] / acc;
+        VM_NEXT();
+    VM_CASE(DivideIntoVariable)
+        acc = cells[ins->operand] / acc;
+        VM_NEXT();
+    VM_CASE(Return)
+        return acc;
+#if !defined(__GNUC__)
+        }
+    }
+#endif
+#undef VM_CASE
+#undef VM_NEXT
+}
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+// Binds every slot and specializes the fused program to the bound symbol ids. While some
+// variable is undefined or uninitialized the checked loop runs instead, binding or
+// throwing at the instruction that reads it, as the tree walk does.
+double Bytecode::bindAndRun() {
+    for (std::size_t slot = 0; slot < ids_.size(); ++slot) {
+        if (ids_[slot] == SymbolTable::kInvalidSymbolId &&
+            bind(static_cast<unsigned int>(slot)) == SymbolTable::kInvalidSymbolId) {
+            return runChecked();
+        }
+    }
+    bound_ = fused_;
+    for (FusedInstruction& ins : bound_) {
+        if (usesSlot(ins.op)) {
+            ins.operand = ids_[ins.operand];
+        }
+    }
+    return run();
+}
+
+double Bytecode::runChecked() {
+    const Storage& storage = env_.getStorage();
+    double* const base = stack_.data();
+    double* top = base;
+    for (const Instruction& ins : code_) {
+        switch (ins.op) {
+            case EOpCode::PushConst:
+                *top++ = constants_[ins.operand];
+                break;
+            case EOpCode::Load: {
+                const unsigned int id = ids_[ins.operand];
+                *top++ = id != SymbolTable::kInvalidSymbolId ? storage.valueAt(id) : load(ins.operand);
+                break;
+            }
+            case EOpCode::Store:
+                store(ins.operand, top[-1]);
+                break;
+            case EOpCode::Add:
+                --top;
+                top[-1] += *top;
+                break;
+            case EOpCode::Subtract:
+                --top;
+                top[-1] -= *top;
+                break;
+            case EOpCode::Multiply:
+                --top;
+                top[-1] *= *top;
+                break;
+            case EOpCode::Divide:
+                --top;
+                if (*top == 0) {
+                    throw DivisionByZeroError();
+                }
+                top[-1] /= *top;
+                break;
+            case EOpCode::CheckDivisor:
+                if (top[-1] == 0) {
+                    throw DivisionByZeroError();
+                }
+                break;
+            case EOpCode::DivideInto:
+                --top;
+                top[-1] = *top / top[-1];
+                break;
+            case EOpCode::Negate:
+                top[-1] = -top[-1];
+                break;
+            case EOpCode::Call:
+                top[-1] = (*funcs_[ins.operand])(top[-1]);
+                break;
+        }
+    }
+    return base[0];
+}
+
+void Bytecode::emit(EOpCode op) {
+    push(op, 0);
+}
+
+void Bytecode::emitConst(double value) {
+    constants_.push_back(value);
+    push(EOpCode::PushConst, static_cast<unsigned int>(constants_.size() - 1));
+}
+
+void Bytecode::emitLoad(const std::string& symbol) {
+    push(EOpCode::Load, slotOf(symbol));
+}
+
+void Bytecode::emitStore(const std::string& symbol) {
+    push(EOpCode::Store, slotOf(symbol));
+}
+
+void Bytecode::emitCall(FuncPtr func) {
+    const auto it = std::find(funcs_.begin(), funcs_.end(), func);
+    if (it != funcs_.end()) {
+        push(EOpCode::Call, static_cast<unsigned int>(it - funcs_.begin()));
+        return;
+    }
+    funcs_.push_back(func);
+    push(EOpCode::Call, static_cast<unsigned int>(funcs_.size() - 1));
+}
+
+void Bytecode::fuse() {
+    for (const Instruction& ins : code_) {
+        switch (ins.op) {
+            case EOpCode::PushConst:
+                fused_.push_back({EFusedOp::PushConst, ins.operand});
+                break;
+            case EOpCode::Load:
+                fused_.push_back({EFusedOp::PushVariable, ins.operand});
+                break;
+            case EOpCode::Store:
+                fused_.push_back({EFusedOp::Store, ins.operand});
+                break;
+            case EOpCode::Add:
+                fuseBinary(EFusedOp::Add, EFusedOp::AddConst, EFusedOp::AddVariable);
+                break;
+            case EOpCode::Subtract:
+                fuseBinary(EFusedOp::Subtract, EFusedOp::SubtractConst, EFusedOp::SubtractVariable);
+                break;
+            case EOpCode::Multiply:
+                fuseBinary(EFusedOp::Multiply, EFusedOp::MultiplyConst, EFusedOp::MultiplyVariable);
+                break;
+            case EOpCode::Divide:
+                fuseBinary(EFusedOp::Divide, EFusedOp::DivideConst, EFusedOp::DivideVariable);
+                break;
+            case EOpCode::CheckDivisor:
+                fused_.push_back({EFusedOp::CheckDivisor, 0});
+                break;
+            case EOpCode::DivideInto:
+                fuseBinary(EFusedOp::DivideInto, EFusedOp::DivideIntoConst, EFusedOp::DivideIntoVariable);
+                break;
+            case EOpCode::Negate:
+                fused_.push_back({EFusedOp::Negate, 0});
+                break;
+            case EOpCode::Call:
+                fused_.push_back({EFusedOp::Call, ins.operand});
+                break;
+        }
+    }
+    fused_.push_back({EFusedOp::Return, 0});
+}
+
+// A binary operator right after a push takes the pushed operand directly.
+void Bytecode::fuseBinary(EFusedOp op, EFusedOp withConst, EFusedOp withVariable) {
+    if (!fused_.empty() && fused_.back().op == EFusedOp::PushConst) {
+        fused_.back().op = withConst;
+        return;
+    }
+    if (!fused_.empty() && fused_.back().op == EFusedOp::PushVariable) {
+        fused_.back().op = withVariable;
+        return;
+    }
+    fused_.push_back({op, 0});
+}
+
+unsigned int Bytecode::slotOf(const std::string& symbol) {
+    const auto it = std::find(symbols_.begin(), symbols_.end(), symbol);
+    if (it != symbols_.end()) {
+        return static_cast<unsigned int>(it - symbols_.begin());
+    }
+    symbols_.push_back(symbol);
+    const unsigned int id = env_.findSymbol(symbol);
+    ids_.push_back(env_.getStorage().isInit(id) ? id : SymbolTable::kInvalidSymbolId);
+    return static_cast<unsigned int>(symbols_.size() - 1);
+}
+
+// Binds the slot if its variable is defined and initialized.
+unsigned int Bytecode::bind(unsigned int slot) {
+    const unsigned int id = env_.findSymbol(symbols_[slot]);
+    if (id == SymbolTable::kInvalidSymbolId || !env_.getStorage().isInit(id)) {
+        return SymbolTable::kInvalidSymbolId;
+    }
+    ids_[slot] = id;
+    return id;
+}
+
+// Slow path of Load: binds the slot or throws like VariableNode::calc().
+double Bytecode::load(unsigned int slot) {
+    const unsigned int id = env_.findSymbol(symbols_[slot]);
+    if (id == SymbolTable::kInvalidSymbolId) {
+        throw UndefinedVariableError(symbols_[slot]);
+    }
+    const Storage& storage = env_.getStorage();
+    if (!storage.isInit(id)) {
+        throw UninitializedVariableError(symbols_[slot]);
+    }
+    ids_[slot] = id;
+    return storage.valueAt(id);
+}
+
+void Bytecode::store(unsigned int slot, double value) {
+    unsigned int id = ids_[slot];
+    if (id == SymbolTable::kInvalidSymbolId) {
+        id = env_.findSymbol(symbols_[slot]);
+        if (id == SymbolTable::kInvalidSymbolId) {
+            id = env_.addSymbol(symbols_[slot]);
+        }
+    }
+    env_.getStorage().setValue(id, value);
+    ids_[slot] = id;
+}
+
+void Bytecode::push(EOpCode op, unsigned int operand) {
+    code_.push_back({op, operand});
+    depth_ += StackEffect(op);
+    maxDepth_ = std::max(maxDepth_, depth_);
+}
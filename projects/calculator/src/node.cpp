@@ -1,43 +1,188 @@
+#include <cmath>
+#include <cstddef>
+#include <iterator>
 #include "node.h"
+#include "bytecode.h"
 #include "env.h"
 #include "exception.h"
+#include "simplifier.h"
+
+namespace {
+
+bool IsNumber(const NodePtr& node, double& value) {
+    const auto* number = dynamic_cast<const NumberNode*>(node.get());
+    if (!number) {
+        return false;
+    }
+    value = number->value();
+    return true;
+}
+
+// Exact match, so 0.0 and -0.0 differ.
+bool IsExactly(const NodePtr& node, double expected) {
+    double value = 0;
+    return IsNumber(node, value) && value == expected && std::signbit(value) == std::signbit(expected);
+}
+
+} // namespace
+
+void NodeDeleter::operator()(Node* node) const {
+    if (inArena) {
+        node->~Node();
+    } else {
+        delete node;
+    }
+}
 
 double NumberNode::calc() const {
     return value_;
 }
 
+void NumberNode::compile(Bytecode& out) const {
+    out.emitConst(value_);
+}
+
 
-double VariableNode::calc() const{
+VariableNode::VariableNode(std::string symbol, Env& env)
+    : symbol_(std::move(symbol)), env_(env), id_(SymbolTable::kInvalidSymbolId), generation_(0) {
+    const unsigned int id = env_.findSymbol(symbol_);
+    if (env_.getStorage().isInit(id)) {
+        id_ = id;
+        generation_ = env_.getStorage().generation();
+    }
+}
+
+double VariableNode::calc() const {
+    const Storage& storage = env_.getStorage();
+    if (id_ != SymbolTable::kInvalidSymbolId && generation_ == storage.generation()) {
+        return storage.valueAt(id_);
+    }
+    return storage.valueAt(bind());
+}
+
+unsigned int VariableNode::bind() const {
     const unsigned int id = env_.findSymbol(symbol_);
     if (id == SymbolTable::kInvalidSymbolId) {
         throw UndefinedVariableError(symbol_);
     }
-    if (!env_.getStorage().isInit(id)) {
+    const Storage& storage = env_.getStorage();
+    if (!storage.isInit(id)) {
         throw UninitializedVariableError(symbol_);
     }
-    return env_.getStorage().getValue(id);
+    id_ = id;
+    generation_ = storage.generation();
+    return id;
 }
 
 void VariableNode::assign(double value) {
-    unsigned int id = env_.findSymbol(symbol_);
-    if (id == SymbolTable::kInvalidSymbolId) {
-        id = env_.addSymbol(symbol_);
+    Storage& storage = env_.getStorage();
+    unsigned int id = id_;
+    if (id == SymbolTable::kInvalidSymbolId || generation_ != storage.generation()) {
+        id = env_.findSymbol(symbol_);
+        if (id == SymbolTable::kInvalidSymbolId) {
+            id = env_.addSymbol(symbol_);
+        }
+    }
+    storage.setValue(id, value);
+    id_ = id;
+    generation_ = storage.generation();
+}
+
+void VariableNode::compile(Bytecode& out) const {
+    out.emitLoad(symbol_);
+}
+
+void VariableNode::compileAssign(Bytecode& out) const {
+    out.emitStore(symbol_);
+}
+
+NodePtr VariableNode::simplify(AstSimplifier& pass) {
+    double value = 0;
+    if (pass.builtinConstant(symbol_, env_, value)) {
+        return pass.makeNumber(value);
     }
-    env_.getStorage().setValue(id, value);
+    return nullptr;
+}
+
+bool BinaryNode::simplifyOperands(AstSimplifier& pass, double& left, double& right) {
+    left_ = pass.run(std::move(left_));
+    right_ = pass.run(std::move(right_));
+    return IsNumber(left_, left) && IsNumber(right_, right);
 }
 
 double AddNode::calc() const {
     return left_->calc() + right_->calc();
 }
 
+void AddNode::compile(Bytecode& out) const {
+    left_->compile(out);
+    right_->compile(out);
+    out.emit(EOpCode::Add);
+}
+
+NodePtr AddNode::simplify(AstSimplifier& pass) {
+    double left = 0;
+    double right = 0;
+    if (simplifyOperands(pass, left, right)) {
+        return pass.makeNumber(left + right);
+    }
+    // x + (-0) == x for every x, but -0 + 0 is +0, so x + 0 is kept.
+    if (IsExactly(right_, -0.0)) {
+        return std::move(left_);
+    }
+    if (IsExactly(left_, -0.0)) {
+        return std::move(right_);
+    }
+    return nullptr;
+}
+
 double SubtractNode::calc() const {
     return left_->calc() - right_->calc();
 }
 
+void SubtractNode::compile(Bytecode& out) const {
+    left_->compile(out);
+    right_->compile(out);
+    out.emit(EOpCode::Subtract);
+}
+
+NodePtr SubtractNode::simplify(AstSimplifier& pass) {
+    double left = 0;
+    double right = 0;
+    if (simplifyOperands(pass, left, right)) {
+        return pass.makeNumber(left - right);
+    }
+    if (IsExactly(right_, 0.0)) {
+        return std::move(left_);
+    }
+    return nullptr;
+}
+
 double MultiplyNode::calc() const {
     return left_->calc() * right_->calc();
 }
 
+void MultiplyNode::compile(Bytecode& out) const {
+    left_->compile(out);
+    right_->compile(out);
+    out.emit(EOpCode::Multiply);
+}
+
+NodePtr MultiplyNode::simplify(AstSimplifier& pass) {
+    double left = 0;
+    double right = 0;
+    if (simplifyOperands(pass, left, right)) {
+        return pass.makeNumber(left * right);
+    }
+    if (IsExactly(right_, 1.0)) {
+        return std::move(left_);
+    }
+    if (IsExactly(left_, 1.0)) {
+        return std::move(right_);
+    }
+    return nullptr;
+}
+
 double DivideNode::calc() const {
     double denominator = right_->calc();
     if (denominator == 0) {
@@ -46,32 +191,97 @@ double DivideNode::calc() const {
     return left_->calc() / denominator;
 }
 
+void DivideNode::compile(Bytecode& out) const {
+    right_->compile(out);
+    out.emit(EOpCode::CheckDivisor);
+    left_->compile(out);
+    out.emit(EOpCode::DivideInto);
+}
+
+NodePtr DivideNode::simplify(AstSimplifier& pass) {
+    double left = 0;
+    double right = 0;
+    // A constant zero divisor is left for calc() to throw on.
+    if (simplifyOperands(pass, left, right) && right != 0) {
+        return pass.makeNumber(left / right);
+    }
+    if (IsExactly(right_, 1.0)) {
+        return std::move(left_);
+    }
+    return nullptr;
+}
+
 double AssignNode::calc() const {
     double value = right_->calc();
     left_->assign(value);
     return value;
 }
 
+void AssignNode::compile(Bytecode& out) const {
+    right_->compile(out);
+    left_->compileAssign(out);
+}
+
+NodePtr AssignNode::simplify(AstSimplifier& pass) {
+    right_ = pass.run(std::move(right_));
+    return nullptr;
+}
+
 double NegateNode::calc() const {
     return -child_->calc();
 }
 
+void NegateNode::compile(Bytecode& out) const {
+    child_->compile(out);
+    out.emit(EOpCode::Negate);
+}
+
+NodePtr NegateNode::simplify(AstSimplifier& pass) {
+    child_ = pass.run(std::move(child_));
+    double value = 0;
+    if (IsNumber(child_, value)) {
+        return pass.makeNumber(-value);
+    }
+    return nullptr;
+}
+
 double FunNode::calc() const {
     return (*pfunc_)(child_->calc());
 }
 
-NaryNode::NaryNode(std::unique_ptr<Node> child) {
+void FunNode::compile(Bytecode& out) const {
+    child_->compile(out);
+    out.emitCall(pfunc_);
+}
+
+NodePtr FunNode::simplify(AstSimplifier& pass) {
+    child_ = pass.run(std::move(child_));
+    // FuncTable only holds pure <cmath> functions.
+    double value = 0;
+    if (IsNumber(child_, value)) {
+        return pass.makeNumber((*pfunc_)(value));
+    }
+    return nullptr;
+}
+
+NaryNode::NaryNode(NodePtr child) {
     appendChild(std::move(child));
 }
 
-void NaryNode::appendChild(std::unique_ptr<Node> child) {
+void NaryNode::appendChild(NodePtr child) {
     children_.push_back(std::move(child));
 }
 
-SumNode::SumNode(std::unique_ptr<Node> child)
+void NaryNode::simplifyChildren(AstSimplifier& pass) {
+    for (NodePtr& child : children_) {
+        child = pass.run(std::move(child));
+    }
+}
+
+SumNode::SumNode(NodePtr child)
     : NaryNode(std::move(child)), operations_{EAdditiveOp::Add} {}
 
-void SumNode::addTerm(std::unique_ptr<Node> term, EAdditiveOp op) {
+void SumNode::addTerm(NodePtr term, EAdditiveOp op) {
     appendChild(std::move(term));
     operations_.push_back(op);
 }
@@ -89,10 +299,70 @@ double SumNode::calc() const {
     return result;
 }
 
-ProductNode::ProductNode(std::unique_ptr<Node> child)
+void SumNode::compile(Bytecode& out) const {
+    // calc() starts from 0, which turns a leading -0.0 into +0.0; keep that.
+    out.emitConst(0);
+    for (size_t i = 0; i < children_.size(); ++i) {
+        children_[i]->compile(out);
+        out.emit(operations_[i] == EAdditiveOp::Add ? EOpCode::Add : EOpCode::Subtract);
+    }
+}
+
+/*
+calc() starts from +0 and a sum of two values is -0 only when both are, so the running total
+is never -0. That makes 0 + S == S for a leading SumNode S, and adding or subtracting a zero
+term a no-op anywhere in the chain.
+*/
+NodePtr SumNode::simplify(AstSimplifier& pass) {
+    simplifyChildren(pass);
+    spliceLeadingSum();
+
+    double result = 0;
+    size_t count = 0;
+    double value = 0;
+    for (; count < children_.size() && IsNumber(children_[count], value); ++count) {
+        result = operations_[count] == EAdditiveOp::Add ? result + value : result - value;
+    }
+    if (count == children_.size()) {
+        return pass.makeNumber(result);
+    }
+    if (count > 1) {
+        children_.erase(children_.begin() + 1, children_.begin() + static_cast<std::ptrdiff_t>(count));
+        operations_.erase(operations_.begin() + 1, operations_.begin() + static_cast<std::ptrdiff_t>(count));
+        children_[0] = pass.makeNumber(result);
+        operations_[0] = EAdditiveOp::Add;
+    }
+
+    // A non-constant term is left, so the chain never becomes empty.
+    for (size_t i = 0; i < children_.size();) {
+        if (IsNumber(children_[i], value) && value == 0) {
+            children_.erase(children_.begin() + static_cast<std::ptrdiff_t>(i));
+            operations_.erase(operations_.begin() + static_cast<std::ptrdiff_t>(i));
+        } else {
+            ++i;
+        }
+    }
+    spliceLeadingSum();
+    return nullptr;
+}
+
+void SumNode::spliceLeadingSum() {
+    auto* nested = dynamic_cast<SumNode*>(children_[0].get());
+    if (!nested || operations_[0] != EAdditiveOp::Add) {
+        return;
+    }
+    NodePtr owner = std::move(children_[0]);
+    children_.erase(children_.begin());
+    operations_.erase(operations_.begin());
+    children_.insert(children_.begin(), std::make_move_iterator(nested->children_.begin()),
+                     std::make_move_iterator(nested->children_.end()));
+    operations_.insert(operations_.begin(), nested->operations_.begin(), nested->operations_.end());
+}
+
+ProductNode::ProductNode(NodePtr child)
     : NaryNode(std::move(child)), operations_{EMultiplicativeOp::Multiply} {}
 
-void ProductNode::addFactor(std::unique_ptr<Node> factor, EMultiplicativeOp op) {
+void ProductNode::addFactor(NodePtr factor, EMultiplicativeOp op) {
     appendChild(std::move(factor));
     operations_.push_back(op);
 }
@@ -112,3 +382,72 @@ double ProductNode::calc() const {
     }
     return result;
 }
+
+void ProductNode::compile(Bytecode& out) const {
+    // 1 * x == x exactly, so the first factor needs no multiply.
+    children_[0]->compile(out);
+    for (size_t i = 1; i < children_.size(); ++i) {
+        children_[i]->compile(out);
+        out.emit(operations_[i] == EMultiplicativeOp::Multiply ? EOpCode::Multiply : EOpCode::Divide);
+    }
+}
+
+/*
+calc() starts from 1 and 1 * x == x exactly, so a leading ProductNode splices in unchanged and
+a factor of 1 can be dropped, except where it is the dividend of a following division.
+*/
+NodePtr ProductNode::simplify(AstSimplifier& pass) {
+    simplifyChildren(pass);
+    spliceLeadingProduct();
+
+    double result = 1;
+    size_t count = 0;
+    double value = 0;
+    for (; count < children_.size() && IsNumber(children_[count], value); ++count) {
+        if (operations_[count] == EMultiplicativeOp::Multiply) {
+            result *= value;
+        } else if (value == 0) {
+            break;
+        } else {
+            result /= value;
+        }
+    }
+    if (count == children_.size()) {
+        return pass.makeNumber(result);
+    }
+    if (count > 1) {
+        children_.erase(children_.begin() + 1, children_.begin() + static_cast<std::ptrdiff_t>(count));
+        operations_.erase(operations_.begin() + 1, operations_.begin() + static_cast<std::ptrdiff_t>(count));
+        children_[0] = pass.makeNumber(result);
+        operations_[0] = EMultiplicativeOp::Multiply;
+    }
+
+    // compile() needs a leading Multiply, so the first factor only goes if the next multiplies.
+    for (size_t i = 0; i < children_.size() && children_.size() > 1;) {
+        const bool keepsLeadingMultiply = i > 0 || operations_[1] == EMultiplicativeOp::Multiply;
+        if (keepsLeadingMultiply && IsExactly(children_[i], 1.0)) {
+            children_.erase(children_.begin() + static_cast<std::ptrdiff_t>(i));
+            operations_.erase(operations_.begin() + static_cast<std::ptrdiff_t>(i));
+        } else {
+            ++i;
+        }
+    }
+    spliceLeadingProduct();
+    if (children_.size() == 1) {
+        return std::move(children_[0]);
+    }
+    return nullptr;
+}
+
+void ProductNode::spliceLeadingProduct() {
+    auto* nested = dynamic_cast<ProductNode*>(children_[0].get());
+    if (!nested) {
+        return;
+    }
+    NodePtr owner = std::move(children_[0]);
+    children_.erase(children_.begin());
+    operations_.erase(operations_.begin());
+    children_.insert(children_.begin(), std::make_move_iterator(nested->children_.begin()),
+                     std::make_move_iterator(nested->children_.end()));
+    operations_.insert(operations_.begin(), nested->operations_.begin(), nested->operations_.end());
+}
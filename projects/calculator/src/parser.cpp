@@ -1,7 +1,9 @@
 #include <vector>
 #include "ast_builder.h"
+#include "bytecode.h"
 #include "node.h"
 #include "scanner.h"
+#include "simplifier.h"
 #include "parser.h"
 #include "env.h"
 #include "exception.h"
@@ -12,8 +14,11 @@ Parser::Parser(Scanner& scanner)
       builder_(*ownedBuilder_),
       scanner_(scanner),
       env_(*ownedEnv_),
+      arena_(nullptr),
       tree_(nullptr),
-      status_(EStatus::STATUS_SUCCESS) {}
+      status_(EStatus::STATUS_SUCCESS),
+      simplify_(true),
+      assigns_(false) {}
 
 Parser::Parser(Scanner& scanner, IAstBuilder& builder)
     : ownedBuilder_(nullptr),
@@ -21,8 +26,11 @@ Parser::Parser(Scanner& scanner, IAstBuilder& builder)
       builder_(builder),
       scanner_(scanner),
       env_(*ownedEnv_),
+      arena_(nullptr),
       tree_(nullptr),
-      status_(EStatus::STATUS_SUCCESS) {}
+      status_(EStatus::STATUS_SUCCESS),
+      simplify_(true),
+      assigns_(false) {}
 
 Parser::Parser(Scanner& scanner, Env& env)
     : ownedBuilder_(std::make_unique<BinaryAstBuilder>()),
@@ -30,8 +38,11 @@ Parser::Parser(Scanner& scanner, Env& env)
       builder_(*ownedBuilder_),
       scanner_(scanner),
       env_(env),
+      arena_(nullptr),
       tree_(nullptr),
-      status_(EStatus::STATUS_SUCCESS) {}
+      status_(EStatus::STATUS_SUCCESS),
+      simplify_(true),
+      assigns_(false) {}
 
 Parser::Parser(Scanner& scanner, IAstBuilder& builder, Env& env)
     : ownedBuilder_(nullptr),
@@ -39,23 +50,54 @@ Parser::Parser(Scanner& scanner, IAstBuilder& builder, Env& env)
       builder_(builder),
       scanner_(scanner),
       env_(env),
+      arena_(nullptr),
       tree_(nullptr),
-      status_(EStatus::STATUS_SUCCESS) {}
+      status_(EStatus::STATUS_SUCCESS),
+      simplify_(true),
+      assigns_(false) {}
 
 Parser::~Parser() = default;
 
+namespace {
+
+// Points the builder at the parse's arena until parse() returns or throws.
+class ArenaScope {
+public:
+    ArenaScope(IAstBuilder& builder, NodeArena* arena): builder_(builder) { builder_.setArena(arena); }
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope(ArenaScope&&) = delete;
+    const ArenaScope& operator=(const ArenaScope&) = delete;
+    ArenaScope& operator=(ArenaScope&&) = delete;
+    ~ArenaScope() { builder_.setArena(nullptr); }
+private:
+    IAstBuilder& builder_;
+};
+
+} // namespace
+
 EStatus Parser::parse() {
+    tree_.reset();
+    arena_.reset();
+    assigns_ = false;
+    if (builder_.allocation() == ENodeAllocation::Arena) {
+        arena_ = std::make_unique<NodeArena>();
+    }
+    ArenaScope scope(builder_, arena_.get());
     try {
         tree_ = expr();
         if (scanner_.getToken() != EToken::TOKEN_END) {
             throw SyntaxError("Unexpected token");
         }
+        if (simplify_) {
+            tree_ = AstSimplifier(builder_, !assigns_).run(std::move(tree_));
+        }
         if (!scanner_.isDone()) {
             status_ = EStatus::STATUS_ERROR;
         }
         return status_;
     } catch (...) {
         tree_.reset();
+        arena_.reset();
         status_ = EStatus::STATUS_ERROR;
         throw;
     }
@@ -68,6 +110,13 @@ double Parser::calc() const {
     return tree_->calc();
 }
 
+Bytecode Parser::compile() const {
+    if (!tree_) {
+        throw RuntimeError("Parse tree is empty");
+    }
+    return Bytecode(*tree_, env_);
+}
+
 /*
 expr is 
     term + expr
@@ -75,8 +124,8 @@ expr is
     term = expr
     term
 */
-std::unique_ptr<Node> Parser::expr() {
-    std::unique_ptr<Node> node = term();
+NodePtr Parser::expr() {
+    NodePtr node = term();
     std::vector<AdditivePart> rest;
     while (scanner_.getToken() == EToken::TOKEN_PLUS ||
            scanner_.getToken() == EToken::TOKEN_MINUS) {
@@ -88,11 +137,12 @@ std::unique_ptr<Node> Parser::expr() {
     node = builder_.makeAdditive(std::move(node), std::move(rest));
     if (scanner_.getToken() == EToken::TOKEN_ASSIGN) {
         scanner_.accept();
-        std::unique_ptr<Node> right = expr();
+        NodePtr right = expr();
         if (!node->isLvalue()) {
             throw SyntaxError("Cannot assign to a non-lvalue");
         }
         node = builder_.makeAssign(std::move(node), std::move(right));
+        assigns_ = true;
     }
     return node;
 }
@@ -103,8 +153,8 @@ term is
     factor / term
     factor
 */
-std::unique_ptr<Node> Parser::term() {
-    std::unique_ptr<Node> node = factor();
+NodePtr Parser::term() {
+    NodePtr node = factor();
     std::vector<MultiplicativePart> rest;
     while (scanner_.getToken() == EToken::TOKEN_MULTIPLY ||
            scanner_.getToken() == EToken::TOKEN_DIVIDE) {
@@ -125,7 +175,7 @@ factor is
     (expr)
     -factor
 */
-std::unique_ptr<Node> Parser::factor() {
+NodePtr Parser::factor() {
     switch (scanner_.getToken()) {
         case EToken::TOKEN_NUMBER: {
             const double value = scanner_.getValue();
@@ -134,7 +184,7 @@ std::unique_ptr<Node> Parser::factor() {
         }
         case EToken::TOKEN_LPAREN: {
             scanner_.accept();
-            std::unique_ptr<Node> node = expr();
+            NodePtr node = expr();
             if (scanner_.getToken() != EToken::TOKEN_RPAREN) {
                 throw SyntaxError("Expected ')'");
             }
@@ -147,7 +197,7 @@ std::unique_ptr<Node> Parser::factor() {
             const FuncPtr func = env_.findFunc(symbol);
             if (scanner_.getToken() == EToken::TOKEN_LPAREN) {
                 scanner_.accept();
-                std::unique_ptr<Node> node = expr();
+                NodePtr node = expr();
                 if (scanner_.getToken() != EToken::TOKEN_RPAREN) {
                     throw SyntaxError("Expected ')'");
                 }
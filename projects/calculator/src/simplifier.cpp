@@ -0,0 +1,29 @@
+#include "simplifier.h"
+#include "ast_builder.h"
+#include "env.h"
+
+AstSimplifier::AstSimplifier(const IAstBuilder& builder, bool foldBuiltins)
+    : builder_(builder), foldBuiltins_(foldBuiltins) {}
+
+NodePtr AstSimplifier::run(NodePtr node) {
+    NodePtr replacement = node->simplify(*this);
+    return replacement ? std::move(replacement) : std::move(node);
+}
+
+NodePtr AstSimplifier::makeNumber(double value) const {
+    return builder_.makeNumber(value);
+}
+
+bool AstSimplifier::builtinConstant(const std::string& symbol, const Env& env, double& value) const {
+    double initial = 0;
+    if (!foldBuiltins_ || !Storage::builtinConstant(symbol, initial)) {
+        return false;
+    }
+    const unsigned int id = env.findSymbol(symbol);
+    const Storage& storage = env.getStorage();
+    if (!storage.isInit(id) || storage.valueAt(id) != initial) {
+        return false;
+    }
+    value = initial;
+    return true;
+}
@@ -11,6 +11,16 @@ void ValidateSymbolId(unsigned int id) {
     }
 }
 
+struct ConstantEntry {
+    const char* name;
+    double value;
+};
+
+const ConstantEntry kConstants[] = {
+    {"pi", 2.0 * std::acos(0.0)},
+    {"e", std::exp(1.0)},
+};
+
 } // namespace
 
 void Storage::serialize(Serializer& output) const {
@@ -21,6 +31,7 @@ void Storage::serialize(Serializer& output) const {
 }
 
 void Storage::deserialize(DeSerializer& input) {
+    ++generation_;
     cells_.clear();
     inits_.clear();
     size_t size;
@@ -33,8 +44,19 @@ void Storage::deserialize(DeSerializer& input) {
 }
 
 Storage::Storage(SymbolTable& tbl) {
-    addConstant(tbl, "pi", 2.0 * std::acos(0.0));
-    addConstant(tbl, "e", std::exp(1.0));
+    for (const ConstantEntry& entry : kConstants) {
+        addConstant(tbl, entry.name, entry.value);
+    }
+}
+
+bool Storage::builtinConstant(const std::string& name, double& value) {
+    for (const ConstantEntry& entry : kConstants) {
+        if (name == entry.name) {
+            value = entry.value;
+            return true;
+        }
+    }
+    return false;
 }
 
 bool Storage::isInit(unsigned int id) const {
@@ -71,6 +93,7 @@ void Storage::addValue(unsigned int id, double value) {
 }
 
 void Storage::clear() {
+    ++generation_;
     cells_.clear();
     inits_.clear();
 }
@@ -0,0 +1,197 @@
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <vector>
+#include "gtest_prompt.h"
+#include "ast_builder.h"
+#include "batch.h"
+#include "bytecode.h"
+#include "env.h"
+#include "exception.h"
+#include "parser.h"
+#include "scanner.h"
+
+namespace {
+
+void Execute(const std::string& statement, Env& env) {
+    std::istringstream input(statement);
+    Scanner scanner(input);
+    Parser parser(scanner, env);
+    parser.parse();
+    parser.calc();
+}
+
+// Not a multiple of the block size, so the last block is partial.
+constexpr std::size_t kRows = 3 * BatchEvaluator::kBlockSize + 37;
+
+const char* const kArithmetic[] = {
+    "x",
+    "a * x + b",
+    "x * y - y / a",
+    "-(x - y) * (x + 1)",
+    "(x + y) * (x - y) / (a + b + c)",
+    "1 + x - 2 * y + 3 * a - 4 / a + 5 * x * y",
+    "a * b + c",
+    "x + 0",
+    "2 * pi * x",
+};
+
+const char* const kFunctions[] = {
+    "sqrt(x * x + y * y)",
+    "sin(x) * cos(y) + exp(-x * x) - log(1 + y * y)",
+    "log10(1 + y * y) + tan(x / 8) + atan(y)",
+    "asin(x / 8) + acos(y / 8)",
+    "sinh(x / 4) - cosh(y / 4) + tanh(x)",
+};
+
+class BatchTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        for (const char* init : {"a = 0.5", "b = -2", "c = 7", "x = 0", "y = 0"}) {
+            Execute(init, env_);
+        }
+        xs_.resize(kRows);
+        ys_.resize(kRows);
+        for (std::size_t i = 0; i < kRows; ++i) {
+            xs_[i] = (static_cast<double>(i % 97) - 48) / 6;
+            ys_[i] = (static_cast<double>(i % 89) - 44) / 6;
+        }
+        // Special values go through unchanged, as they would one row at a time.
+        xs_[5] = -0.0;
+        xs_[6] = std::numeric_limits<double>::quiet_NaN();
+        ys_[7] = std::numeric_limits<double>::infinity();
+    }
+
+    Bytecode compile(const std::string& expression) {
+        std::istringstream input(expression);
+        Scanner scanner(input);
+        Parser parser(scanner, env_);
+        parser.parse();
+        return parser.compile();
+    }
+
+    // Bytecode::run() once per row, with x and y set in the Env.
+    std::vector<double> runPerRow(Bytecode& program) {
+        const unsigned int xId = env_.findSymbol("x");
+        const unsigned int yId = env_.findSymbol("y");
+        std::vector<double> results(kRows);
+        for (std::size_t i = 0; i < kRows; ++i) {
+            env_.getStorage().setValue(xId, xs_[i]);
+            env_.getStorage().setValue(yId, ys_[i]);
+            results[i] = program.run();
+        }
+        return results;
+    }
+
+    std::vector<double> runBatch(Bytecode& program, bool exactMath) {
+        BatchEvaluator batch(program);
+        batch.bind("x", xs_.data());
+        batch.bind("y", ys_.data());
+        batch.setExactMath(exactMath);
+        std::vector<double> results(kRows);
+        batch.run(results.data(), results.size());
+        return results;
+    }
+
+    Env env_;
+    std::vector<double> xs_;
+    std::vector<double> ys_;
+};
+
+void ExpectSameBits(const std::vector<double>& expected, const std::vector<double>& actual,
+                    const std::string& expression) {
+    for (std::size_t i = 0; i < expected.size(); ++i) {
+        if (std::isnan(expected[i])) {
+            EXPECT_TRUE(std::isnan(actual[i])) << expression << " row " << i;
+        } else {
+            EXPECT_EQ(expected[i], actual[i]) << expression << " row " << i;
+            EXPECT_EQ(std::signbit(expected[i]), std::signbit(actual[i])) << expression << " row " << i;
+        }
+    }
+}
+
+} // namespace
+
+TEST_F(BatchTest, ArithmeticMatchesRunPerRow) {
+    for (const char* expression : kArithmetic) {
+        Bytecode program = compile(expression);
+        ExpectSameBits(runPerRow(program), runBatch(program, false), expression);
+    }
+}
+
+TEST_F(BatchTest, ExactMathMatchesRunPerRow) {
+    for (const char* expression : kFunctions) {
+        Bytecode program = compile(expression);
+        ExpectSameBits(runPerRow(program), runBatch(program, true), expression);
+    }
+}
+
+TEST_F(BatchTest, VectorMathStaysWithinRounding) {
+    for (const char* expression : kFunctions) {
+        Bytecode program = compile(expression);
+        const std::vector<double> expected = runPerRow(program);
+        const std::vector<double> actual = runBatch(program, false);
+        for (std::size_t i = 0; i < kRows; ++i) {
+            if (std::isfinite(expected[i])) {
+                EXPECT_NEAR(expected[i], actual[i], 1e-12 * (1 + std::fabs(expected[i]))) << expression << " row " << i;
+            } else {
+                EXPECT_EQ(std::isnan(expected[i]), std::isnan(actual[i])) << expression << " row " << i;
+            }
+        }
+    }
+}
+
+TEST_F(BatchTest, AssignmentKeepsLastRow) {
+    Bytecode program = compile("t = (y = a * x + b) * y");
+    const std::vector<double> results = runBatch(program, false);
+    const double y = 0.5 * xs_[kRows - 1] - 2;
+    EXPECT_DOUBLE_EQ(results[kRows - 1], y * y);
+    EXPECT_DOUBLE_EQ(env_.getStorage().getValue(env_.findSymbol("y")), y);
+    EXPECT_DOUBLE_EQ(env_.getStorage().getValue(env_.findSymbol("t")), y * y);
+}
+
+TEST_F(BatchTest, RejectsReadBeforeAssignmentUnlessBound) {
+    Bytecode program = compile("a + (a = x)");
+    std::vector<double> results(kRows);
+    BatchEvaluator batch(program);
+    batch.bind("x", xs_.data());
+    EXPECT_THROW(batch.run(results.data(), results.size()), RuntimeError);
+
+    std::vector<double> as(kRows, 1.0);
+    batch.bind("a", as.data());
+    batch.run(results.data(), results.size());
+    EXPECT_DOUBLE_EQ(results[10], 1.0 + xs_[10]);
+}
+
+TEST_F(BatchTest, ThrowsLikeRun) {
+    std::vector<double> results(kRows);
+    {
+        // One zero divisor among the rows is enough.
+        Bytecode program = compile("1 / (x - 1)");
+        BatchEvaluator batch(program);
+        std::vector<double> xs(kRows, 2.0);
+        xs[kRows - 1] = 1.0;
+        batch.bind("x", xs.data());
+        EXPECT_THROW(batch.run(results.data(), results.size()), DivisionByZeroError);
+    }
+    {
+        Bytecode program = compile("x / (a - 0.5)");
+        BatchEvaluator batch(program);
+        batch.bind("x", xs_.data());
+        EXPECT_THROW(batch.run(results.data(), results.size()), DivisionByZeroError);
+    }
+    {
+        Bytecode program = compile("x * q");
+        BatchEvaluator batch(program);
+        batch.bind("x", xs_.data());
+        batch.bind("unused", xs_.data());
+        Execute("q = 1", env_);
+        env_.getStorage().clear();
+        EXPECT_THROW(batch.run(results.data(), results.size()), UninitializedVariableError);
+    }
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,175 @@
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <sstream>
+#include "gtest_prompt.h"
+#include "ast_builder.h"
+#include "bytecode.h"
+#include "env.h"
+#include "exception.h"
+#include "parser.h"
+#include "scanner.h"
+
+namespace {
+
+double TreeEvaluate(const std::string& expression, IAstBuilder& builder, Env& env) {
+    std::istringstream input(expression);
+    Scanner scanner(input);
+    Parser parser(scanner, builder, env);
+    parser.parse();
+    return parser.calc();
+}
+
+double VmEvaluate(const std::string& expression, IAstBuilder& builder, Env& env) {
+    std::istringstream input(expression);
+    Scanner scanner(input);
+    Parser parser(scanner, builder, env);
+    parser.parse();
+    Bytecode program = parser.compile();
+    return program.run();
+}
+
+// Bitwise comparison, so -0.0 and NaN results must match too.
+void ExpectSameBits(double expected, double actual, const std::string& expression) {
+    EXPECT_EQ(std::signbit(expected), std::signbit(actual)) << expression;
+    if (std::isnan(expected)) {
+        EXPECT_TRUE(std::isnan(actual)) << expression;
+    } else {
+        EXPECT_EQ(expected, actual) << expression;
+    }
+}
+
+const char* const kExpressions[] = {
+    "42",
+    "1 + 2 * 3",
+    "(1 + 2) * 3",
+    "10 - 3 - 2 + 8",
+    "48 / 3 * 2 / 4",
+    "-5 + -(2 - 7)",
+    "-0",
+    "-0 + -0",
+    "2 * pi * r",
+    "sqrt(x * x + y * y)",
+    "a * x * x + b * x + c",
+    "sin(x) * cos(y) - tan(x / y) + exp(-x) + log(y)",
+    "log(-1) + 1",
+    "1 / 3 / 7 * 21",
+};
+
+class BytecodeTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        BinaryAstBuilder builder;
+        for (const char* init : {"r = 1.5", "x = 3", "y = 4", "a = 0.5", "b = -2", "c = 7"}) {
+            TreeEvaluate(init, builder, env_);
+        }
+    }
+
+    Env env_;
+};
+
+} // namespace
+
+TEST_F(BytecodeTest, MatchesTreeWalkForBothBuilders) {
+    BinaryAstBuilder binaryBuilder;
+    NaryAstBuilder naryBuilder;
+    for (IAstBuilder* builder : {static_cast<IAstBuilder*>(&binaryBuilder), static_cast<IAstBuilder*>(&naryBuilder)}) {
+        for (const char* expression : kExpressions) {
+            ExpectSameBits(TreeEvaluate(expression, *builder, env_), VmEvaluate(expression, *builder, env_),
+                           expression);
+        }
+    }
+}
+
+TEST_F(BytecodeTest, ProgramCanBeRunRepeatedly) {
+    BinaryAstBuilder builder;
+    std::istringstream input("a * x + b");
+    Scanner scanner(input);
+    Parser parser(scanner, builder, env_);
+    parser.parse();
+    Bytecode program = parser.compile();
+    EXPECT_DOUBLE_EQ(program.run(), -0.5);
+    TreeEvaluate("x = 10", builder, env_);
+    EXPECT_DOUBLE_EQ(program.run(), 3.0);
+    EXPECT_EQ(program.stackDepth(), 2U);
+}
+
+TEST_F(BytecodeTest, BoundProgramKeepsAssignmentsAndChecks) {
+    BinaryAstBuilder builder;
+    std::istringstream input("(t = x / y) * t - 1 / x");
+    Scanner scanner(input);
+    Parser parser(scanner, builder, env_);
+    parser.parse();
+    Bytecode program = parser.compile();
+    // The first run creates t through the checked loop, the later ones run bound.
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_DOUBLE_EQ(program.run(), parser.calc());
+    }
+    TreeEvaluate("x = 0", builder, env_);
+    EXPECT_THROW(program.run(), DivisionByZeroError);
+    EXPECT_DOUBLE_EQ(TreeEvaluate("t", builder, env_), 0.0);
+}
+
+TEST_F(BytecodeTest, AssignmentsCreateVariables) {
+    NaryAstBuilder builder;
+    EXPECT_DOUBLE_EQ(VmEvaluate("z = w = 2 + 3", builder, env_), 5.0);
+    EXPECT_DOUBLE_EQ(TreeEvaluate("z * w", builder, env_), 25.0);
+    EXPECT_DOUBLE_EQ(VmEvaluate("(q = 2) * q", builder, env_), 4.0);
+}
+
+TEST_F(BytecodeTest, KeepsTreeEvaluationOrder) {
+    BinaryAstBuilder builder;
+    // DivideNode evaluates its divisor first.
+    EXPECT_DOUBLE_EQ(VmEvaluate("x / (x = 4)", builder, env_), TreeEvaluate("x / (x = 4)", builder, env_));
+    EXPECT_THROW(VmEvaluate("undefined_name / 0", builder, env_), DivisionByZeroError);
+}
+
+TEST_F(BytecodeTest, ThrowsLikeTreeWalk) {
+    BinaryAstBuilder binaryBuilder;
+    NaryAstBuilder naryBuilder;
+    EXPECT_THROW(VmEvaluate("1 / (x - 3)", binaryBuilder, env_), DivisionByZeroError);
+    EXPECT_THROW(VmEvaluate("2 * 3 / 0", naryBuilder, env_), DivisionByZeroError);
+    EXPECT_THROW(VmEvaluate("missing + 1", naryBuilder, env_), UndefinedVariableError);
+    EXPECT_EQ(env_.findSymbol("missing"), SymbolTable::kInvalidSymbolId);
+}
+
+TEST(VariableBindingTest, ReloadedEnvRebindsTreeAndBytecode) {
+    BinaryAstBuilder builder;
+    const std::string path = "/tmp/test_calculator_variable_binding.bin";
+    {
+        // Same names, other ids: y is defined before x here.
+        Env other;
+        TreeEvaluate("y = 20", builder, other);
+        TreeEvaluate("x = 10", builder, other);
+        Serializer output(path);
+        other.serialize(output);
+    }
+
+    Env env;
+    TreeEvaluate("x = 1", builder, env);
+    TreeEvaluate("y = 2", builder, env);
+    std::istringstream input("y - x");
+    Scanner scanner(input);
+    Parser parser(scanner, builder, env);
+    parser.parse();
+    Bytecode program = parser.compile();
+    EXPECT_DOUBLE_EQ(parser.calc(), 1.0);
+    EXPECT_DOUBLE_EQ(program.run(), 1.0);
+
+    {
+        DeSerializer reload(path);
+        env.deserialize(reload);
+    }
+    EXPECT_DOUBLE_EQ(parser.calc(), 10.0);
+    EXPECT_DOUBLE_EQ(program.run(), 10.0);
+
+    env.getStorage().clear();
+    EXPECT_THROW(parser.calc(), UninitializedVariableError);
+    EXPECT_THROW(program.run(), UninitializedVariableError);
+    std::remove(path.c_str());
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
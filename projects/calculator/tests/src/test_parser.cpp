@@ -172,6 +172,41 @@ TEST(ParserBuilderTest, BinaryAndNaryBuildersMatchForDivisionByZero) {
     EXPECT_EQ(EvaluateError("8 / (3 - 3)", binaryBuilder), "Division by zero");
 }
 
+TEST(ParserArenaTest, ArenaBuildersMatchHeapBuilders) {
+    BinaryAstBuilder binaryBuilder;
+    NaryAstBuilder naryBuilder;
+    BinaryAstBuilder binaryArenaBuilder(ENodeAllocation::Arena);
+    NaryAstBuilder naryArenaBuilder(ENodeAllocation::Arena);
+
+    for (const char* expression : {"10 - 2 * 3 + 8 / 4", "-5 + 2 * -3", "sqrt(16) * (1 + 2) - exp(0)",
+                                   "64 / 2 / 4 * 8 / 2"}) {
+        EXPECT_DOUBLE_EQ(ParseAndEvaluate(expression, binaryArenaBuilder), ParseAndEvaluate(expression, binaryBuilder));
+        EXPECT_DOUBLE_EQ(ParseAndEvaluate(expression, naryArenaBuilder), ParseAndEvaluate(expression, naryBuilder));
+    }
+    EXPECT_EQ(EvaluateError("8 / (3 - 3)", naryArenaBuilder), "Division by zero");
+}
+
+TEST(ParserArenaTest, ArenaTreeKeepsAssignments) {
+    NaryAstBuilder builder(ENodeAllocation::Arena);
+    Env env;
+
+    EXPECT_DOUBLE_EQ(ParseAndEvaluate("x = y = 2 * 3", builder, env), 6.0);
+    EXPECT_DOUBLE_EQ(ParseAndEvaluate("x * y + 1", builder, env), 37.0);
+}
+
+TEST(ParserArenaTest, FailedParseLeavesParserAndBuilderUsable) {
+    BinaryAstBuilder builder(ENodeAllocation::Arena);
+    std::istringstream input("1 + (2 * 3");
+    Scanner scanner(input);
+    Parser parser(scanner, builder);
+
+    EXPECT_THROW(parser.parse(), SyntaxError);
+    EXPECT_THROW(static_cast<void>(parser.calc()), RuntimeError);
+    // Outside parse() the builder has no arena and falls back to the heap.
+    EXPECT_DOUBLE_EQ(builder.makeNegate(builder.makeNumber(2))->calc(), -2.0);
+    EXPECT_DOUBLE_EQ(ParseAndEvaluate("1 + (2 * 3)", builder), 7.0);
+}
+
 TEST(ParserAssignmentTest, SupportsSimpleAssignmentAcrossStatements) {
     Env env;
 
@@ -3,6 +3,7 @@
 #include "symbol_table.h"
 
 #include <cmath>
+#include <cstdio>
 
 TEST(SymbolTableTest, AddReturnsExistingIdForDuplicateName) {
     SymbolTable table;
@@ -78,6 +79,32 @@ TEST(StorageTest, SetValueRejectsInvalidSymbolId) {
     EXPECT_THROW(storage.setValue(SymbolTable::kInvalidSymbolId, 1.0), std::out_of_range);
 }
 
+TEST(StorageTest, ClearAndDeserializeAdvanceGeneration) {
+    SymbolTable table;
+    Storage storage(table);
+    const std::string path = "/tmp/test_calculator_storage_generation.bin";
+
+    const std::uint64_t initial = storage.generation();
+    storage.setValue(table.add("value"), 1.0);
+    EXPECT_EQ(storage.generation(), initial);
+
+    {
+        Serializer output(path);
+        storage.serialize(output);
+    }
+    storage.clear();
+    const std::uint64_t cleared = storage.generation();
+    EXPECT_NE(cleared, initial);
+
+    {
+        DeSerializer input(path);
+        storage.deserialize(input);
+    }
+    EXPECT_NE(storage.generation(), cleared);
+    EXPECT_DOUBLE_EQ(storage.valueAt(table.find("value")), 1.0);
+    std::remove(path.c_str());
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
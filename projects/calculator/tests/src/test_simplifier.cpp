@@ -0,0 +1,205 @@
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include "gtest_prompt.h"
+#include "ast_builder.h"
+#include "bytecode.h"
+#include "env.h"
+#include "exception.h"
+#include "parser.h"
+#include "scanner.h"
+
+namespace {
+
+struct Outcome {
+    double value = 0;
+    std::string error;
+};
+
+Outcome Evaluate(const std::string& expression, IAstBuilder& builder, Env& env, bool simplify) {
+    std::istringstream input(expression);
+    Scanner scanner(input);
+    Parser parser(scanner, builder, env);
+    parser.setSimplify(simplify);
+    Outcome outcome;
+    try {
+        parser.parse();
+        outcome.value = parser.calc();
+    } catch (const std::exception& error) {
+        outcome.error = error.what();
+    }
+    return outcome;
+}
+
+std::size_t CompiledSize(const std::string& expression, IAstBuilder& builder, Env& env, bool simplify) {
+    std::istringstream input(expression);
+    Scanner scanner(input);
+    Parser parser(scanner, builder, env);
+    parser.setSimplify(simplify);
+    parser.parse();
+    return parser.compile().code().size();
+}
+
+// Same exception, or the same bits, so -0.0 and NaN results must match too.
+void ExpectSameOutcome(const Outcome& expected, const Outcome& actual, const std::string& expression) {
+    EXPECT_EQ(expected.error, actual.error) << expression;
+    EXPECT_EQ(std::signbit(expected.value), std::signbit(actual.value)) << expression;
+    if (std::isnan(expected.value)) {
+        EXPECT_TRUE(std::isnan(actual.value)) << expression;
+    } else {
+        EXPECT_EQ(expected.value, actual.value) << expression;
+    }
+}
+
+const char* const kExpressions[] = {
+    "2 * pi * r",
+    "sqrt(2) * x",
+    "e * e * x",
+    "sin(pi / 6) * x",
+    "-(2 * 3) + x",
+    "x * 1",
+    "1 * z",
+    "z * 1",
+    "z / 1",
+    "z + 0",
+    "0 + z",
+    "z + -0",
+    "-0 + z",
+    "z - 0",
+    "0 - z",
+    "z * -1",
+    "(z * 1) + 0",
+    "z + z + 0",
+    "0 + (z + z)",
+    "(z + z) - 0 + 0",
+    "-0 + -0",
+    "--z",
+    "n * 1",
+    "n + 0",
+    "i - i + 0",
+    "exp(1000) * 0 + x",
+    "log(0) + x",
+    "log(-1) * 1",
+    "x + 1 + 2",
+    "1 + 2 + x",
+    "0.1 + 0.2 + x",
+    "x + 0.1 + 0.2",
+    "(0.1 + x) + 0.2",
+    "0.1 + (0.2 + x)",
+    "(x + y) + (2 + 3)",
+    "(1 + 2) + x + 3 + 4",
+    "1 - 1 + x - 0 + 0",
+    "(x * y) * 2 * 3",
+    "2 * 3 * x * y",
+    "0.1 * 3 * x",
+    "x * (0.1 * 3)",
+    "1 / x / 1",
+    "1 * 1 / x",
+    "1 / 3 / 7 * 21 * x",
+    "x / 0",
+    "x / (1 - 1)",
+    "2 * 3 / 0 * x",
+    "1 * 1 / 0",
+    "missing / 0",
+    "missing * 1",
+    "1 / 0 * missing",
+    "0 / (x - 3)",
+};
+
+class SimplifierTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        BinaryAstBuilder builder;
+        for (Env* env : {&plain_, &simplified_}) {
+            for (const char* init : {"r = 1.5", "x = 3", "y = 4", "z = -0", "n = log(-1)", "i = exp(1000)"}) {
+                Evaluate(init, builder, *env, false);
+            }
+        }
+    }
+
+    void ExpectIdentical(const std::string& expression, IAstBuilder& builder) {
+        ExpectSameOutcome(Evaluate(expression, builder, plain_, false),
+                          Evaluate(expression, builder, simplified_, true), expression);
+    }
+
+    Env plain_;
+    Env simplified_;
+};
+
+} // namespace
+
+TEST_F(SimplifierTest, MatchesUnsimplifiedTreeForEveryBuilder) {
+    BinaryAstBuilder binaryBuilder;
+    NaryAstBuilder naryBuilder;
+    BinaryAstBuilder binaryArenaBuilder(ENodeAllocation::Arena);
+    NaryAstBuilder naryArenaBuilder(ENodeAllocation::Arena);
+    for (IAstBuilder* builder : {static_cast<IAstBuilder*>(&binaryBuilder), static_cast<IAstBuilder*>(&naryBuilder),
+                                 static_cast<IAstBuilder*>(&binaryArenaBuilder),
+                                 static_cast<IAstBuilder*>(&naryArenaBuilder)}) {
+        for (const char* expression : kExpressions) {
+            ExpectIdentical(expression, *builder);
+        }
+    }
+}
+
+TEST_F(SimplifierTest, BytecodeMatchesSimplifiedTree) {
+    NaryAstBuilder builder;
+    for (const char* expression : kExpressions) {
+        std::istringstream input(expression);
+        Scanner scanner(input);
+        Parser parser(scanner, builder, simplified_);
+        parser.parse();
+        Outcome tree;
+        Outcome vm;
+        try {
+            tree.value = parser.calc();
+        } catch (const std::exception& error) {
+            tree.error = error.what();
+        }
+        try {
+            vm.value = parser.compile().run();
+        } catch (const std::exception& error) {
+            vm.error = error.what();
+        }
+        ExpectSameOutcome(tree, vm, expression);
+    }
+}
+
+TEST_F(SimplifierTest, FoldsConstantSubtrees) {
+    BinaryAstBuilder binaryBuilder;
+    NaryAstBuilder naryBuilder;
+    for (IAstBuilder* builder : {static_cast<IAstBuilder*>(&binaryBuilder), static_cast<IAstBuilder*>(&naryBuilder)}) {
+        EXPECT_EQ(CompiledSize("2 * pi * r", *builder, simplified_, true), 3U);
+        EXPECT_EQ(CompiledSize("2 * pi * r", *builder, simplified_, false), 5U);
+        EXPECT_EQ(CompiledSize("sqrt(2) * x * 1", *builder, simplified_, true), 3U);
+        EXPECT_EQ(CompiledSize("log(exp(2) - 1) / 2", *builder, simplified_, true), 1U);
+        // The zero divisor must still throw when evaluated.
+        EXPECT_GT(CompiledSize("2 / (1 - 1)", *builder, simplified_, true), 1U);
+    }
+    NaryAstBuilder builder;
+    EXPECT_EQ(CompiledSize("x - 0 + 0", builder, simplified_, true), 3U);
+    EXPECT_EQ(CompiledSize("((x + y) + 2 + 3) + r", builder, simplified_, true), 11U);
+}
+
+TEST_F(SimplifierTest, KeepsAssignedBuiltinConstantsLive) {
+    BinaryAstBuilder builder;
+    for (const char* expression : {"(pi = 3) + pi", "pi * (pi = 4)", "t = 2 * e"}) {
+        ExpectIdentical(expression, builder);
+    }
+    ExpectIdentical("2 * pi", builder);
+    EXPECT_DOUBLE_EQ(Evaluate("2 * pi", builder, simplified_, true).value, 8.0);
+}
+
+TEST_F(SimplifierTest, DivisionByZeroStillThrowsAtEvaluation) {
+    NaryAstBuilder builder;
+    std::istringstream input("2 * 3 / (4 - 4)");
+    Scanner scanner(input);
+    Parser parser(scanner, builder, simplified_);
+    EXPECT_NO_THROW(parser.parse());
+    EXPECT_THROW(parser.calc(), DivisionByZeroError);
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -3,12 +3,103 @@
 #define PERF_ENABLED 1
 #include "perf_duration_trace.h"
 
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
 namespace {
 
+constexpr const char* kBenchSamplePath = "/tmp/perf_duration_trace_bench_suite.perfbin";
+constexpr const char* kBenchSitePath = "/tmp/perf_duration_trace_bench_suite.sites.tsv";
+
+// Producer threads that have left their timed loop in the current run.
+std::atomic<int> g_finished_threads {0};
+
 void reset_runtime_for_benchmark() {
     perf_duration_trace::Runtime::instance().reset_for_tests({4U, 1U << 20U});
 }
 
+void reset_sharded_for_benchmark(const benchmark::State&) {
+    reset_runtime_for_benchmark();
+}
+
+void reset_staged_for_benchmark(const benchmark::State&) {
+    perf_duration_trace::Config config;
+    config.shard_count = 4U;
+    config.capacity_per_shard = 1U << 20U;
+    config.staging_batch = 64U;
+    perf_duration_trace::Runtime::instance().reset_for_tests(config);
+}
+
+void reset_thread_ring_for_benchmark(const benchmark::State&) {
+    // Each producer thread gets its own ring, so keep the per-ring capacity modest.
+    perf_duration_trace::Runtime::instance().reset_for_tests(
+        {0U, 1U << 16U, perf_duration_trace::CaptureMode::thread_ring});
+}
+
+void reset_histogram_for_benchmark(const benchmark::State&) {
+    perf_duration_trace::Runtime::instance().reset_for_tests({0U, 0U, perf_duration_trace::CaptureMode::histogram});
+}
+
+void reset_flight_recorder_for_benchmark(const benchmark::State&) {
+    perf_duration_trace::Runtime::instance().reset_for_tests(
+        {0U, 1U << 16U, perf_duration_trace::CaptureMode::flight_recorder});
+}
+
+// Shard sweep: range(0) shards of range(1) records each.
+void reset_shard_sweep_for_benchmark(const benchmark::State& state) {
+    g_finished_threads.store(0, std::memory_order_relaxed);
+    perf_duration_trace::Runtime::instance().reset_for_tests(
+        {static_cast<size_t>(state.range(0)), static_cast<size_t>(state.range(1))});
+}
+
+// One tiny shard that fills within the first few calls, so nearly every end() takes the
+// drop path.
+void reset_saturated_sharded_for_benchmark(const benchmark::State&) {
+    g_finished_threads.store(0, std::memory_order_relaxed);
+    perf_duration_trace::Runtime::instance().reset_for_tests({1U, 64U});
+}
+
+void reset_saturated_thread_ring_for_benchmark(const benchmark::State&) {
+    g_finished_threads.store(0, std::memory_order_relaxed);
+    perf_duration_trace::Runtime::instance().reset_for_tests(
+        {0U, 64U, perf_duration_trace::CaptureMode::thread_ring});
+}
+
+void start_async_for_benchmark(const perf_duration_trace::Config& config) {
+    g_finished_threads.store(0, std::memory_order_relaxed);
+    perf_duration_trace::Runtime::instance().reset_for_tests(config);
+    if (!perf_duration_trace::Runtime::instance().start_async_export(
+            {{kBenchSamplePath, kBenchSitePath}, 10U, perf_duration_trace::SampleWriter::mmap})) {
+        std::abort();
+    }
+}
+
+void reset_async_sharded_for_benchmark(const benchmark::State&) {
+    start_async_for_benchmark({4U, 1U << 16U});
+}
+
+void reset_async_thread_ring_for_benchmark(const benchmark::State&) {
+    start_async_for_benchmark({0U, 1U << 14U, perf_duration_trace::CaptureMode::thread_ring});
+}
+
+// Called by every producer thread after its timed loop. The last one out exports (the
+// async thread's final drain or finalize()) and reports how many calls were recorded or
+// dropped; counters are summed over threads, so the totals appear exactly once.
+void finish_run(benchmark::State& state, bool async) {
+    if (g_finished_threads.fetch_add(1, std::memory_order_acq_rel) + 1 != state.threads()) {
+        return;
+    }
+    perf_duration_trace::Runtime& runtime = perf_duration_trace::Runtime::instance();
+    const perf_duration_trace::ExportStats stats =
+        async ? runtime.stop_async_export() : runtime.finalize({kBenchSamplePath, kBenchSitePath});
+    const double calls = static_cast<double>(stats.exported_samples + stats.dropped_samples);
+    state.counters["exported"] = static_cast<double>(stats.exported_samples);
+    state.counters["dropped"] = static_cast<double>(stats.dropped_samples);
+    state.counters["drop_rate"] = calls != 0.0 ? static_cast<double>(stats.dropped_samples) / calls : 0.0;
+}
+
 }  // namespace
 
 static void BM_perf_trace_baseline(benchmark::State& state) {
@@ -27,6 +118,18 @@ static void BM_perf_trace_scope(benchmark::State& state) {
 }
 BENCHMARK(BM_perf_trace_scope);
 
+// One value rides along as an argument record in the same shard reservation.
+static void BM_perf_trace_scope_arg(benchmark::State& state) {
+    reset_runtime_for_benchmark();
+    uint64_t bytes = 0U;
+    for (auto _ : state) {
+        PERF_SCOPE_ARG("bench_scope_arg", bytes);
+        ++bytes;
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_perf_trace_scope_arg);
+
 static void BM_perf_trace_manual(benchmark::State& state) {
     reset_runtime_for_benchmark();
     for (auto _ : state) {
@@ -37,6 +140,289 @@ static void BM_perf_trace_manual(benchmark::State& state) {
 }
 BENCHMARK(BM_perf_trace_manual);
 
+static void BM_perf_trace_scope_thread_ring(benchmark::State& state) {
+    reset_thread_ring_for_benchmark(state);
+    for (auto _ : state) {
+        PERF_SCOPE("bench_scope_thread_ring");
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_perf_trace_scope_thread_ring);
+
+static void BM_perf_trace_scope_histogram(benchmark::State& state) {
+    reset_histogram_for_benchmark(state);
+    for (auto _ : state) {
+        PERF_SCOPE("bench_scope_histogram");
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_perf_trace_scope_histogram);
+
+static void BM_perf_trace_scope_flight_recorder(benchmark::State& state) {
+    reset_flight_recorder_for_benchmark(state);
+    for (auto _ : state) {
+        PERF_SCOPE("bench_scope_flight_recorder");
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_perf_trace_scope_flight_recorder);
+
+// A site switched off at runtime should cost about as much as BM_perf_trace_disabled_scope
+// in perf_duration_trace_disabled_benchmark, where PERF_ENABLED compiles the scope out.
+static void BM_perf_trace_scope_site_off(benchmark::State& state) {
+    reset_runtime_for_benchmark();
+    (void)perf_duration_trace::Runtime::instance().set_site_sampling("bench_scope_site_off",
+                                                                     perf_duration_trace::kSiteOff);
+    for (auto _ : state) {
+        PERF_SCOPE("bench_scope_site_off");
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_perf_trace_scope_site_off);
+
+static void BM_perf_trace_scope_sampled(benchmark::State& state) {
+    reset_runtime_for_benchmark();
+    (void)perf_duration_trace::Runtime::instance().set_site_sampling("bench_scope_sampled",
+                                                                     static_cast<uint32_t>(state.range(0)));
+    for (auto _ : state) {
+        PERF_SCOPE("bench_scope_sampled");
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_perf_trace_scope_sampled)->ArgName("every")->Arg(8)->Arg(64);
+
+static void BM_perf_trace_scope_tsc(benchmark::State& state) {
+    perf_duration_trace::Runtime::instance().reset_for_tests(
+        {4U, 1U << 20U, perf_duration_trace::CaptureMode::sharded, perf_duration_trace::ClockSource::tsc});
+    for (auto _ : state) {
+        PERF_SCOPE("bench_scope_tsc");
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_perf_trace_scope_tsc);
+
+// cpu_hint capture cost per source; the second argument is Config::cpu_hint_interval.
+static void BM_perf_trace_scope_cpu_hint(benchmark::State& state) {
+    perf_duration_trace::Config config {4U, 1U << 20U};
+    config.cpu_hint_source = static_cast<perf_duration_trace::CpuHintSource>(state.range(0));
+    config.cpu_hint_interval = static_cast<uint32_t>(state.range(1));
+    perf_duration_trace::Runtime::instance().reset_for_tests(config);
+    for (auto _ : state) {
+        PERF_SCOPE("bench_scope_cpu_hint");
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_perf_trace_scope_cpu_hint)
+    ->ArgNames({"source", "interval"})
+    ->Args({static_cast<int64_t>(perf_duration_trace::CpuHintSource::rdtscp), 1})
+    ->Args({static_cast<int64_t>(perf_duration_trace::CpuHintSource::getcpu), 1})
+    ->Args({static_cast<int64_t>(perf_duration_trace::CpuHintSource::getcpu), 64});
+
+static void BM_perf_trace_scope_contended(benchmark::State& state) {
+    for (auto _ : state) {
+        PERF_SCOPE("bench_scope_contended");
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_perf_trace_scope_contended)
+    ->Name("BM_perf_trace_scope_contended/sharded")
+    ->Setup(reset_sharded_for_benchmark)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_perf_trace_scope_contended)
+    ->Name("BM_perf_trace_scope_contended/sharded_staged")
+    ->Setup(reset_staged_for_benchmark)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_perf_trace_scope_contended)
+    ->Name("BM_perf_trace_scope_contended/thread_ring")
+    ->Setup(reset_thread_ring_for_benchmark)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_perf_trace_scope_contended)
+    ->Name("BM_perf_trace_scope_contended/histogram")
+    ->Setup(reset_histogram_for_benchmark)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_perf_trace_scope_contended)
+    ->Name("BM_perf_trace_scope_contended/flight_recorder")
+    ->Setup(reset_flight_recorder_for_benchmark)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+
+// Per-call cost and drops for a grid of Config::shard_count x capacity_per_shard, with up to
+// 64 producers and nothing draining: once the shards are full the remaining calls are
+// drops, so drop_rate shows how much of a burst of this size each configuration absorbs.
+static void BM_perf_trace_shard_sweep(benchmark::State& state) {
+    for (auto _ : state) {
+        PERF_SCOPE("bench_shard_sweep");
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations());
+    finish_run(state, false);
+}
+BENCHMARK(BM_perf_trace_shard_sweep)
+    ->Setup(reset_shard_sweep_for_benchmark)
+    ->ArgNames({"shards", "capacity"})
+    ->ArgsProduct({{1, 4, 16}, {1 << 12, 1 << 16}})
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+
+// Drop-path cost: the queue is full from the first few calls on.
+static void BM_perf_trace_scope_saturated(benchmark::State& state) {
+    for (auto _ : state) {
+        PERF_SCOPE("bench_scope_saturated");
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations());
+    finish_run(state, false);
+}
+BENCHMARK(BM_perf_trace_scope_saturated)
+    ->Name("BM_perf_trace_scope_saturated/sharded")
+    ->Setup(reset_saturated_sharded_for_benchmark)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+BENCHMARK(BM_perf_trace_scope_saturated)
+    ->Name("BM_perf_trace_scope_saturated/thread_ring")
+    ->Setup(reset_saturated_thread_ring_for_benchmark)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+
+// Producers while the async export thread drains every 10ms into a mapped file; drops
+// show whether the queues are large enough for that flush interval at this call rate.
+static void BM_perf_trace_scope_async(benchmark::State& state) {
+    for (auto _ : state) {
+        PERF_SCOPE("bench_scope_async");
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations());
+    finish_run(state, true);
+}
+BENCHMARK(BM_perf_trace_scope_async)
+    ->Name("BM_perf_trace_scope_async/sharded")
+    ->Setup(reset_async_sharded_for_benchmark)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+BENCHMARK(BM_perf_trace_scope_async)
+    ->Name("BM_perf_trace_scope_async/thread_ring")
+    ->Setup(reset_async_thread_ring_for_benchmark)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+
+// Times the final drain + write done by stop_async_export() for a burst already sitting in
+// the shards, comparing the buffered stdio writer with the mapped writer.
+static void BM_perf_trace_async_drain(benchmark::State& state) {
+    constexpr int kBurst = 1 << 16;
+    perf_duration_trace::AsyncExportConfig config {
+        {"/tmp/perf_duration_trace_bench_drain.perfbin", "/tmp/perf_duration_trace_bench_drain.sites.tsv"},
+        60000U};
+    config.writer = static_cast<perf_duration_trace::SampleWriter>(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        perf_duration_trace::Runtime::instance().reset_for_tests({4U, 1U << 16U});
+        if (!perf_duration_trace::Runtime::instance().start_async_export(config)) {
+            state.SkipWithError("start_async_export failed");
+            break;
+        }
+        for (int i = 0; i < kBurst; ++i) {
+            PERF_SCOPE("bench_async_drain");
+        }
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(perf_duration_trace::Runtime::instance().stop_async_export());
+    }
+    state.SetItemsProcessed(state.iterations() * kBurst);
+}
+BENCHMARK(BM_perf_trace_async_drain)
+    ->ArgName("writer")
+    ->Arg(static_cast<int64_t>(perf_duration_trace::SampleWriter::stdio))
+    ->Arg(static_cast<int64_t>(perf_duration_trace::SampleWriter::mmap))
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+// Times finalize() on a burst already sitting in the shards. The argument is the merge
+// memory budget in records: 0 keeps the default (everything resident), small budgets force
+// runs through temporary files.
+static void BM_perf_trace_finalize_merge(benchmark::State& state) {
+    constexpr int kBurst = 1 << 16;
+    perf_duration_trace::Config config {4U, 1U << 16U};
+    if (state.range(0) != 0) {
+        config.finalize_memory_bytes =
+            static_cast<size_t>(state.range(0)) * sizeof(perf_duration_trace::SampleRecord);
+    }
+    for (auto _ : state) {
+        state.PauseTiming();
+        perf_duration_trace::Runtime::instance().reset_for_tests(config);
+        for (int i = 0; i < kBurst; ++i) {
+            PERF_SCOPE("bench_finalize_merge");
+        }
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(perf_duration_trace::Runtime::instance().finalize(
+            {"/tmp/perf_duration_trace_bench_finalize.perfbin", "/tmp/perf_duration_trace_bench_finalize.sites.tsv"}));
+    }
+    state.SetItemsProcessed(state.iterations() * kBurst);
+}
+BENCHMARK(BM_perf_trace_finalize_merge)
+    ->ArgName("memory_records")
+    ->Arg(0)
+    ->Arg(4096)
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+// finalize() throughput in samples/s for a burst recorded by range(1) threads (so the
+// merge sees that many interleaved thread streams), per sample format.
+static void BM_perf_trace_finalize_throughput(benchmark::State& state) {
+    constexpr uint32_t kBurst = 1U << 18U;
+    const auto threads = static_cast<uint32_t>(state.range(1));
+    perf_duration_trace::Config config {4U, kBurst};
+    config.sample_format = static_cast<perf_duration_trace::SampleFormat>(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        perf_duration_trace::Runtime::instance().reset_for_tests(config);
+        std::vector<std::thread> producers;
+        for (uint32_t t = 0U; t < threads; ++t) {
+            producers.emplace_back([threads]() {
+                for (uint32_t i = 0U; i < kBurst / threads; ++i) {
+                    PERF_SCOPE("bench_finalize_throughput");
+                }
+            });
+        }
+        for (auto& producer : producers) {
+            producer.join();
+        }
+        state.ResumeTiming();
+        const perf_duration_trace::ExportStats stats =
+            perf_duration_trace::Runtime::instance().finalize({kBenchSamplePath, kBenchSitePath});
+        state.counters["dropped"] = static_cast<double>(stats.dropped_samples);
+    }
+    state.SetItemsProcessed(state.iterations() * kBurst);
+}
+BENCHMARK(BM_perf_trace_finalize_throughput)
+    ->ArgNames({"format", "threads"})
+    ->ArgsProduct({{static_cast<int64_t>(perf_duration_trace::SampleFormat::fixed),
+                    static_cast<int64_t>(perf_duration_trace::SampleFormat::compressed)},
+                   {1, 16}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// end() alone, without begin(): shows how the per-sample bookkeeping (sequence numbers,
+// queue reservation) scales as more producer threads record at the same time.
+static void BM_perf_trace_end_scaling(benchmark::State& state) {
+    const auto token = PERF_BEGIN("bench_end_scaling");
+    for (auto _ : state) {
+        PERF_END(token);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_perf_trace_end_scaling)
+    ->Setup(reset_sharded_for_benchmark)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+BENCHMARK(BM_perf_trace_end_scaling)
+    ->Name("BM_perf_trace_end_scaling/staged")
+    ->Setup(reset_staged_for_benchmark)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+
 int main(int argc, char** argv) {
     ::benchmark::Initialize(&argc, argv);
     if (::benchmark::ReportUnrecognizedArguments(argc, argv)) {
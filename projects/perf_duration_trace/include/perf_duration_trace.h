@@ -1,23 +1,53 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 
+#include "perf_duration_trace_format.h"
+#include "perf_duration_trace_live.h"
+
 #if defined(PERF_ENABLED)
 #include <algorithm>
-#include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <csignal>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <ctime>
-#include <deque>
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <new>
+#include <string>
 #include <thread>
 #include <type_traits>
 #include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <cpuid.h>
+#include <x86intrin.h>
+#define PERF_DURATION_TRACE_HAS_TSC 1
+#else
+#define PERF_DURATION_TRACE_HAS_TSC 0
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define PERF_DURATION_TRACE_HAS_MMAP 1
+#else
+#define PERF_DURATION_TRACE_HAS_MMAP 0
+#endif
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
 #endif
 
 namespace perf_duration_trace {
@@ -29,51 +59,175 @@ struct SiteDesc {
     uint32_t line;
 };
 
+// Per-site sampling control: kSiteOff skips the site, kSiteOn records every span and any
+// larger N records about one span in N (chosen per thread with a cheap PRNG).
+constexpr uint32_t kSiteOff = 0U;
+constexpr uint32_t kSiteOn = 1U;
+
 struct SiteRef {
     uint32_t id;
     SiteDesc site_desc;
+    // Read with one relaxed load in begin(); changed through Runtime::set_site_sampling().
+    mutable std::atomic<uint32_t> control {kSiteOn};
 };
 
+namespace detail {
+
+class SpanStack;
+
+}  // namespace detail
+
 struct Token {
     // Token is an ordinary value type. If it crosses threads, the caller must
     // publish and consume it through synchronization that creates a happens-before edge.
+    // start_ns is in the units of the active clock source (raw ticks in ClockSource::tsc).
     uint64_t start_ns = 0;
+    // Span stack of the thread that opened the span; a token ended on another thread marks
+    // its level closed there instead of touching the ending thread's stack.
+    detail::SpanStack* owner = nullptr;
     uint32_t site_id = 0;
+    // Nesting depth on the starting thread's span stack, and the serial its level was
+    // pushed with, so that a level reused by a later span is not closed by mistake.
+    uint16_t depth = 0;
+    uint16_t serial = 0;
 
     [[nodiscard]] bool valid() const noexcept { return start_ns != 0U; }
 };
 
-struct SampleRecord {
-    uint64_t start_ns = 0;
-    uint64_t duration_ns = 0;
-    uint32_t site_id = 0;
-    uint32_t tid_hash = 0;
-    uint32_t seq_no = 0;
-    uint16_t cpu_hint = 0;
-    uint16_t flags = 0;
-};
-
 struct ExportPaths {
     const char* sample_path = "perf_duration_trace.perfbin";
     const char* site_path = "perf_duration_trace.sites.tsv";
+    // Thread table. nullptr derives it from site_path: "x.sites.tsv" -> "x.threads.tsv".
+    const char* thread_path = nullptr;
+};
+
+enum class SampleWriter : uint8_t {
+    // Buffered stdio appends from an intermediate batch vector.
+    stdio,
+    // The sample file is preallocated and mapped; the export thread drains records straight
+    // into the mapping. Falls back to stdio on platforms without mmap.
+    mmap,
 };
 
 struct AsyncExportConfig {
     ExportPaths paths {};
     uint32_t flush_interval_ms = 100;
+    SampleWriter writer = SampleWriter::stdio;
+    // Growth step of the mapped sample file. Ignored by the stdio writer.
+    size_t mmap_chunk_bytes = size_t {32} << 20U;
+    // POSIX shared-memory name ("/name") that receives a live copy of every exported record
+    // for tools/perf_duration_trace_live. nullptr disables it. Needs a record capture mode
+    // and mmap support; start_async_export() fails otherwise. The segment is created fresh
+    // with mode 0600, replacing a stale one of the same name; the export fails if another
+    // process creates that name first.
+    const char* live_shm_name = nullptr;
+    // Records kept in the live ring (rounded up to a power of two); older ones are overwritten.
+    size_t live_records = size_t {1} << 16U;
+    // Sites with ids above this are published by id only.
+    uint32_t live_sites = 4096;
+    // Rotation (record capture modes): once the current sample file reaches rotate_bytes or
+    // is rotate_interval_ms old, the export thread closes it with its own header counts and
+    // continues in the next one. Files are "<stem>.000000.perfbin", "<stem>.000001.perfbin",
+    // ... where stem is paths.sample_path without ".perfbin"; the site and thread files are
+    // shared and rewritten at every rollover. Limits are checked after each flush, so a file
+    // may overshoot rotate_bytes by one flush. 0 disables either limit.
+    uint64_t rotate_bytes = 0;
+    uint32_t rotate_interval_ms = 0;
+    // Keeps only the newest max_segments files and deletes older ones; 0 keeps all.
+    uint32_t max_segments = 0;
+};
+
+enum class CaptureMode : uint8_t {
+    // Threads hash onto a small set of shared MPMC shards.
+    sharded,
+    // Every producer thread owns a private SPSC ring; capacity_per_shard sizes each ring.
+    thread_ring,
+    // No raw samples: every thread folds durations into per-site log-linear histograms and
+    // exports write a compact histogram file to ExportPaths::sample_path instead of records.
+    histogram,
+    // Every thread owns a fixed ring of the latest capacity_per_shard samples; new samples
+    // overwrite the oldest. Nothing is exported in the background: dump_snapshot() (or an
+    // armed FlightTriggerConfig) copies the rings out without stopping producers.
+    flight_recorder,
+};
+
+enum class ClockSource : uint8_t {
+    // clock_gettime(CLOCK_MONOTONIC_RAW), recorded in nanoseconds.
+    monotonic,
+    // Raw invariant TSC ticks, converted by the analyzer using the calibration stored in
+    // the file header. Falls back to monotonic when the TSC is missing or not invariant.
+    tsc,
+};
+
+enum class SampleFormat : uint8_t {
+    // PDTBIN1: fixed 32-byte SampleRecord array.
+    fixed,
+    // PDTBIN2: per-thread blocks with varint deltas and a site dictionary, see
+    // perf_duration_trace_format.h. Typically 4-6x smaller than fixed.
+    compressed,
+};
+
+enum class CpuHintSource : uint8_t {
+    // cpu_hint stays 0.
+    none,
+    // RDTSCP's TSC_AUX, which Linux loads with the CPU number. Falls back to getcpu when
+    // RDTSCP is unavailable.
+    rdtscp,
+    // sched_getcpu(), served from the vDSO on Linux.
+    getcpu,
 };
 
 struct Config {
     size_t shard_count = 0;
     size_t capacity_per_shard = 4096;
+    CaptureMode capture_mode = CaptureMode::sharded;
+    ClockSource clock_source = ClockSource::monotonic;
+    SampleFormat sample_format = SampleFormat::fixed;
+    CpuHintSource cpu_hint_source = CpuHintSource::none;
+    // The CPU is re-read every this many samples per thread and reused in between.
+    uint32_t cpu_hint_interval = 1;
+    // Records each thread's OS id and name when it first traces and writes them to
+    // ExportPaths::thread_path on export. Off by default: no table, no file.
+    bool thread_table = false;
+    // finalize() keeps about this many bytes of drained samples in memory; further sorted
+    // runs spill to temporary files and are merged back from there.
+    size_t finalize_memory_bytes = size_t {256} << 20U;
+    // Sharded mode only: every thread stages up to this many records and publishes them to
+    // its shard with one reservation. 0 or 1 enqueues each record on its own; larger values
+    // are capped at the shard capacity.
+    uint32_t staging_batch = 0;
+    // A partial batch is published by its thread's next end() once its oldest record is
+    // this old. Exports flush every thread's batch regardless, see Runtime::flush_staging().
+    uint32_t staging_flush_us = 1000;
+};
+
+// Automatic dump_snapshot() calls in flight_recorder mode. Dump n goes to
+// "<path_prefix>.<n>.perfbin" and "<path_prefix>.<n>.sites.tsv".
+struct FlightTriggerConfig {
+    const char* path_prefix = "perf_duration_trace.flight";
+    // A span of this site lasting at least latency_threshold_ns requests a dump.
+    const SiteRef* latency_site = nullptr;
+    uint64_t latency_threshold_ns = 0;
+    // When non-zero, a handler for this signal requests a dump.
+    int signal_number = 0;
+    // Recording continues this long after the trigger, so the dump covers both sides of it.
+    uint32_t post_trigger_ms = 20;
+    // Triggers arriving sooner than this after the previous dump are ignored.
+    uint32_t cooldown_ms = 1000;
+    uint32_t max_dumps = 8;
 };
 
 struct ExportStats {
+    // Records written, including argument records (see kRecordArgument).
     uint64_t exported_samples = 0;
     uint64_t dropped_samples = 0;
+    // Flight recorder only: samples already replaced by newer ones when the snapshot ran.
+    uint64_t overwritten_samples = 0;
     uint64_t registered_sites = 0;
     uint32_t shard_count = 0;
     uint32_t capacity_per_shard = 0;
+    // Async exports: sample files written, more than one only with rotation.
+    uint32_t segments = 0;
     bool success = false;
 };
 
@@ -83,14 +237,38 @@ class Runtime final {
 
     [[nodiscard]] const SiteRef& register_site(const SiteDesc& desc);
 
+    // Sets the sampling control of one site (kSiteOff, kSiteOn or N for 1-in-N).
+    void set_site_sampling(const SiteRef& site, uint32_t every_n) noexcept;
+    // Applies every_n to registered sites whose label or file matches glob ('*' and '?'),
+    // and remembers the rule for sites registered later. Later rules win. Returns the
+    // number of registered sites that matched. The PERF_DURATION_TRACE_SITES environment
+    // variable holds startup rules as "glob=on|off|N[,glob=...]".
+    size_t set_site_sampling(const char* glob, uint32_t every_n);
+
     [[nodiscard]] Token begin(const SiteRef& site) noexcept;
     [[nodiscard]] Token start(const SiteRef& site) noexcept { return begin(site); }
     void end(Token token) noexcept;
+    // Ends the span and attaches one or two numeric values to it (bytes, items, ...); the
+    // analyzer's --args report buckets the span durations by them.
+    void end(Token token, uint64_t arg0) noexcept;
+    void end(Token token, uint64_t arg0, uint64_t arg1) noexcept;
     void stop(Token token) noexcept { end(token); }
+    // Publishes the records every thread has staged (Config::staging_batch) to the shards.
+    // finalize() and the async export thread call it before draining.
+    void flush_staging() noexcept;
 
     [[nodiscard]] bool start_async_export(const AsyncExportConfig& config = AsyncExportConfig()) noexcept;
     [[nodiscard]] ExportStats stop_async_export() noexcept;
     [[nodiscard]] ExportStats finalize(const ExportPaths& paths = ExportPaths()) noexcept;
+    // Flight recorder: writes the current ring contents without consuming them. In the
+    // other capture modes this behaves like finalize().
+    [[nodiscard]] ExportStats dump_snapshot(const ExportPaths& paths = ExportPaths()) noexcept;
+    // Starts the trigger thread; fails outside flight_recorder mode or when already armed.
+    [[nodiscard]] bool arm_flight_trigger(const FlightTriggerConfig& config) noexcept;
+    // Stops the trigger thread, restores the signal handler and returns the dumps written.
+    uint32_t disarm_flight_trigger() noexcept;
+    // Async-signal-safe: only sets a flag that the armed trigger thread polls.
+    static void request_flight_dump() noexcept;
     void reset_for_tests(const Config& config = Config()) noexcept;
     [[nodiscard]] uint64_t now_ns() const noexcept;
 
@@ -116,6 +294,23 @@ class Scope final {
     Token token_;
 };
 
+// Scope that attaches one or two values, fixed at construction, to its span.
+class ArgScope final {
+ public:
+    ArgScope(const SiteRef& site, uint64_t arg0) noexcept;
+    ArgScope(const SiteRef& site, uint64_t arg0, uint64_t arg1) noexcept;
+    ~ArgScope() noexcept;
+
+    ArgScope(const ArgScope&) = delete;
+    ArgScope& operator=(const ArgScope&) = delete;
+    ArgScope& operator=(ArgScope&&) = delete;
+
+ private:
+    Token token_;
+    uint64_t args_[2];
+    uint32_t arg_count_;
+};
+
 namespace detail {
 
 struct StaticSiteSlot;
@@ -131,8 +326,9 @@ struct StaticSiteSlot;
 namespace perf_duration_trace::detail {
 
 static_assert(std::is_trivially_copyable_v<Token>, "Token must remain trivially copyable");
-static_assert(std::is_trivially_copyable_v<SampleRecord>,
-              "SampleRecord must remain trivially copyable");
+static_assert(sizeof(Token) == 24U, "Token must stay three words");
+static_assert(static_cast<uint32_t>(ClockSource::tsc) == kTscClockSource,
+              "ClockSource::tsc must match the file header value the tools read");
 
 enum class AsyncState : uint8_t {
     stopped,
@@ -140,38 +336,150 @@ enum class AsyncState : uint8_t {
     stopping,
 };
 
-constexpr uint32_t kFileFormatVersion = 1U;
-constexpr char kFileMagic[8] = {'P', 'D', 'T', 'B', 'I', 'N', '1', '\0'};
 constexpr uint32_t kDefaultFlushIntervalMs = 100U;
 constexpr size_t kDefaultShardCount = 4U;
 constexpr size_t kMinimumRingCapacity = 64U;
+constexpr size_t kCacheLineSize = 64U;
 constexpr uint64_t kOneSecondInNs = 1000000000ULL;
-
-struct FileHeader {
-    char magic[8];
-    uint32_t version;
-    uint32_t record_size;
-    uint64_t record_count;
-    uint64_t overwritten_samples;
-    uint64_t dropped_samples;
-    uint32_t shard_count;
-    uint32_t capacity_per_shard;
-};
-
-static_assert(std::is_trivially_copyable_v<FileHeader>,
-              "FileHeader must remain trivially copyable for binary serialization");
-static_assert(sizeof(FileHeader) == 48U,
-              "FileHeader size must match Python struct.Struct('<8sIIQQQII') = 48 bytes");
-static_assert(sizeof(SampleRecord) == 32U,
-              "SampleRecord size must match Python struct.Struct('<QQIIIHH') = 32 bytes");
+constexpr uint64_t kTscCalibrationWindowNs = 2000000ULL;
+constexpr int kTscPairAttempts = 8;
+
+// Log-linear buckets: values below 2 * kHistogramSubBucketCount are exact, above that every
+// power of two is split into kHistogramSubBucketCount linear buckets (<= 6.25% wide).
+// Values at or above 2^kHistogramValueBits (~18 minutes) share the top bucket.
+constexpr uint32_t kHistogramSubBucketBits = 4U;
+constexpr uint32_t kHistogramSubBucketCount = 1U << kHistogramSubBucketBits;
+constexpr uint32_t kHistogramValueBits = 40U;
+constexpr uint32_t kHistogramBucketCount =
+    (kHistogramValueBits - kHistogramSubBucketBits + 1U) * kHistogramSubBucketCount;
+constexpr uint32_t kHistogramPageBits = 8U;
+constexpr uint32_t kHistogramPageSize = 1U << kHistogramPageBits;
+constexpr uint32_t kHistogramDirectorySize = 256U;
+constexpr uint32_t kFlightTriggerPollMs = 10U;
+constexpr uint32_t kSiteChunkBits = 9U;
+constexpr uint32_t kSiteChunkSize = 1U << kSiteChunkBits;
+constexpr uint32_t kSiteChunkCount = 4096U;
+constexpr uint32_t kMaxSites = kSiteChunkSize * kSiteChunkCount;
+constexpr const char* kSiteRulesEnv = "PERF_DURATION_TRACE_SITES";
+constexpr size_t kSampleRecordWords = sizeof(SampleRecord) / sizeof(uint64_t);
+constexpr size_t kMergeReadRecords = 4096U;
+constexpr size_t kMergeWriteRecords = 65536U;
+
+static_assert(sizeof(SampleRecord) % sizeof(uint64_t) == 0U, "SampleRecord must be whole words");
+static_assert(std::atomic<bool>::is_always_lock_free, "dump requests must be signal-safe");
+
+// Set by Runtime::request_flight_dump(), possibly from a signal handler.
+inline std::atomic<bool> g_flight_dump_requested {false};
+
+constexpr size_t kThreadNameSize = 64U;
+constexpr size_t kMaxThreadInfos = 4096U;
+
+class ThreadRing;
+class SpanStack;
+class ThreadHistograms;
+class FlightRing;
+class StagingBuffer;
 
 struct ThreadRoute {
     uint64_t generation = 0;
+    uint64_t next_sequence = 0;
+    ThreadRing* ring = nullptr;
+    ThreadHistograms* histograms = nullptr;
+    FlightRing* flight = nullptr;
+    StagingBuffer* staging = nullptr;
+    // Claimed once per thread and kept across generations (see g_span_stack_lease).
+    SpanStack* span_stack = nullptr;
     uint32_t tid_hash = 0;
     uint16_t shard_id = 0;
+    // Number of spans begun and not yet ended on this thread. Each Token remembers its own
+    // depth, so end() unwinds by restoring it; span_stack only tracks which levels were
+    // ended on another thread.
+    uint16_t span_depth = 0;
     bool initialized = false;
+    // xorshift32 state for 1-in-N site sampling; never zero once initialized.
+    uint32_t sample_state = 1;
+    // Cached cpu_hint and the samples left before it is re-read.
+    uint16_t cpu_hint = 0;
+    uint32_t cpu_hint_countdown = 0;
+
+    [[nodiscard]] bool sample_one_in(uint32_t every_n) noexcept {
+        sample_state ^= sample_state << 13U;
+        sample_state ^= sample_state >> 17U;
+        sample_state ^= sample_state << 5U;
+        return sample_state % every_n == 0U;
+    }
+};
+
+struct SiteRule {
+    std::string glob;
+    uint32_t every_n = kSiteOn;
 };
 
+// Shell-style match supporting '*' and '?'; backtracks only to the most recent '*'.
+[[nodiscard]] inline bool glob_match(const char* pattern, const char* text) noexcept {
+    const char* star = nullptr;
+    const char* resume = nullptr;
+    while (*text != '\0') {
+        if (*pattern == '*') {
+            star = pattern++;
+            resume = text;
+        } else if (*pattern == '?' || *pattern == *text) {
+            ++pattern;
+            ++text;
+        } else if (star != nullptr) {
+            pattern = star + 1;
+            text = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (*pattern == '*') {
+        ++pattern;
+    }
+    return *pattern == '\0';
+}
+
+[[nodiscard]] inline bool site_matches(const SiteDesc& desc, const char* glob) noexcept {
+    return (desc.label != nullptr && glob_match(glob, desc.label)) ||
+           (desc.file != nullptr && glob_match(glob, desc.file));
+}
+
+// Parses "glob=on|off|N" rules separated by commas. Malformed rules are skipped.
+[[nodiscard]] inline std::vector<SiteRule> parse_site_rules(const char* spec) {
+    std::vector<SiteRule> rules;
+    if (spec == nullptr) {
+        return rules;
+    }
+    const std::string text(spec);
+    size_t begin = 0U;
+    while (begin <= text.size()) {
+        size_t end = text.find(',', begin);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        const std::string rule = text.substr(begin, end - begin);
+        const size_t equals = rule.rfind('=');
+        if (equals != std::string::npos && equals != 0U) {
+            const std::string value = rule.substr(equals + 1U);
+            SiteRule parsed {rule.substr(0U, equals), kSiteOn};
+            bool valid = true;
+            if (value == "off") {
+                parsed.every_n = kSiteOff;
+            } else if (value != "on") {
+                char* parse_end = nullptr;
+                const unsigned long every_n = std::strtoul(value.c_str(), &parse_end, 10);
+                valid = !value.empty() && *parse_end == '\0' && every_n != 0U && every_n <= UINT32_MAX;
+                parsed.every_n = static_cast<uint32_t>(every_n);
+            }
+            if (valid) {
+                rules.push_back(std::move(parsed));
+            }
+        }
+        begin = end + 1U;
+    }
+    return rules;
+}
+
 struct StaticSiteSlot {
     std::mutex mutex;
     std::atomic<const SiteRef*> site_ref {nullptr};
@@ -200,6 +508,152 @@ inline thread_local ThreadRoute g_thread_route;
     return fallback_now_ns();
 }
 
+struct TscCalibration {
+    uint64_t base_ticks = 0;
+    uint64_t base_ns = 0;
+    double ns_per_tick = 1.0;
+};
+
+[[nodiscard]] inline bool tsc_is_invariant() noexcept {
+#if PERF_DURATION_TRACE_HAS_TSC
+    unsigned int eax = 0U;
+    unsigned int ebx = 0U;
+    unsigned int ecx = 0U;
+    unsigned int edx = 0U;
+    if (__get_cpuid(0x80000000U, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007U) {
+        return false;
+    }
+    if (__get_cpuid(0x80000007U, &eax, &ebx, &ecx, &edx) == 0) {
+        return false;
+    }
+    return (edx & (1U << 8U)) != 0U;
+#else
+    return false;
+#endif
+}
+
+[[nodiscard]] inline uint64_t read_tsc() noexcept {
+#if PERF_DURATION_TRACE_HAS_TSC
+    return static_cast<uint64_t>(__rdtsc());
+#else
+    return 0U;
+#endif
+}
+
+[[nodiscard]] inline bool rdtscp_supported() noexcept {
+#if PERF_DURATION_TRACE_HAS_TSC && defined(__linux__)
+    unsigned int eax = 0U;
+    unsigned int ebx = 0U;
+    unsigned int ecx = 0U;
+    unsigned int edx = 0U;
+    if (__get_cpuid(0x80000000U, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000001U) {
+        return false;
+    }
+    if (__get_cpuid(0x80000001U, &eax, &ebx, &ecx, &edx) == 0) {
+        return false;
+    }
+    return (edx & (1U << 27U)) != 0U;
+#else
+    return false;
+#endif
+}
+
+// Both readers return the CPU number plus one, or 0 when it cannot be determined.
+[[nodiscard]] inline uint16_t read_cpu_rdtscp() noexcept {
+#if PERF_DURATION_TRACE_HAS_TSC && defined(__linux__)
+    unsigned int aux = 0U;
+    (void)__rdtscp(&aux);
+    // Linux stores (node << 12) | cpu in TSC_AUX.
+    return static_cast<uint16_t>((aux & 0xFFFU) + 1U);
+#else
+    return 0U;
+#endif
+}
+
+[[nodiscard]] inline uint16_t read_cpu_getcpu() noexcept {
+#if defined(__linux__)
+    const int cpu = ::sched_getcpu();
+    return cpu >= 0 && cpu < UINT16_MAX ? static_cast<uint16_t>(cpu + 1) : 0U;
+#else
+    return 0U;
+#endif
+}
+
+[[nodiscard]] inline uint64_t current_os_tid() noexcept {
+#if defined(__linux__)
+    return static_cast<uint64_t>(::syscall(SYS_gettid));
+#elif defined(__APPLE__)
+    uint64_t tid = 0U;
+    (void)pthread_threadid_np(nullptr, &tid);
+    return tid;
+#else
+    return 0U;
+#endif
+}
+
+// Copies the calling thread's name, with tabs and newlines replaced so it fits a TSV cell.
+inline void current_thread_name(char (&name)[kThreadNameSize]) noexcept {
+    name[0] = '\0';
+#if PERF_DURATION_TRACE_HAS_MMAP && (defined(__linux__) || defined(__APPLE__))
+    if (pthread_getname_np(pthread_self(), name, sizeof(name)) != 0) {
+        name[0] = '\0';
+    }
+#endif
+    for (char& ch : name) {
+        if (ch == '\0') {
+            break;
+        }
+        if (ch == '\t' || ch == '\n' || ch == '\r') {
+            ch = ' ';
+        }
+    }
+}
+
+// Pairs a TSC read with the monotonic time taken around it. The attempt with the
+// narrowest clock_gettime bracket wins, so the pairing error stays within one clock call.
+inline void sample_tsc_pair(uint64_t& ticks, uint64_t& ns) noexcept {
+    uint64_t best_window = UINT64_MAX;
+    for (int attempt = 0; attempt < kTscPairAttempts; ++attempt) {
+        const auto before = monotonic_now_ns();
+        const auto current_ticks = read_tsc();
+        const auto after = monotonic_now_ns();
+        if (after - before < best_window) {
+            best_window = after - before;
+            ticks = current_ticks;
+            ns = before + (after - before) / 2U;
+        }
+    }
+}
+
+[[nodiscard]] inline TscCalibration calibrate_tsc() noexcept {
+    TscCalibration calibration;
+    sample_tsc_pair(calibration.base_ticks, calibration.base_ns);
+    uint64_t ticks = 0U;
+    uint64_t ns = 0U;
+    do {
+        sample_tsc_pair(ticks, ns);
+    } while (ns - calibration.base_ns < kTscCalibrationWindowNs);
+    if (ticks > calibration.base_ticks) {
+        calibration.ns_per_tick =
+            static_cast<double>(ns - calibration.base_ns) / static_cast<double>(ticks - calibration.base_ticks);
+    }
+    return calibration;
+}
+
+// Re-measures the slope against the startup base point. The longer baseline available at
+// export time makes the rate far more precise than the short startup window.
+[[nodiscard]] inline TscCalibration refine_tsc_calibration(const TscCalibration& startup) noexcept {
+    TscCalibration calibration = startup;
+    uint64_t ticks = 0U;
+    uint64_t ns = 0U;
+    sample_tsc_pair(ticks, ns);
+    if (ns - startup.base_ns >= kTscCalibrationWindowNs && ticks > startup.base_ticks) {
+        calibration.ns_per_tick =
+            static_cast<double>(ns - startup.base_ns) / static_cast<double>(ticks - startup.base_ticks);
+    }
+    return calibration;
+}
+
 [[nodiscard]] inline uint32_t hash_current_thread() noexcept {
     const auto hashed = static_cast<uint64_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()));
     return static_cast<uint32_t>(hashed ^ (hashed >> 32U));
@@ -230,6 +684,17 @@ inline thread_local ThreadRoute g_thread_route;
     return normalize_power_of_two(capacity, kMinimumRingCapacity);
 }
 
+[[nodiscard]] inline uint32_t histogram_bucket_index(uint64_t value) noexcept {
+    if ((value >> kHistogramValueBits) != 0U) {
+        return kHistogramBucketCount - 1U;
+    }
+    return log_linear_bucket_index(value, kHistogramSubBucketBits);
+}
+
+[[nodiscard]] inline uint64_t histogram_bucket_lower_bound(uint32_t index) noexcept {
+    return log_linear_bucket_bounds(index, kHistogramSubBucketBits).lower;
+}
+
 [[nodiscard]] inline bool sample_less(const SampleRecord& lhs, const SampleRecord& rhs) noexcept {
     if (lhs.start_ns != rhs.start_ns) {
         return lhs.start_ns < rhs.start_ns;
@@ -237,7 +702,13 @@ inline thread_local ThreadRoute g_thread_route;
     if (lhs.site_id != rhs.site_id) {
         return lhs.site_id < rhs.site_id;
     }
-    return lhs.seq_no < rhs.seq_no;
+    if (lhs.tid_hash != rhs.tid_hash) {
+        return lhs.tid_hash < rhs.tid_hash;
+    }
+    if (lhs.seq_no != rhs.seq_no) {
+        return lhs.seq_no < rhs.seq_no;
+    }
+    return record_kind_less(lhs, rhs);
 }
 
 struct Slot {
@@ -279,6 +750,42 @@ class Shard final {
         }
     }
 
+    // Reserves count consecutive slots with a single CAS and fills them in order. Enqueues
+    // nothing and returns false when fewer than count slots are free; the caller then falls
+    // back to enqueue(). count must not exceed the capacity.
+    [[nodiscard]] bool enqueue_batch(const SampleRecord* records, size_t count) noexcept {
+        auto position = enqueue_position_.load(std::memory_order_relaxed);
+        for (;;) {
+            const auto first = slots_[position & mask_].sequence.load(std::memory_order_acquire);
+            const auto last_position = position + static_cast<uint64_t>(count) - 1U;
+            const auto last = slots_[last_position & mask_].sequence.load(std::memory_order_acquire);
+            if (first == position && last == last_position) {
+                if (enqueue_position_.compare_exchange_weak(
+                        position, position + static_cast<uint64_t>(count), std::memory_order_relaxed)) {
+                    break;
+                }
+                continue;
+            }
+            if (static_cast<int64_t>(first) - static_cast<int64_t>(position) < 0 ||
+                static_cast<int64_t>(last) - static_cast<int64_t>(last_position) < 0) {
+                return false;
+            }
+            position = enqueue_position_.load(std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            const auto slot_position = position + static_cast<uint64_t>(i);
+            Slot& slot = slots_[slot_position & mask_];
+            // The last slot being free means consumers have claimed every slot before it, but
+            // one of them may still be copying its record out; that takes only a few stores.
+            while (slot.sequence.load(std::memory_order_acquire) != slot_position) {
+                std::this_thread::yield();
+            }
+            slot.record = records[i];
+            slot.sequence.store(slot_position + 1U, std::memory_order_release);
+        }
+        return true;
+    }
+
     [[nodiscard]] bool dequeue(SampleRecord& record) noexcept {
         auto position = dequeue_position_.load(std::memory_order_relaxed);
         for (;;) {
@@ -316,159 +823,1435 @@ class Shard final {
     std::atomic<uint64_t> dropped_samples_ {0};
 };
 
-class RuntimeState final {
+// Per-thread batch in front of a shard (Config::staging_batch). The owner appends with
+// plain stores and publishes the batch with one Shard::enqueue_batch() when it is full or
+// old. flush() lets an exporter publish what another thread has staged so far: it takes
+// the buffer lock, publishes up to the count the owner last released and remembers that
+// point, so nothing is enqueued twice. The owner rewrites slots only after restarting the
+// batch under the same lock, and exporters never read past the released count.
+class StagingBuffer final {
  public:
-    RuntimeState() { reconfigure(Config{}); }
-
-    RuntimeState(const RuntimeState&) = delete;
-    RuntimeState& operator=(const RuntimeState&) = delete;
+    explicit StagingBuffer(size_t batch) : batch_(batch), records_(new SampleRecord[batch]) {}
 
-    [[nodiscard]] const SiteRef& register_site(const SiteDesc& desc) {
-        std::lock_guard<std::mutex> lock(site_mutex_);
-        sites_.push_back(SiteRef{next_site_id_++, desc});
-        return sites_.back();
+    [[nodiscard]] bool try_claim() noexcept {
+        bool expected = false;
+        return in_use_.compare_exchange_strong(expected, true, std::memory_order_acquire,
+                                               std::memory_order_relaxed);
     }
 
-    [[nodiscard]] Token begin(const SiteRef& site) noexcept {
-        return Token{monotonic_now_ns(), site.id};
-    }
+    void release() noexcept { in_use_.store(false, std::memory_order_release); }
 
-    void end(Token token) noexcept {
-        if (!token.valid()) {
-            return;
+    // Called by a new owner while the buffer is empty.
+    void bind(Shard* shard) noexcept { shard_.store(shard, std::memory_order_relaxed); }
+
+    // Owner only. now and max_age are in capture clock units.
+    void append(const SampleRecord& record, uint64_t now, uint64_t max_age) noexcept {
+        const auto count = count_.load(std::memory_order_relaxed);
+        if (count == 0U) {
+            first_staged_ = now;
         }
+        records_[count] = record;
+        count_.store(count + 1U, std::memory_order_release);
+        if (count + 1U == batch_ || now - first_staged_ >= max_age) {
+            publish();
+        }
+    }
 
-        const auto end_ns = monotonic_now_ns();
-        const auto duration_ns = end_ns >= token.start_ns ? (end_ns - token.start_ns) : 0U;
-        ThreadRoute& route = route_for_current_thread();
-        const auto shard_index = static_cast<size_t>(route.shard_id);
-        SampleRecord record {
-            token.start_ns,
-            duration_ns,
-            token.site_id,
-            route.tid_hash,
-            next_sequence_.fetch_add(1U, std::memory_order_relaxed),
-            0U,
-            0U,
-        };
-        (void)shards_[shard_index]->enqueue(record);
+    // Owner only: publishes the rest of the batch and starts a new one.
+    void publish() noexcept {
+        lock();
+        publish_locked(count_.load(std::memory_order_relaxed));
+        published_ = 0U;
+        count_.store(0U, std::memory_order_relaxed);
+        unlock();
     }
 
-    [[nodiscard]] bool start_async_export(const AsyncExportConfig& config) noexcept {
-        std::lock_guard<std::mutex> lock(async_mutex_);
-        if (async_state_ != AsyncState::stopped) {
-            return false;
-        }
+    // Any thread: publishes what the owner has staged so far.
+    void flush() noexcept {
+        lock();
+        const auto count = count_.load(std::memory_order_acquire);
+        publish_locked(count);
+        published_ = count;
+        unlock();
+    }
 
-        async_last_stats_ = make_base_stats();
-        async_last_stats_ready_ = false;
+    [[nodiscard]] StagingBuffer* next() const noexcept { return next_; }
+    void set_next(StagingBuffer* next) noexcept { next_ = next; }
 
-        AsyncExportConfig normalized = config;
-        if (normalized.flush_interval_ms == 0U) {
-            normalized.flush_interval_ms = kDefaultFlushIntervalMs;
+ private:
+    void lock() noexcept {
+        while (locked_.exchange(true, std::memory_order_acquire)) {
+            std::this_thread::yield();
         }
+    }
 
-        async_sample_file_ = std::fopen(normalized.paths.sample_path, "wb+");
-        if (async_sample_file_ == nullptr) {
-            return false;
-        }
+    void unlock() noexcept { locked_.store(false, std::memory_order_release); }
 
-        const FileHeader header = make_header(0U, 0U);
-        if (std::fwrite(&header, sizeof(header), 1U, async_sample_file_) != 1U ||
-            std::fflush(async_sample_file_) != 0) {
-            std::fclose(async_sample_file_);
-            async_sample_file_ = nullptr;
-            return false;
+    void publish_locked(size_t count) noexcept {
+        if (count <= published_) {
+            return;
         }
-
-        async_config_ = normalized;
-        async_exported_samples_ = 0U;
-        async_dropped_samples_ = 0U;
-        async_write_failed_ = false;
-        async_stop_requested_ = false;
-        async_last_stats_ready_ = false;
-        async_state_ = AsyncState::running;
-
-        try {
-            async_thread_ = std::thread([this]() { async_worker(); });
-        } catch (...) {
-            std::fclose(async_sample_file_);
-            async_sample_file_ = nullptr;
-            async_state_ = AsyncState::stopped;
-            return false;
+        Shard* shard = shard_.load(std::memory_order_relaxed);
+        const SampleRecord* first = &records_[published_];
+        const size_t pending = count - published_;
+        if (!shard->enqueue_batch(first, pending)) {
+            // Not enough room for the whole batch: enqueue() takes what fits and counts the
+            // rest as dropped.
+            for (size_t i = 0; i < pending; ++i) {
+                (void)shard->enqueue(first[i]);
+            }
         }
-        return true;
     }
 
-    [[nodiscard]] ExportStats stop_async_export() noexcept {
-        std::thread worker;
-        {
-            std::unique_lock<std::mutex> lock(async_mutex_);
-            const StopAsyncAction action = prepare_stop_async_locked(worker);
-            if (action == StopAsyncAction::return_last_stats) {
-                return async_last_stats_;
-            }
-            if (action == StopAsyncAction::wait_for_completion) {
-                async_cv_.wait(lock, [this]() { return async_state_ == AsyncState::stopped; });
-                return async_last_stats_;
-            }
-        }
+    // Owner line; exporters touch it only inside flush().
+    alignas(kCacheLineSize) std::atomic<size_t> count_ {0U};
+    std::atomic<bool> locked_ {false};
+    size_t published_ = 0U;
+    uint64_t first_staged_ = 0U;
+
+    // Read-mostly state.
+    alignas(kCacheLineSize) std::atomic<bool> in_use_ {false};
+    std::atomic<Shard*> shard_ {nullptr};
+    const size_t batch_;
+    std::unique_ptr<SampleRecord[]> records_;
+    StagingBuffer* next_ = nullptr;
+};
 
-        return finish_stop_async(std::move(worker));
+// Single-producer ring owned by one thread at a time. The producer and consumer indices
+// live on separate cache lines so a thread recording samples never shares a written line
+// with another producer. Ownership moves between threads through in_use_: a thread
+// releases its ring on exit and a later thread may claim it, records already queued stay
+// valid because every record carries its own tid_hash.
+class ThreadRing final {
+ public:
+    explicit ThreadRing(size_t requested_capacity)
+        : capacity_(normalize_capacity(requested_capacity)),
+          mask_(capacity_ - 1U),
+          records_(new SampleRecord[capacity_]) {}
+
+    [[nodiscard]] bool try_claim() noexcept {
+        bool expected = false;
+        return in_use_.compare_exchange_strong(expected, true, std::memory_order_acquire,
+                                               std::memory_order_relaxed);
     }
 
-    [[nodiscard]] ExportStats finalize(const ExportPaths& paths) noexcept {
-        std::thread worker;
-        {
-            std::unique_lock<std::mutex> lock(async_mutex_);
-            const StopAsyncAction action = prepare_stop_async_locked(worker);
-            if (action == StopAsyncAction::return_last_stats && async_last_stats_ready_) {
-                return async_last_stats_;
-            }
-            if (action == StopAsyncAction::wait_for_completion) {
-                async_cv_.wait(lock, [this]() { return async_state_ == AsyncState::stopped; });
-                return async_last_stats_;
+    void release() noexcept { in_use_.store(false, std::memory_order_release); }
+
+    [[nodiscard]] bool push(const SampleRecord& record) noexcept {
+        const auto head = head_.load(std::memory_order_relaxed);
+        if (head - cached_tail_ >= static_cast<uint64_t>(capacity_)) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head - cached_tail_ >= static_cast<uint64_t>(capacity_)) {
+                // Only the owning thread writes the counter, so no read-modify-write is needed.
+                dropped_samples_.store(dropped_samples_.load(std::memory_order_relaxed) + 1U,
+                                       std::memory_order_relaxed);
+                return false;
             }
         }
+        records_[head & mask_] = record;
+        head_.store(head + 1U, std::memory_order_release);
+        return true;
+    }
 
-        if (worker.joinable()) {
-            return finish_stop_async(std::move(worker));
+    template <typename Sink>
+    void drain(Sink&& sink) noexcept {
+        const auto tail = tail_.load(std::memory_order_relaxed);
+        const auto head = head_.load(std::memory_order_acquire);
+        for (auto position = tail; position != head; ++position) {
+            sink(records_[position & mask_]);
         }
+        tail_.store(head, std::memory_order_release);
+    }
 
-        ExportStats stats = make_base_stats();
-        std::vector<SampleRecord> merged;
-        uint64_t dropped = 0U;
-        drain_shards(merged, dropped);
-        std::sort(merged.begin(), merged.end(), sample_less);
+    [[nodiscard]] uint64_t take_dropped_samples() noexcept {
+        const auto total = dropped_samples_.load(std::memory_order_relaxed);
+        const auto taken = total - dropped_taken_;
+        dropped_taken_ = total;
+        return taken;
+    }
 
-        FILE* sample_file = std::fopen(paths.sample_path, "wb");
-        if (sample_file == nullptr) {
-            return stats;
-        }
+    [[nodiscard]] size_t capacity() const noexcept { return capacity_; }
+    [[nodiscard]] ThreadRing* next() const noexcept { return next_; }
+    void set_next(ThreadRing* next) noexcept { next_ = next; }
 
-        const FileHeader header = make_header(static_cast<uint64_t>(merged.size()), dropped);
-        const bool header_ok = std::fwrite(&header, sizeof(header), 1U, sample_file) == 1U;
-        const bool records_ok = merged.empty() ||
-                                (std::fwrite(merged.data(), sizeof(SampleRecord), merged.size(), sample_file) ==
-                                 merged.size());
-        const bool flush_ok = std::fflush(sample_file) == 0;
-        std::fclose(sample_file);
-        if (!(header_ok && records_ok && flush_ok)) {
-            return stats;
-        }
+ private:
+    // Producer-owned line.
+    alignas(kCacheLineSize) std::atomic<uint64_t> head_ {0};
+    uint64_t cached_tail_ = 0;
+    std::atomic<uint64_t> dropped_samples_ {0};
 
-        if (!write_site_file(paths.site_path)) {
-            return stats;
-        }
+    // Consumer-owned line.
+    alignas(kCacheLineSize) std::atomic<uint64_t> tail_ {0};
+    uint64_t dropped_taken_ = 0;
 
-        stats.exported_samples = static_cast<uint64_t>(merged.size());
-        stats.dropped_samples = dropped;
-        stats.success = true;
-        return stats;
-    }
+    // Read-mostly state.
+    alignas(kCacheLineSize) std::atomic<bool> in_use_ {false};
+    const size_t capacity_;
+    const size_t mask_;
+    std::unique_ptr<SampleRecord[]> records_;
+    ThreadRing* next_ = nullptr;
+};
+
+// Overwrite-oldest ring for one producer thread. Each slot is a small seqlock: the producer
+// marks the slot odd while writing it and publishes the even value for its position when
+// done, so snapshot() can copy the ring while the owner keeps recording and simply skips
+// slots that were being rewritten. The record lives in atomic words so that the racy read
+// is well-defined; relaxed word stores compile to plain moves.
+class FlightRing final {
+ public:
+    explicit FlightRing(size_t requested_capacity)
+        : capacity_(normalize_capacity(requested_capacity)),
+          mask_(capacity_ - 1U),
+          slots_(new FlightSlot[capacity_]) {}
+
+    [[nodiscard]] bool try_claim() noexcept {
+        bool expected = false;
+        return in_use_.compare_exchange_strong(expected, true, std::memory_order_acquire,
+                                               std::memory_order_relaxed);
+    }
+
+    void release() noexcept { in_use_.store(false, std::memory_order_release); }
+
+    void push(const SampleRecord& record) noexcept {
+        const auto position = head_.load(std::memory_order_relaxed);
+        FlightSlot& slot = slots_[position & mask_];
+        uint64_t words[kSampleRecordWords];
+        std::memcpy(words, &record, sizeof(words));
+        slot.sequence.store(2U * position + 1U, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0U; i < kSampleRecordWords; ++i) {
+            slot.words[i].store(words[i], std::memory_order_relaxed);
+        }
+        slot.sequence.store(2U * position + 2U, std::memory_order_release);
+        head_.store(position + 1U, std::memory_order_release);
+    }
+
+    // Passes every intact record still in the ring to sink, oldest first, and returns how
+    // many samples this ring has lost to overwriting (including slots torn by the copy).
+    template <typename Sink>
+    [[nodiscard]] uint64_t snapshot(Sink&& sink) const noexcept {
+        const auto head = head_.load(std::memory_order_acquire);
+        const auto first = head > capacity_ ? head - capacity_ : 0U;
+        uint64_t overwritten = first;
+        for (auto position = first; position != head; ++position) {
+            const FlightSlot& slot = slots_[position & mask_];
+            const auto expected = 2U * position + 2U;
+            if (slot.sequence.load(std::memory_order_acquire) != expected) {
+                ++overwritten;
+                continue;
+            }
+            uint64_t words[kSampleRecordWords];
+            for (size_t i = 0U; i < kSampleRecordWords; ++i) {
+                words[i] = slot.words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) != expected) {
+                ++overwritten;
+                continue;
+            }
+            SampleRecord record {};
+            std::memcpy(&record, words, sizeof(record));
+            sink(record);
+        }
+        return overwritten;
+    }
+
+    [[nodiscard]] FlightRing* next() const noexcept { return next_; }
+    void set_next(FlightRing* next) noexcept { next_ = next; }
+
+ private:
+    struct FlightSlot {
+        std::atomic<uint64_t> sequence {0U};
+        std::atomic<uint64_t> words[kSampleRecordWords] {};
+    };
+
+    alignas(kCacheLineSize) std::atomic<uint64_t> head_ {0};
+    alignas(kCacheLineSize) std::atomic<bool> in_use_ {false};
+    const size_t capacity_;
+    const size_t mask_;
+    std::unique_ptr<FlightSlot[]> slots_;
+    FlightRing* next_ = nullptr;
+};
+
+// Adds to a counter that only one thread writes; a plain load/store pair is enough and
+// avoids a locked read-modify-write on the hot path.
+inline void add_single_writer(std::atomic<uint64_t>& counter, uint64_t delta) noexcept {
+    counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+struct SiteHistogram {
+    std::atomic<uint64_t> count {0U};
+    std::atomic<uint64_t> sum_ns {0U};
+    std::atomic<uint64_t> min_ns {UINT64_MAX};
+    std::atomic<uint64_t> max_ns {0U};
+    std::atomic<uint64_t> buckets[kHistogramBucketCount] {};
+
+    void record(uint64_t duration_ns) noexcept {
+        add_single_writer(count, 1U);
+        add_single_writer(sum_ns, duration_ns);
+        if (duration_ns < min_ns.load(std::memory_order_relaxed)) {
+            min_ns.store(duration_ns, std::memory_order_relaxed);
+        }
+        if (duration_ns > max_ns.load(std::memory_order_relaxed)) {
+            max_ns.store(duration_ns, std::memory_order_relaxed);
+        }
+        add_single_writer(buckets[histogram_bucket_index(duration_ns)], 1U);
+    }
+};
+
+// Per-thread histogram table indexed by site id through a two-level directory. Pages and
+// site histograms are allocated on a thread's first hit of a site and never afterwards, so
+// the steady state is allocation-free. Only the owning thread writes; exporters read the
+// counters concurrently with relaxed loads.
+class ThreadHistograms final {
+ public:
+    ThreadHistograms() = default;
+    ThreadHistograms(const ThreadHistograms&) = delete;
+    ThreadHistograms& operator=(const ThreadHistograms&) = delete;
+
+    ~ThreadHistograms() {
+        for (auto& page_slot : pages_) {
+            HistogramPage* page = page_slot.load(std::memory_order_relaxed);
+            if (page == nullptr) {
+                continue;
+            }
+            for (auto& site_slot : page->sites) {
+                delete site_slot.load(std::memory_order_relaxed);
+            }
+            delete page;
+        }
+    }
+
+    void record(uint32_t site_id, uint64_t duration_ns) noexcept {
+        SiteHistogram* histogram = site_histogram(site_id);
+        if (histogram == nullptr) {
+            add_single_writer(dropped_samples_, 1U);
+            return;
+        }
+        histogram->record(duration_ns);
+    }
+
+    template <typename Fn>
+    void for_each_site(Fn&& fn) const noexcept {
+        for (uint32_t page_index = 0U; page_index < kHistogramDirectorySize; ++page_index) {
+            const HistogramPage* page = pages_[page_index].load(std::memory_order_acquire);
+            if (page == nullptr) {
+                continue;
+            }
+            for (uint32_t offset = 0U; offset < kHistogramPageSize; ++offset) {
+                const SiteHistogram* histogram = page->sites[offset].load(std::memory_order_acquire);
+                if (histogram != nullptr) {
+                    fn((page_index << kHistogramPageBits) | offset, *histogram);
+                }
+            }
+        }
+    }
+
+    [[nodiscard]] uint64_t dropped_samples() const noexcept {
+        return dropped_samples_.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool try_claim() noexcept {
+        bool expected = false;
+        return in_use_.compare_exchange_strong(expected, true, std::memory_order_acquire,
+                                               std::memory_order_relaxed);
+    }
+
+    void release() noexcept { in_use_.store(false, std::memory_order_release); }
+    [[nodiscard]] ThreadHistograms* next() const noexcept { return next_; }
+    void set_next(ThreadHistograms* next) noexcept { next_ = next; }
+
+ private:
+    struct HistogramPage {
+        std::atomic<SiteHistogram*> sites[kHistogramPageSize] {};
+    };
+
+    [[nodiscard]] SiteHistogram* site_histogram(uint32_t site_id) noexcept {
+        const uint32_t page_index = site_id >> kHistogramPageBits;
+        if (page_index >= kHistogramDirectorySize) {
+            return nullptr;
+        }
+        HistogramPage* page = pages_[page_index].load(std::memory_order_relaxed);
+        if (page == nullptr) {
+            page = new (std::nothrow) HistogramPage;
+            if (page == nullptr) {
+                return nullptr;
+            }
+            pages_[page_index].store(page, std::memory_order_release);
+        }
+        auto& slot = page->sites[site_id & (kHistogramPageSize - 1U)];
+        SiteHistogram* histogram = slot.load(std::memory_order_relaxed);
+        if (histogram == nullptr) {
+            histogram = new (std::nothrow) SiteHistogram;
+            if (histogram == nullptr) {
+                return nullptr;
+            }
+            slot.store(histogram, std::memory_order_release);
+        }
+        return histogram;
+    }
+
+    std::atomic<HistogramPage*> pages_[kHistogramDirectorySize] {};
+    std::atomic<uint64_t> dropped_samples_ {0U};
+    std::atomic<bool> in_use_ {false};
+    ThreadHistograms* next_ = nullptr;
+};
+
+// Levels of one thread's span stack. The owner stores each level's serial when it pushes a
+// span there; a thread that ends the span elsewhere sets the level's closed bit, and the
+// owner pops closed levels off the top on its next begin() or end(). Depths past the
+// exported limit are not tracked. Stacks outlive their threads so that a late token never
+// points at freed memory.
+class SpanStack final {
+ public:
+    static constexpr uint16_t kLevels = kRecordDepthMask + 1U;
+
+    // Owner only. Returns the serial the caller stores in its Token.
+    [[nodiscard]] uint16_t push(uint16_t depth) noexcept {
+        const auto serial = static_cast<uint16_t>(++next_serial_);
+        if (depth < kLevels) {
+            levels_[depth].store(static_cast<uint32_t>(serial) << 1U, std::memory_order_relaxed);
+        }
+        return serial;
+    }
+
+    // Owner only: whether the span is still open at its level.
+    [[nodiscard]] bool holds(uint16_t depth, uint16_t serial) const noexcept {
+        return depth >= kLevels ||
+               levels_[depth].load(std::memory_order_relaxed) == (static_cast<uint32_t>(serial) << 1U);
+    }
+
+    // Owner only: the depth left after popping every closed span off the top.
+    [[nodiscard]] uint16_t unwind_closed(uint16_t depth) const noexcept {
+        while (depth != 0U && depth <= kLevels &&
+               (levels_[depth - 1U].load(std::memory_order_relaxed) & 1U) != 0U) {
+            --depth;
+        }
+        return depth;
+    }
+
+    // Any thread. A level the owner has already reused keeps its new serial.
+    void close(uint16_t depth, uint16_t serial) noexcept {
+        if (depth >= kLevels) {
+            return;
+        }
+        uint32_t expected = static_cast<uint32_t>(serial) << 1U;
+        (void)levels_[depth].compare_exchange_strong(expected, expected | 1U, std::memory_order_relaxed,
+                                                     std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool try_claim() noexcept {
+        bool expected = false;
+        return in_use_.compare_exchange_strong(expected, true, std::memory_order_acquire,
+                                               std::memory_order_relaxed);
+    }
+
+    void release() noexcept { in_use_.store(false, std::memory_order_release); }
+    [[nodiscard]] SpanStack* next() const noexcept { return next_; }
+    void set_next(SpanStack* next) noexcept { next_ = next; }
+
+ private:
+    std::atomic<uint32_t> levels_[kLevels] {};
+    uint32_t next_serial_ = 0U;
+    std::atomic<bool> in_use_ {false};
+    SpanStack* next_ = nullptr;
+};
+
+// Returns the calling thread's capture resources to the registry when the thread exits.
+struct ThreadLease {
+    ThreadLease() = default;
+    ThreadLease(const ThreadLease&) = delete;
+    ThreadLease& operator=(const ThreadLease&) = delete;
+    ~ThreadLease();
+
+    uint64_t generation = 0;
+    ThreadRing* ring = nullptr;
+    ThreadHistograms* histograms = nullptr;
+    FlightRing* flight = nullptr;
+    StagingBuffer* staging = nullptr;
+};
+
+inline thread_local ThreadLease g_thread_lease;
+
+// The span stack is not tied to a generation, so it has a lease of its own.
+struct SpanStackLease {
+    SpanStackLease() = default;
+    SpanStackLease(const SpanStackLease&) = delete;
+    SpanStackLease& operator=(const SpanStackLease&) = delete;
+    ~SpanStackLease() {
+        if (stack != nullptr) {
+            stack->release();
+        }
+    }
+
+    SpanStack* stack = nullptr;
+};
+
+inline thread_local SpanStackLease g_span_stack_lease;
+
+// Lock-free, append-only registry of per-thread resources (rings, histogram tables,
+// flight recorder rings, span stacks).
+// A resource is claimed by one thread at a time; entries released by exited threads are
+// claimed again before anything new is allocated. Entries are only freed by clear(), which
+// the runtime calls while reconfiguring.
+template <typename Resource>
+class ThreadResourceList final {
+ public:
+    ThreadResourceList() = default;
+    ThreadResourceList(const ThreadResourceList&) = delete;
+    ThreadResourceList& operator=(const ThreadResourceList&) = delete;
+    ~ThreadResourceList() { clear(); }
+
+    template <typename Factory>
+    [[nodiscard]] Resource* acquire(Factory&& make) noexcept {
+        for (Resource* candidate = head_.load(std::memory_order_acquire); candidate != nullptr;
+             candidate = candidate->next()) {
+            if (candidate->try_claim()) {
+                return candidate;
+            }
+        }
+
+        Resource* resource = make();
+        if (resource == nullptr) {
+            return nullptr;
+        }
+        (void)resource->try_claim();
+        Resource* head = head_.load(std::memory_order_relaxed);
+        do {
+            resource->set_next(head);
+        } while (!head_.compare_exchange_weak(head, resource, std::memory_order_release,
+                                              std::memory_order_relaxed));
+        count_.fetch_add(1U, std::memory_order_relaxed);
+        return resource;
+    }
+
+    template <typename Fn>
+    void for_each(Fn&& fn) const noexcept {
+        for (Resource* resource = head_.load(std::memory_order_acquire); resource != nullptr;
+             resource = resource->next()) {
+            fn(*resource);
+        }
+    }
+
+    void clear() noexcept {
+        Resource* resource = head_.exchange(nullptr, std::memory_order_acq_rel);
+        while (resource != nullptr) {
+            Resource* next = resource->next();
+            delete resource;
+            resource = next;
+        }
+        count_.store(0U, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] uint32_t size() const noexcept { return count_.load(std::memory_order_relaxed); }
+
+ private:
+    std::atomic<Resource*> head_ {nullptr};
+    std::atomic<uint32_t> count_ {0U};
+};
+
+#if PERF_DURATION_TRACE_HAS_MMAP
+// Append-only .perfbin writer backed by a shared file mapping. Space is reserved in whole
+// chunks (fallocate where available) so appends are plain stores into page cache; close()
+// trims the file back to the bytes actually written. Owned by the async export thread.
+class MappedSampleFile final {
+ public:
+    MappedSampleFile() = default;
+    MappedSampleFile(const MappedSampleFile&) = delete;
+    MappedSampleFile& operator=(const MappedSampleFile&) = delete;
+    ~MappedSampleFile() { (void)close(); }
+
+    [[nodiscard]] bool open(const char* path, const FileHeader& header, size_t chunk_bytes) noexcept {
+        fd_ = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) {
+            return false;
+        }
+        chunk_bytes_ = std::max(chunk_bytes, sizeof(FileHeader));
+        if (!grow(sizeof(FileHeader))) {
+            (void)close();
+            return false;
+        }
+        ::new (static_cast<void*>(base_)) FileHeader(header);
+        size_ = sizeof(FileHeader);
+        return true;
+    }
+
+    [[nodiscard]] bool is_open() const noexcept { return fd_ >= 0; }
+
+    [[nodiscard]] bool append(const SampleRecord& record) noexcept {
+        if (size_ + sizeof(SampleRecord) > capacity_ && !grow(sizeof(SampleRecord))) {
+            return false;
+        }
+        ::new (static_cast<void*>(base_ + size_)) SampleRecord(record);
+        size_ += sizeof(SampleRecord);
+        return true;
+    }
+
+    [[nodiscard]] bool append_bytes(const void* data, size_t size) noexcept {
+        if (size_ + size > capacity_ && !grow(size)) {
+            return false;
+        }
+        if (size != 0U) {
+            std::memcpy(base_ + size_, data, size);
+        }
+        size_ += size;
+        return true;
+    }
+
+    [[nodiscard]] FileHeader& header() noexcept { return *std::launder(reinterpret_cast<FileHeader*>(base_)); }
+
+    [[nodiscard]] SampleRecord* records() noexcept {
+        return std::launder(reinterpret_cast<SampleRecord*>(base_ + sizeof(FileHeader)));
+    }
+
+    [[nodiscard]] size_t record_count() const noexcept {
+        return size_ < sizeof(FileHeader) ? 0U : (size_ - sizeof(FileHeader)) / sizeof(SampleRecord);
+    }
+
+    bool close() noexcept {
+        if (fd_ < 0) {
+            return false;
+        }
+        bool ok = true;
+        if (base_ != nullptr) {
+            ok = ::munmap(base_, capacity_) == 0;
+        }
+        ok = ::ftruncate(fd_, static_cast<off_t>(size_)) == 0 && ok;
+        ok = ::close(fd_) == 0 && ok;
+        fd_ = -1;
+        base_ = nullptr;
+        capacity_ = 0U;
+        size_ = 0U;
+        return ok;
+    }
+
+ private:
+    [[nodiscard]] bool grow(size_t required) noexcept {
+        const size_t next_capacity = std::max(capacity_ + chunk_bytes_, size_ + required);
+#if defined(__linux__)
+        if (::posix_fallocate(fd_, static_cast<off_t>(capacity_), static_cast<off_t>(next_capacity - capacity_)) !=
+            0) {
+            return false;
+        }
+#else
+        if (::ftruncate(fd_, static_cast<off_t>(next_capacity)) != 0) {
+            return false;
+        }
+#endif
+        // Remapping the whole file keeps the code portable; growth is rare with large chunks.
+        if (base_ != nullptr && ::munmap(base_, capacity_) != 0) {
+            return false;
+        }
+        base_ = nullptr;
+        void* mapped = ::mmap(nullptr, next_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (mapped == MAP_FAILED) {
+            capacity_ = 0U;
+            return false;
+        }
+        base_ = static_cast<unsigned char*>(mapped);
+        capacity_ = next_capacity;
+        return true;
+    }
+
+    int fd_ = -1;
+    unsigned char* base_ = nullptr;
+    size_t capacity_ = 0U;
+    size_t size_ = 0U;
+    size_t chunk_bytes_ = 0U;
+};
+
+// Writer of the live shared-memory segment (layout in perf_duration_trace_live.h). Owned by
+// the async export thread, which publishes every drained record and the site table each
+// pass. Readers map the segment read-only, so nothing they do can stall or corrupt it.
+class LiveSegment final {
+ public:
+    LiveSegment() = default;
+    LiveSegment(const LiveSegment&) = delete;
+    LiveSegment& operator=(const LiveSegment&) = delete;
+    ~LiveSegment() { close(); }
+
+    [[nodiscard]] bool open(const char* name, size_t records, uint32_t sites, ClockSource clock,
+                            double ns_per_tick) noexcept {
+        close();
+        const size_t capacity = normalize_capacity(records);
+        if (capacity > UINT32_MAX) {
+            return false;
+        }
+        const auto record_capacity = static_cast<uint32_t>(capacity);
+        const size_t size = live_segment_size(record_capacity, sites);
+        // Never resize a segment someone may still have mapped: drop the old name and create
+        // a new object, so the previous writer and its readers keep their own.
+        ::shm_unlink(name);
+        const int fd = ::shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) {
+            return false;
+        }
+        void* mapped = MAP_FAILED;
+        struct stat status {};
+        if (::fstat(fd, &status) == 0 && ::ftruncate(fd, static_cast<off_t>(size)) == 0) {
+            mapped = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            ::shm_unlink(name);
+            return false;
+        }
+        name_ = name;
+        device_ = status.st_dev;
+        inode_ = status.st_ino;
+        base_ = mapped;
+        size_ = size;
+        header_ = ::new (base_) LiveHeader();
+        header_->version = kLiveFormatVersion;
+        header_->header_size = static_cast<uint32_t>(sizeof(LiveHeader));
+        header_->record_capacity = record_capacity;
+        header_->site_capacity = sites;
+        header_->clock_source = static_cast<uint32_t>(clock);
+        header_->writer_pid = static_cast<uint32_t>(::getpid());
+        header_->ns_per_tick = ns_per_tick;
+        sites_ = live_sites(base_);
+        slots_ = live_slots(base_, sites);
+        mask_ = capacity - 1U;
+        position_ = 0U;
+        // Readers treat the segment as valid once the magic is visible.
+        header_->magic.store(live_magic_word(), std::memory_order_release);
+        return true;
+    }
+
+    [[nodiscard]] bool is_open() const noexcept { return base_ != nullptr; }
+
+    void publish(const SampleRecord& record) noexcept {
+        live_write_slot(slots_[position_ & mask_], position_, record);
+        ++position_;
+        header_->write_position.store(position_, std::memory_order_release);
+    }
+
+    void publish_site(const SiteRef& site) noexcept {
+        if (site.id == 0U || site.id > header_->site_capacity) {
+            return;
+        }
+        LiveSiteEntry& entry = sites_[site.id - 1U];
+        if (entry.ready.load(std::memory_order_relaxed) != 0U) {
+            return;
+        }
+        const char* label = site.site_desc.label != nullptr ? site.site_desc.label : "";
+        const size_t length = std::min(std::strlen(label), kLiveLabelSize - 1U);
+        std::memcpy(entry.label, label, length);
+        entry.label[length] = '\0';
+        entry.line = site.site_desc.line;
+        entry.ready.store(1U, std::memory_order_release);
+    }
+
+    void heartbeat(uint64_t dropped_samples) noexcept {
+        header_->dropped_samples.fetch_add(dropped_samples, std::memory_order_relaxed);
+        header_->heartbeat_ns.store(monotonic_now_ns(), std::memory_order_release);
+    }
+
+    // Marks the segment closed and unlinks its name unless another writer has taken the name
+    // over since. Readers that are still attached keep their mapping and see the final state.
+    void close() noexcept {
+        if (base_ == nullptr) {
+            return;
+        }
+        header_->closed.store(1U, std::memory_order_release);
+        ::munmap(base_, size_);
+        const int fd = ::shm_open(name_.c_str(), O_RDONLY, 0);
+        if (fd >= 0) {
+            struct stat status {};
+            const bool ours = ::fstat(fd, &status) == 0 && status.st_dev == device_ && status.st_ino == inode_;
+            ::close(fd);
+            if (ours) {
+                ::shm_unlink(name_.c_str());
+            }
+        }
+        base_ = nullptr;
+        header_ = nullptr;
+        size_ = 0U;
+    }
+
+ private:
+    std::string name_;
+    dev_t device_ = 0;
+    ino_t inode_ = 0;
+    void* base_ = nullptr;
+    size_t size_ = 0U;
+    LiveHeader* header_ = nullptr;
+    LiveSiteEntry* sites_ = nullptr;
+    LiveSlot* slots_ = nullptr;
+    size_t mask_ = 0U;
+    uint64_t position_ = 0U;
+};
+#endif
+
+// Sorted runs feeding a k-way merge. Each drained queue becomes one or more runs that are
+// sorted on their own; per-thread queues arrive almost in start order, so that is cheap.
+// Runs stay resident up to a record budget and are written to anonymous temporary files
+// past it, so merge() needs the budget plus one read buffer per spilled run.
+class SampleRunSet final {
+ public:
+    explicit SampleRunSet(size_t memory_records) noexcept
+        : memory_records_(std::max(memory_records, kMinimumRingCapacity)) {}
+    SampleRunSet(const SampleRunSet&) = delete;
+    SampleRunSet& operator=(const SampleRunSet&) = delete;
+
+    ~SampleRunSet() {
+        for (Run& run : runs_) {
+            if (run.spill != nullptr) {
+                std::fclose(run.spill);
+            }
+        }
+    }
+
+    // Callers cut longer queues into several runs of at most this many records.
+    [[nodiscard]] size_t max_run_records() const noexcept { return memory_records_; }
+
+    [[nodiscard]] uint64_t record_count() const noexcept { return record_count_; }
+
+    [[nodiscard]] size_t spilled_runs() const noexcept { return spilled_runs_; }
+
+    // Sorts records and takes them over; records is left empty with its capacity intact.
+    [[nodiscard]] bool add_run(std::vector<SampleRecord>& records) {
+        if (records.empty()) {
+            return true;
+        }
+        if (!std::is_sorted(records.begin(), records.end(), sample_less)) {
+            std::sort(records.begin(), records.end(), sample_less);
+        }
+        record_count_ += records.size();
+
+        runs_.emplace_back();
+        Run& run = runs_.back();
+        if (resident_records_ + records.size() <= memory_records_) {
+            resident_records_ += records.size();
+            run.buffer.assign(records.begin(), records.end());
+            records.clear();
+            return true;
+        }
+
+        ++spilled_runs_;
+        run.spill = std::tmpfile();
+        run.spilled = records.size();
+        const bool ok = run.spill != nullptr &&
+                        std::fwrite(records.data(), sizeof(SampleRecord), records.size(), run.spill) ==
+                            records.size() &&
+                        std::fflush(run.spill) == 0 && std::fseek(run.spill, 0L, SEEK_SET) == 0;
+        records.clear();
+        return ok;
+    }
+
+    // Calls sink(record) for every record in sample_less order. Returns false if a spilled
+    // run could not be read back.
+    template <typename Sink>
+    [[nodiscard]] bool merge(Sink&& sink) {
+        std::vector<size_t> heap;
+        heap.reserve(runs_.size());
+        for (size_t i = 0; i < runs_.size(); ++i) {
+            if (refill(runs_[i])) {
+                heap.push_back(i);
+            }
+        }
+        const auto later = [this](size_t lhs, size_t rhs) { return sample_less(head(rhs), head(lhs)); };
+        std::make_heap(heap.begin(), heap.end(), later);
+        while (!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), later);
+            Run& run = runs_[heap.back()];
+            sink(run.buffer[run.position]);
+            ++run.position;
+            if (refill(run)) {
+                std::push_heap(heap.begin(), heap.end(), later);
+            } else {
+                heap.pop_back();
+            }
+        }
+        return !read_failed_;
+    }
+
+ private:
+    struct Run {
+        std::vector<SampleRecord> buffer;
+        size_t position = 0U;
+        FILE* spill = nullptr;
+        size_t spilled = 0U;
+    };
+
+    [[nodiscard]] const SampleRecord& head(size_t index) const noexcept {
+        const Run& run = runs_[index];
+        return run.buffer[run.position];
+    }
+
+    // True while run has a current record, reading the next chunk of a spilled run if needed.
+    [[nodiscard]] bool refill(Run& run) {
+        if (run.position < run.buffer.size()) {
+            return true;
+        }
+        if (run.spill == nullptr || run.spilled == 0U) {
+            return false;
+        }
+        const size_t count = std::min(run.spilled, kMergeReadRecords);
+        run.buffer.resize(count);
+        run.position = 0U;
+        if (std::fread(run.buffer.data(), sizeof(SampleRecord), count, run.spill) != count) {
+            run.spilled = 0U;
+            run.buffer.clear();
+            read_failed_ = true;
+            return false;
+        }
+        run.spilled -= count;
+        return true;
+    }
+
+    std::vector<Run> runs_;
+    size_t memory_records_;
+    size_t resident_records_ = 0U;
+    uint64_t record_count_ = 0U;
+    size_t spilled_runs_ = 0U;
+    bool read_failed_ = false;
+};
+
+// Append-only site registry made of lazily allocated fixed-size chunks. Ids come from one
+// atomic counter and id - 1 selects the slot, so registering threads never wait for each
+// other: the only shared write besides the counter is the CAS that installs a new chunk.
+// A slot is published by its ready flag; readers skip slots that are still being filled.
+// Chunks are freed only with the table, so returned references stay valid.
+class SiteTable final {
+ public:
+    SiteTable() = default;
+    SiteTable(const SiteTable&) = delete;
+    SiteTable& operator=(const SiteTable&) = delete;
+
+    ~SiteTable() {
+        for (auto& chunk : chunks_) {
+            delete chunk.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Returns nullptr once kMaxSites ids are used or when a chunk cannot be allocated.
+    [[nodiscard]] SiteRef* append(const SiteDesc& desc, uint32_t control) noexcept {
+        const uint32_t id = next_id_.fetch_add(1U, std::memory_order_relaxed);
+        if (id == 0U || id > kMaxSites) {
+            return nullptr;
+        }
+        const uint32_t index = id - 1U;
+        Chunk* chunk = chunk_at(index >> kSiteChunkBits);
+        if (chunk == nullptr) {
+            return nullptr;
+        }
+        Entry& entry = chunk->entries[index & (kSiteChunkSize - 1U)];
+        entry.site.id = id;
+        entry.site.site_desc = desc;
+        entry.site.control.store(control, std::memory_order_relaxed);
+        // seq_cst rather than release: RuntimeState pairs it with the rule snapshot pointer.
+        entry.ready.store(true, std::memory_order_seq_cst);
+        return &entry.site;
+    }
+
+    // Visits published sites in id order.
+    template <typename Fn>
+    void for_each(Fn&& fn) const noexcept {
+        const uint32_t issued = next_id_.load(std::memory_order_acquire) - 1U;
+        const uint32_t end = issued < kMaxSites ? issued : kMaxSites;
+        for (uint32_t index = 0U; index < end; ++index) {
+            const Chunk* chunk = chunks_[index >> kSiteChunkBits].load(std::memory_order_acquire);
+            if (chunk == nullptr) {
+                index |= kSiteChunkSize - 1U;
+                continue;
+            }
+            const Entry& entry = chunk->entries[index & (kSiteChunkSize - 1U)];
+            if (entry.ready.load(std::memory_order_seq_cst)) {
+                fn(entry.site);
+            }
+        }
+    }
+
+    [[nodiscard]] uint64_t size() const noexcept {
+        uint64_t count = 0U;
+        for_each([&count](const SiteRef&) { ++count; });
+        return count;
+    }
+
+ private:
+    struct Entry {
+        SiteRef site {};
+        std::atomic<bool> ready {false};
+    };
+
+    struct Chunk {
+        Entry entries[kSiteChunkSize];
+    };
+
+    [[nodiscard]] Chunk* chunk_at(uint32_t chunk_index) noexcept {
+        Chunk* chunk = chunks_[chunk_index].load(std::memory_order_acquire);
+        if (chunk != nullptr) {
+            return chunk;
+        }
+        Chunk* fresh = new (std::nothrow) Chunk;
+        if (fresh == nullptr) {
+            return nullptr;
+        }
+        if (chunks_[chunk_index].compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel,
+                                                         std::memory_order_acquire)) {
+            return fresh;
+        }
+        delete fresh;
+        return chunk;
+    }
+
+    std::atomic<Chunk*> chunks_[kSiteChunkCount] {};
+    std::atomic<uint32_t> next_id_ {1U};
+};
+
+using SiteRuleList = std::vector<SiteRule>;
+
+struct ThreadInfo {
+    uint32_t tid_hash = 0U;
+    uint64_t os_tid = 0U;
+    // Capture clock units, like SampleRecord::start_ns.
+    uint64_t first_seen = 0U;
+    char name[kThreadNameSize] {};
+};
+
+// "x.sites.tsv" -> "x.threads.tsv"; any other site path just gets ".threads.tsv" appended.
+[[nodiscard]] inline std::string derive_thread_path(const char* site_path) {
+    static constexpr char kSiteSuffix[] = ".sites.tsv";
+    std::string path = site_path != nullptr ? site_path : "perf_duration_trace.sites.tsv";
+    const size_t suffix_size = sizeof(kSiteSuffix) - 1U;
+    if (path.size() >= suffix_size && path.compare(path.size() - suffix_size, suffix_size, kSiteSuffix) == 0) {
+        path.resize(path.size() - suffix_size);
+    }
+    return path + ".threads.tsv";
+}
+
+// ("x.perfbin", 3) -> "x.000003.perfbin"; any other sample path just gets ".000003.perfbin".
+[[nodiscard]] inline std::string derive_segment_path(const char* sample_path, uint32_t index) {
+    static constexpr char kSampleSuffix[] = ".perfbin";
+    std::string path = sample_path != nullptr ? sample_path : "perf_duration_trace";
+    const size_t suffix_size = sizeof(kSampleSuffix) - 1U;
+    if (path.size() >= suffix_size && path.compare(path.size() - suffix_size, suffix_size, kSampleSuffix) == 0) {
+        path.resize(path.size() - suffix_size);
+    }
+    char number[16];
+    std::snprintf(number, sizeof(number), ".%06u", index);
+    return path + number + kSampleSuffix;
+}
+
+class RuntimeState final {
+ public:
+    RuntimeState() {
+        overflow_site_.control.store(kSiteOff, std::memory_order_relaxed);
+        env_site_rules_ = publish_site_rules_locked(parse_site_rules(std::getenv(kSiteRulesEnv)));
+        reconfigure(Config{});
+    }
+
+    RuntimeState(const RuntimeState&) = delete;
+    RuntimeState& operator=(const RuntimeState&) = delete;
+
+    [[nodiscard]] const SiteRef& register_site(const SiteDesc& desc) {
+        SiteRuleReader reader(site_rule_readers_);
+        const SiteRuleList* rules = site_rules_.load(std::memory_order_seq_cst);
+        SiteRef* site = site_table_.append(desc, control_for(*rules, desc));
+        if (site == nullptr) {
+            // Site id 0 is never exported and the overflow site is switched off.
+            return overflow_site_;
+        }
+        // A rule published while the slot was being filled may have missed this site: either
+        // the rule writer saw the ready flag and updated the control word, or this loop sees
+        // the newer snapshot. Re-check after every store in case yet another rule landed.
+        for (const SiteRuleList* latest = site_rules_.load(std::memory_order_seq_cst); latest != rules;
+             latest = site_rules_.load(std::memory_order_seq_cst)) {
+            rules = latest;
+            site->control.store(control_for(*rules, desc), std::memory_order_seq_cst);
+        }
+        return *site;
+    }
+
+    void set_site_sampling(const SiteRef& site, uint32_t every_n) noexcept {
+        site.control.store(every_n, std::memory_order_relaxed);
+    }
+
+    size_t set_site_sampling(const char* glob, uint32_t every_n) {
+        if (glob == nullptr) {
+            return 0U;
+        }
+        std::lock_guard<std::mutex> lock(site_rules_mutex_);
+        // A glob applied again replaces its rule and moves it last, where it takes precedence.
+        SiteRuleList next = *site_rules_.load(std::memory_order_relaxed);
+        next.erase(std::remove_if(next.begin(), next.end(), [glob](const SiteRule& rule) { return rule.glob == glob; }),
+                   next.end());
+        next.push_back(SiteRule {glob, every_n});
+        (void)publish_site_rules_locked(std::move(next));
+        size_t matched = 0U;
+        site_table_.for_each([glob, every_n, &matched](const SiteRef& site) {
+            if (site_matches(site.site_desc, glob)) {
+                site.control.store(every_n, std::memory_order_seq_cst);
+                ++matched;
+            }
+        });
+        return matched;
+    }
+
+    [[nodiscard]] size_t site_rule_count() {
+        std::lock_guard<std::mutex> lock(site_rules_mutex_);
+        return site_rules_.load(std::memory_order_relaxed)->size();
+    }
+
+    // Rule lists kept alive, including the current and the startup ones.
+    [[nodiscard]] size_t retained_site_rule_lists() {
+        std::lock_guard<std::mutex> lock(site_rules_mutex_);
+        return site_rule_snapshots_.size();
+    }
+
+    [[nodiscard]] Token begin(const SiteRef& site) noexcept {
+        const uint32_t control = site.control.load(std::memory_order_relaxed);
+        if (control == kSiteOff) {
+            return Token {};
+        }
+        ThreadRoute& route = route_for_current_thread();
+        if (control != kSiteOn && !route.sample_one_in(control)) {
+            return Token {};
+        }
+        SpanStack* stack = route.span_stack;
+        uint16_t depth = route.span_depth;
+        uint16_t serial = 0U;
+        if (stack != nullptr) {
+            depth = stack->unwind_closed(depth);
+            serial = stack->push(depth);
+        }
+        route.span_depth = depth != UINT16_MAX ? static_cast<uint16_t>(depth + 1U) : depth;
+        return Token {capture_now(), stack, site.id, depth, serial};
+    }
+
+    void end(Token token) noexcept { end_with_args<0U>(token, nullptr); }
+
+    // Records the span followed by ArgCount argument records (see kRecordArgument). The
+    // histogram backend keeps durations only and drops the values.
+    template <uint32_t ArgCount>
+    void end_with_args(Token token, const uint64_t* args) noexcept {
+        static_assert(ArgCount <= kMaxRecordArgs, "at most kMaxRecordArgs arguments per span");
+        if (!token.valid()) {
+            return;
+        }
+
+        const auto end_ns = capture_now();
+        const auto duration_ns = end_ns >= token.start_ns ? (end_ns - token.start_ns) : 0U;
+        ThreadRoute& route = route_for_current_thread();
+        // Ending a span also closes anything opened above it that was never ended. Tokens
+        // already unwound by an outer span leave the stack alone. A token ended on another
+        // thread is recorded there as a top-level span (its parent lives on the opening
+        // thread's stack) and only marks its level closed for the owner to pop.
+        SpanStack* stack = route.span_stack;
+        const bool same_thread = token.owner == stack;
+        if (!same_thread) {
+            if (token.owner != nullptr) {
+                token.owner->close(token.depth, token.serial);
+            }
+        } else if (stack == nullptr || stack->holds(token.depth, token.serial)) {
+            if (token.depth < route.span_depth) {
+                route.span_depth = token.depth;
+            }
+            if (stack != nullptr) {
+                route.span_depth = stack->unwind_closed(route.span_depth);
+            }
+        }
+        const uint16_t depth = same_thread ? token.depth : uint16_t {0U};
+        if (route.histograms != nullptr) {
+            route.histograms->record(token.site_id, duration_to_ns(duration_ns));
+            return;
+        }
+        SampleRecord record {
+            token.start_ns,
+            duration_ns,
+            token.site_id,
+            route.tid_hash,
+            static_cast<uint32_t>(route.next_sequence++),
+            cpu_hint_source_ == CpuHintSource::none ? uint16_t {0U} : cpu_hint_for(route),
+            static_cast<uint16_t>(record_depth_flags(depth) | (ArgCount << kRecordArgCountShift)),
+        };
+        if constexpr (ArgCount == 0U) {
+            if (route.flight != nullptr) {
+                route.flight->push(record);
+                check_flight_trigger(token.site_id, duration_ns);
+            } else if (route.ring != nullptr) {
+                (void)route.ring->push(record);
+            } else if (route.staging != nullptr) {
+                route.staging->append(record, end_ns, staging_flush_ticks_);
+            } else if (capture_mode_ == CaptureMode::sharded) {
+                (void)shards_[static_cast<size_t>(route.shard_id)]->enqueue(record);
+            }
+        } else {
+            SampleRecord records[ArgCount + 1U] = {record};
+            for (uint32_t i = 0U; i < ArgCount; ++i) {
+                records[i + 1U] = SampleRecord {token.start_ns, args[i], token.site_id, record.tid_hash,
+                                                record.seq_no, static_cast<uint16_t>(i), kRecordArgument};
+            }
+            if (route.flight != nullptr) {
+                for (const SampleRecord& entry : records) {
+                    route.flight->push(entry);
+                }
+                check_flight_trigger(token.site_id, duration_ns);
+            } else if (route.ring != nullptr) {
+                // An argument whose sample did not fit is dropped with it.
+                if (route.ring->push(record)) {
+                    for (uint32_t i = 1U; i <= ArgCount; ++i) {
+                        (void)route.ring->push(records[i]);
+                    }
+                }
+            } else if (route.staging != nullptr) {
+                for (const SampleRecord& entry : records) {
+                    route.staging->append(entry, end_ns, staging_flush_ticks_);
+                }
+            } else if (capture_mode_ == CaptureMode::sharded) {
+                // One reservation keeps the sample and its arguments together in the shard.
+                Shard& shard = *shards_[static_cast<size_t>(route.shard_id)];
+                if (!shard.enqueue_batch(records, ArgCount + 1U) && shard.enqueue(record)) {
+                    for (uint32_t i = 1U; i <= ArgCount; ++i) {
+                        (void)shard.enqueue(records[i]);
+                    }
+                }
+            }
+        }
+    }
+
+    void check_flight_trigger(uint32_t site_id, uint64_t duration_ns) noexcept {
+        if (site_id == flight_trigger_site_.load(std::memory_order_relaxed) &&
+            duration_ns >= flight_trigger_threshold_.load(std::memory_order_relaxed)) {
+            g_flight_dump_requested.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    [[nodiscard]] bool start_async_export(const AsyncExportConfig& config) noexcept {
+        std::lock_guard<std::mutex> lock(async_mutex_);
+        if (async_state_ != AsyncState::stopped || capture_mode_ == CaptureMode::flight_recorder) {
+            return false;
+        }
+
+        async_last_stats_ = make_base_stats();
+        async_last_stats_ready_ = false;
+
+        AsyncExportConfig normalized = config;
+        if (normalized.flush_interval_ms == 0U) {
+            normalized.flush_interval_ms = kDefaultFlushIntervalMs;
+        }
+
+        if (normalized.live_shm_name != nullptr) {
+#if PERF_DURATION_TRACE_HAS_MMAP
+            if (capture_mode_ == CaptureMode::histogram) {
+                return false;
+            }
+#else
+            return false;
+#endif
+        }
+
+        if (capture_mode_ == CaptureMode::histogram) {
+            // Histogram files are cumulative snapshots; there is nothing to rotate.
+            normalized.rotate_bytes = 0U;
+            normalized.rotate_interval_ms = 0U;
+            HistogramTotals totals;
+            if (!write_histogram_file(normalized.paths.sample_path, totals)) {
+                return false;
+            }
+        } else {
+            const bool rotating = normalized.rotate_bytes != 0U || normalized.rotate_interval_ms != 0U;
+            try {
+                async_segment_path_ = rotating ? derive_segment_path(normalized.paths.sample_path, 0U)
+                                               : std::string(normalized.paths.sample_path);
+            } catch (...) {
+                return false;
+            }
+            if (!open_async_sample_file_locked(normalized)) {
+                return false;
+            }
+        }
+#if PERF_DURATION_TRACE_HAS_MMAP
+        if (normalized.live_shm_name != nullptr &&
+            !async_live_.open(normalized.live_shm_name, normalized.live_records, normalized.live_sites, clock_source_,
+                              tsc_calibration_.ns_per_tick)) {
+            (void)close_async_file_locked();
+            return false;
+        }
+#endif
+
+        async_config_ = normalized;
+        async_exported_samples_ = 0U;
+        async_dropped_samples_ = 0U;
+        async_drop_markers_ = 0U;
+        async_segment_index_ = 0U;
+        async_segment_records_ = 0U;
+        async_segment_dropped_ = 0U;
+        async_segment_bytes_ = sizeof(FileHeader);
+        async_segment_started_ = monotonic_now_ns();
+        async_last_flush_ = capture_now();
+        async_write_failed_ = false;
+        async_stop_requested_ = false;
+        async_last_stats_ready_ = false;
+        async_state_ = AsyncState::running;
+
+        try {
+            async_thread_ = std::thread([this]() { async_worker(); });
+        } catch (...) {
+            (void)close_async_file_locked();
+            async_state_ = AsyncState::stopped;
+            return false;
+        }
+        return true;
+    }
+
+    [[nodiscard]] ExportStats stop_async_export() noexcept {
+        std::thread worker;
+        {
+            std::unique_lock<std::mutex> lock(async_mutex_);
+            const StopAsyncAction action = prepare_stop_async_locked(worker);
+            if (action == StopAsyncAction::return_last_stats) {
+                return async_last_stats_;
+            }
+            if (action == StopAsyncAction::wait_for_completion) {
+                async_cv_.wait(lock, [this]() { return async_state_ == AsyncState::stopped; });
+                return async_last_stats_;
+            }
+        }
+
+        return finish_stop_async(std::move(worker));
+    }
+
+    [[nodiscard]] ExportStats finalize(const ExportPaths& paths) noexcept {
+        std::thread worker;
+        {
+            std::unique_lock<std::mutex> lock(async_mutex_);
+            const StopAsyncAction action = prepare_stop_async_locked(worker);
+            if (action == StopAsyncAction::return_last_stats && async_last_stats_ready_) {
+                return async_last_stats_;
+            }
+            if (action == StopAsyncAction::wait_for_completion) {
+                async_cv_.wait(lock, [this]() { return async_state_ == AsyncState::stopped; });
+                return async_last_stats_;
+            }
+        }
+
+        if (worker.joinable()) {
+            return finish_stop_async(std::move(worker));
+        }
+
+        ExportStats stats = make_base_stats();
+        if (capture_mode_ == CaptureMode::histogram) {
+            HistogramTotals totals;
+            if (!write_histogram_file(paths.sample_path, totals) || !write_metadata_files(paths)) {
+                return stats;
+            }
+            stats.exported_samples = totals.samples;
+            stats.dropped_samples = totals.dropped;
+            stats.success = true;
+            return stats;
+        }
+
+        if (capture_mode_ == CaptureMode::flight_recorder) {
+            return dump_snapshot(paths);
+        }
+
+        SampleRunSet runs(finalize_memory_records_);
+        uint64_t dropped = 0U;
+        if (!drain_runs(runs, dropped) || !write_sample_file(paths.sample_path, runs, dropped, 0U) ||
+            !write_metadata_files(paths)) {
+            return stats;
+        }
+
+        stats.exported_samples = runs.record_count();
+        stats.dropped_samples = dropped;
+        stats.success = true;
+        return stats;
+    }
+
+    [[nodiscard]] ExportStats dump_snapshot(const ExportPaths& paths) noexcept {
+        if (capture_mode_ != CaptureMode::flight_recorder) {
+            return finalize(paths);
+        }
+
+        ExportStats stats = make_base_stats();
+        SampleRunSet runs(finalize_memory_records_);
+        std::vector<SampleRecord> run;
+        uint64_t overwritten = 0U;
+        bool runs_ok = true;
+        flight_rings_.for_each([&runs, &run, &overwritten, &runs_ok](const FlightRing& ring) {
+            overwritten += ring.snapshot([&runs, &run, &runs_ok](const SampleRecord& record) {
+                run.push_back(record);
+                if (run.size() == runs.max_run_records()) {
+                    runs_ok = runs.add_run(run) && runs_ok;
+                }
+            });
+            runs_ok = runs.add_run(run) && runs_ok;
+        });
+        if (!runs_ok || !write_sample_file(paths.sample_path, runs, 0U, overwritten) ||
+            !write_metadata_files(paths)) {
+            return stats;
+        }
+
+        stats.exported_samples = runs.record_count();
+        stats.overwritten_samples = overwritten;
+        stats.success = true;
+        return stats;
+    }
+
+    [[nodiscard]] bool arm_flight_trigger(const FlightTriggerConfig& config) noexcept {
+        std::lock_guard<std::mutex> lock(flight_mutex_);
+        if (capture_mode_ != CaptureMode::flight_recorder || flight_thread_.joinable()) {
+            return false;
+        }
+        try {
+            flight_prefix_ = config.path_prefix != nullptr ? config.path_prefix : "";
+        } catch (...) {
+            return false;
+        }
+        if (config.signal_number != 0) {
+            flight_previous_handler_ = std::signal(config.signal_number, flight_signal_handler);
+            if (flight_previous_handler_ == SIG_ERR) {
+                flight_previous_handler_ = SIG_DFL;
+                return false;
+            }
+        }
+
+        flight_config_ = config;
+        flight_dumps_ = 0U;
+        flight_stop_ = false;
+        g_flight_dump_requested.store(false, std::memory_order_relaxed);
+        uint64_t threshold = config.latency_threshold_ns;
+        if (clock_source_ == ClockSource::tsc && tsc_calibration_.ns_per_tick > 0.0) {
+            threshold = static_cast<uint64_t>(static_cast<double>(threshold) / tsc_calibration_.ns_per_tick);
+        }
+        flight_trigger_threshold_.store(threshold, std::memory_order_relaxed);
+        flight_trigger_site_.store(config.latency_site != nullptr ? config.latency_site->id : 0U,
+                                   std::memory_order_relaxed);
+
+        try {
+            flight_thread_ = std::thread([this]() { flight_trigger_worker(); });
+        } catch (...) {
+            flight_trigger_site_.store(0U, std::memory_order_relaxed);
+            restore_flight_signal_locked();
+            return false;
+        }
+        return true;
+    }
+
+    uint32_t disarm_flight_trigger() noexcept {
+        std::thread worker;
+        {
+            std::lock_guard<std::mutex> lock(flight_mutex_);
+            if (!flight_thread_.joinable()) {
+                return 0U;
+            }
+            flight_stop_ = true;
+            flight_trigger_site_.store(0U, std::memory_order_relaxed);
+            restore_flight_signal_locked();
+            worker = std::move(flight_thread_);
+        }
+        flight_cv_.notify_all();
+        worker.join();
+        std::lock_guard<std::mutex> lock(flight_mutex_);
+        return flight_dumps_;
+    }
 
     void reset_for_tests(const Config& config) noexcept {
         (void)stop_async_export();
+        (void)disarm_flight_trigger();
+        reset_site_rules();
         reconfigure(config);
         async_last_stats_ = make_base_stats();
         async_last_stats_ready_ = false;
@@ -476,6 +2259,29 @@ class RuntimeState final {
 
     [[nodiscard]] uint64_t now_ns() const noexcept { return monotonic_now_ns(); }
 
+    void release_thread_resources(const ThreadLease& lease) noexcept {
+        if (lease.generation != generation_.load(std::memory_order_acquire)) {
+            return;
+        }
+        if (lease.ring != nullptr) {
+            lease.ring->release();
+        }
+        if (lease.histograms != nullptr) {
+            lease.histograms->release();
+        }
+        if (lease.flight != nullptr) {
+            lease.flight->release();
+        }
+        if (lease.staging != nullptr) {
+            lease.staging->publish();
+            lease.staging->release();
+        }
+    }
+
+    void flush_staging() noexcept {
+        staging_.for_each([](StagingBuffer& buffer) { buffer.flush(); });
+    }
+
  private:
     enum class StopAsyncAction : uint8_t {
         return_last_stats,
@@ -483,131 +2289,697 @@ class RuntimeState final {
         join_worker,
     };
 
-    [[nodiscard]] StopAsyncAction prepare_stop_async_locked(std::thread& worker) noexcept {
-        if (async_state_ == AsyncState::stopped) {
-            return StopAsyncAction::return_last_stats;
+    [[nodiscard]] StopAsyncAction prepare_stop_async_locked(std::thread& worker) noexcept {
+        if (async_state_ == AsyncState::stopped) {
+            return StopAsyncAction::return_last_stats;
+        }
+        if (async_state_ == AsyncState::stopping) {
+            return StopAsyncAction::wait_for_completion;
+        }
+
+        async_state_ = AsyncState::stopping;
+        async_stop_requested_ = true;
+        async_cv_.notify_all();
+        worker = std::move(async_thread_);
+        return StopAsyncAction::join_worker;
+    }
+
+    [[nodiscard]] ExportStats finish_stop_async(std::thread worker) noexcept {
+
+        if (worker.joinable()) {
+            worker.join();
+        }
+
+        ExportStats stats = make_base_stats();
+        bool ok = false;
+        {
+            std::lock_guard<std::mutex> lock(async_mutex_);
+            if (capture_mode_ == CaptureMode::histogram) {
+                HistogramTotals totals;
+                ok = write_histogram_file(async_config_.paths.sample_path, totals);
+                stats.exported_samples = totals.samples;
+                stats.dropped_samples = totals.dropped;
+            } else {
+                stats.exported_samples = async_exported_samples_;
+                stats.dropped_samples = async_dropped_samples_;
+                ok = !async_write_failed_;
+                stats.segments = async_segment_index_ + 1U;
+                ok = rewrite_async_header_locked(async_segment_records_, async_segment_dropped_) && ok;
+            }
+            ok = write_metadata_files(async_config_.paths) && ok;
+            ok = close_async_file_locked() && ok;
+            async_stop_requested_ = false;
+            async_write_failed_ = false;
+            async_state_ = AsyncState::stopped;
+            stats.success = ok;
+            async_last_stats_ = stats;
+            async_last_stats_ready_ = true;
+            async_cv_.notify_all();
+        }
+        return stats;
+    }
+    void async_worker() noexcept {
+        for (;;) {
+            uint32_t flush_interval_ms = kDefaultFlushIntervalMs;
+            // Sampled before draining: a stop requested while a pass runs still gets one
+            // more pass, which sees everything recorded before the request.
+            bool stopping = false;
+            {
+                std::lock_guard<std::mutex> lock(async_mutex_);
+                flush_interval_ms = async_config_.flush_interval_ms;
+                stopping = async_stop_requested_;
+            }
+
+            if (capture_mode_ == CaptureMode::histogram) {
+                flush_async_histograms();
+            }
+#if PERF_DURATION_TRACE_HAS_MMAP
+            else if (async_mapped_file_.is_open() && sample_format_ == SampleFormat::fixed) {
+                drain_into_mapped_file();
+            }
+#endif
+            else {
+                std::vector<SampleRecord> batch;
+                uint64_t dropped = 0U;
+                drain_shards(batch, dropped);
+                publish_live(batch.data(), batch.size(), dropped);
+                if (!batch.empty() || dropped != 0U) {
+                    append_async_batch(batch, dropped);
+                }
+            }
+            if (capture_mode_ != CaptureMode::histogram) {
+                rotate_async_segment_if_due();
+            }
+
+            if (stopping) {
+                break;
+            }
+            std::unique_lock<std::mutex> lock(async_mutex_);
+            // A stop request cuts the wait short; the next pass performs the final drain.
+            async_cv_.wait_for(lock, std::chrono::milliseconds(flush_interval_ms),
+                               [this]() { return async_stop_requested_; });
+        }
+    }
+
+    // Copies a drained batch into the live segment, if one is open. Export thread only.
+    void publish_live(const SampleRecord* records, size_t count, uint64_t dropped) noexcept {
+#if PERF_DURATION_TRACE_HAS_MMAP
+        if (!async_live_.is_open()) {
+            return;
+        }
+        site_table_.for_each([this](const SiteRef& site) { async_live_.publish_site(site); });
+        for (size_t i = 0U; i < count; ++i) {
+            async_live_.publish(records[i]);
+        }
+        async_live_.heartbeat(dropped);
+#else
+        (void)records;
+        (void)count;
+        (void)dropped;
+#endif
+    }
+
+    void append_async_batch(std::vector<SampleRecord>& batch, uint64_t dropped) noexcept {
+        const size_t sample_count = batch.size();
+        const bool has_marker = dropped != 0U;
+        if (has_marker) {
+            batch.push_back(make_drop_marker(dropped));
+        }
+
+        // Sorting and block encoding happen before taking the lock.
+        std::vector<unsigned char> blocks;
+        const void* data = batch.data();
+        size_t size = batch.size() * sizeof(SampleRecord);
+        if (sample_format_ == SampleFormat::compressed) {
+            encode_blocks(batch, blocks);
+            data = blocks.data();
+            size = blocks.size();
+        } else {
+            std::sort(batch.begin(), batch.end(), sample_less);
+        }
+
+        std::lock_guard<std::mutex> lock(async_mutex_);
+        if (write_async_bytes_locked(data, size)) {
+            async_exported_samples_ += static_cast<uint64_t>(sample_count);
+            async_drop_markers_ += has_marker ? 1U : 0U;
+            async_segment_records_ += static_cast<uint64_t>(batch.size());
+            async_segment_bytes_ += static_cast<uint64_t>(size);
+        } else {
+            async_write_failed_ = true;
+        }
+        async_dropped_samples_ += dropped;
+        async_segment_dropped_ += dropped;
+    }
+
+    [[nodiscard]] bool write_async_bytes_locked(const void* data, size_t size) noexcept {
+#if PERF_DURATION_TRACE_HAS_MMAP
+        if (async_mapped_file_.is_open()) {
+            return async_mapped_file_.append_bytes(data, size);
         }
-        if (async_state_ == AsyncState::stopping) {
-            return StopAsyncAction::wait_for_completion;
+#endif
+        if (async_sample_file_ == nullptr) {
+            return false;
         }
+        if (size != 0U && std::fwrite(data, 1U, size, async_sample_file_) != size) {
+            return false;
+        }
+        return std::fflush(async_sample_file_) == 0;
+    }
 
-        async_state_ = AsyncState::stopping;
-        async_stop_requested_ = true;
-        worker = std::move(async_thread_);
-        return StopAsyncAction::join_worker;
+#if PERF_DURATION_TRACE_HAS_MMAP
+    // Zero-copy counterpart of append_async_batch(): records go from the capture queues
+    // straight into the mapping and are sorted there. Only the export thread touches the
+    // mapping while it runs, so the async mutex guards just the counters.
+    void drain_into_mapped_file() noexcept {
+        const size_t first = async_mapped_file_.record_count();
+        uint64_t dropped = 0U;
+        bool ok = true;
+        drain_shards([this, &ok](const SampleRecord& record) { ok = async_mapped_file_.append(record) && ok; },
+                     dropped);
+        const size_t last = async_mapped_file_.record_count();
+        SampleRecord* records = async_mapped_file_.records();
+        std::sort(records + first, records + last, sample_less);
+        publish_live(records + first, last - first, dropped);
+        const bool has_marker = dropped != 0U;
+        if (has_marker) {
+            ok = async_mapped_file_.append(make_drop_marker(dropped)) && ok;
+        }
+
+        const uint64_t written = static_cast<uint64_t>(last - first) + (has_marker ? 1U : 0U);
+        std::lock_guard<std::mutex> lock(async_mutex_);
+        async_exported_samples_ += static_cast<uint64_t>(last - first);
+        async_drop_markers_ += has_marker ? 1U : 0U;
+        async_dropped_samples_ += dropped;
+        async_segment_records_ += written;
+        async_segment_dropped_ += dropped;
+        async_segment_bytes_ += written * sizeof(SampleRecord);
+        if (!ok) {
+            async_write_failed_ = true;
+        }
     }
+#endif
 
-    [[nodiscard]] ExportStats finish_stop_async(std::thread worker) noexcept {
+    // Export thread only. Producers never touch the sample file, so finishing one segment and
+    // opening the next only delays the following flush; their records wait in the capture
+    // queues meanwhile. Empty segments are not rolled over.
+    void rotate_async_segment_if_due() noexcept {
+        std::lock_guard<std::mutex> lock(async_mutex_);
+        const AsyncExportConfig& config = async_config_;
+        const uint64_t now = monotonic_now_ns();
+        const bool size_due = config.rotate_bytes != 0U && async_segment_bytes_ >= config.rotate_bytes;
+        const bool time_due = config.rotate_interval_ms != 0U &&
+                              now - async_segment_started_ >= uint64_t {config.rotate_interval_ms} * 1000000U;
+        if (!size_due && !time_due) {
+            return;
+        }
+        async_segment_started_ = now;
+        if (async_segment_records_ == 0U) {
+            return;
+        }
 
-        if (worker.joinable()) {
-            worker.join();
+        bool ok = rewrite_async_header_locked(async_segment_records_, async_segment_dropped_);
+        ok = close_async_sample_file_locked() && ok;
+        ok = write_metadata_files(config.paths) && ok;
+        ++async_segment_index_;
+        try {
+            async_segment_path_ = derive_segment_path(config.paths.sample_path, async_segment_index_);
+            if (config.max_segments != 0U && async_segment_index_ >= config.max_segments) {
+                const uint32_t expired = async_segment_index_ - config.max_segments;
+                (void)std::remove(derive_segment_path(config.paths.sample_path, expired).c_str());
+            }
+        } catch (...) {
+            ok = false;
+        }
+        ok = open_async_sample_file_locked(config) && ok;
+        async_segment_records_ = 0U;
+        async_segment_dropped_ = 0U;
+        async_segment_bytes_ = sizeof(FileHeader);
+        if (!ok) {
+            async_write_failed_ = true;
         }
+    }
 
-        ExportStats stats = make_base_stats();
-        bool ok = false;
+    // Histograms are cumulative, so every flush rewrites the whole file with the current
+    // totals. The file is replaced atomically; readers never observe a partial snapshot.
+    void flush_async_histograms() noexcept {
+        const char* path = nullptr;
         {
             std::lock_guard<std::mutex> lock(async_mutex_);
-            stats.exported_samples = async_exported_samples_;
-            stats.dropped_samples = async_dropped_samples_;
-            ok = !async_write_failed_;
-            ok = rewrite_async_header_locked(stats.exported_samples, stats.dropped_samples) && ok;
-            ok = write_site_file(async_config_.paths.site_path) && ok;
-            close_async_file_locked();
-            async_stop_requested_ = false;
-            async_write_failed_ = false;
-            async_state_ = AsyncState::stopped;
-            stats.success = ok;
-            async_last_stats_ = stats;
-            async_last_stats_ready_ = true;
-            async_cv_.notify_all();
+            path = async_config_.paths.sample_path;
+        }
+        HistogramTotals totals;
+        const bool ok = write_histogram_file(path, totals);
+        std::lock_guard<std::mutex> lock(async_mutex_);
+        if (ok) {
+            async_exported_samples_ = totals.samples;
+            async_dropped_samples_ = totals.dropped;
+        } else {
+            async_write_failed_ = true;
         }
-        return stats;
     }
-    void async_worker() noexcept {
-        for (;;) {
-            uint32_t flush_interval_ms = kDefaultFlushIntervalMs;
-            {
-                std::lock_guard<std::mutex> lock(async_mutex_);
-                flush_interval_ms = async_config_.flush_interval_ms;
-            }
 
-            std::vector<SampleRecord> batch;
-            uint64_t dropped = 0U;
-            drain_shards(batch, dropped);
-            if (!batch.empty() || dropped != 0U) {
-                std::sort(batch.begin(), batch.end(), sample_less);
-                append_async_batch(batch, dropped);
+    // Covers the time since the previous flush; only the export thread calls this.
+    [[nodiscard]] SampleRecord make_drop_marker(uint64_t dropped) noexcept {
+        const uint64_t now = capture_now();
+        SampleRecord marker {};
+        marker.start_ns = async_last_flush_;
+        marker.duration_ns = now >= async_last_flush_ ? now - async_last_flush_ : 0U;
+        marker.seq_no = dropped < UINT32_MAX ? static_cast<uint32_t>(dropped) : UINT32_MAX;
+        marker.flags = kRecordDropMarker;
+        async_last_flush_ = now;
+        return marker;
+    }
+
+    [[nodiscard]] uint16_t cpu_hint_for(ThreadRoute& route) const noexcept {
+        if (route.cpu_hint_countdown == 0U) {
+            route.cpu_hint = cpu_hint_source_ == CpuHintSource::rdtscp ? read_cpu_rdtscp() : read_cpu_getcpu();
+            route.cpu_hint_countdown = cpu_hint_interval_;
+        }
+        --route.cpu_hint_countdown;
+        return route.cpu_hint;
+    }
+
+    // Once per thread and generation; the thread table is cold, so a mutex is fine here.
+    // A thread already listed is not added again, and the table stops at kMaxThreadInfos.
+    void record_thread(uint32_t tid_hash) noexcept {
+        ThreadInfo info;
+        info.tid_hash = tid_hash;
+        info.os_tid = current_os_tid();
+        info.first_seen = capture_now();
+        current_thread_name(info.name);
+        std::lock_guard<std::mutex> lock(thread_mutex_);
+        if (threads_.size() >= kMaxThreadInfos) {
+            return;
+        }
+        for (const ThreadInfo& known : threads_) {
+            if (known.tid_hash == info.tid_hash && known.os_tid == info.os_tid) {
+                return;
             }
+        }
+        try {
+            threads_.push_back(info);
+        } catch (...) {
+        }
+    }
 
-            {
-                std::lock_guard<std::mutex> lock(async_mutex_);
-                if (async_stop_requested_) {
-                    break;
+    [[nodiscard]] bool write_metadata_files(const ExportPaths& paths) const noexcept {
+        bool ok = write_site_file(paths.site_path);
+        if (!thread_table_) {
+            return ok;
+        }
+        try {
+            const std::string derived = paths.thread_path == nullptr ? derive_thread_path(paths.site_path) : "";
+            ok = write_thread_file(paths.thread_path != nullptr ? paths.thread_path : derived.c_str()) && ok;
+        } catch (...) {
+            ok = false;
+        }
+        return ok;
+    }
+
+    // first_seen_ns is converted to nanoseconds so the table needs no clock metadata.
+    [[nodiscard]] bool write_thread_file(const char* path) const noexcept {
+        FILE* thread_file = std::fopen(path, "w");
+        if (thread_file == nullptr) {
+            return false;
+        }
+        const TscCalibration calibration = export_calibration();
+        std::fputs("tid_hash\ttid\tname\tfirst_seen_ns\n", thread_file);
+        {
+            std::lock_guard<std::mutex> lock(thread_mutex_);
+            for (const ThreadInfo& info : threads_) {
+                uint64_t first_seen_ns = info.first_seen;
+                if (clock_source_ == ClockSource::tsc) {
+                    const double ticks = info.first_seen >= calibration.base_ticks
+                                             ? static_cast<double>(info.first_seen - calibration.base_ticks)
+                                             : -static_cast<double>(calibration.base_ticks - info.first_seen);
+                    first_seen_ns = static_cast<uint64_t>(static_cast<double>(calibration.base_ns) +
+                                                          ticks * calibration.ns_per_tick);
                 }
+                std::fprintf(thread_file,
+                             "%u\t%llu\t%s\t%llu\n",
+                             info.tid_hash,
+                             static_cast<unsigned long long>(info.os_tid),
+                             info.name,
+                             static_cast<unsigned long long>(first_seen_ns));
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(flush_interval_ms));
         }
+        return std::fclose(thread_file) == 0;
     }
 
-    void append_async_batch(const std::vector<SampleRecord>& batch, uint64_t dropped) noexcept {
-        std::lock_guard<std::mutex> lock(async_mutex_);
-        if (async_sample_file_ == nullptr) {
+    [[nodiscard]] static uint32_t control_for(const SiteRuleList& rules, const SiteDesc& desc) noexcept {
+        uint32_t control = kSiteOn;
+        for (const SiteRule& rule : rules) {
+            if (site_matches(desc, rule.glob.c_str())) {
+                control = rule.every_n;
+            }
+        }
+        return control;
+    }
+
+    // Counts register_site() calls that may still read a rule list without the lock.
+    class SiteRuleReader final {
+     public:
+        explicit SiteRuleReader(std::atomic<uint32_t>& readers) noexcept : readers_(readers) {
+            readers_.fetch_add(1U, std::memory_order_seq_cst);
+        }
+        SiteRuleReader(const SiteRuleReader&) = delete;
+        SiteRuleReader& operator=(const SiteRuleReader&) = delete;
+        ~SiteRuleReader() { readers_.fetch_sub(1U, std::memory_order_seq_cst); }
+
+     private:
+        std::atomic<uint32_t>& readers_;
+    };
+
+    // Rule lists are immutable once published. Registering threads read the current one
+    // without a lock, so superseded lists are retired and freed by a later publish once no
+    // registration is in flight.
+    const SiteRuleList* publish_site_rules_locked(SiteRuleList rules) {
+        site_rule_snapshots_.push_back(std::make_unique<const SiteRuleList>(std::move(rules)));
+        const SiteRuleList* published = site_rule_snapshots_.back().get();
+        site_rules_.store(published, std::memory_order_seq_cst);
+        reclaim_site_rules_locked();
+        return published;
+    }
+
+    // A reader counted after this check loads the current list, so when the count is zero no
+    // one can still hold a superseded one. The startup list is kept for reset_site_rules().
+    void reclaim_site_rules_locked() noexcept {
+        if (site_rule_readers_.load(std::memory_order_seq_cst) != 0U) {
             return;
         }
+        const SiteRuleList* current = site_rules_.load(std::memory_order_relaxed);
+        site_rule_snapshots_.erase(
+            std::remove_if(site_rule_snapshots_.begin(), site_rule_snapshots_.end(),
+                           [this, current](const std::unique_ptr<const SiteRuleList>& rules) {
+                               return rules.get() != current && rules.get() != env_site_rules_;
+                           }),
+            site_rule_snapshots_.end());
+    }
 
-        bool ok = true;
+    // Drops rules added through the API and re-derives every site from the startup rules.
+    void reset_site_rules() noexcept {
+        std::lock_guard<std::mutex> lock(site_rules_mutex_);
+        site_rules_.store(env_site_rules_, std::memory_order_seq_cst);
+        reclaim_site_rules_locked();
+        const SiteRuleList& rules = *env_site_rules_;
+        site_table_.for_each([&rules](const SiteRef& site) {
+            site.control.store(control_for(rules, site.site_desc), std::memory_order_seq_cst);
+        });
+    }
+
+    // Merges runs into a complete sample file in the configured format. Records are written in
+    // batches, so the file never has to exist in memory as a whole.
+    [[nodiscard]] bool write_sample_file(const char* path, SampleRunSet& runs, uint64_t dropped,
+                                         uint64_t overwritten) noexcept {
+        FILE* sample_file = std::fopen(path, "wb");
+        if (sample_file == nullptr) {
+            return false;
+        }
+
+        FileHeader header = make_header(runs.record_count(), dropped, export_calibration());
+        header.overwritten_samples = overwritten;
+        const bool header_ok = std::fwrite(&header, sizeof(header), 1U, sample_file) == 1U;
+        bool records_ok = true;
+        std::vector<SampleRecord> batch;
+        std::vector<unsigned char> blocks;
+        const auto write_batch = [this, sample_file, &batch, &blocks, &records_ok]() {
+            if (sample_format_ == SampleFormat::compressed) {
+                blocks.clear();
+                encode_blocks(batch, blocks);
+                records_ok = std::fwrite(blocks.data(), 1U, blocks.size(), sample_file) == blocks.size() && records_ok;
+            } else {
+                records_ok =
+                    std::fwrite(batch.data(), sizeof(SampleRecord), batch.size(), sample_file) == batch.size() &&
+                    records_ok;
+            }
+            batch.clear();
+        };
+        batch.reserve(static_cast<size_t>(std::min<uint64_t>(runs.record_count(), kMergeWriteRecords)));
+        const bool merge_ok = runs.merge([&batch, &write_batch](const SampleRecord& record) {
+            batch.push_back(record);
+            if (batch.size() == kMergeWriteRecords) {
+                write_batch();
+            }
+        });
         if (!batch.empty()) {
-            ok = std::fwrite(batch.data(), sizeof(SampleRecord), batch.size(), async_sample_file_) ==
-                 batch.size();
+            write_batch();
         }
-        if (ok) {
-            ok = std::fflush(async_sample_file_) == 0;
+        const bool flush_ok = std::fflush(sample_file) == 0;
+        std::fclose(sample_file);
+        return header_ok && merge_ok && records_ok && flush_ok;
+    }
+
+    static void flight_signal_handler(int) noexcept {
+        g_flight_dump_requested.store(true, std::memory_order_relaxed);
+    }
+
+    void restore_flight_signal_locked() noexcept {
+        if (flight_config_.signal_number != 0) {
+            (void)std::signal(flight_config_.signal_number, flight_previous_handler_);
+            flight_config_.signal_number = 0;
         }
-        if (ok) {
-            async_exported_samples_ += static_cast<uint64_t>(batch.size());
-        } else {
-            async_write_failed_ = true;
+        flight_previous_handler_ = SIG_DFL;
+    }
+
+    // Polls the request flag rather than waiting on it: a signal handler may only touch the
+    // lock-free atomic, so there is nothing it could safely notify.
+    void flight_trigger_worker() noexcept {
+        const auto cooldown_ns = static_cast<uint64_t>(flight_config_.cooldown_ms) * 1000000ULL;
+        uint64_t last_dump_ns = 0U;
+        std::unique_lock<std::mutex> lock(flight_mutex_);
+        for (;;) {
+            if (flight_cv_.wait_for(lock, std::chrono::milliseconds(kFlightTriggerPollMs),
+                                    [this]() { return flight_stop_; })) {
+                break;
+            }
+            if (!g_flight_dump_requested.exchange(false, std::memory_order_relaxed)) {
+                continue;
+            }
+            if (flight_dumps_ >= flight_config_.max_dumps ||
+                (flight_dumps_ != 0U && monotonic_now_ns() - last_dump_ns < cooldown_ns)) {
+                continue;
+            }
+            if (flight_cv_.wait_for(lock, std::chrono::milliseconds(flight_config_.post_trigger_ms),
+                                    [this]() { return flight_stop_; })) {
+                break;
+            }
+
+            const std::string base = flight_prefix_ + "." + std::to_string(flight_dumps_);
+            const std::string sample_path = base + ".perfbin";
+            const std::string site_path = base + ".sites.tsv";
+            lock.unlock();
+            const bool ok = dump_snapshot({sample_path.c_str(), site_path.c_str()}).success;
+            lock.lock();
+            if (ok) {
+                ++flight_dumps_;
+                last_dump_ns = monotonic_now_ns();
+            }
         }
-        async_dropped_samples_ += dropped;
     }
 
     void drain_shards(std::vector<SampleRecord>& output, uint64_t& dropped) noexcept {
+        drain_shards([&output](const SampleRecord& record) { output.push_back(record); }, dropped);
+    }
+
+    // Turns every queue into its own sorted runs for the final merge.
+    [[nodiscard]] bool drain_runs(SampleRunSet& runs, uint64_t& dropped) noexcept {
+        std::vector<SampleRecord> run;
+        bool ok = true;
+        const auto append = [&runs, &run, &ok](const SampleRecord& record) {
+            run.push_back(record);
+            if (run.size() == runs.max_run_records()) {
+                ok = runs.add_run(run) && ok;
+            }
+        };
+        std::lock_guard<std::mutex> lock(drain_mutex_);
+        flush_staging();
+        rings_.for_each([&runs, &run, &ok, &append, &dropped](ThreadRing& ring) {
+            ring.drain(append);
+            dropped += ring.take_dropped_samples();
+            ok = runs.add_run(run) && ok;
+        });
+        for (const auto& shard : shards_) {
+            SampleRecord record {};
+            while (shard->dequeue(record)) {
+                append(record);
+            }
+            dropped += shard->take_dropped_samples();
+            ok = runs.add_run(run) && ok;
+        }
+        return ok;
+    }
+
+    template <typename Sink>
+    void drain_shards(Sink&& sink, uint64_t& dropped) noexcept {
+        // Thread rings are single-consumer, so concurrent finalize() callers take turns.
+        std::lock_guard<std::mutex> lock(drain_mutex_);
+        flush_staging();
+        rings_.for_each([&sink, &dropped](ThreadRing& ring) {
+            ring.drain(sink);
+            dropped += ring.take_dropped_samples();
+        });
         for (const auto& shard : shards_) {
             SampleRecord record {};
             while (shard->dequeue(record)) {
-                output.push_back(record);
+                sink(record);
             }
             dropped += shard->take_dropped_samples();
         }
     }
 
-    [[nodiscard]] FileHeader make_header(uint64_t exported_samples, uint64_t dropped_samples) const noexcept {
+    struct HistogramTotals {
+        uint64_t samples = 0U;
+        uint64_t dropped = 0U;
+    };
+
+    struct MergedHistogram {
+        uint64_t count = 0U;
+        uint64_t sum_ns = 0U;
+        uint64_t min_ns = UINT64_MAX;
+        uint64_t max_ns = 0U;
+        std::vector<uint64_t> buckets;
+
+        void merge(const SiteHistogram& histogram) {
+            if (buckets.empty()) {
+                buckets.assign(kHistogramBucketCount, 0U);
+            }
+            count += histogram.count.load(std::memory_order_relaxed);
+            sum_ns += histogram.sum_ns.load(std::memory_order_relaxed);
+            min_ns = std::min(min_ns, histogram.min_ns.load(std::memory_order_relaxed));
+            max_ns = std::max(max_ns, histogram.max_ns.load(std::memory_order_relaxed));
+            for (uint32_t i = 0U; i < kHistogramBucketCount; ++i) {
+                buckets[i] += histogram.buckets[i].load(std::memory_order_relaxed);
+            }
+        }
+    };
+
+    [[nodiscard]] bool write_histogram_file(const char* path, HistogramTotals& totals) const noexcept {
+        std::vector<MergedHistogram> merged(static_cast<size_t>(site_count()) + 1U);
+        histograms_.for_each([&merged, &totals](const ThreadHistograms& thread_histograms) {
+            thread_histograms.for_each_site([&merged](uint32_t site_id, const SiteHistogram& histogram) {
+                if (site_id >= merged.size()) {
+                    merged.resize(static_cast<size_t>(site_id) + 1U);
+                }
+                merged[site_id].merge(histogram);
+            });
+            totals.dropped += thread_histograms.dropped_samples();
+        });
+
+        HistogramFileHeader header {};
+        std::memcpy(header.magic, kHistogramFileMagic, sizeof(kHistogramFileMagic));
+        header.version = kHistogramFileFormatVersion;
+        header.header_size = static_cast<uint32_t>(sizeof(HistogramFileHeader));
+        header.sub_bucket_bits = kHistogramSubBucketBits;
+        header.bucket_count = kHistogramBucketCount;
+        for (const MergedHistogram& histogram : merged) {
+            if (histogram.count != 0U) {
+                ++header.site_count;
+                header.sample_count += histogram.count;
+            }
+        }
+        header.dropped_samples = totals.dropped;
+        totals.samples = header.sample_count;
+
+        const std::string temp_path = std::string(path) + ".tmp";
+        FILE* file = std::fopen(temp_path.c_str(), "wb");
+        if (file == nullptr) {
+            return false;
+        }
+        bool ok = std::fwrite(&header, sizeof(header), 1U, file) == 1U;
+        for (uint32_t site_id = 0U; ok && site_id < merged.size(); ++site_id) {
+            const MergedHistogram& histogram = merged[site_id];
+            if (histogram.count == 0U) {
+                continue;
+            }
+            HistogramSiteHeader site {};
+            site.site_id = site_id;
+            site.count = histogram.count;
+            site.sum_ns = histogram.sum_ns;
+            site.min_ns = histogram.min_ns;
+            site.max_ns = histogram.max_ns;
+            site.bucket_entries = static_cast<uint32_t>(
+                std::count_if(histogram.buckets.begin(), histogram.buckets.end(),
+                              [](uint64_t count) { return count != 0U; }));
+            ok = std::fwrite(&site, sizeof(site), 1U, file) == 1U;
+            for (uint32_t index = 0U; ok && index < kHistogramBucketCount; ++index) {
+                if (histogram.buckets[index] == 0U) {
+                    continue;
+                }
+                unsigned char entry[sizeof(uint32_t) + sizeof(uint64_t)];
+                std::memcpy(entry, &index, sizeof(uint32_t));
+                std::memcpy(entry + sizeof(uint32_t), &histogram.buckets[index], sizeof(uint64_t));
+                ok = std::fwrite(entry, sizeof(entry), 1U, file) == 1U;
+            }
+        }
+        ok = (std::fclose(file) == 0) && ok;
+        return ok && std::rename(temp_path.c_str(), path) == 0;
+    }
+
+    [[nodiscard]] uint64_t duration_to_ns(uint64_t duration) const noexcept {
+        if (clock_source_ == ClockSource::tsc) {
+            return static_cast<uint64_t>(static_cast<double>(duration) * tsc_calibration_.ns_per_tick);
+        }
+        return duration;
+    }
+
+    [[nodiscard]] uint64_t capture_now() const noexcept {
+        if (clock_source_ == ClockSource::tsc) {
+            return read_tsc();
+        }
+        return monotonic_now_ns();
+    }
+
+    [[nodiscard]] TscCalibration export_calibration() const noexcept {
+        if (clock_source_ != ClockSource::tsc) {
+            return tsc_calibration_;
+        }
+        return refine_tsc_calibration(tsc_calibration_);
+    }
+
+    [[nodiscard]] FileHeader make_header(uint64_t exported_samples,
+                                         uint64_t dropped_samples,
+                                         const TscCalibration& calibration) const noexcept {
         FileHeader header {};
-        std::memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+        if (sample_format_ == SampleFormat::compressed) {
+            std::memcpy(header.magic, kBlockFileMagic, sizeof(kBlockFileMagic));
+        } else {
+            std::memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+        }
         header.version = kFileFormatVersion;
         header.record_size = static_cast<uint32_t>(sizeof(SampleRecord));
         header.record_count = exported_samples;
         header.overwritten_samples = 0U;
         header.dropped_samples = dropped_samples;
-        header.shard_count = static_cast<uint32_t>(shards_.size());
-        header.capacity_per_shard = shards_.empty() ? 0U : static_cast<uint32_t>(shards_.front()->capacity());
+        header.shard_count = capture_queue_count();
+        header.capacity_per_shard = static_cast<uint32_t>(capacity_);
+        header.header_size = static_cast<uint32_t>(sizeof(FileHeader));
+        header.clock_source = static_cast<uint32_t>(clock_source_);
+        header.tsc_base_ticks = calibration.base_ticks;
+        header.tsc_base_ns = calibration.base_ns;
+        header.tsc_ns_per_tick = calibration.ns_per_tick;
         return header;
     }
 
     [[nodiscard]] ExportStats make_base_stats() const noexcept {
         ExportStats stats;
-        stats.shard_count = static_cast<uint32_t>(shards_.size());
-        stats.capacity_per_shard = shards_.empty() ? 0U : static_cast<uint32_t>(shards_.front()->capacity());
+        stats.shard_count = capture_queue_count();
+        stats.capacity_per_shard = static_cast<uint32_t>(capacity_);
         stats.registered_sites = site_count();
         return stats;
     }
 
     [[nodiscard]] bool rewrite_async_header_locked(uint64_t exported_samples,
                                                    uint64_t dropped_samples) noexcept {
+#if PERF_DURATION_TRACE_HAS_MMAP
+        if (async_mapped_file_.is_open()) {
+            async_mapped_file_.header() = make_header(exported_samples, dropped_samples, export_calibration());
+            return true;
+        }
+#endif
         if (async_sample_file_ == nullptr) {
             return false;
         }
-        const FileHeader header = make_header(exported_samples, dropped_samples);
+        const FileHeader header = make_header(exported_samples, dropped_samples, export_calibration());
         if (std::fseek(async_sample_file_, 0, SEEK_SET) != 0) {
             return false;
         }
@@ -621,31 +2993,66 @@ class RuntimeState final {
             return false;
         }
         std::fputs("site_id\tlabel\tfile\tfunction\tline\n", site_file);
-        {
-            std::lock_guard<std::mutex> lock(site_mutex_);
-            for (const SiteRef& site : sites_) {
-                std::fprintf(site_file,
-                             "%u\t%s\t%s\t%s\t%u\n",
-                             site.id,
-                             site.site_desc.label ? site.site_desc.label : "",
-                             site.site_desc.file ? site.site_desc.file : "",
-                             site.site_desc.function ? site.site_desc.function : "",
-                             site.site_desc.line);
-            }
-        }
+        // Sites registered while this runs are either listed or left for the next export.
+        site_table_.for_each([site_file](const SiteRef& site) {
+            std::fprintf(site_file,
+                         "%u\t%s\t%s\t%s\t%u\n",
+                         site.id,
+                         site.site_desc.label ? site.site_desc.label : "",
+                         site.site_desc.file ? site.site_desc.file : "",
+                         site.site_desc.function ? site.site_desc.function : "",
+                         site.site_desc.line);
+        });
         return std::fclose(site_file) == 0;
     }
 
-    void close_async_file_locked() noexcept {
+    // Opens async_segment_path_ with an empty header.
+    [[nodiscard]] bool open_async_sample_file_locked(const AsyncExportConfig& config) noexcept {
+        const FileHeader header = make_header(0U, 0U, tsc_calibration_);
+#if PERF_DURATION_TRACE_HAS_MMAP
+        if (config.writer == SampleWriter::mmap) {
+            return async_mapped_file_.open(async_segment_path_.c_str(), header, config.mmap_chunk_bytes);
+        }
+#else
+        (void)config;
+#endif
+        async_sample_file_ = std::fopen(async_segment_path_.c_str(), "wb+");
+        if (async_sample_file_ == nullptr) {
+            return false;
+        }
+        if (std::fwrite(&header, sizeof(header), 1U, async_sample_file_) != 1U ||
+            std::fflush(async_sample_file_) != 0) {
+            (void)close_async_sample_file_locked();
+            return false;
+        }
+        return true;
+    }
+
+    bool close_async_sample_file_locked() noexcept {
+        bool ok = true;
+#if PERF_DURATION_TRACE_HAS_MMAP
+        if (async_mapped_file_.is_open()) {
+            ok = async_mapped_file_.close();
+        }
+#endif
         if (async_sample_file_ != nullptr) {
-            std::fclose(async_sample_file_);
+            ok = std::fclose(async_sample_file_) == 0 && ok;
             async_sample_file_ = nullptr;
         }
+        return ok;
+    }
+
+    bool close_async_file_locked() noexcept {
+#if PERF_DURATION_TRACE_HAS_MMAP
+        async_live_.close();
+#endif
+        return close_async_sample_file_locked();
     }
 
     void reconfigure(const Config& config) noexcept {
-        const size_t shard_count = normalize_shard_count(config.shard_count);
         const size_t capacity = normalize_capacity(config.capacity_per_shard);
+        const size_t shard_count =
+            config.capture_mode == CaptureMode::sharded ? normalize_shard_count(config.shard_count) : 0U;
 
         std::vector<std::unique_ptr<Shard>> next_shards;
         next_shards.reserve(shard_count);
@@ -653,50 +3060,183 @@ class RuntimeState final {
             next_shards.emplace_back(new Shard(capacity));
         }
 
+        staging_.clear();
         shards_.swap(next_shards);
+        rings_.clear();
+        histograms_.clear();
+        flight_rings_.clear();
+        capture_mode_ = config.capture_mode;
+        sample_format_ = config.sample_format;
+        cpu_hint_source_ = config.cpu_hint_source;
+        if (cpu_hint_source_ == CpuHintSource::rdtscp && !rdtscp_supported()) {
+            cpu_hint_source_ = CpuHintSource::getcpu;
+        }
+        cpu_hint_interval_ = config.cpu_hint_interval != 0U ? config.cpu_hint_interval : 1U;
+        thread_table_ = config.thread_table;
+        finalize_memory_records_ = config.finalize_memory_bytes / sizeof(SampleRecord);
+        staging_batch_ = config.staging_batch > 1U ? std::min<size_t>(config.staging_batch, capacity) : 0U;
+        {
+            std::lock_guard<std::mutex> lock(thread_mutex_);
+            threads_.clear();
+        }
+        capacity_ = capacity;
+        clock_source_ = ClockSource::monotonic;
+        tsc_calibration_ = TscCalibration{};
+        if (config.clock_source == ClockSource::tsc && tsc_is_invariant()) {
+            clock_source_ = ClockSource::tsc;
+            tsc_calibration_ = calibrate_tsc();
+        }
+        const double staging_flush_ns = static_cast<double>(config.staging_flush_us) * 1000.0;
+        staging_flush_ticks_ = clock_source_ == ClockSource::tsc
+                                   ? static_cast<uint64_t>(staging_flush_ns / tsc_calibration_.ns_per_tick)
+                                   : static_cast<uint64_t>(staging_flush_ns);
         generation_.fetch_add(1U, std::memory_order_release);
-        next_sequence_.store(0U, std::memory_order_relaxed);
     }
 
     [[nodiscard]] ThreadRoute& route_for_current_thread() noexcept {
         ThreadRoute& route = g_thread_route;
         const auto generation = generation_.load(std::memory_order_acquire);
-        if (route.initialized && route.generation == generation &&
-            static_cast<size_t>(route.shard_id) < shards_.size()) {
+        if (route.initialized && route.generation == generation) {
             return route;
         }
 
         route.generation = generation;
+        route.next_sequence = 0U;
+        route.span_depth = 0U;
+        if (route.span_stack == nullptr) {
+            route.span_stack = span_stacks_.acquire([] { return new (std::nothrow) SpanStack(); });
+            g_span_stack_lease.stack = route.span_stack;
+        }
         route.tid_hash = hash_current_thread();
-        route.shard_id = static_cast<uint16_t>(route.tid_hash & static_cast<uint32_t>(shards_.size() - 1U));
+        route.sample_state = route.tid_hash | 1U;
+        route.cpu_hint = 0U;
+        route.cpu_hint_countdown = 0U;
+        if (thread_table_) {
+            record_thread(route.tid_hash);
+        }
+        route.ring = nullptr;
+        route.histograms = nullptr;
+        route.flight = nullptr;
+        route.staging = nullptr;
+        route.shard_id = 0U;
+        if (capture_mode_ == CaptureMode::thread_ring) {
+            route.ring = rings_.acquire([this]() { return new (std::nothrow) ThreadRing(capacity_); });
+        } else if (capture_mode_ == CaptureMode::histogram) {
+            route.histograms = histograms_.acquire([]() { return new (std::nothrow) ThreadHistograms; });
+        } else if (capture_mode_ == CaptureMode::flight_recorder) {
+            route.flight = flight_rings_.acquire([this]() { return new (std::nothrow) FlightRing(capacity_); });
+        } else {
+            route.shard_id =
+                static_cast<uint16_t>(route.tid_hash & static_cast<uint32_t>(shards_.size() - 1U));
+            if (staging_batch_ != 0U) {
+                route.staging =
+                    staging_.acquire([this]() { return new (std::nothrow) StagingBuffer(staging_batch_); });
+                if (route.staging != nullptr) {
+                    route.staging->bind(shards_[static_cast<size_t>(route.shard_id)].get());
+                }
+            }
+        }
+        if (route.ring != nullptr || route.histograms != nullptr || route.flight != nullptr ||
+            route.staging != nullptr) {
+            // Touching the lease registers its destructor, which hands the resources back
+            // to the registry when this thread exits.
+            ThreadLease& lease = g_thread_lease;
+            lease.generation = generation;
+            lease.ring = route.ring;
+            lease.histograms = route.histograms;
+            lease.flight = route.flight;
+            lease.staging = route.staging;
+        }
         route.initialized = true;
         return route;
     }
 
+    [[nodiscard]] uint32_t capture_queue_count() const noexcept {
+        if (capture_mode_ == CaptureMode::thread_ring) {
+            return rings_.size();
+        }
+        if (capture_mode_ == CaptureMode::histogram) {
+            return histograms_.size();
+        }
+        if (capture_mode_ == CaptureMode::flight_recorder) {
+            return flight_rings_.size();
+        }
+        return static_cast<uint32_t>(shards_.size());
+    }
+
     [[nodiscard]] uint64_t site_count() const noexcept {
-        std::lock_guard<std::mutex> lock(site_mutex_);
-        return static_cast<uint64_t>(sites_.size());
+        return site_table_.size();
     }
 
-    mutable std::mutex site_mutex_;
-    std::deque<SiteRef> sites_;
+    SiteTable site_table_;
+    mutable std::mutex thread_mutex_;
+    std::vector<ThreadInfo> threads_;
+    SiteRef overflow_site_ {};
+    // Serializes rule writers only; registration reads site_rules_ without it.
+    std::mutex site_rules_mutex_;
+    std::atomic<const SiteRuleList*> site_rules_ {nullptr};
+    const SiteRuleList* env_site_rules_ = nullptr;
+    std::vector<std::unique_ptr<const SiteRuleList>> site_rule_snapshots_;
+    std::atomic<uint32_t> site_rule_readers_ {0U};
     std::vector<std::unique_ptr<Shard>> shards_;
+    ThreadResourceList<ThreadRing> rings_;
+    ThreadResourceList<ThreadHistograms> histograms_;
+    ThreadResourceList<FlightRing> flight_rings_;
+    ThreadResourceList<StagingBuffer> staging_;
+    // Never cleared: tokens may still point at a stack after a reconfiguration.
+    ThreadResourceList<SpanStack> span_stacks_;
+    std::mutex drain_mutex_;
+    CaptureMode capture_mode_ = CaptureMode::sharded;
+    ClockSource clock_source_ = ClockSource::monotonic;
+    SampleFormat sample_format_ = SampleFormat::fixed;
+    CpuHintSource cpu_hint_source_ = CpuHintSource::none;
+    uint32_t cpu_hint_interval_ = 1U;
+    bool thread_table_ = false;
+    size_t finalize_memory_records_ = 0U;
+    size_t staging_batch_ = 0U;
+    uint64_t staging_flush_ticks_ = 0U;
+    TscCalibration tsc_calibration_ {};
+    size_t capacity_ = 0U;
     std::atomic<uint64_t> generation_ {1U};
-    std::atomic<uint32_t> next_sequence_ {0U};
-    uint32_t next_site_id_ = 1U;
 
     mutable std::mutex async_mutex_;
     std::condition_variable async_cv_;
     std::thread async_thread_;
     AsyncExportConfig async_config_ {};
     FILE* async_sample_file_ = nullptr;
+#if PERF_DURATION_TRACE_HAS_MMAP
+    MappedSampleFile async_mapped_file_;
+    LiveSegment async_live_;
+#endif
     uint64_t async_exported_samples_ = 0U;
     uint64_t async_dropped_samples_ = 0U;
+    uint64_t async_drop_markers_ = 0U;
+    // The sample file being written: the configured path, or the current rotated segment.
+    std::string async_segment_path_;
+    uint32_t async_segment_index_ = 0U;
+    // Header counts of the current segment (records include drop markers).
+    uint64_t async_segment_records_ = 0U;
+    uint64_t async_segment_dropped_ = 0U;
+    uint64_t async_segment_bytes_ = 0U;
+    uint64_t async_segment_started_ = 0U;
+    uint64_t async_last_flush_ = 0U;
     ExportStats async_last_stats_ {};
     bool async_last_stats_ready_ = false;
     AsyncState async_state_ = AsyncState::stopped;
     bool async_stop_requested_ = false;
     bool async_write_failed_ = false;
+
+    std::mutex flight_mutex_;
+    std::condition_variable flight_cv_;
+    std::thread flight_thread_;
+    FlightTriggerConfig flight_config_ {};
+    std::string flight_prefix_;
+    void (*flight_previous_handler_)(int) = SIG_DFL;
+    // Site id 0 is never registered, so 0 disables the latency trigger.
+    std::atomic<uint32_t> flight_trigger_site_ {0U};
+    std::atomic<uint64_t> flight_trigger_threshold_ {UINT64_MAX};
+    uint32_t flight_dumps_ = 0U;
+    bool flight_stop_ = false;
 };
 
 [[nodiscard]] inline RuntimeState& state() noexcept {
@@ -707,6 +3247,12 @@ class RuntimeState final {
     return *runtime_state;
 }
 
+inline ThreadLease::~ThreadLease() {
+    if (ring != nullptr || histograms != nullptr || flight != nullptr || staging != nullptr) {
+        state().release_thread_resources(*this);
+    }
+}
+
 }  // namespace perf_duration_trace::detail
 
 namespace perf_duration_trace {
@@ -724,6 +3270,14 @@ inline Runtime::~Runtime() = default;
     return detail::state().register_site(desc);
 }
 
+inline void Runtime::set_site_sampling(const SiteRef& site, uint32_t every_n) noexcept {
+    detail::state().set_site_sampling(site, every_n);
+}
+
+inline size_t Runtime::set_site_sampling(const char* glob, uint32_t every_n) {
+    return detail::state().set_site_sampling(glob, every_n);
+}
+
 [[nodiscard]] inline Token Runtime::begin(const SiteRef& site) noexcept {
     return detail::state().begin(site);
 }
@@ -732,6 +3286,20 @@ inline void Runtime::end(Token token) noexcept {
     detail::state().end(token);
 }
 
+inline void Runtime::end(Token token, uint64_t arg0) noexcept {
+    const uint64_t args[] = {arg0};
+    detail::state().end_with_args<1U>(token, args);
+}
+
+inline void Runtime::end(Token token, uint64_t arg0, uint64_t arg1) noexcept {
+    const uint64_t args[] = {arg0, arg1};
+    detail::state().end_with_args<2U>(token, args);
+}
+
+inline void Runtime::flush_staging() noexcept {
+    detail::state().flush_staging();
+}
+
 [[nodiscard]] inline bool Runtime::start_async_export(const AsyncExportConfig& config) noexcept {
     return detail::state().start_async_export(config);
 }
@@ -744,6 +3312,22 @@ inline void Runtime::end(Token token) noexcept {
     return detail::state().finalize(paths);
 }
 
+[[nodiscard]] inline ExportStats Runtime::dump_snapshot(const ExportPaths& paths) noexcept {
+    return detail::state().dump_snapshot(paths);
+}
+
+[[nodiscard]] inline bool Runtime::arm_flight_trigger(const FlightTriggerConfig& config) noexcept {
+    return detail::state().arm_flight_trigger(config);
+}
+
+inline uint32_t Runtime::disarm_flight_trigger() noexcept {
+    return detail::state().disarm_flight_trigger();
+}
+
+inline void Runtime::request_flight_dump() noexcept {
+    detail::g_flight_dump_requested.store(true, std::memory_order_relaxed);
+}
+
 inline void Runtime::reset_for_tests(const Config& config) noexcept {
     detail::state().reset_for_tests(config);
 }
@@ -752,16 +3336,45 @@ inline void Runtime::reset_for_tests(const Config& config) noexcept {
     return detail::state().now_ns();
 }
 
-inline Scope::Scope(const SiteRef& site) noexcept : token_(Runtime::instance().begin(site)) {}
+// Disabled sites are filtered before touching the runtime singletons, so a switched-off
+// scope costs two loads and two predictable branches.
+inline Scope::Scope(const SiteRef& site) noexcept
+    : token_(site.control.load(std::memory_order_relaxed) == kSiteOff ? Token {}
+                                                                       : Runtime::instance().begin(site)) {}
 
 inline Scope::~Scope() noexcept {
-    Runtime::instance().end(token_);
+    if (token_.valid()) {
+        Runtime::instance().end(token_);
+    }
 }
 
 inline Scope::Scope(Scope&& other) noexcept : token_(other.token_) {
     other.token_ = Token{};
 }
 
+inline ArgScope::ArgScope(const SiteRef& site, uint64_t arg0) noexcept
+    : token_(site.control.load(std::memory_order_relaxed) == kSiteOff ? Token {}
+                                                                       : Runtime::instance().begin(site)),
+      args_ {arg0, 0U},
+      arg_count_(1U) {}
+
+inline ArgScope::ArgScope(const SiteRef& site, uint64_t arg0, uint64_t arg1) noexcept
+    : token_(site.control.load(std::memory_order_relaxed) == kSiteOff ? Token {}
+                                                                       : Runtime::instance().begin(site)),
+      args_ {arg0, arg1},
+      arg_count_(2U) {}
+
+inline ArgScope::~ArgScope() noexcept {
+    if (!token_.valid()) {
+        return;
+    }
+    if (arg_count_ == 1U) {
+        Runtime::instance().end(token_, args_[0]);
+    } else {
+        Runtime::instance().end(token_, args_[0], args_[1]);
+    }
+}
+
 namespace detail {
 
 [[nodiscard]] inline const SiteRef& static_site(StaticSiteSlot& slot, const SiteDesc& desc) {
@@ -800,8 +3413,13 @@ inline Runtime::~Runtime() = default;
     return site_ref;
 }
 
+inline void Runtime::set_site_sampling(const SiteRef&, uint32_t) noexcept {}
+inline size_t Runtime::set_site_sampling(const char*, uint32_t) { return 0U; }
 [[nodiscard]] inline Token Runtime::begin(const SiteRef&) noexcept { return {}; }
 inline void Runtime::end(Token) noexcept {}
+inline void Runtime::end(Token, uint64_t) noexcept {}
+inline void Runtime::end(Token, uint64_t, uint64_t) noexcept {}
+inline void Runtime::flush_staging() noexcept {}
 [[nodiscard]] inline bool Runtime::start_async_export(const AsyncExportConfig&) noexcept { return true; }
 [[nodiscard]] inline ExportStats Runtime::stop_async_export() noexcept {
     ExportStats stats;
@@ -813,6 +3431,14 @@ inline void Runtime::end(Token) noexcept {}
     stats.success = true;
     return stats;
 }
+[[nodiscard]] inline ExportStats Runtime::dump_snapshot(const ExportPaths&) noexcept {
+    ExportStats stats;
+    stats.success = true;
+    return stats;
+}
+[[nodiscard]] inline bool Runtime::arm_flight_trigger(const FlightTriggerConfig&) noexcept { return true; }
+inline uint32_t Runtime::disarm_flight_trigger() noexcept { return 0U; }
+inline void Runtime::request_flight_dump() noexcept {}
 inline void Runtime::reset_for_tests(const Config&) noexcept {}
 [[nodiscard]] inline uint64_t Runtime::now_ns() const noexcept { return 0U; }
 
@@ -820,10 +3446,18 @@ inline Scope::Scope(const SiteRef&) noexcept : token_{} {}
 inline Scope::~Scope() noexcept = default;
 inline Scope::Scope(Scope&& other) noexcept : token_(other.token_) { other.token_ = Token{}; }
 
+inline ArgScope::ArgScope(const SiteRef&, uint64_t) noexcept : token_{}, args_{}, arg_count_(0U) {}
+inline ArgScope::ArgScope(const SiteRef&, uint64_t, uint64_t) noexcept : token_{}, args_{}, arg_count_(0U) {}
+inline ArgScope::~ArgScope() noexcept = default;
+
 namespace detail {
 
 struct StaticSiteSlot {};
 
+// Declared only; PERF_SCOPE_ARG / PERF_END_ARG name it inside sizeof.
+template <typename... Args>
+int unevaluated_args(const Args&...) noexcept;
+
 [[nodiscard]] inline const SiteRef& static_site(StaticSiteSlot&, const SiteDesc& desc) {
     static const SiteRef site_ref{0U, desc};
     return site_ref;
@@ -869,10 +3503,20 @@ struct StaticSiteSlot {};
 
 #define PERF_TRACE_END(token) (::perf_duration_trace::Runtime::instance().end((token)))
 
+// One or two uint64_t values attached to the span, e.g. PERF_SCOPE_ARG("copy", bytes).
+#define PERF_TRACE_SCOPE_ARG(name_literal, ...)                                              \
+    ::perf_duration_trace::ArgScope PERF_DURATION_TRACE_JOIN(perf_scope_, __LINE__)(         \
+        PERF_TRACE_SITE(name_literal), __VA_ARGS__)
+
+#define PERF_TRACE_END_ARG(token, ...)                                                       \
+    (::perf_duration_trace::Runtime::instance().end((token), __VA_ARGS__))
+
 #define PERF_SCOPE(name_literal) PERF_TRACE_SCOPE(name_literal)
 #define PERF_SCOPE_FUNC() PERF_TRACE_SCOPE_FUNC()
+#define PERF_SCOPE_ARG(name_literal, ...) PERF_TRACE_SCOPE_ARG(name_literal, __VA_ARGS__)
 #define PERF_BEGIN(name_literal) PERF_TRACE_BEGIN(name_literal)
 #define PERF_END(token) PERF_TRACE_END(token)
+#define PERF_END_ARG(token, ...) PERF_TRACE_END_ARG(token, __VA_ARGS__)
 
 #else
 
@@ -880,10 +3524,17 @@ struct StaticSiteSlot {};
 #define PERF_TRACE_SCOPE_FUNC() ((void)0)
 #define PERF_TRACE_BEGIN(name_literal) (::perf_duration_trace::Token{})
 #define PERF_TRACE_END(token) ((void)(token))
+// The values are not evaluated, only named so that variables feeding them stay "used".
+#define PERF_TRACE_SCOPE_ARG(name_literal, ...)                                              \
+    ((void)sizeof(name_literal), (void)sizeof(::perf_duration_trace::detail::unevaluated_args(__VA_ARGS__)))
+#define PERF_TRACE_END_ARG(token, ...)                                                       \
+    ((void)(token), (void)sizeof(::perf_duration_trace::detail::unevaluated_args(__VA_ARGS__)))
 
 #define PERF_SCOPE(name_literal) PERF_TRACE_SCOPE(name_literal)
 #define PERF_SCOPE_FUNC() PERF_TRACE_SCOPE_FUNC()
+#define PERF_SCOPE_ARG(name_literal, ...) PERF_TRACE_SCOPE_ARG(name_literal, __VA_ARGS__)
 #define PERF_BEGIN(name_literal) PERF_TRACE_BEGIN(name_literal)
 #define PERF_END(token) PERF_TRACE_END(token)
+#define PERF_END_ARG(token, ...) PERF_TRACE_END_ARG(token, __VA_ARGS__)
 
 #endif
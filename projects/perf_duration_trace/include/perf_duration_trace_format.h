@@ -0,0 +1,394 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// On-disk layout shared by the runtime writer (perf_duration_trace.h) and offline readers
+// (perf_duration_trace_reader.h). Nothing here depends on PERF_ENABLED.
+
+namespace perf_duration_trace {
+
+struct SampleRecord {
+    uint64_t start_ns = 0;
+    uint64_t duration_ns = 0;
+    uint32_t site_id = 0;
+    uint32_t tid_hash = 0;
+    // Low 32 bits of the producing thread's 64-bit sample counter. (tid_hash, seq_no) is
+    // unique per thread; the export order is (start_ns, site_id, tid_hash, seq_no).
+    uint32_t seq_no = 0;
+    // CPU the span ended on plus one, or 0 when not captured (see Config::cpu_hint_source).
+    uint16_t cpu_hint = 0;
+    // Bits 0-5: span nesting depth on the producing thread (0 = outermost, saturates at 63).
+    // Bits 6-7: number of argument records that follow the sample (version 3).
+    // Bit 14: argument record, see kRecordArgument.
+    // Bit 15: drop marker, see kRecordDropMarker.
+    uint16_t flags = 0;
+};
+
+namespace detail {
+
+constexpr uint32_t kFileFormatVersion = 3U;
+constexpr char kFileMagic[8] = {'P', 'D', 'T', 'B', 'I', 'N', '1', '\0'};
+constexpr char kBlockFileMagic[8] = {'P', 'D', 'T', 'B', 'I', 'N', '2', '\0'};
+constexpr uint16_t kRecordDepthMask = 0x3FU;
+// Version 1 headers end before header_size; later versions record their own size.
+constexpr size_t kFileHeaderV1Size = 48U;
+// FileHeader::clock_source value of ClockSource::tsc.
+constexpr uint32_t kTscClockSource = 1U;
+// Not a sample: async export appends one per flush interval that lost samples. start_ns and
+// duration_ns span the interval, seq_no holds the dropped count (saturating), site_id and
+// tid_hash are 0. FileHeader::record_count includes markers.
+constexpr uint16_t kRecordDropMarker = 1U << 15U;
+// Not a sample: one numeric payload of the sample with the same (tid_hash, seq_no, site_id,
+// start_ns), written by PERF_SCOPE_ARG / PERF_END_ARG. duration_ns holds the value and
+// cpu_hint the argument index. Argument records sort right after their sample; a reader
+// that lost the sample (ring overflow, flight recorder overwrite) ignores them.
+constexpr uint16_t kRecordArgument = 1U << 14U;
+constexpr uint16_t kRecordArgCountShift = 6U;
+constexpr uint16_t kRecordArgCountMask = 0x3U << kRecordArgCountShift;
+constexpr uint32_t kMaxRecordArgs = 2U;
+
+[[nodiscard]] constexpr uint16_t record_depth_flags(uint16_t depth) noexcept {
+    return depth < kRecordDepthMask ? depth : kRecordDepthMask;
+}
+
+[[nodiscard]] constexpr uint16_t record_depth(const SampleRecord& record) noexcept {
+    return static_cast<uint16_t>(record.flags & kRecordDepthMask);
+}
+
+[[nodiscard]] constexpr bool is_drop_marker(const SampleRecord& record) noexcept {
+    return (record.flags & kRecordDropMarker) != 0U;
+}
+
+[[nodiscard]] constexpr bool is_argument(const SampleRecord& record) noexcept {
+    return (record.flags & kRecordArgument) != 0U;
+}
+
+[[nodiscard]] constexpr uint32_t record_arg_count(const SampleRecord& record) noexcept {
+    return static_cast<uint32_t>((record.flags & kRecordArgCountMask) >> kRecordArgCountShift);
+}
+
+// Tie-break after (start_ns, site_id, tid_hash, seq_no): a sample, then its arguments in
+// index order.
+[[nodiscard]] constexpr bool record_kind_less(const SampleRecord& lhs, const SampleRecord& rhs) noexcept {
+    const bool lhs_argument = is_argument(lhs);
+    const bool rhs_argument = is_argument(rhs);
+    if (lhs_argument != rhs_argument) {
+        return rhs_argument;
+    }
+    return lhs_argument && lhs.cpu_hint < rhs.cpu_hint;
+}
+
+[[nodiscard]] inline uint32_t highest_bit(uint64_t value) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63U - static_cast<uint32_t>(__builtin_clzll(value));
+#else
+    uint32_t bit = 0U;
+    while ((value >>= 1U) != 0U) {
+        ++bit;
+    }
+    return bit;
+#endif
+}
+
+// Log-linear buckets shared by the runtime histograms and the tools: values below
+// 2 << sub_bucket_bits get a bucket each, then every power of two is split into
+// 1 << sub_bucket_bits buckets of equal width.
+struct BucketBounds {
+    uint64_t lower;
+    uint64_t width;
+};
+
+[[nodiscard]] inline uint32_t log_linear_bucket_index(uint64_t value, uint32_t sub_bucket_bits) noexcept {
+    if (value < (uint64_t {2} << sub_bucket_bits)) {
+        return static_cast<uint32_t>(value);
+    }
+    const uint32_t exponent = highest_bit(value) - sub_bucket_bits;
+    return (exponent << sub_bucket_bits) + static_cast<uint32_t>(value >> exponent);
+}
+
+[[nodiscard]] inline BucketBounds log_linear_bucket_bounds(uint64_t index, uint32_t sub_bucket_bits) noexcept {
+    const uint64_t sub_bucket_count = uint64_t {1} << sub_bucket_bits;
+    if (index < 2U * sub_bucket_count) {
+        return {index, 1U};
+    }
+    const uint64_t exponent = index / sub_bucket_count - 1U;
+    return {(index - exponent * sub_bucket_count) << exponent, uint64_t {1} << exponent};
+}
+
+constexpr uint32_t kHistogramFileFormatVersion = 1U;
+constexpr char kHistogramFileMagic[8] = {'P', 'D', 'T', 'H', 'S', 'T', '1', '\0'};
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t record_count;
+    uint64_t overwritten_samples;
+    uint64_t dropped_samples;
+    uint32_t shard_count;
+    uint32_t capacity_per_shard;
+    // Version 2 fields. Readers locate the first record at header_size.
+    uint32_t header_size;
+    // 0 for monotonic nanoseconds, kTscClockSource for raw TSC ticks.
+    uint32_t clock_source;
+    // ns = tsc_base_ns + (ticks - tsc_base_ticks) * tsc_ns_per_tick when clock_source is tsc.
+    uint64_t tsc_base_ticks;
+    uint64_t tsc_base_ns;
+    double tsc_ns_per_tick;
+};
+
+static_assert(std::is_trivially_copyable_v<SampleRecord>,
+              "SampleRecord must remain trivially copyable");
+static_assert(std::is_trivially_copyable_v<FileHeader>,
+              "FileHeader must remain trivially copyable for binary serialization");
+static_assert(sizeof(FileHeader) == 80U,
+              "FileHeader size must match Python struct.Struct('<8sIIQQQIIIIQQd') = 80 bytes");
+static_assert(sizeof(SampleRecord) == 32U,
+              "SampleRecord size must match Python struct.Struct('<QQIIIHH') = 32 bytes");
+
+// Compressed sample files (magic PDTBIN2) share FileHeader; record_size still names the
+// decoded SampleRecord size. From header_size on, the file is a sequence of blocks, each a
+// BlockHeader followed by payload_bytes of payload. A block holds records of one thread
+// ordered by (start_ns, site_id, seq_no):
+//
+//   site dictionary   site_count varints, ascending site ids delta-encoded
+//   per record        varint  start_ns delta from the previous record (first: first_start_ns)
+//                     varint  duration_ns
+//                     varint  dictionary index       (only when site_count > 1)
+//                     varint  zigzag(seq_no - previous seq_no - 1)   (first: vs first_seq_no)
+//                     varint  cpu_hint               (only with kBlockHasCpuHint)
+//                     varint  flags                  (only with kBlockHasFlags)
+struct BlockHeader {
+    uint32_t payload_bytes;
+    uint32_t record_count;
+    uint32_t tid_hash;
+    uint32_t first_seq_no;
+    uint64_t first_start_ns;
+    uint64_t last_start_ns;
+    uint32_t site_count;
+    uint16_t flags;
+    uint16_t reserved;
+};
+
+static_assert(std::is_trivially_copyable_v<BlockHeader>,
+              "BlockHeader must remain trivially copyable for binary serialization");
+static_assert(sizeof(BlockHeader) == 40U,
+              "BlockHeader size must match Python struct.Struct('<IIIIQQIHH') = 40 bytes");
+
+constexpr uint16_t kBlockHasCpuHint = 1U << 0U;
+constexpr uint16_t kBlockHasFlags = 1U << 1U;
+constexpr size_t kBlockMaxRecords = 4096U;
+constexpr size_t kMaxVarintBytes = 10U;
+
+// Histogram export: header, then site_count entries of HistogramSiteHeader each followed by
+// bucket_entries packed (uint32 bucket_index, uint64 count) pairs for the non-empty buckets.
+struct HistogramFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t sub_bucket_bits;
+    uint32_t bucket_count;
+    uint64_t site_count;
+    uint64_t sample_count;
+    uint64_t dropped_samples;
+};
+
+struct HistogramSiteHeader {
+    uint32_t site_id;
+    uint32_t bucket_entries;
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+};
+
+static_assert(sizeof(HistogramFileHeader) == 48U,
+              "HistogramFileHeader size must match Python struct.Struct('<8sIIIIQQQ') = 48 bytes");
+static_assert(sizeof(HistogramSiteHeader) == 40U,
+              "HistogramSiteHeader size must match Python struct.Struct('<IIQQQQ') = 40 bytes");
+
+inline void put_varint(std::vector<unsigned char>& out, uint64_t value) {
+    while (value >= 0x80U) {
+        out.push_back(static_cast<unsigned char>(value | 0x80U));
+        value >>= 7U;
+    }
+    out.push_back(static_cast<unsigned char>(value));
+}
+
+[[nodiscard]] inline bool get_varint(const unsigned char*& cursor, const unsigned char* end,
+                                     uint64_t& value) noexcept {
+    value = 0U;
+    for (uint32_t shift = 0U; shift < 64U && cursor != end; shift += 7U) {
+        const unsigned char byte = *cursor++;
+        value |= static_cast<uint64_t>(byte & 0x7FU) << shift;
+        if ((byte & 0x80U) == 0U) {
+            return true;
+        }
+    }
+    return false;
+}
+
+[[nodiscard]] inline uint64_t zigzag_encode(int64_t value) noexcept {
+    return (static_cast<uint64_t>(value) << 1U) ^ static_cast<uint64_t>(value >> 63);
+}
+
+[[nodiscard]] inline int64_t zigzag_decode(uint64_t value) noexcept {
+    return static_cast<int64_t>(value >> 1U) ^ -static_cast<int64_t>(value & 1U);
+}
+
+inline void encode_block(const SampleRecord* records, size_t count, std::vector<unsigned char>& out,
+                         std::vector<uint32_t>& dictionary) {
+    dictionary.clear();
+    uint16_t block_flags = 0U;
+    for (size_t i = 0U; i < count; ++i) {
+        dictionary.push_back(records[i].site_id);
+        if (records[i].cpu_hint != 0U) {
+            block_flags = static_cast<uint16_t>(block_flags | kBlockHasCpuHint);
+        }
+        if (records[i].flags != 0U) {
+            block_flags = static_cast<uint16_t>(block_flags | kBlockHasFlags);
+        }
+    }
+    std::sort(dictionary.begin(), dictionary.end());
+    dictionary.erase(std::unique(dictionary.begin(), dictionary.end()), dictionary.end());
+
+    BlockHeader header {};
+    header.record_count = static_cast<uint32_t>(count);
+    header.tid_hash = records[0].tid_hash;
+    header.first_seq_no = records[0].seq_no;
+    header.first_start_ns = records[0].start_ns;
+    header.last_start_ns = records[count - 1U].start_ns;
+    header.site_count = static_cast<uint32_t>(dictionary.size());
+    header.flags = block_flags;
+
+    const size_t header_offset = out.size();
+    out.resize(out.size() + sizeof(BlockHeader));
+    const size_t payload_offset = out.size();
+
+    uint32_t previous_site = 0U;
+    for (const uint32_t site_id : dictionary) {
+        put_varint(out, site_id - previous_site);
+        previous_site = site_id;
+    }
+
+    uint64_t previous_start = header.first_start_ns;
+    uint32_t previous_seq = header.first_seq_no - 1U;
+    for (size_t i = 0U; i < count; ++i) {
+        const SampleRecord& record = records[i];
+        put_varint(out, record.start_ns - previous_start);
+        put_varint(out, record.duration_ns);
+        if (dictionary.size() > 1U) {
+            const auto it = std::lower_bound(dictionary.begin(), dictionary.end(), record.site_id);
+            put_varint(out, static_cast<uint64_t>(it - dictionary.begin()));
+        }
+        put_varint(out, zigzag_encode(static_cast<int32_t>(record.seq_no - previous_seq - 1U)));
+        if ((block_flags & kBlockHasCpuHint) != 0U) {
+            put_varint(out, record.cpu_hint);
+        }
+        if ((block_flags & kBlockHasFlags) != 0U) {
+            put_varint(out, record.flags);
+        }
+        previous_start = record.start_ns;
+        previous_seq = record.seq_no;
+    }
+
+    header.payload_bytes = static_cast<uint32_t>(out.size() - payload_offset);
+    std::memcpy(out.data() + header_offset, &header, sizeof(header));
+}
+
+// Appends the block encoding of records to out. Records may arrive in any order; they are
+// grouped per thread and sorted by start time so timestamp deltas stay small and positive.
+inline void encode_blocks(std::vector<SampleRecord>& records, std::vector<unsigned char>& out) {
+    std::sort(records.begin(), records.end(), [](const SampleRecord& lhs, const SampleRecord& rhs) {
+        if (lhs.tid_hash != rhs.tid_hash) {
+            return lhs.tid_hash < rhs.tid_hash;
+        }
+        if (lhs.start_ns != rhs.start_ns) {
+            return lhs.start_ns < rhs.start_ns;
+        }
+        if (lhs.site_id != rhs.site_id) {
+            return lhs.site_id < rhs.site_id;
+        }
+        if (lhs.seq_no != rhs.seq_no) {
+            return lhs.seq_no < rhs.seq_no;
+        }
+        return record_kind_less(lhs, rhs);
+    });
+
+    std::vector<uint32_t> dictionary;
+    size_t begin = 0U;
+    while (begin < records.size()) {
+        size_t end = begin + 1U;
+        while (end < records.size() && end - begin < kBlockMaxRecords &&
+               records[end].tid_hash == records[begin].tid_hash) {
+            ++end;
+        }
+        encode_block(records.data() + begin, end - begin, out, dictionary);
+        begin = end;
+    }
+}
+
+// Decodes one block payload and appends its records. Returns false on malformed input.
+[[nodiscard]] inline bool decode_block(const BlockHeader& header, const unsigned char* payload,
+                                       std::vector<SampleRecord>& out) {
+    const unsigned char* cursor = payload;
+    const unsigned char* const end = payload + header.payload_bytes;
+    if (header.site_count == 0U && header.record_count != 0U) {
+        return false;
+    }
+
+    std::vector<uint32_t> dictionary(header.site_count);
+    uint64_t site_id = 0U;
+    for (uint32_t& entry : dictionary) {
+        uint64_t delta = 0U;
+        if (!get_varint(cursor, end, delta)) {
+            return false;
+        }
+        site_id += delta;
+        entry = static_cast<uint32_t>(site_id);
+    }
+
+    uint64_t previous_start = header.first_start_ns;
+    uint32_t previous_seq = header.first_seq_no - 1U;
+    out.reserve(out.size() + header.record_count);
+    for (uint32_t i = 0U; i < header.record_count; ++i) {
+        uint64_t start_delta = 0U;
+        uint64_t duration = 0U;
+        uint64_t site_index = 0U;
+        uint64_t seq_delta = 0U;
+        uint64_t cpu_hint = 0U;
+        uint64_t flags = 0U;
+        if (!get_varint(cursor, end, start_delta) || !get_varint(cursor, end, duration) ||
+            (dictionary.size() > 1U && !get_varint(cursor, end, site_index)) ||
+            !get_varint(cursor, end, seq_delta) ||
+            ((header.flags & kBlockHasCpuHint) != 0U && !get_varint(cursor, end, cpu_hint)) ||
+            ((header.flags & kBlockHasFlags) != 0U && !get_varint(cursor, end, flags))) {
+            return false;
+        }
+        if (site_index >= dictionary.size()) {
+            return false;
+        }
+
+        SampleRecord record {};
+        record.start_ns = previous_start + start_delta;
+        record.duration_ns = duration;
+        record.site_id = dictionary[static_cast<size_t>(site_index)];
+        record.tid_hash = header.tid_hash;
+        record.seq_no = previous_seq + 1U + static_cast<uint32_t>(zigzag_decode(seq_delta));
+        record.cpu_hint = static_cast<uint16_t>(cpu_hint);
+        record.flags = static_cast<uint16_t>(flags);
+        out.push_back(record);
+        previous_start = record.start_ns;
+        previous_seq = record.seq_no;
+    }
+    return cursor == end;
+}
+
+}  // namespace detail
+
+}  // namespace perf_duration_trace
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "perf_duration_trace_format.h"
+
+// Layout of the live shared-memory segment that the async export thread fills when
+// AsyncExportConfig::live_shm_name is set, shared with the perf_duration_trace_live reader.
+// Nothing here depends on PERF_ENABLED.
+//
+//   LiveHeader                       at offset 0
+//   LiveSiteEntry[site_capacity]     at header_size
+//   LiveSlot[record_capacity]        after the site table
+//
+// There is one writer, the export thread, and any number of read-only readers. The writer
+// never looks at readers. A slow reader simply finds its records overwritten, and a dead
+// reader leaves nothing behind that the writer would wait for. Each record slot is a seqlock
+// like the flight recorder's: the sequence is odd while the slot is rewritten and
+// 2 * position + 2 once it holds record `position`, so readers detect torn copies and
+// overwritten slots without taking any lock.
+
+namespace perf_duration_trace::detail {
+
+constexpr uint32_t kLiveFormatVersion = 1U;
+constexpr char kLiveMagic[8] = {'P', 'D', 'T', 'S', 'H', 'M', '1', '\0'};
+constexpr size_t kLiveLabelSize = 120U;
+constexpr size_t kLiveRecordWords = sizeof(SampleRecord) / sizeof(uint64_t);
+
+struct LiveHeader {
+    // The bytes of kLiveMagic, stored with release once everything else in the header is set.
+    std::atomic<uint64_t> magic;
+    uint32_t version;
+    uint32_t header_size;
+    // Power of two; record `position` lives in slot position & (record_capacity - 1).
+    uint32_t record_capacity;
+    // Site id n is described by entry n - 1; sites past the table are shown by id only.
+    uint32_t site_capacity;
+    // ClockSource of the records; with tsc, durations are converted by ns_per_tick.
+    uint32_t clock_source;
+    uint32_t writer_pid;
+    double ns_per_tick;
+    // Records published so far, the next position to be written.
+    std::atomic<uint64_t> write_position;
+    // Samples the capture queues dropped before the export thread saw them, cumulative.
+    std::atomic<uint64_t> dropped_samples;
+    // CLOCK_MONOTONIC_RAW time of the writer's last pass, in nanoseconds. Readers compare it
+    // with their own clock to spot a stalled or exited writer.
+    std::atomic<uint64_t> heartbeat_ns;
+    // Non-zero once the export has stopped; the segment name is already unlinked then.
+    std::atomic<uint32_t> closed;
+    uint32_t reserved;
+};
+
+struct LiveSiteEntry {
+    // Non-zero once line and label are filled; entries are written once.
+    std::atomic<uint32_t> ready;
+    uint32_t line;
+    char label[kLiveLabelSize];
+};
+
+struct LiveSlot {
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> words[kLiveRecordWords];
+};
+
+static_assert(sizeof(LiveHeader) == 72U, "LiveHeader layout is part of the shared-memory format");
+static_assert(sizeof(LiveSiteEntry) == 128U, "LiveSiteEntry layout is part of the shared-memory format");
+static_assert(sizeof(LiveSlot) == 40U, "LiveSlot layout is part of the shared-memory format");
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "shared-memory atomics must be lock-free to work across processes");
+
+[[nodiscard]] constexpr size_t live_segment_size(uint32_t record_capacity, uint32_t site_capacity) noexcept {
+    return sizeof(LiveHeader) + static_cast<size_t>(site_capacity) * sizeof(LiveSiteEntry) +
+           static_cast<size_t>(record_capacity) * sizeof(LiveSlot);
+}
+
+// LiveHeader::magic once published: kLiveMagic's bytes in native order.
+[[nodiscard]] inline uint64_t live_magic_word() noexcept {
+    uint64_t word = 0U;
+    std::memcpy(&word, kLiveMagic, sizeof(word));
+    return word;
+}
+
+[[nodiscard]] inline LiveSiteEntry* live_sites(void* base) noexcept {
+    return reinterpret_cast<LiveSiteEntry*>(static_cast<unsigned char*>(base) + sizeof(LiveHeader));
+}
+
+[[nodiscard]] inline LiveSlot* live_slots(void* base, uint32_t site_capacity) noexcept {
+    return reinterpret_cast<LiveSlot*>(static_cast<unsigned char*>(base) + sizeof(LiveHeader) +
+                                       static_cast<size_t>(site_capacity) * sizeof(LiveSiteEntry));
+}
+
+// Writer side; only the export thread calls this.
+inline void live_write_slot(LiveSlot& slot, uint64_t position, const SampleRecord& record) noexcept {
+    uint64_t words[kLiveRecordWords];
+    std::memcpy(words, &record, sizeof(words));
+    slot.sequence.store(2U * position + 1U, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0U; i < kLiveRecordWords; ++i) {
+        slot.words[i].store(words[i], std::memory_order_relaxed);
+    }
+    slot.sequence.store(2U * position + 2U, std::memory_order_release);
+}
+
+// Copies record `position` out of its slot. Returns false when the slot already holds a
+// newer record or was being rewritten during the copy.
+[[nodiscard]] inline bool live_read_slot(const LiveSlot& slot, uint64_t position, SampleRecord& record) noexcept {
+    const auto expected = 2U * position + 2U;
+    if (slot.sequence.load(std::memory_order_acquire) != expected) {
+        return false;
+    }
+    uint64_t words[kLiveRecordWords];
+    for (size_t i = 0U; i < kLiveRecordWords; ++i) {
+        words[i] = slot.words[i].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != expected) {
+        return false;
+    }
+    std::memcpy(&record, words, sizeof(record));
+    return true;
+}
+
+}  // namespace perf_duration_trace::detail
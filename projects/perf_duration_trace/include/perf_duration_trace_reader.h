@@ -0,0 +1,288 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "perf_duration_trace_format.h"
+
+// Offline loader for .perfbin exports, usable without PERF_ENABLED.
+
+namespace perf_duration_trace {
+
+struct PerfbinContents {
+    detail::FileHeader header {};
+    std::vector<SampleRecord> records;
+    bool compressed = false;
+    // Fewer records could be decoded than the header announces.
+    bool truncated = false;
+};
+
+namespace detail {
+
+constexpr size_t kReaderBatchRecords = 4096U;
+
+}  // namespace detail
+
+// Streams a fixed (PDTBIN1) or compressed (PDTBIN2) sample file batch by batch, so the
+// memory held stays bounded by one block (or kReaderBatchRecords fixed records) no matter
+// how large the export is. Fixed files come back in on-disk order; compressed files come
+// back grouped per thread in block order. Timestamps stay in the units named by
+// header().clock_source.
+class PerfbinReader {
+public:
+    PerfbinReader() = default;
+    PerfbinReader(const PerfbinReader&) = delete;
+    PerfbinReader& operator=(const PerfbinReader&) = delete;
+    ~PerfbinReader() { close(); }
+
+    // Returns false when the file cannot be opened or is not a perfbin export.
+    [[nodiscard]] bool open(const char* path) {
+        close();
+        file_ = std::fopen(path, "rb");
+        if (file_ == nullptr) {
+            return false;
+        }
+        header_ = detail::FileHeader {};
+        if (std::fread(&header_, 1U, detail::kFileHeaderV1Size, file_) != detail::kFileHeaderV1Size) {
+            close();
+            return false;
+        }
+        if (header_.version >= 2U) {
+            constexpr size_t kRemaining = sizeof(detail::FileHeader) - detail::kFileHeaderV1Size;
+            auto* tail = reinterpret_cast<unsigned char*>(&header_) + detail::kFileHeaderV1Size;
+            if (std::fread(tail, 1U, kRemaining, file_) != kRemaining) {
+                close();
+                return false;
+            }
+        } else {
+            header_.header_size = static_cast<uint32_t>(detail::kFileHeaderV1Size);
+        }
+
+        compressed_ = std::memcmp(header_.magic, detail::kBlockFileMagic, sizeof(header_.magic)) == 0;
+        const bool valid = compressed_ || std::memcmp(header_.magic, detail::kFileMagic, sizeof(header_.magic)) == 0;
+        if (!valid || header_.record_size != sizeof(SampleRecord) ||
+            header_.header_size < detail::kFileHeaderV1Size ||
+            std::fseek(file_, static_cast<long>(header_.header_size), SEEK_SET) != 0) {
+            close();
+            return false;
+        }
+        records_read_ = 0U;
+        exhausted_ = false;
+        return true;
+    }
+
+    [[nodiscard]] const detail::FileHeader& header() const noexcept { return header_; }
+    [[nodiscard]] bool compressed() const noexcept { return compressed_; }
+    [[nodiscard]] uint64_t records_read() const noexcept { return records_read_; }
+    // Fewer records could be decoded than the header announces; meaningful once next()
+    // has returned false.
+    [[nodiscard]] bool truncated() const noexcept { return records_read_ < header_.record_count; }
+
+    // Replaces batch with the next run of records. Returns false at the end of the stream
+    // or at the first short/corrupt chunk.
+    [[nodiscard]] bool next(std::vector<SampleRecord>& batch) {
+        batch.clear();
+        if (file_ == nullptr || exhausted_ || records_read_ >= header_.record_count) {
+            return false;
+        }
+        const bool ok = compressed_ ? next_block(batch) : next_fixed(batch);
+        if (!ok || batch.empty()) {
+            exhausted_ = true;
+            batch.clear();
+            return false;
+        }
+        records_read_ += batch.size();
+        return true;
+    }
+
+    void close() noexcept {
+        if (file_ != nullptr) {
+            std::fclose(file_);
+            file_ = nullptr;
+        }
+    }
+
+private:
+    bool next_fixed(std::vector<SampleRecord>& batch) {
+        const uint64_t remaining = header_.record_count - records_read_;
+        const size_t wanted = remaining < detail::kReaderBatchRecords ? static_cast<size_t>(remaining)
+                                                                      : detail::kReaderBatchRecords;
+        batch.resize(wanted);
+        batch.resize(std::fread(batch.data(), sizeof(SampleRecord), wanted, file_));
+        return true;
+    }
+
+    bool next_block(std::vector<SampleRecord>& batch) {
+        detail::BlockHeader block {};
+        if (std::fread(&block, sizeof(block), 1U, file_) != 1U) {
+            return false;
+        }
+        payload_.resize(block.payload_bytes);
+        if (!payload_.empty() && std::fread(payload_.data(), 1U, payload_.size(), file_) != payload_.size()) {
+            return false;
+        }
+        return detail::decode_block(block, payload_.data(), batch);
+    }
+
+    FILE* file_ = nullptr;
+    detail::FileHeader header_ {};
+    std::vector<unsigned char> payload_;
+    uint64_t records_read_ = 0U;
+    bool compressed_ = false;
+    bool exhausted_ = false;
+};
+
+// Loads a whole sample file into memory; see PerfbinReader for ordering. Returns false when
+// the file cannot be read or is not a perfbin export; a short record stream only sets
+// truncated.
+[[nodiscard]] inline bool read_perfbin(const char* path, PerfbinContents& contents) {
+    PerfbinReader reader;
+    if (!reader.open(path)) {
+        return false;
+    }
+    contents = PerfbinContents {};
+    contents.header = reader.header();
+    contents.compressed = reader.compressed();
+    contents.records.reserve(static_cast<size_t>(contents.header.record_count));
+    std::vector<SampleRecord> batch;
+    while (reader.next(batch)) {
+        contents.records.insert(contents.records.end(), batch.begin(), batch.end());
+    }
+    contents.truncated = reader.truncated();
+    return true;
+}
+
+constexpr size_t kNoParentSpan = static_cast<size_t>(-1);
+
+struct SpanLinks {
+    // Index of the enclosing span for every record, or kNoParentSpan for outermost spans,
+    // drop markers, argument records and spans whose parent was not exported.
+    std::vector<size_t> parent;
+    // duration_ns minus the durations of the direct children.
+    std::vector<uint64_t> self_ns;
+};
+
+// Recovers the span tree from the per-record depth. Walking one thread's spans in start
+// order, the parent of a span at depth d is the most recent span at depth d - 1 that still
+// contains it. Spans that cannot contain anything later (they ended before the current
+// start) are discarded as the walk goes, so each thread is processed in near-linear time.
+[[nodiscard]] inline SpanLinks link_spans(const std::vector<SampleRecord>& records) {
+    SpanLinks links;
+    links.parent.assign(records.size(), kNoParentSpan);
+    links.self_ns.resize(records.size());
+    std::vector<size_t> order(records.size());
+    for (size_t i = 0U; i < records.size(); ++i) {
+        order[i] = i;
+        links.self_ns[i] = records[i].duration_ns;
+    }
+    std::sort(order.begin(), order.end(), [&records](size_t lhs, size_t rhs) {
+        const SampleRecord& a = records[lhs];
+        const SampleRecord& b = records[rhs];
+        if (a.tid_hash != b.tid_hash) {
+            return a.tid_hash < b.tid_hash;
+        }
+        if (a.start_ns != b.start_ns) {
+            return a.start_ns < b.start_ns;
+        }
+        if (detail::record_depth(a) != detail::record_depth(b)) {
+            return detail::record_depth(a) < detail::record_depth(b);
+        }
+        return a.seq_no < b.seq_no;
+    });
+
+    const auto end_of = [&records](size_t index) {
+        return records[index].start_ns + records[index].duration_ns;
+    };
+    std::vector<std::vector<size_t>> open_by_depth(static_cast<size_t>(detail::kRecordDepthMask) + 1U);
+    uint32_t current_tid = 0U;
+    bool first = true;
+    for (const size_t index : order) {
+        const SampleRecord& record = records[index];
+        if (detail::is_drop_marker(record) || detail::is_argument(record)) {
+            continue;
+        }
+        if (first || record.tid_hash != current_tid) {
+            for (auto& open : open_by_depth) {
+                open.clear();
+            }
+            current_tid = record.tid_hash;
+            first = false;
+        }
+        const uint16_t depth = detail::record_depth(record);
+        if (depth != 0U) {
+            std::vector<size_t>& candidates = open_by_depth[depth - 1U];
+            while (!candidates.empty() && end_of(candidates.back()) < record.start_ns) {
+                candidates.pop_back();
+            }
+            for (auto it = candidates.rbegin(); it != candidates.rend(); ++it) {
+                if (end_of(*it) >= end_of(index)) {
+                    links.parent[index] = *it;
+                    links.self_ns[*it] -= std::min(links.self_ns[*it], record.duration_ns);
+                    break;
+                }
+            }
+        }
+        open_by_depth[depth].push_back(index);
+    }
+    return links;
+}
+
+struct SpanArgs {
+    uint32_t count = 0U;
+    uint64_t values[detail::kMaxRecordArgs] = {};
+};
+
+// Attaches argument records (PERF_SCOPE_ARG / PERF_END_ARG) to their samples: entry i holds
+// the values of records[i], and stays empty for samples without arguments and for the
+// argument records themselves. Works in any record order.
+[[nodiscard]] inline std::vector<SpanArgs> collect_span_args(const std::vector<SampleRecord>& records) {
+    std::vector<SpanArgs> args(records.size());
+    std::vector<size_t> order;
+    for (size_t i = 0U; i < records.size(); ++i) {
+        if (!detail::is_drop_marker(records[i]) &&
+            (detail::is_argument(records[i]) || detail::record_arg_count(records[i]) != 0U)) {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&records](size_t lhs, size_t rhs) {
+        const SampleRecord& a = records[lhs];
+        const SampleRecord& b = records[rhs];
+        if (a.tid_hash != b.tid_hash) {
+            return a.tid_hash < b.tid_hash;
+        }
+        if (a.seq_no != b.seq_no) {
+            return a.seq_no < b.seq_no;
+        }
+        if (a.site_id != b.site_id) {
+            return a.site_id < b.site_id;
+        }
+        if (a.start_ns != b.start_ns) {
+            return a.start_ns < b.start_ns;
+        }
+        return detail::record_kind_less(a, b);
+    });
+
+    size_t owner = kNoParentSpan;
+    for (const size_t index : order) {
+        const SampleRecord& record = records[index];
+        if (!detail::is_argument(record)) {
+            owner = index;
+            continue;
+        }
+        if (owner == kNoParentSpan || records[owner].tid_hash != record.tid_hash ||
+            records[owner].seq_no != record.seq_no || records[owner].site_id != record.site_id ||
+            records[owner].start_ns != record.start_ns || record.cpu_hint >= detail::kMaxRecordArgs) {
+            continue;
+        }
+        SpanArgs& target = args[owner];
+        target.values[record.cpu_hint] = record.duration_ns;
+        target.count = std::max<uint32_t>(target.count, record.cpu_hint + 1U);
+    }
+    return args;
+}
+
+}  // namespace perf_duration_trace
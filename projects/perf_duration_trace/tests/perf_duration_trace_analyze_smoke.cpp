@@ -1,10 +1,19 @@
 #include "perf_duration_trace.h"
 
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+
+#ifndef PERF_DURATION_TRACE_ANALYZE_TOOL
+#error "PERF_DURATION_TRACE_ANALYZE_TOOL must name the native analyzer binary"
+#endif
 
 namespace {
 
@@ -48,11 +57,130 @@ void test_analyzer_smoke() {
            "analyzer json output should contain record_count");
 }
 
+// Same structure as the Python output; quantiles and trimmed means may differ by the
+// sketch resolution, everything else must be equal.
+constexpr const char* kCompareScript = R"(import json, math, sys
+approx = {"p50_ns", "p90_ns", "p99_ns", "p999_ns", "trimmed_mean_ns"}
+def same(x, y, key):
+    if key in approx:
+        return abs(x - y) <= max(1.0, abs(x) / 128.0)
+    if isinstance(x, float) or isinstance(y, float):
+        return type(x) == type(y) and math.isclose(x, y, rel_tol=1e-9)
+    if isinstance(x, dict):
+        return list(x) == list(y) and all(same(x[k], y[k], k) for k in x)
+    if isinstance(x, list):
+        return len(x) == len(y) and all(same(a, b, key) for a, b in zip(x, y))
+    return type(x) == type(y) and x == y
+sys.exit(0 if same(json.load(open(sys.argv[1])), json.load(open(sys.argv[2])), None) else 1)
+)";
+
+void test_native_analyzer_matches_python() {
+    for (const auto format : {perf_duration_trace::SampleFormat::fixed, perf_duration_trace::SampleFormat::compressed}) {
+        perf_duration_trace::Config config;
+        config.shard_count = 4U;
+        config.capacity_per_shard = 4096U;
+        config.sample_format = format;
+        perf_duration_trace::Runtime::instance().reset_for_tests(config);
+        const std::string bin_path = "/tmp/perf_duration_trace_native.perfbin";
+        const std::string site_path = "/tmp/perf_duration_trace_native.sites.tsv";
+        const std::string python_json = "/tmp/perf_duration_trace_native.py.json";
+        const std::string native_json = "/tmp/perf_duration_trace_native.cc.json";
+        const std::string script_path = "/tmp/perf_duration_trace_native_compare.py";
+        std::remove(bin_path.c_str());
+        std::remove(site_path.c_str());
+
+        std::vector<std::thread> workers;
+        for (int t = 0; t < 3; ++t) {
+            workers.emplace_back([t]() {
+                volatile uint32_t sink = 0U;
+                for (uint32_t i = 0U; i < 400U; ++i) {
+                    PERF_SCOPE("native_outer");
+                    for (uint32_t k = 0U; k < (i % 5U) * 40U; ++k) {
+                        sink = sink + k;
+                    }
+                    if (i % 3U == 0U) {
+                        const uint32_t bytes = (i % 7U) * 512U;
+                        PERF_SCOPE_ARG("native_copy", bytes, i);
+                        for (uint32_t k = 0U; k < bytes / 8U; ++k) {
+                            sink = sink + k;
+                        }
+                    }
+                    if ((i + static_cast<uint32_t>(t)) % 2U == 0U) {
+                        PERF_SCOPE("native_inner");
+                        for (uint32_t k = 0U; k < (i % 11U) * 60U; ++k) {
+                            sink = sink + k;
+                        }
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        const auto stats = perf_duration_trace::Runtime::instance().finalize({bin_path.c_str(), site_path.c_str()});
+        expect(stats.success, "finalize should succeed before native analyzer comparison");
+
+        const std::string python_command = "python3 projects/perf_duration_trace/tools/perf_duration_analyze.py " +
+                                           bin_path + " " + site_path + " --json > " + python_json;
+        expect(std::system(python_command.c_str()) == 0, "python analyzer should succeed");
+        const std::string native_command = std::string(PERF_DURATION_TRACE_ANALYZE_TOOL) + " " + bin_path + " " +
+                                           site_path + " --json --jobs 3 > " + native_json;
+        expect(std::system(native_command.c_str()) == 0, "native analyzer should succeed");
+
+        std::ofstream(script_path) << kCompareScript;
+        const std::string compare = "python3 " + script_path + " " + python_json + " " + native_json;
+        expect(std::system(compare.c_str()) == 0, "native analyzer json should match the python analyzer");
+    }
+}
+
+void record_compare_run(const std::string& bin_path, const std::string& site_path, std::chrono::microseconds pause) {
+    perf_duration_trace::Runtime::instance().reset_for_tests({4U, 1024U});
+    std::remove(bin_path.c_str());
+    std::remove(site_path.c_str());
+    for (int i = 0; i < 200; ++i) {
+        PERF_SCOPE("compare_case");
+        std::this_thread::sleep_for(pause);
+    }
+    const auto stats = perf_duration_trace::Runtime::instance().finalize({bin_path.c_str(), site_path.c_str()});
+    expect(stats.success, "finalize should succeed before compare run");
+}
+
+int run_compare(const std::string& baseline, const std::string& candidate, const std::string& json_path) {
+    const std::string command = std::string(PERF_DURATION_TRACE_ANALYZE_TOOL) + " --compare " + baseline +
+                                ".perfbin " + baseline + ".sites.tsv " + candidate + ".perfbin " + candidate +
+                                ".sites.tsv --json > " + json_path;
+    const int status = std::system(command.c_str());
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void test_native_analyzer_compare() {
+    const std::string baseline = "/tmp/perf_duration_trace_compare_base";
+    const std::string candidate = "/tmp/perf_duration_trace_compare_slow";
+    const std::string json_path = "/tmp/perf_duration_trace_compare.json";
+    record_compare_run(baseline + ".perfbin", baseline + ".sites.tsv", std::chrono::microseconds(20));
+    record_compare_run(candidate + ".perfbin", candidate + ".sites.tsv", std::chrono::microseconds(400));
+
+    expect(run_compare(baseline, baseline, json_path) == 0, "comparing a run with itself should not regress");
+    expect(run_compare(baseline, candidate, json_path) == 1, "a slower candidate should fail the comparison");
+
+    std::ifstream in(json_path);
+    std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    expect(content.find("\"verdict\": \"regressed\"") != std::string::npos,
+           "compare json should mark the slower site as regressed");
+    expect(run_compare(candidate, baseline, json_path) == 0, "a faster candidate should pass the comparison");
+    std::ifstream improved(json_path);
+    content.assign((std::istreambuf_iterator<char>(improved)), std::istreambuf_iterator<char>());
+    expect(content.find("\"verdict\": \"improved\"") != std::string::npos,
+           "compare json should mark the faster site as improved");
+}
+
 }  // namespace
 
 int main() {
     try {
         test_analyzer_smoke();
+        test_native_analyzer_matches_python();
+        test_native_analyzer_compare();
     } catch (const std::exception& ex) {
         std::fprintf(stderr, "perf_duration_trace_analyze_smoke failed: %s\n", ex.what());
         return 1;
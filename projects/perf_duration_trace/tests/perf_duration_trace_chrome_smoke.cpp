@@ -0,0 +1,221 @@
+#include "perf_duration_trace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef PERF_DURATION_TRACE_CHROME_TOOL
+#error "PERF_DURATION_TRACE_CHROME_TOOL must name the converter binary"
+#endif
+
+namespace {
+
+[[noreturn]] void fail(const std::string& message) {
+    throw std::runtime_error(message);
+}
+
+void expect(bool cond, const std::string& message) {
+    if (!cond) {
+        fail(message);
+    }
+}
+
+std::string read_file(const std::string& path) {
+    std::ifstream in(path);
+    expect(in.good(), "chrome converter should write its output");
+    return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+size_t count_occurrences(const std::string& text, const std::string& needle) {
+    size_t count = 0U;
+    for (size_t pos = text.find(needle); pos != std::string::npos; pos = text.find(needle, pos + needle.size())) {
+        ++count;
+    }
+    return count;
+}
+
+void test_chrome_converter_smoke() {
+    // A tiny queue and a long flush interval make the final drain see dropped samples.
+    perf_duration_trace::Runtime::instance().reset_for_tests({1U, 64U});
+    const std::string bin_path = "/tmp/perf_duration_trace_chrome_smoke.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_chrome_smoke.sites.tsv";
+    const std::string json_path = "/tmp/perf_duration_trace_chrome_smoke.json";
+    std::remove(bin_path.c_str());
+    std::remove(site_path.c_str());
+    std::remove(json_path.c_str());
+
+    const bool started = perf_duration_trace::Runtime::instance().start_async_export(
+        {{bin_path.c_str(), site_path.c_str()}, 60000U});
+    expect(started, "async export should start before chrome smoke");
+    for (int i = 0; i < 256; ++i) {
+        PERF_SCOPE("chrome \"smoke\" case");
+    }
+    const auto stats = perf_duration_trace::Runtime::instance().stop_async_export();
+    expect(stats.success, "async export should succeed before chrome smoke");
+    expect(stats.dropped_samples != 0U, "chrome smoke needs dropped samples");
+
+    const std::string command =
+        std::string(PERF_DURATION_TRACE_CHROME_TOOL) + " " + bin_path + " " + site_path + " " + json_path;
+    expect(std::system(command.c_str()) == 0, "chrome converter should succeed");
+
+    const std::string validate = "python3 -c \"import json,sys; json.load(open(sys.argv[1]))\" " + json_path;
+    expect(std::system(validate.c_str()) == 0, "chrome converter should write valid json");
+
+    const std::string content = read_file(json_path);
+    expect(count_occurrences(content, "\"ph\":\"X\"") == stats.exported_samples,
+           "every exported sample should become a complete event");
+    expect(count_occurrences(content, "\"ph\":\"M\"") == 1U, "one producer thread should get one track");
+    expect(count_occurrences(content, "\"name\":\"dropped_samples\"") == 2U,
+           "the lossy flush interval should open and close a counter");
+    expect(content.find("\"dropped\":" + std::to_string(stats.dropped_samples)) != std::string::npos,
+           "the counter should carry the dropped count");
+}
+
+void chrome_arg_case(uint64_t bytes) {
+    PERF_SCOPE_ARG("chrome_arg_case", bytes, bytes + 1U);
+}
+
+// A thread_ring export drains each ring separately and may split a sample from its argument
+// records across flushes; the converter must still attach every argument. An exited thread
+// hands its ring to the next one, so all spans together must fit in one ring.
+void test_chrome_converter_async_arguments() {
+    perf_duration_trace::Runtime::instance().reset_for_tests(
+        {0U, size_t {1} << 16U, perf_duration_trace::CaptureMode::thread_ring});
+    const std::string bin_path = "/tmp/perf_duration_trace_chrome_args.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_chrome_args.sites.tsv";
+    const std::string json_path = "/tmp/perf_duration_trace_chrome_args.json";
+    std::remove(bin_path.c_str());
+    std::remove(site_path.c_str());
+    std::remove(json_path.c_str());
+
+    const bool started = perf_duration_trace::Runtime::instance().start_async_export(
+        {{bin_path.c_str(), site_path.c_str()}, 1U});
+    expect(started, "async export should start before the argument case");
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 3; ++t) {
+        workers.emplace_back([]() {
+            for (uint64_t i = 0U; i < 5000U; ++i) {
+                chrome_arg_case(i);
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    const auto stats = perf_duration_trace::Runtime::instance().stop_async_export();
+    expect(stats.success && stats.dropped_samples == 0U, "async argument export should keep every record");
+
+    const std::string command =
+        std::string(PERF_DURATION_TRACE_CHROME_TOOL) + " " + bin_path + " " + site_path + " " + json_path;
+    expect(std::system(command.c_str()) == 0, "chrome converter should succeed on async arguments");
+    const std::string content = read_file(json_path);
+    expect(count_occurrences(content, "\"ph\":\"X\"") == 15000U, "every argument span should become an event");
+    expect(count_occurrences(content, "\"arg0\":") == 15000U && count_occurrences(content, "\"arg1\":") == 15000U,
+           "every span should carry both arguments");
+}
+
+// Two flushes written by hand: the argument lands after records of other threads and after
+// a later sample of its own thread, which is what a flush boundary looks like in the file.
+// Writes a fixed-format export holding exactly these records.
+void write_perfbin(const std::string& path, const std::vector<perf_duration_trace::SampleRecord>& records) {
+    namespace detail = perf_duration_trace::detail;
+    detail::FileHeader header {};
+    std::memcpy(header.magic, detail::kFileMagic, sizeof(header.magic));
+    header.version = detail::kFileFormatVersion;
+    header.record_size = sizeof(perf_duration_trace::SampleRecord);
+    header.record_count = records.size();
+    header.header_size = sizeof(detail::FileHeader);
+    FILE* file = std::fopen(path.c_str(), "wb");
+    expect(file != nullptr, "handcrafted export should be writable");
+    const bool written = std::fwrite(&header, sizeof(header), 1U, file) == 1U &&
+                         std::fwrite(records.data(), sizeof(records[0]), records.size(), file) == records.size();
+    expect(std::fclose(file) == 0 && written, "handcrafted export should be written");
+}
+
+void test_chrome_converter_split_arguments() {
+    namespace detail = perf_duration_trace::detail;
+    using perf_duration_trace::SampleRecord;
+    const std::string bin_path = "/tmp/perf_duration_trace_chrome_split.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_chrome_split.sites.tsv";
+    const std::string json_path = "/tmp/perf_duration_trace_chrome_split.json";
+    const auto with_args = static_cast<uint16_t>(1U << detail::kRecordArgCountShift);
+    const std::vector<SampleRecord> records = {
+        {1000U, 50U, 1U, 7U, 0U, 0U, with_args},
+        {1010U, 20U, 2U, 8U, 0U, 0U, 0U},
+        {1100U, 30U, 1U, 7U, 1U, 0U, with_args},
+        {1100U, 222U, 1U, 7U, 1U, 0U, detail::kRecordArgument},
+        {1000U, 111U, 1U, 7U, 0U, 0U, detail::kRecordArgument},
+        // Same (tid_hash, seq_no, site_id) as the first sample but another start: not its argument.
+        {999U, 333U, 1U, 7U, 0U, 0U, detail::kRecordArgument},
+    };
+    write_perfbin(bin_path, records);
+    std::ofstream sites(site_path);
+    sites << "site_id\tlabel\tfile\tfunction\tline\n1\tsplit_case\tx.cpp\tf\t1\n2\tother_case\tx.cpp\tg\t2\n";
+    sites.close();
+
+    const std::string command =
+        std::string(PERF_DURATION_TRACE_CHROME_TOOL) + " " + bin_path + " " + site_path + " " + json_path;
+    expect(std::system(command.c_str()) == 0, "chrome converter should succeed on split arguments");
+    const std::string content = read_file(json_path);
+    expect(count_occurrences(content, "\"ph\":\"X\"") == 3U, "every sample should become one event");
+    expect(content.find("\"seq\":0,\"depth\":0,\"arg0\":111}") != std::string::npos,
+           "an argument written after other records should reach its sample");
+    expect(content.find("\"seq\":1,\"depth\":0,\"arg0\":222}") != std::string::npos,
+           "an argument directly after its sample should still attach");
+    expect(content.find("333") == std::string::npos, "an argument with another start must not attach");
+}
+
+void test_chrome_converter_lost_arguments() {
+    namespace detail = perf_duration_trace::detail;
+    using perf_duration_trace::SampleRecord;
+    const std::string bin_path = "/tmp/perf_duration_trace_chrome_lost.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_chrome_lost.sites.tsv";
+    const std::string json_path = "/tmp/perf_duration_trace_chrome_lost.json";
+    const auto with_args = static_cast<uint16_t>(1U << detail::kRecordArgCountShift);
+    // More samples than the converter's pending window, none of which get their argument
+    // in time; the first one's argument only shows up at the very end.
+    constexpr uint32_t kSamples = 10000U;
+    std::vector<SampleRecord> records;
+    for (uint32_t i = 0U; i < kSamples; ++i) {
+        records.push_back({1000U + i, 5U, 1U, 7U, i, 0U, with_args});
+    }
+    records.push_back({1000U + kSamples - 1U, 444U, 1U, 7U, kSamples - 1U, 0U, detail::kRecordArgument});
+    records.push_back({1000U, 987654321U, 1U, 7U, 0U, 0U, detail::kRecordArgument});
+    write_perfbin(bin_path, records);
+    std::ofstream sites(site_path);
+    sites << "site_id\tlabel\tfile\tfunction\tline\n1\tlost_case\tx.cpp\tf\t1\n";
+    sites.close();
+
+    const std::string command =
+        std::string(PERF_DURATION_TRACE_CHROME_TOOL) + " " + bin_path + " " + site_path + " " + json_path;
+    expect(std::system(command.c_str()) == 0, "chrome converter should succeed on lost arguments");
+    const std::string content = read_file(json_path);
+    expect(count_occurrences(content, "\"ph\":\"X\"") == kSamples, "every sample should become one event");
+    expect(content.find("\"seq\":0,\"depth\":0}}") != std::string::npos,
+           "a sample older than the pending window should be written without its argument");
+    expect(content.find("987654321") == std::string::npos, "an argument past the window must not attach");
+    expect(content.find("\"seq\":9999,\"depth\":0,\"arg0\":444}") != std::string::npos,
+           "a recent sample should still get its argument");
+}
+
+}  // namespace
+
+int main() {
+    try {
+        test_chrome_converter_smoke();
+        test_chrome_converter_async_arguments();
+        test_chrome_converter_split_arguments();
+        test_chrome_converter_lost_arguments();
+    } catch (const std::exception& ex) {
+        std::fprintf(stderr, "perf_duration_trace_chrome_smoke failed: %s\n", ex.what());
+        return 1;
+    }
+
+    std::puts("perf_duration_trace_chrome_smoke passed");
+    return 0;
+}
@@ -20,6 +20,10 @@ void test_disabled_mode_is_noop() {
     PERF_SCOPE("disabled_scope_case");
     auto token = PERF_BEGIN("disabled_manual_case");
     PERF_END(token);
+    const uint64_t bytes = 4096U;
+    PERF_SCOPE_ARG("disabled_arg_case", bytes);
+    auto arg_token = PERF_BEGIN("disabled_manual_arg_case");
+    PERF_END_ARG(arg_token, bytes, bytes * 2U);
 
     const bool started = perf_duration_trace::Runtime::instance().start_async_export();
     expect(started, "disabled mode start_async_export should succeed");
@@ -0,0 +1,143 @@
+#include "perf_duration_trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef PERF_DURATION_TRACE_LIVE_TOOL
+#error "PERF_DURATION_TRACE_LIVE_TOOL must name the live reader binary"
+#endif
+
+namespace {
+
+using perf_duration_trace::SampleRecord;
+using perf_duration_trace::detail::LiveHeader;
+
+[[noreturn]] void fail(const std::string& message) {
+    throw std::runtime_error(message);
+}
+
+void expect(bool cond, const std::string& message) {
+    if (!cond) {
+        fail(message);
+    }
+}
+
+std::string read_file(const std::string& path) {
+    std::ifstream in(path);
+    return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+// Waits until the export thread has copied `records` samples into the segment.
+void wait_for_live_records(const LiveHeader& header, uint64_t records) {
+    for (int attempt = 0; attempt < 400; ++attempt) {
+        if (header.write_position.load(std::memory_order_acquire) >= records) {
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    fail("live segment did not receive the recorded samples");
+}
+
+void live_smoke_case() {
+    PERF_SCOPE("live_smoke_case");
+}
+
+void test_live_reader_smoke() {
+    perf_duration_trace::Runtime::instance().reset_for_tests({4U, 1024U});
+    const char* shm_name = "/perf_duration_trace_live_smoke";
+    const std::string bin_path = "/tmp/perf_duration_trace_live_smoke.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_live_smoke.sites.tsv";
+    const std::string out_path = "/tmp/perf_duration_trace_live_smoke.txt";
+
+    perf_duration_trace::AsyncExportConfig config;
+    config.paths = {bin_path.c_str(), site_path.c_str()};
+    config.flush_interval_ms = 10U;
+    config.live_shm_name = shm_name;
+    config.live_records = 128U;
+
+    // A segment left behind under the same name, still mapped by its old owner.
+    const int stale_fd = shm_open(shm_name, O_RDWR | O_CREAT, 0600);
+    expect(stale_fd >= 0 && ftruncate(stale_fd, 4096) == 0, "stale segment should be created");
+    auto* stale = static_cast<unsigned char*>(mmap(nullptr, 4096U, PROT_READ | PROT_WRITE, MAP_SHARED, stale_fd, 0));
+    close(stale_fd);
+    expect(stale != MAP_FAILED, "stale segment should map");
+    stale[4095] = 0x5AU;
+
+    expect(perf_duration_trace::Runtime::instance().start_async_export(config), "live export should start");
+    expect(stale[4095] == 0x5AU, "starting the export must not truncate or reuse an existing segment");
+    munmap(stale, 4096U);
+
+    // Attach like an external reader would, before anything is recorded.
+    const int fd = shm_open(shm_name, O_RDONLY, 0);
+    expect(fd >= 0, "live segment should exist while the export runs");
+    struct stat st {};
+    expect(fstat(fd, &st) == 0, "live segment should be statable");
+    expect((st.st_mode & 0777U) == 0600U, "live segment should be private to its owner");
+    void* mapped = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    expect(mapped != MAP_FAILED, "live segment should map read-only");
+    const auto& header = *static_cast<const LiveHeader*>(mapped);
+    expect(header.record_capacity == 128U, "live ring capacity mismatch");
+
+    for (int i = 0; i < 100; ++i) {
+        live_smoke_case();
+    }
+    wait_for_live_records(header, 100U);
+    const auto* slots = perf_duration_trace::detail::live_slots(mapped, header.site_capacity);
+    SampleRecord record {};
+    expect(perf_duration_trace::detail::live_read_slot(slots[0], 0U, record), "first live record should be readable");
+    const uint32_t site_id = record.site_id;
+
+    // Past the ring capacity the oldest records are overwritten, never waited for.
+    for (int i = 0; i < 200; ++i) {
+        live_smoke_case();
+    }
+    wait_for_live_records(header, 300U);
+    expect(!perf_duration_trace::detail::live_read_slot(slots[0], 0U, record),
+           "an overwritten live slot must not pass as the old record");
+    expect(perf_duration_trace::detail::live_read_slot(slots[299U & 127U], 299U, record) && record.site_id == site_id,
+           "the newest live record should be readable");
+
+    const std::string command = std::string(PERF_DURATION_TRACE_LIVE_TOOL) + " " + shm_name +
+                                " --interval-ms 50 --iterations 2 > " + out_path;
+    expect(std::system(command.c_str()) == 0, "live reader should succeed");
+    const std::string output = read_file(out_path);
+    expect(output.find("live_smoke_case\t128\t") != std::string::npos,
+           "live reader should report the records still in the ring");
+    expect(output.find("writer=alive") != std::string::npos, "live reader should see a live writer");
+
+    const auto stats = perf_duration_trace::Runtime::instance().stop_async_export();
+    expect(stats.success && stats.exported_samples == 300U, "live export should still write every sample to file");
+    expect(header.closed.load(std::memory_order_acquire) != 0U, "stopping the export should close the segment");
+    munmap(mapped, static_cast<size_t>(st.st_size));
+    expect(std::system(command.c_str()) != 0, "the segment name should be gone after the export stops");
+
+    perf_duration_trace::Runtime::instance().reset_for_tests(
+        {0U, 0U, perf_duration_trace::CaptureMode::histogram});
+    expect(!perf_duration_trace::Runtime::instance().start_async_export(config),
+           "histogram mode has no records to publish live");
+}
+
+}  // namespace
+
+int main() {
+    try {
+        test_live_reader_smoke();
+    } catch (const std::exception& ex) {
+        std::fprintf(stderr, "perf_duration_trace_live_smoke failed: %s\n", ex.what());
+        return 1;
+    }
+
+    std::puts("perf_duration_trace_live_smoke passed");
+    return 0;
+}
@@ -1,25 +1,41 @@
 #include "perf_duration_trace.h"
+#include "perf_duration_trace_reader.h"
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <csignal>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <future>
+#include <map>
 #include <stdexcept>
 #include <string>
 #include <thread>
 #include <vector>
 
+#if defined(__linux__)
+#include <pthread.h>
+#endif
+
 void perf_duration_trace_multi_tu_site_a();
 void perf_duration_trace_multi_tu_site_b();
 
 namespace {
 
 using perf_duration_trace::AsyncExportConfig;
+using perf_duration_trace::CaptureMode;
+using perf_duration_trace::ClockSource;
+using perf_duration_trace::CpuHintSource;
 using perf_duration_trace::ExportStats;
+using perf_duration_trace::FlightTriggerConfig;
 using perf_duration_trace::Runtime;
+using perf_duration_trace::PerfbinContents;
+using perf_duration_trace::SampleFormat;
 using perf_duration_trace::SampleRecord;
+using perf_duration_trace::SampleWriter;
 
 struct BinaryHeader {
     char magic[8];
@@ -30,6 +46,32 @@ struct BinaryHeader {
     uint64_t dropped_samples;
     uint32_t shard_count;
     uint32_t capacity_per_shard;
+    uint32_t header_size;
+    uint32_t clock_source;
+    uint64_t tsc_base_ticks;
+    uint64_t tsc_base_ns;
+    double tsc_ns_per_tick;
+};
+
+struct HistogramHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t sub_bucket_bits;
+    uint32_t bucket_count;
+    uint64_t site_count;
+    uint64_t sample_count;
+    uint64_t dropped_samples;
+};
+
+struct HistogramSite {
+    uint32_t site_id;
+    uint32_t bucket_entries;
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    std::map<uint32_t, uint64_t> buckets;
 };
 
 [[noreturn]] void fail(const std::string& message) {
@@ -52,9 +94,10 @@ BinaryHeader read_header(const std::string& path) {
 }
 
 std::vector<SampleRecord> read_records(const std::string& path) {
+    const BinaryHeader header = read_header(path);
     std::ifstream in(path, std::ios::binary);
     expect(in.good(), "failed to open binary export: " + path);
-    in.seekg(static_cast<std::streamoff>(sizeof(BinaryHeader)), std::ios::beg);
+    in.seekg(static_cast<std::streamoff>(header.header_size), std::ios::beg);
 
     std::vector<SampleRecord> records;
     SampleRecord record {};
@@ -89,10 +132,12 @@ void expect_records_sorted(const std::vector<SampleRecord>& records) {
     for (size_t i = 1U; i < records.size(); ++i) {
         const SampleRecord& prev = records[i - 1U];
         const SampleRecord& curr = records[i];
+        const bool same_site = prev.start_ns == curr.start_ns && prev.site_id == curr.site_id;
         const bool in_order =
             (prev.start_ns < curr.start_ns) ||
             (prev.start_ns == curr.start_ns && prev.site_id < curr.site_id) ||
-            (prev.start_ns == curr.start_ns && prev.site_id == curr.site_id && prev.seq_no <= curr.seq_no);
+            (same_site && prev.tid_hash < curr.tid_hash) ||
+            (same_site && prev.tid_hash == curr.tid_hash && prev.seq_no <= curr.seq_no);
         expect(in_order, "records should be sorted for analyzer consumption");
     }
 }
@@ -101,6 +146,71 @@ void reset_runtime(size_t shards = 4U, size_t capacity = 128U) {
     Runtime::instance().reset_for_tests({shards, capacity});
 }
 
+std::vector<HistogramSite> read_histograms(const std::string& path, HistogramHeader& header) {
+    std::ifstream in(path, std::ios::binary);
+    expect(in.good(), "failed to open histogram export: " + path);
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    expect(in.good(), "failed to read histogram header");
+    expect(std::memcmp(header.magic, "PDTHST1", 8U) == 0, "unexpected histogram magic");
+    in.seekg(static_cast<std::streamoff>(header.header_size));
+
+    std::vector<HistogramSite> sites(static_cast<size_t>(header.site_count));
+    for (HistogramSite& site : sites) {
+        in.read(reinterpret_cast<char*>(&site.site_id), sizeof(uint32_t));
+        in.read(reinterpret_cast<char*>(&site.bucket_entries), sizeof(uint32_t));
+        in.read(reinterpret_cast<char*>(&site.count), sizeof(uint64_t));
+        in.read(reinterpret_cast<char*>(&site.sum_ns), sizeof(uint64_t));
+        in.read(reinterpret_cast<char*>(&site.min_ns), sizeof(uint64_t));
+        in.read(reinterpret_cast<char*>(&site.max_ns), sizeof(uint64_t));
+        for (uint32_t i = 0U; i < site.bucket_entries; ++i) {
+            uint32_t index = 0U;
+            uint64_t count = 0U;
+            in.read(reinterpret_cast<char*>(&index), sizeof(index));
+            in.read(reinterpret_cast<char*>(&count), sizeof(count));
+            site.buckets[index] = count;
+        }
+        expect(in.good(), "truncated histogram site entry");
+    }
+    return sites;
+}
+
+std::map<std::string, uint32_t> read_site_ids(const std::string& path) {
+    std::map<std::string, uint32_t> ids;
+    const auto lines = read_lines(path);
+    for (size_t i = 1U; i < lines.size(); ++i) {
+        const auto tab = lines[i].find('\t');
+        const auto label_end = lines[i].find('\t', tab + 1U);
+        if (tab == std::string::npos || label_end == std::string::npos) {
+            continue;
+        }
+        ids[lines[i].substr(tab + 1U, label_end - tab - 1U)] =
+            static_cast<uint32_t>(std::stoul(lines[i].substr(0U, tab)));
+    }
+    return ids;
+}
+
+void reset_runtime_histogram() {
+    Runtime::instance().reset_for_tests({0U, 0U, CaptureMode::histogram});
+}
+
+void reset_runtime_flight_recorder(size_t capacity) {
+    Runtime::instance().reset_for_tests({0U, capacity, CaptureMode::flight_recorder});
+}
+
+bool wait_for_file(const std::string& path) {
+    for (int attempt = 0; attempt < 400; ++attempt) {
+        if (std::ifstream(path).good()) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return false;
+}
+
+void reset_runtime_thread_ring(size_t capacity = 128U) {
+    Runtime::instance().reset_for_tests({0U, capacity, CaptureMode::thread_ring});
+}
+
 void concurrent_registration_site() {
     PERF_SCOPE("concurrent_registration_case");
 }
@@ -157,6 +267,9 @@ void test_scope_and_manual_modes() {
 
     const BinaryHeader header = read_header(bin_path);
     expect(std::memcmp(header.magic, "PDTBIN1", sizeof(header.magic)) == 0, "unexpected file magic");
+    expect(header.version == 3U, "unexpected file format version");
+    expect(header.header_size == sizeof(BinaryHeader), "header_size should point past the v2 header");
+    expect(header.clock_source == 0U, "default clock source should be monotonic");
     expect(header.record_count == 2U, "binary header record count mismatch");
     expect(header.dropped_samples == 0U, "binary header dropped count mismatch");
 
@@ -244,6 +357,139 @@ void test_multithread_capture() {
     expect(stats.dropped_samples == 0U, "multithread case should fit in queue");
 }
 
+void test_per_thread_sequence_numbers() {
+    reset_runtime(4U, 1024U);
+    const std::string bin_path = "/tmp/perf_duration_trace_sequence.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_sequence.sites.tsv";
+    std::remove(bin_path.c_str());
+    std::remove(site_path.c_str());
+
+    constexpr int kThreadCount = 4;
+    constexpr uint32_t kIterations = 64U;
+    std::vector<std::thread> threads;
+    threads.reserve(static_cast<size_t>(kThreadCount));
+    for (int t = 0; t < kThreadCount; ++t) {
+        threads.emplace_back([]() {
+            for (uint32_t i = 0; i < kIterations; ++i) {
+                PERF_SCOPE("sequence_case");
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    const ExportStats stats = Runtime::instance().finalize({bin_path.c_str(), site_path.c_str()});
+    expect(stats.success, "finalize should succeed for sequence case");
+
+    const auto records = read_records(bin_path);
+    expect(records.size() == static_cast<size_t>(kThreadCount) * kIterations, "sequence case record count mismatch");
+    expect_records_sorted(records);
+
+    std::map<uint32_t, std::vector<uint32_t>> per_thread;
+    for (const SampleRecord& record : records) {
+        per_thread[record.tid_hash].push_back(record.seq_no);
+    }
+    expect(per_thread.size() == static_cast<size_t>(kThreadCount), "each producer thread should keep its own tid_hash");
+    for (auto& entry : per_thread) {
+        std::sort(entry.second.begin(), entry.second.end());
+        for (uint32_t i = 0; i < kIterations; ++i) {
+            expect(entry.second[i] == i, "per-thread sequence numbers should be dense and start at zero");
+        }
+    }
+}
+
+void reset_runtime_staged(size_t shards, size_t capacity, uint32_t batch) {
+    perf_duration_trace::Config config;
+    config.shard_count = shards;
+    config.capacity_per_shard = capacity;
+    config.staging_batch = batch;
+    // Long enough that only full batches, thread exit and exports publish records.
+    config.staging_flush_us = 60U * 1000U * 1000U;
+    Runtime::instance().reset_for_tests(config);
+}
+
+void test_staged_enqueue() {
+    reset_runtime_staged(2U, 1024U, 16U);
+    const std::string bin_path = "/tmp/perf_duration_trace_staged.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_staged.sites.tsv";
+    std::remove(bin_path.c_str());
+    std::remove(site_path.c_str());
+
+    // 100 is not a multiple of the batch, so thread exit has to publish the remainder.
+    constexpr int kThreadCount = 4;
+    constexpr uint32_t kIterations = 100U;
+    std::vector<std::thread> threads;
+    threads.reserve(static_cast<size_t>(kThreadCount));
+    for (int t = 0; t < kThreadCount; ++t) {
+        threads.emplace_back([]() {
+            for (uint32_t i = 0; i < kIterations; ++i) {
+                PERF_SCOPE("staged_thread_case");
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // A live thread's partial batch: flushed by an export, then extended and flushed again.
+    for (int i = 0; i < 5; ++i) {
+        PERF_SCOPE("staged_live_case");
+    }
+    Runtime::instance().flush_staging();
+    for (int i = 0; i < 20; ++i) {
+        PERF_SCOPE("staged_live_case");
+    }
+
+    const ExportStats stats = Runtime::instance().finalize({bin_path.c_str(), site_path.c_str()});
+    expect(stats.success, "finalize should succeed for staged capture");
+    expect(stats.exported_samples == static_cast<uint64_t>(kThreadCount) * kIterations + 25U,
+           "staged capture should export every sample exactly once");
+    expect(stats.dropped_samples == 0U, "staged capture should fit in the shards");
+
+    const auto records = read_records(bin_path);
+    expect_records_sorted(records);
+    std::map<uint32_t, std::vector<uint32_t>> per_thread;
+    for (const SampleRecord& record : records) {
+        per_thread[record.tid_hash].push_back(record.seq_no);
+    }
+    expect(per_thread.size() == static_cast<size_t>(kThreadCount) + 1U, "staged capture thread count mismatch");
+    for (auto& entry : per_thread) {
+        std::sort(entry.second.begin(), entry.second.end());
+        for (size_t i = 0; i < entry.second.size(); ++i) {
+            expect(entry.second[i] == i, "staged sequence numbers should be dense without duplicates");
+        }
+    }
+
+    // Batches that no longer fit fall back to per-record enqueue and count the drops.
+    reset_runtime_staged(1U, 64U, 16U);
+    for (int i = 0; i < 200; ++i) {
+        PERF_SCOPE("staged_drop_case");
+    }
+    const ExportStats drop_stats = Runtime::instance().finalize({bin_path.c_str(), site_path.c_str()});
+    expect(drop_stats.success, "finalize should succeed for staged drop case");
+    expect(drop_stats.exported_samples == 64U, "staged shard should retain up to its capacity");
+    expect(drop_stats.dropped_samples == 136U, "staged drop count should match queue overflow");
+}
+
+void test_staged_async_export() {
+    reset_runtime_staged(4U, 1024U, 64U);
+    const std::string bin_path = "/tmp/perf_duration_trace_staged_async.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_staged_async.sites.tsv";
+    std::remove(bin_path.c_str());
+    std::remove(site_path.c_str());
+
+    const bool started = Runtime::instance().start_async_export({{bin_path.c_str(), site_path.c_str()}, 10U});
+    expect(started, "staged async export should start");
+    for (int i = 0; i < 150; ++i) {
+        PERF_SCOPE("staged_async_case");
+    }
+    const ExportStats stats = Runtime::instance().stop_async_export();
+    expect(stats.success, "staged async stop should succeed");
+    expect(stats.exported_samples == 150U, "stop_async_export should flush staged samples of live threads");
+    expect(read_records(bin_path).size() == 150U, "staged async record count mismatch");
+}
+
 void test_drop_newest_when_full() {
     reset_runtime(1U, 64U);
     const std::string bin_path = "/tmp/perf_duration_trace_drop.perfbin";
@@ -265,6 +511,663 @@ void test_drop_newest_when_full() {
     expect(header.dropped_samples == 136U, "binary header dropped count mismatch");
 }
 
+void test_site_sampling_controls() {
+    reset_runtime(4U, 1U << 14U);
+    const std::string bin_path = "/tmp/perf_duration_trace_sampling.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_sampling.sites.tsv";
+    std::remove(bin_path.c_str());
+    std::remove(site_path.c_str());
+
+    const auto& off_site = PERF_TRACE_SITE("sampling_off_case");
+    const auto& sampled_site = PERF_TRACE_SITE("sampling_one_in_eight_case");
+    Runtime::instance().set_site_sampling(off_site, perf_duration_trace::kSiteOff);
+    Runtime::instance().set_site_sampling(sampled_site, 8U);
+    expect(Runtime::instance().set_site_sampling("sampling_glob_*", perf_duration_trace::kSiteOff) == 0U,
+           "the glob rule should not match any registered site yet");
+    expect(Runtime::instance().set_site_sampling("*perf_duration_trace_test_site_a.cpp",
+                                                 perf_duration_trace::kSiteOff) <= 1U,
+           "the file rule should match at most the site from that file");
+
+    for (int i = 0; i < 100; ++i) {
+        auto token = Runtime::instance().begin(off_site);
+        expect(!token.valid(), "a disabled site should hand out an invalid token");
+        Runtime::instance().end(token);
+        PERF_SCOPE("sampling_glob_case");
+    }
+    for (int i = 0; i < 8000; ++i) {
+        auto token = Runtime::instance().begin(sampled_site);
+        Runtime::instance().end(token);
+    }
+    perf_duration_trace_multi_tu_site_a();
+    perf_duration_trace_multi_tu_site_b();
+
+    const ExportStats stats = Runtime::instance().finalize({bin_path.c_str(), site_path.c_str()});
+    expect(stats.success, "sampling finalize should succeed");
+    const auto site_ids = read_site_ids(site_path);
+    std::map<uint32_t, size_t> per_site;
+    for (const SampleRecord& record : read_records(bin_path)) {
+        ++per_site[record.site_id];
+    }
+    expect(per_site.count(off_site.id) == 0U, "a disabled site should record nothing");
+    expect(per_site.count(site_ids.at("sampling_glob_case")) == 0U,
+           "a glob rule should apply to sites registered later");
+    expect(per_site.count(site_ids.at("multi_tu_site_a")) == 0U, "a file glob should disable that file");
+    expect(per_site[site_ids.at("multi_tu_site_b")] == 1U, "other files should keep recording");
+    const size_t sampled = per_site[sampled_site.id];
+    expect(sampled > 600U && sampled < 1400U, "1-in-8 sampling should keep about an eighth of the spans");
+
+    // Resetting drops API rules, so the same sites record everything again.
+    reset_runtime();
+    expect(Runtime::instance().begin(off_site).valid(), "reset should re-enable API-disabled sites");
+
+    // Applying a glob again replaces its rule, and superseded rule lists are freed.
+    auto& state = perf_duration_trace::detail::state();
+    const size_t startup_rules = state.site_rule_count();
+    for (uint32_t i = 0U; i < 1000U; ++i) {
+        const uint32_t every_n = i % 2U == 0U ? perf_duration_trace::kSiteOff : 4U;
+        (void)Runtime::instance().set_site_sampling("sampling_repeat_*", every_n);
+        (void)Runtime::instance().set_site_sampling("sampling_other_*", perf_duration_trace::kSiteOff);
+    }
+    expect(state.site_rule_count() == startup_rules + 2U, "a repeated glob should replace its rule");
+    expect(state.retained_site_rule_lists() <= 2U, "superseded rule lists should be freed");
+    expect(PERF_TRACE_SITE("sampling_repeat_case").control.load() == 4U, "the latest rate for a glob should win");
+    reset_runtime();
+}
+
+void test_site_rule_parsing() {
+    using perf_duration_trace::detail::glob_match;
+    expect(glob_match("net_*", "net_rx"), "star should match a suffix");
+    expect(glob_match("*/codec/*.cpp", "src/codec/h264.cpp"), "star should match path segments");
+    expect(glob_match("rx_?", "rx_1") && !glob_match("rx_?", "rx_12"), "question mark should match one char");
+    expect(!glob_match("net_*", "tcp_net_rx"), "globs should be anchored");
+
+    const auto rules = perf_duration_trace::detail::parse_site_rules("net_*=off,*codec*=100,bad,x=0,y=on");
+    expect(rules.size() == 3U, "malformed and zero-rate rules should be skipped");
+    expect(rules[0].glob == "net_*" && rules[0].every_n == perf_duration_trace::kSiteOff, "off rule mismatch");
+    expect(rules[1].glob == "*codec*" && rules[1].every_n == 100U, "rate rule mismatch");
+    expect(rules[2].glob == "y" && rules[2].every_n == perf_duration_trace::kSiteOn, "on rule mismatch");
+}
+
+void test_thread_ring_multithread_capture() {
+    reset_runtime_thread_ring(256U);
+    const std::string bin_path = "/tmp/perf_duration_trace_ring_mt.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_ring_mt.sites.tsv";
+    std::remove(bin_path.c_str());
+    std::remove(site_path.c_str());
+
+    constexpr int kThreadCount = 4;
+    constexpr int kIterations = 50;
+    std::atomic<bool> start {false};
+    std::vector<std::thread> threads;
+    threads.reserve(static_cast<size_t>(kThreadCount));
+    for (int t = 0; t < kThreadCount; ++t) {
+        threads.emplace_back([&start]() {
+            while (!start.load(std::memory_order_acquire)) {
+            }
+            for (int i = 0; i < kIterations; ++i) {
+                PERF_SCOPE("ring_threaded_case");
+            }
+        });
+    }
+    start.store(true, std::memory_order_release);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    const ExportStats stats = Runtime::instance().finalize({bin_path.c_str(), site_path.c_str()});
+    expect(stats.success, "finalize should succeed for thread ring capture");
+    expect(stats.exported_samples == static_cast<uint64_t>(kThreadCount * kIterations),
+           "unexpected thread ring sample count");
+    expect(stats.dropped_samples == 0U, "thread ring case should fit in the per-thread rings");
+    expect(stats.shard_count >= 1U && stats.shard_count <= static_cast<uint32_t>(kThreadCount),
+           "thread ring mode should report one ring per live producer thread");
+    expect(stats.capacity_per_shard == 256U, "thread ring capacity should follow capacity_per_shard");
+
+    const auto records = read_records(bin_path);
+    expect(records.size() == static_cast<size_t>(kThreadCount * kIterations),
+           "thread ring binary record count mismatch");
+    expect_records_sorted(records);
+}
+
+void test_thread_ring_reuses_exited_thread_rings() {
+    reset_runtime_thread_ring(128U);
+    const std::string bin_path = "/tmp/perf_duration_trace_ring_reuse.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_ring_reuse.sites.tsv";
+    std::remove(bin_path.c_str());
+    std::remove(site_path.c_str());
+
+    for (int t = 0; t < 6; ++t) {
+        std::thread worker([]() {
+            for (int i = 0; i < 10; ++i) {
+                PERF_SCOPE("ring_reuse_case");
+            }
+        });
+        worker.join();
+    }
+
+    const ExportStats stats = Runtime::instance().finalize({bin_path.c_str(), site_path.c_str()});
+    expect(stats.success, "finalize should succeed for ring reuse case");
+    expect(stats.exported_samples == 60U, "samples from exited threads should be kept");
+    expect(stats.shard_count == 1U, "sequential threads should reuse a single released ring");
+}
+
+void test_thread_ring_drop_newest_when_full() {
+    reset_runtime_thread_ring(64U);
+    const std::string bin_path = "/tmp/perf_duration_trace_ring_drop.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_ring_drop.sites.tsv";
+    std::remove(bin_path.c_str());
+    std::remove(site_path.c_str());
+
+    for (int i = 0; i < 200; ++i) {
+        PERF_SCOPE("ring_drop_case");
+    }
+
+    const ExportStats stats = Runtime::instance().finalize({bin_path.c_str(), site_path.c_str()});
+    expect(stats.success, "finalize should succeed for ring drop case");
+    expect(stats.exported_samples == 64U, "bounded ring should retain up to its capacity");
+    expect(stats.dropped_samples == 136U, "ring drop count should match overflow");
+
+    const BinaryHeader header = read_header(bin_path);
+    expect(header.dropped_samples == 136U, "binary header dropped count mismatch for ring drop case");
+}
+
+void test_flight_recorder_keeps_latest_samples() {
+    reset_runtime_flight_recorder(64U);
+    const std::string bin_path = "/tmp/perf_duration_trace_flight.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_flight.sites.tsv";
+    std::remove(bin_path.c_str());
+    std::remove(site_path.c_str());
+
+    expect(!Runtime::instance().start_async_export({{bin_path.c_str(), site_path.c_str()}, 10U}),
+           "flight recorder should not run a background export");
+    for (int i = 0; i < 200; ++i) {
+        PERF_SCOPE("flight_case");
+    }
+
+    // Snapshots copy the rings without consuming them.
+    for (int round = 0; round < 2; ++round) {
+        const ExportStats stats = Runtime::instance().dump_snapshot({bin_path.c_str(), site_path.c_str()});
+        expect(stats.success, "flight snapshot should succeed");
+        expect(stats.exported_samples == 64U, "flight snapshot should hold one ring of samples");
+        expect(stats.overwritten_samples == 136U, "flight snapshot should count overwritten samples");
+        expect(stats.dropped_samples == 0U, "flight recorder should never drop new samples");
+
+        const BinaryHeader header = read_header(bin_path);
+        expect(header.record_count == 64U, "flight header record count mismatch");
+        expect(header.overwritten_samples == 136U, "flight header overwritten count mismatch");
+        const std::vector<SampleRecord> records = read_records(bin_path);
+        expect(records.size() == 64U, "flight snapshot record count mismatch");
+        expect_records_sorted(records);
+        for (const SampleRecord& record : records) {
+            expect(record.seq_no >= 136U, "flight snapshot should keep the newest samples");
+        }
+    }
+
+    std::thread producer([]() {
+        for (int i = 0; i < 20000; ++i) {
+            PERF_SCOPE("flight_concurrent_case");
+        }
+    });
+    for (int i = 0; i < 20; ++i) {
+        const ExportStats stats = Runtime::instance().dump_snapshot({bin_path.c_str(), site_path.c_str()});
+        expect(stats.success, "flight snapshot should succeed while recording");
+        expect(stats.exported_samples <= 128U, "flight snapshot should stay bounded by the rings");
+    }
+    producer.join();
+}
+
+void test_flight_recorder_triggers() {
+    reset_runtime_flight_recorder(256U);
+    const std::string prefix = "/tmp/perf_duration_trace_flight_trigger";
+    for (int i = 0; i < 3; ++i) {
+        std::remove((prefix + "." + std::to_string(i) + ".perfbin").c_str());
+        std::remove((prefix + "." + std::to_string(i) + ".sites.tsv").c_str());
+    }
+
+    const auto& slow_site = PERF_TRACE_SITE("flight_slow_case");
+    FlightTriggerConfig config;
+    config.path_prefix = prefix.c_str();
+    config.latency_site = &slow_site;
+    config.latency_threshold_ns = 2000000U;
+    config.signal_number = SIGUSR1;
+    config.post_trigger_ms = 5U;
+    config.cooldown_ms = 0U;
+    expect(Runtime::instance().arm_flight_trigger(config), "flight trigger should arm");
+    expect(!Runtime::instance().arm_flight_trigger(config), "flight trigger should only arm once");
+
+    for (int i = 0; i < 10; ++i) {
+        PERF_SCOPE("flight_fast_case");
+        auto token = Runtime::instance().begin(slow_site);
+        Runtime::instance().end(token);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    expect(!std::ifstream(prefix + ".0.perfbin").good(), "fast spans should not trigger a dump");
+
+    {
+        auto token = Runtime::instance().begin(slow_site);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        Runtime::instance().end(token);
+    }
+    expect(wait_for_file(prefix + ".0.sites.tsv"), "a slow span should trigger a dump");
+    const BinaryHeader latency_header = read_header(prefix + ".0.perfbin");
+    expect(latency_header.record_count == 21U, "latency dump should include the slow span and its neighbours");
+
+    expect(std::raise(SIGUSR1) == 0, "raising the dump signal should succeed");
+    expect(wait_for_file(prefix + ".1.sites.tsv"), "the dump signal should trigger a dump");
+
+    expect(Runtime::instance().disarm_flight_trigger() == 2U, "disarm should report both dumps");
+    expect(Runtime::instance().disarm_flight_trigger() == 0U, "disarm should be idempotent");
+}
+
+void test_thread_ring_async_export() {
+    reset_runtime_thread_ring(128U);
+    const std::string bin_path = "/tmp/perf_duration_trace_ring_async.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_ring_async.sites.tsv";
+    std::remove(bin_path.c_str());
+    std::remove(site_path.c_str());
+
+    const bool started = Runtime::instance().start_async_export({{bin_path.c_str(), site_path.c_str()}, 10U});
+    expect(started, "async export should start in thread ring mode");
+
+    std::thread worker([]() {
+        for (int i = 0; i < 100; ++i) {
+            PERF_SCOPE("ring_async_case");
+        }
+    });
+    worker.join();
+    for (int i = 0; i < 20; ++i) {
+        PERF_SCOPE("ring_async_case");
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    const ExportStats stats = Runtime::instance().stop_async_export();
+    expect(stats.success, "async stop should succeed in thread ring mode");
+    expect(stats.exported_samples == 120U, "async drain should scan every live ring");
+
+    const BinaryHeader header = read_header(bin_path);
+    expect(header.record_count == 120U, "async header record count mismatch in thread ring mode");
+}
+
+void test_tsc_clock_source() {
+    Runtime::instance().reset_for_tests({4U, 128U, CaptureMode::sharded, ClockSource::tsc});
+    const std::string bin_path = "/tmp/perf_duration_trace_tsc.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_tsc.sites.tsv";
+    const std::string json_path = "/tmp/perf_duration_trace_tsc.json";
+    std::remove(bin_path.c_str());
+    std::remove(site_path.c_str());
+    std::remove(json_path.c_str());
+
+    constexpr uint64_t kSleepNs = 2000000U;
+    const uint64_t wall_begin = Runtime::instance().now_ns();
+    {
+        PERF_SCOPE("tsc_case");
+        std::this_thread::sleep_for(std::chrono::nanoseconds(kSleepNs));
+    }
+    const uint64_t wall_end = Runtime::instance().now_ns();
+
+    const ExportStats stats = Runtime::instance().finalize({bin_path.c_str(), site_path.c_str()});
+    expect(stats.success, "finalize should succeed with the tsc clock");
+
+    const BinaryHeader header = read_header(bin_path);
+    const auto records = read_records(bin_path);
+    expect(records.size() == 1U, "expected one tsc sample");
+
+    // Whichever clock was selected, the header must describe how to get nanoseconds back.
+    double duration_ns = static_cast<double>(records[0].duration_ns);
+    double start_ns = static_cast<double>(records[0].start_ns);
+    if (header.clock_source == 1U) {
+        expect(header.tsc_ns_per_tick > 0.0, "tsc calibration should store a positive rate");
+        duration_ns *= header.tsc_ns_per_tick;
+        start_ns = static_cast<double>(header.tsc_base_ns) +
+                   (static_cast<double>(records[0].start_ns) - static_cast<double>(header.tsc_base_ticks)) *
+                       header.tsc_ns_per_tick;
+    } else {
+        expect(header.clock_source == 0U, "fallback clock source should be monotonic");
+    }
+    expect(duration_ns >= static_cast<double>(kSleepNs) * 0.9, "converted tsc duration should cover the sleep");
+    expect(duration_ns <= static_cast<double>(wall_end - wall_begin) * 1.1 + 100000.0,
+           "converted tsc duration should not exceed the wall-clock bracket");
+    expect(start_ns >= static_cast<double>(wall_begin) - 100000.0 && start_ns <= static_cast<double>(wall_end),
+           "converted tsc start should fall inside the monotonic bracket");
+
+    const std::string command =
+        "python3 projects/perf_duration_trace/tools/perf_duration_analyze.py " + bin_path + " " + site_path +
+        " --json > " + json_path;
+    expect(std::system(command.c_str()) == 0, "analyzer should accept tsc exports");
+    std::ifstream in(json_path);
+    std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const auto min_pos = content.find("\"min_ns\": ");
+    expect(min_pos != std::string::npos, "analyzer should report min_ns for tsc exports");
+    const double analyzed_min = std::strtod(content.c_str() + min_pos + 10U, nullptr);
+    expect(analyzed_min >= static_cast<double>(kSleepNs) * 0.9, "analyzer should convert tsc ticks to ns");
+}
+
+void test_nested_spans() {
+    reset_runtime(4U, 256U);
+    const std::string bin_path = "/tmp/perf_duration_trace_nested.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_nested.sites.tsv";
+    const std::string tree_path = "/tmp/perf_duration_trace_nested.tree.txt";
+    std::remove(bin_path.c_str());
+    std::remove(site_path.c_str());
+    std::remove(tree_path.c_str());
+
+    constexpr int kIterations = 10;
+    for (int i = 0; i < kIterations; ++i) {
+        PERF_SCOPE("nested_outer");
+        {
+            PERF_SCOPE("nested_inner");
+            PERF_SCOPE("nested_leaf");
+        }
+        {
+            PERF_SCOPE("nested_inner_second");
+        }
+    }
+
+    // A manual span is a parent like any other: scopes opened inside it are its children.
+    for (int i = 0; i < kIterations; ++i) {
+        PERF_SCOPE("nested_rpc");
+        auto decode = PERF_BEGIN("nested_decode");
+        {
+            PERF_SCOPE("nested_parse_frame");
+        }
+        PERF_END(decode);
+    }
+
+    // Ending a manual token unwinds anything left open above it.
+    {
+        auto outer = PERF_BEGIN("nested_manual_outer");
+        auto leaked = PERF_BEGIN("nested_manual_leaked");
+        (void)leaked;
+        PERF_END(outer);
+        PERF_SCOPE("nested_after_unwind");
+    }
+
+    // A token opened on another thread must not unwind this thread's stack.
+    {
+        PERF_SCOPE("nested_host");
+        perf_duration_trace::Token foreign {};
+        std::thread([&foreign]() { foreign = PERF_BEGIN("nested_foreign"); }).join();
+        PERF_END(foreign);
+        PERF_SCOPE("nested_host_child");
+    }
+
+    // Tokens opened here and ended elsewhere must not leave this thread's stack deeper.
+    {
+        perf_duration_trace::Token handoffs[3];
+        for (auto& handoff : handoffs) {
+            handoff = PERF_BEGIN("nested_handoff");
+        }
+        for (const auto& handoff : handoffs) {
+            std::thread([handoff]() { PERF_END(handoff); }).join();
+        }
+        PERF_SCOPE("nested_after_handoff");
+    }
+
+    const ExportStats stats = Runtime::instance().finalize({bin_path.c_str(), site_path.c_str()});
+    expect(stats.success, "finalize should succeed for nested spans");
+    expect(stats.exported_samples == 7U * kIterations + 9U, "nested span sample count mismatch");
+
+    const auto ids = read_site_ids(site_path);
+    PerfbinContents contents;
+    expect(perf_duration_trace::read_perfbin(bin_path.c_str(), contents), "reader should load nested spans");
+    const auto& records = contents.records;
+    const auto expected_depth = std::map<std::string, uint16_t> {
+        {"nested_outer", 0U},        {"nested_inner", 1U},        {"nested_leaf", 2U},
+        {"nested_inner_second", 1U}, {"nested_manual_outer", 0U}, {"nested_after_unwind", 0U},
+        {"nested_host", 0U},         {"nested_foreign", 0U},      {"nested_host_child", 1U},
+        {"nested_handoff", 0U},      {"nested_after_handoff", 0U}, {"nested_rpc", 0U},
+        {"nested_decode", 1U},       {"nested_parse_frame", 2U},
+    };
+    std::map<uint32_t, uint16_t> depth_by_site;
+    for (const auto& entry : expected_depth) {
+        depth_by_site[ids.at(entry.first)] = entry.second;
+    }
+    for (const auto& record : records) {
+        expect(perf_duration_trace::detail::record_depth(record) == depth_by_site.at(record.site_id),
+               "record depth should match the span nesting");
+    }
+
+    const auto links = perf_duration_trace::link_spans(records);
+    const auto parent_site = [&](size_t index) {
+        return links.parent[index] == perf_duration_trace::kNoParentSpan ? 0U
+                                                                          : records[links.parent[index]].site_id;
+    };
+    const auto self_excludes_children = [&](size_t index) {
+        uint64_t children = 0U;
+        for (size_t j = 0U; j < records.size(); ++j) {
+            if (links.parent[j] == index) {
+                children += records[j].duration_ns;
+            }
+        }
+        return links.self_ns[index] == records[index].duration_ns - children;
+    };
+    int outer_checked = 0;
+    int decode_checked = 0;
+    for (size_t i = 0U; i < records.size(); ++i) {
+        const uint32_t site = records[i].site_id;
+        if (site == ids.at("nested_leaf")) {
+            expect(parent_site(i) == ids.at("nested_inner"), "leaf parent should be inner");
+            expect(links.self_ns[i] == records[i].duration_ns, "leaf self time should equal its duration");
+        } else if (site == ids.at("nested_inner") || site == ids.at("nested_inner_second")) {
+            expect(parent_site(i) == ids.at("nested_outer"), "inner parent should be outer");
+        } else if (site == ids.at("nested_host_child")) {
+            expect(parent_site(i) == ids.at("nested_host"), "host child parent should be host");
+        } else if (site == ids.at("nested_outer")) {
+            expect(self_excludes_children(i), "outer self time should exclude its direct children");
+            ++outer_checked;
+        } else if (site == ids.at("nested_parse_frame")) {
+            expect(parent_site(i) == ids.at("nested_decode"), "parse_frame parent should be the manual decode span");
+            expect(links.self_ns[i] == records[i].duration_ns, "parse_frame self time should equal its duration");
+        } else if (site == ids.at("nested_decode")) {
+            expect(parent_site(i) == ids.at("nested_rpc"), "manual decode parent should be rpc");
+            expect(self_excludes_children(i), "decode self time should exclude parse_frame");
+            ++decode_checked;
+        } else if (site == ids.at("nested_rpc")) {
+            expect(links.parent[i] == perf_duration_trace::kNoParentSpan, "rpc should be top-level");
+            expect(self_excludes_children(i), "rpc self time should exclude the manual decode span");
+        } else {
+            expect(links.parent[i] == perf_duration_trace::kNoParentSpan, "top-level spans should have no parent");
+        }
+    }
+    expect(outer_checked == kIterations, "every outer span should be linked");
+    expect(decode_checked == kIterations, "every manual decode span should be linked");
+
+    const std::string command = "python3 projects/perf_duration_trace/tools/perf_duration_analyze.py " +
+                                bin_path + " " + site_path + " --tree > " + tree_path;
+    expect(std::system(command.c_str()) == 0, "analyzer should print the call tree");
+    const auto lines = read_lines(tree_path);
+    expect(count_lines_with_substring(lines, "    nested_leaf\t10\t") == 1U,
+           "call tree should place the leaf under outer/inner");
+    expect(count_lines_with_substring(lines, "  nested_inner_second\t10\t") == 1U,
+           "call tree should place the second inner span under outer");
+}
+
+void record_span_arguments(uint32_t iterations) {
+    for (uint32_t i = 0U; i < iterations; ++i) {
+        {
+            PERF_SCOPE_ARG("arg_copy", uint64_t {64} << (i % 4U));
+            PERF_SCOPE("arg_plain");
+        }
+        auto token = PERF_BEGIN("arg_manual");
+        PERF_END_ARG(token, i, 1000U + i);
+    }
+}
+
+void test_span_arguments() {
+    constexpr uint32_t kIterations = 20U;
+    const std::string bin_path = "/tmp/perf_duration_trace_args.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_args.sites.tsv";
+    const std::string table_path = "/tmp/perf_duration_trace_args.txt";
+    perf_duration_trace::Config staged;
+    staged.staging_batch = 8U;
+    perf_duration_trace::Config compressed;
+    compressed.sample_format = SampleFormat::compressed;
+    perf_duration_trace::Config ring;
+    ring.capture_mode = CaptureMode::thread_ring;
+    for (const perf_duration_trace::Config& config : {perf_duration_trace::Config(), staged, compressed, ring}) {
+        Runtime::instance().reset_for_tests(config);
+        std::remove(bin_path.c_str());
+        std::remove(site_path.c_str());
+        std::thread(record_span_arguments, kIterations).join();
+        record_span_arguments(kIterations);
+
+        const ExportStats stats = Runtime::instance().finalize({bin_path.c_str(), site_path.c_str()});
+        expect(stats.success, "finalize should succeed with span arguments");
+        // Three spans and three argument records per iteration on two threads.
+        expect(stats.exported_samples == 2U * kIterations * 6U, "argument records should be exported");
+
+        const auto ids = read_site_ids(site_path);
+        PerfbinContents contents;
+        expect(perf_duration_trace::read_perfbin(bin_path.c_str(), contents), "reader should load span arguments");
+        const auto& records = contents.records;
+        const auto args = perf_duration_trace::collect_span_args(records);
+        const auto links = perf_duration_trace::link_spans(records);
+        std::map<uint32_t, uint32_t> samples_by_site;
+        size_t argument_records = 0U;
+        for (size_t i = 0U; i < records.size(); ++i) {
+            const SampleRecord& record = records[i];
+            if (perf_duration_trace::detail::is_argument(record)) {
+                ++argument_records;
+                expect(args[i].count == 0U, "argument records carry no arguments themselves");
+                expect(links.parent[i] == perf_duration_trace::kNoParentSpan, "argument records are not spans");
+                expect(i > 0U && records[i - 1U].seq_no == record.seq_no, "arguments should follow their sample");
+                continue;
+            }
+            ++samples_by_site[record.site_id];
+            expect(args[i].count == perf_duration_trace::detail::record_arg_count(record),
+                   "every announced argument should be joined");
+            if (record.site_id == ids.at("arg_copy")) {
+                expect(args[i].count == 1U, "PERF_SCOPE_ARG should carry one value");
+                const uint64_t value = args[i].values[0];
+                expect(value >= 64U && value <= 512U && (value & (value - 1U)) == 0U, "scope argument mismatch");
+            } else if (record.site_id == ids.at("arg_manual")) {
+                expect(args[i].count == 2U, "PERF_END_ARG should carry two values");
+                expect(args[i].values[1] == args[i].values[0] + 1000U, "manual arguments mismatch");
+            } else {
+                expect(args[i].count == 0U, "plain spans carry no arguments");
+                expect(links.parent[i] != perf_duration_trace::kNoParentSpan &&
+                           records[links.parent[i]].site_id == ids.at("arg_copy"),
+                       "argument scopes should still parent nested spans");
+            }
+        }
+        expect(argument_records == 2U * kIterations * 3U, "argument record count mismatch");
+        expect(samples_by_site.size() == 3U && samples_by_site.at(ids.at("arg_copy")) == 2U * kIterations,
+               "argument records should not be counted as samples");
+    }
+
+    // The last export above is a thread ring; the analyzer buckets durations by value.
+    const std::string command = "python3 projects/perf_duration_trace/tools/perf_duration_analyze.py " +
+                                bin_path + " " + site_path + " --args > " + table_path;
+    expect(std::system(command.c_str()) == 0, "analyzer should print the argument report");
+    const auto lines = read_lines(table_path);
+    expect(count_lines_with_substring(lines, "arg_copy\t40\t") == 1U, "site table should ignore argument records");
+    expect(count_lines_with_substring(lines, "arg_copy\t0\tall\t40\t") == 1U, "argument report should cover every span");
+    expect(count_lines_with_substring(lines, "  arg_copy\t0\t64-64\t10\t") == 1U,
+           "argument report should bucket by power of two");
+    expect(count_lines_with_substring(lines, "arg_manual\t1\tall\t40\t") == 1U,
+           "the second argument should get its own report");
+}
+
+void test_histogram_capture_mode() {
+    reset_runtime_histogram();
+    const std::string bin_path = "/tmp/perf_duration_trace_hist.perfhist";
+    const std::string site_path = "/tmp/perf_duration_trace_hist.sites.tsv";
+    const std::string json_path = "/tmp/perf_duration_trace_hist.json";
+    std::remove(bin_path.c_str());
+    std::remove(site_path.c_str());
+    std::remove(json_path.c_str());
+
+    // Backdating the token start pins every duration at or above a known floor.
+    constexpr uint64_t kFloorNs = 1000000U;
+    constexpr int kThreads = 4;
+    constexpr int kPerThread = 250;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < kThreads; ++t) {
+        workers.emplace_back([]() {
+            for (int i = 0; i < kPerThread; ++i) {
+                auto token = PERF_BEGIN("histogram_case");
+                token.start_ns -= kFloorNs;
+                PERF_END(token);
+                PERF_SCOPE("histogram_fast_case");
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    const ExportStats stats = Runtime::instance().finalize({bin_path.c_str(), site_path.c_str()});
+    expect(stats.success, "finalize should succeed in histogram mode");
+    expect(stats.exported_samples == 2U * kThreads * kPerThread, "histogram mode should count every sample");
+    expect(stats.dropped_samples == 0U, "histogram mode should not drop samples");
+
+    HistogramHeader header {};
+    const auto sites = read_histograms(bin_path, header);
+    expect(header.version == 1U, "unexpected histogram version");
+    expect(header.sample_count == stats.exported_samples, "histogram header sample count mismatch");
+    expect(sites.size() == 2U, "expected one histogram per site");
+
+    bool saw_slow_site = false;
+    for (const HistogramSite& site : sites) {
+        expect(site.count == static_cast<uint64_t>(kThreads * kPerThread), "per-site count should merge threads");
+        uint64_t bucket_total = 0U;
+        for (const auto& entry : site.buckets) {
+            expect(entry.first < header.bucket_count, "bucket index out of range");
+            bucket_total += entry.second;
+        }
+        expect(bucket_total == site.count, "bucket counts should add up to the site count");
+        expect(site.min_ns <= site.max_ns, "min should not exceed max");
+        if (site.min_ns >= kFloorNs) {
+            saw_slow_site = true;
+            expect(site.sum_ns >= site.count * kFloorNs, "sum should include the backdated floor");
+        }
+    }
+    expect(saw_slow_site, "backdated site should keep durations above the floor");
+
+    const std::string command =
+        "python3 projects/perf_duration_trace/tools/perf_duration_analyze.py " + bin_path + " " + site_path +
+        " --json > " + json_path;
+    expect(std::system(command.c_str()) == 0, "analyzer should accept histogram exports");
+    const auto lines = read_lines(json_path);
+    expect(count_lines_with_substring(lines, "\"format\": \"histogram\"") == 1U,
+           "analyzer should report the histogram format");
+    expect(count_lines_with_substring(lines, "\"label\": \"histogram_case\"") == 1U,
+           "analyzer should label histogram sites");
+}
+
+void test_histogram_async_export() {
+    reset_runtime_histogram();
+    const std::string bin_path = "/tmp/perf_duration_trace_hist_async.perfhist";
+    const std::string site_path = "/tmp/perf_duration_trace_hist_async.sites.tsv";
+    std::remove(bin_path.c_str());
+    std::remove(site_path.c_str());
+
+    const bool started = Runtime::instance().start_async_export({{bin_path.c_str(), site_path.c_str()}, 5U});
+    expect(started, "async export should start in histogram mode");
+
+    for (int i = 0; i < 64; ++i) {
+        PERF_SCOPE("histogram_async_case");
+    }
+
+    // The worker republishes the cumulative snapshot on every tick.
+    HistogramHeader header {};
+    for (int attempt = 0; attempt < 200 && header.sample_count != 64U; ++attempt) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        (void)read_histograms(bin_path, header);
+    }
+    expect(header.sample_count == 64U, "periodic flush should publish histograms before stop");
+
+    for (int i = 0; i < 16; ++i) {
+        PERF_SCOPE("histogram_async_case");
+    }
+    const ExportStats stats = Runtime::instance().stop_async_export();
+    expect(stats.success, "async stop should succeed in histogram mode");
+    expect(stats.exported_samples == 80U, "final flush should include late samples");
+
+    const auto sites = read_histograms(bin_path, header);
+    expect(header.sample_count == 80U && sites.size() == 2U, "final histogram snapshot mismatch");
+}
+
 void test_async_export() {
     reset_runtime(4U, 128U);
     const std::string bin_path = "/tmp/perf_duration_trace_async.perfbin";
@@ -295,6 +1198,300 @@ void test_async_export() {
     expect(site_lines.size() >= 2U, "async site export should include header and data");
 }
 
+void test_mmap_async_export() {
+    reset_runtime(4U, 1024U);
+    const std::string bin_path = "/tmp/perf_duration_trace_mmap.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_mmap.sites.tsv";
+    std::remove(bin_path.c_str());
+    std::remove(site_path.c_str());
+
+    AsyncExportConfig config {{bin_path.c_str(), site_path.c_str()}, 5U};
+    config.writer = SampleWriter::mmap;
+    // A tiny growth step forces several remaps during the run.
+    config.mmap_chunk_bytes = 4096U;
+    expect(Runtime::instance().start_async_export(config), "mmap async export should start");
+
+    constexpr int kRounds = 8;
+    constexpr int kPerRound = 500;
+    for (int round = 0; round < kRounds; ++round) {
+        for (int i = 0; i < kPerRound; ++i) {
+            PERF_SCOPE("mmap_flush_case");
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    const ExportStats stats = Runtime::instance().stop_async_export();
+    expect(stats.success, "mmap async stop should succeed");
+    expect(stats.exported_samples == kRounds * kPerRound, "mmap export should keep every sample");
+    expect(stats.dropped_samples == 0U, "mmap export should not drop in bounded test");
+
+    const BinaryHeader header = read_header(bin_path);
+    expect(header.record_count == stats.exported_samples, "mapped header record count mismatch");
+    expect(header.header_size == sizeof(BinaryHeader), "mapped header size mismatch");
+
+    std::ifstream in(bin_path, std::ios::binary | std::ios::ate);
+    const auto file_size = static_cast<uint64_t>(in.tellg());
+    expect(file_size == sizeof(BinaryHeader) + header.record_count * sizeof(SampleRecord),
+           "mapped file should be trimmed to the written records");
+
+    const auto records = read_records(bin_path);
+    expect(records.size() == static_cast<size_t>(kRounds * kPerRound), "mapped record count mismatch");
+    std::map<uint32_t, uint64_t> next_seq;
+    for (const auto& record : records) {
+        expect(record.site_id != 0U, "mapped record should carry its site id");
+        expect(record.seq_no == next_seq[record.tid_hash]++, "mapped records should keep per-thread order");
+    }
+
+    AsyncExportConfig bad_config {{"/nonexistent_dir/perf_duration_trace.perfbin", site_path.c_str()}, 5U};
+    bad_config.writer = SampleWriter::mmap;
+    expect(!Runtime::instance().start_async_export(bad_config), "mmap export should fail on a bad path");
+}
+
+bool file_exists(const std::string& path) {
+    return std::ifstream(path, std::ios::binary).good();
+}
+
+void test_async_export_rotation() {
+    const std::string bin_path = "/tmp/perf_duration_trace_rotate.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_rotate.sites.tsv";
+    const std::string json_path = "/tmp/perf_duration_trace_rotate.json";
+    const auto segment_path = [&bin_path](uint32_t index) {
+        return perf_duration_trace::detail::derive_segment_path(bin_path.c_str(), index);
+    };
+    expect(segment_path(3U) == "/tmp/perf_duration_trace_rotate.000003.perfbin", "segment path mismatch");
+    const auto clear_segments = [&segment_path]() {
+        for (uint32_t i = 0U; i < 64U; ++i) {
+            std::remove(segment_path(i).c_str());
+        }
+    };
+    constexpr int kRounds = 6;
+    constexpr int kPerRound = 200;
+    const auto produce = []() {
+        for (int round = 0; round < kRounds; ++round) {
+            for (int i = 0; i < kPerRound; ++i) {
+                PERF_SCOPE("rotate_case");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    };
+
+    for (const SampleWriter writer : {SampleWriter::stdio, SampleWriter::mmap}) {
+        reset_runtime(4U, 1024U);
+        clear_segments();
+        std::remove(bin_path.c_str());
+        AsyncExportConfig config {{bin_path.c_str(), site_path.c_str()}, 5U};
+        config.writer = writer;
+        config.rotate_bytes = 4096U;
+        expect(Runtime::instance().start_async_export(config), "rotating async export should start");
+        produce();
+        const ExportStats stats = Runtime::instance().stop_async_export();
+        expect(stats.success, "rotating async stop should succeed");
+        expect(stats.exported_samples == kRounds * kPerRound, "rotation should keep every sample");
+        expect(stats.segments >= 3U, "rotation should roll over several times");
+        expect(!file_exists(bin_path), "rotation should write numbered segments only");
+
+        uint64_t total = 0U;
+        for (uint32_t i = 0U; i < stats.segments; ++i) {
+            const BinaryHeader header = read_header(segment_path(i));
+            expect(header.version == perf_duration_trace::detail::kFileFormatVersion, "segment header version mismatch");
+            expect(read_records(segment_path(i)).size() == header.record_count,
+                   "segment header should count its own records");
+            total += header.record_count;
+        }
+        expect(!file_exists(segment_path(stats.segments)), "no segment past the last one");
+        expect(total == stats.exported_samples, "segments should add up to the export");
+    }
+
+    const std::string command = "python3 projects/perf_duration_trace/tools/perf_duration_analyze.py "
+                                "'/tmp/perf_duration_trace_rotate.*.perfbin' " +
+                                site_path + " --json > " + json_path;
+    expect(std::system(command.c_str()) == 0, "analyzer should accept a segment glob");
+    std::ifstream in(json_path);
+    const std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    expect(content.find("\"record_count\": " + std::to_string(kRounds * kPerRound)) != std::string::npos,
+           "analyzer should merge every segment");
+
+    reset_runtime(4U, 1024U);
+    clear_segments();
+    AsyncExportConfig config {{bin_path.c_str(), site_path.c_str()}, 5U};
+    config.rotate_bytes = 4096U;
+    config.max_segments = 2U;
+    expect(Runtime::instance().start_async_export(config), "retained async export should start");
+    produce();
+    const ExportStats stats = Runtime::instance().stop_async_export();
+    expect(stats.success && stats.segments >= 3U, "retained export should roll over several times");
+    for (uint32_t i = 0U; i < stats.segments; ++i) {
+        expect(file_exists(segment_path(i)) == (i + 2U >= stats.segments), "only the newest segments are kept");
+    }
+    clear_segments();
+}
+
+bool thread_order_less(const SampleRecord& lhs, const SampleRecord& rhs) {
+    if (lhs.tid_hash != rhs.tid_hash) {
+        return lhs.tid_hash < rhs.tid_hash;
+    }
+    return lhs.seq_no < rhs.seq_no;
+}
+
+void expect_dense_sequences(std::vector<SampleRecord> records, size_t expected_threads, uint32_t per_thread) {
+    std::sort(records.begin(), records.end(), thread_order_less);
+    std::map<uint32_t, uint32_t> next_seq;
+    for (const auto& record : records) {
+        expect(record.seq_no == next_seq[record.tid_hash]++, "decoded sequence numbers should be dense");
+    }
+    expect(next_seq.size() == expected_threads, "decoded thread count mismatch");
+    for (const auto& entry : next_seq) {
+        expect(entry.second == per_thread, "decoded per-thread record count mismatch");
+    }
+}
+
+void test_compressed_block_round_trip() {
+    // Synthetic records covering what the block encoder has to preserve: several threads,
+    // more records than one block holds, seq_no out of start order, wrapping seq_no,
+    // sparse cpu_hint / flags and large timestamp jumps.
+    std::vector<SampleRecord> original;
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    const auto next_random = [&state]() {
+        state ^= state << 13U;
+        state ^= state >> 7U;
+        state ^= state << 17U;
+        return state;
+    };
+    for (uint32_t thread = 0U; thread < 3U; ++thread) {
+        uint64_t start = 1000000000ULL + thread;
+        uint32_t seq = thread == 2U ? 0xFFFFFF00U : 0U;
+        for (uint32_t i = 0U; i < 5000U; ++i) {
+            SampleRecord record {};
+            start += next_random() % (i % 1000U == 999U ? 1000000000ULL : 2000ULL);
+            record.start_ns = start;
+            record.duration_ns = next_random() % 100000ULL;
+            record.site_id = 1U + static_cast<uint32_t>(next_random() % 40U);
+            record.tid_hash = 0xABC00000U + thread;
+            record.seq_no = seq + ((i % 7U == 3U) ? 1U : (i % 7U == 4U ? static_cast<uint32_t>(-1) : 0U));
+            record.cpu_hint = thread == 1U ? static_cast<uint16_t>(i % 64U) : 0U;
+            record.flags = (i % 97U == 0U) ? static_cast<uint16_t>(i % 5U + 1U) : 0U;
+            original.push_back(record);
+            ++seq;
+        }
+    }
+
+    std::vector<SampleRecord> scratch = original;
+    std::vector<unsigned char> encoded;
+    perf_duration_trace::detail::encode_blocks(scratch, encoded);
+    expect(encoded.size() * 3U < original.size() * sizeof(SampleRecord),
+           "block encoding should be at least 3x smaller than fixed records");
+
+    std::vector<SampleRecord> decoded;
+    size_t blocks = 0U;
+    size_t offset = 0U;
+    while (offset < encoded.size()) {
+        perf_duration_trace::detail::BlockHeader header {};
+        std::memcpy(&header, encoded.data() + offset, sizeof(header));
+        offset += sizeof(header);
+        expect(header.record_count <= perf_duration_trace::detail::kBlockMaxRecords, "block exceeds record cap");
+        expect(perf_duration_trace::detail::decode_block(header, encoded.data() + offset, decoded),
+               "block should decode");
+        offset += header.payload_bytes;
+        ++blocks;
+    }
+    expect(blocks >= 6U, "each thread should span more than one block");
+    expect(decoded.size() == original.size(), "decoded record count mismatch");
+
+    const auto record_less = [](const SampleRecord& lhs, const SampleRecord& rhs) {
+        return std::memcmp(&lhs, &rhs, sizeof(SampleRecord)) < 0;
+    };
+    std::sort(original.begin(), original.end(), record_less);
+    std::sort(decoded.begin(), decoded.end(), record_less);
+    expect(std::memcmp(original.data(), decoded.data(), original.size() * sizeof(SampleRecord)) == 0,
+           "decoded records should match the originals bit for bit");
+}
+
+void test_compressed_export() {
+    Runtime::instance().reset_for_tests({4U, 4096U, CaptureMode::sharded, ClockSource::monotonic,
+                                         SampleFormat::compressed});
+    const std::string bin_path = "/tmp/perf_duration_trace_compressed.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_compressed.sites.tsv";
+    const std::string json_path = "/tmp/perf_duration_trace_compressed.json";
+    std::remove(bin_path.c_str());
+    std::remove(site_path.c_str());
+    std::remove(json_path.c_str());
+
+    constexpr int kThreads = 4;
+    constexpr uint32_t kPerThread = 1000U;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < kThreads; ++t) {
+        workers.emplace_back([]() {
+            for (uint32_t i = 0U; i < kPerThread; ++i) {
+                if ((i & 1U) == 0U) {
+                    PERF_SCOPE("compressed_even_case");
+                } else {
+                    PERF_SCOPE("compressed_odd_case");
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    const ExportStats stats = Runtime::instance().finalize({bin_path.c_str(), site_path.c_str()});
+    expect(stats.success, "finalize should succeed with the compressed format");
+    expect(stats.exported_samples == kThreads * kPerThread, "compressed export count mismatch");
+
+    PerfbinContents contents;
+    expect(perf_duration_trace::read_perfbin(bin_path.c_str(), contents), "reader should load compressed files");
+    expect(contents.compressed && !contents.truncated, "reader should decode every compressed block");
+    expect(std::memcmp(contents.header.magic, "PDTBIN2", 8U) == 0, "compressed magic mismatch");
+    expect(contents.header.record_count == stats.exported_samples, "compressed header count mismatch");
+    expect_dense_sequences(contents.records, kThreads, kPerThread);
+
+    std::ifstream in(bin_path, std::ios::binary | std::ios::ate);
+    const auto file_size = static_cast<uint64_t>(in.tellg());
+    expect(file_size * 4U < stats.exported_samples * sizeof(SampleRecord),
+           "compressed file should be at least 4x smaller than fixed records");
+
+    const std::string command =
+        "python3 projects/perf_duration_trace/tools/perf_duration_analyze.py " + bin_path + " " + site_path +
+        " --json > " + json_path;
+    expect(std::system(command.c_str()) == 0, "analyzer should accept compressed exports");
+    const auto lines = read_lines(json_path);
+    expect(count_lines_with_substring(lines, "\"parsed_record_count\": 4000") == 1U,
+           "analyzer should decode every compressed record");
+    expect(count_lines_with_substring(lines, "\"truncated\": false") == 1U,
+           "analyzer should not report a truncated compressed stream");
+}
+
+void test_compressed_async_export() {
+    for (const SampleWriter writer : {SampleWriter::stdio, SampleWriter::mmap}) {
+        Runtime::instance().reset_for_tests({4U, 1024U, CaptureMode::sharded, ClockSource::monotonic,
+                                             SampleFormat::compressed});
+        const std::string bin_path = "/tmp/perf_duration_trace_compressed_async.perfbin";
+        const std::string site_path = "/tmp/perf_duration_trace_compressed_async.sites.tsv";
+        std::remove(bin_path.c_str());
+        std::remove(site_path.c_str());
+
+        AsyncExportConfig config {{bin_path.c_str(), site_path.c_str()}, 5U};
+        config.writer = writer;
+        config.mmap_chunk_bytes = 4096U;
+        expect(Runtime::instance().start_async_export(config), "compressed async export should start");
+        for (int round = 0; round < 4; ++round) {
+            for (int i = 0; i < 500; ++i) {
+                PERF_SCOPE("compressed_async_case");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        const ExportStats stats = Runtime::instance().stop_async_export();
+        expect(stats.success && stats.exported_samples == 2000U, "compressed async export count mismatch");
+
+        PerfbinContents contents;
+        expect(perf_duration_trace::read_perfbin(bin_path.c_str(), contents),
+               "reader should load compressed async files");
+        expect(!contents.truncated && contents.records.size() == 2000U,
+               "compressed async file should decode completely");
+        expect_dense_sequences(contents.records, 1U, 2000U);
+    }
+}
+
 void test_finalize_stops_async_export() {
     reset_runtime(4U, 128U);
     const std::string bin_path = "/tmp/perf_duration_trace_async_finalize.perfbin";
@@ -343,6 +1540,83 @@ void test_export_records_are_sorted() {
     expect_records_sorted(records);
 }
 
+void test_sample_run_set_merges_spilled_runs() {
+    // Interleaved runs with a 64-record budget: the first run stays resident, the rest spill.
+    perf_duration_trace::detail::SampleRunSet runs(64U);
+    std::vector<SampleRecord> run;
+    for (uint32_t r = 0U; r < 5U; ++r) {
+        for (uint32_t i = 0U; i < 3000U; ++i) {
+            SampleRecord record {};
+            record.start_ns = 1000U + static_cast<uint64_t>(i) * 5U + r;
+            record.site_id = 1U + (i % 3U);
+            record.tid_hash = 0x100U + r;
+            record.seq_no = i;
+            run.push_back(record);
+            if (run.size() == runs.max_run_records()) {
+                expect(runs.add_run(run), "run set should accept a full run");
+            }
+        }
+        std::reverse(run.begin(), run.end());
+        expect(runs.add_run(run), "run set should accept a tail run");
+    }
+    expect(runs.record_count() == 15000U, "run set should count every record");
+    expect(runs.spilled_runs() != 0U, "a small budget should spill runs");
+
+    std::vector<SampleRecord> merged;
+    expect(runs.merge([&merged](const SampleRecord& record) { merged.push_back(record); }),
+           "spilled runs should read back");
+    expect(merged.size() == 15000U, "merge should yield every record");
+    expect_records_sorted(merged);
+    expect_dense_sequences(merged, 5U, 3000U);
+}
+
+void test_finalize_merges_with_small_memory_budget() {
+    for (const CaptureMode mode : {CaptureMode::sharded, CaptureMode::thread_ring}) {
+        for (const SampleFormat format : {SampleFormat::fixed, SampleFormat::compressed}) {
+            perf_duration_trace::Config config;
+            config.shard_count = 4U;
+            config.capacity_per_shard = 16384U;
+            config.capture_mode = mode;
+            config.sample_format = format;
+            config.finalize_memory_bytes = 256U * sizeof(SampleRecord);
+            Runtime::instance().reset_for_tests(config);
+            const std::string bin_path = "/tmp/perf_duration_trace_merge.perfbin";
+            const std::string site_path = "/tmp/perf_duration_trace_merge.sites.tsv";
+            std::remove(bin_path.c_str());
+            std::remove(site_path.c_str());
+
+            constexpr int kThreads = 4;
+            constexpr uint32_t kPerThread = 1500U;
+            std::vector<std::thread> workers;
+            for (int t = 0; t < kThreads; ++t) {
+                workers.emplace_back([]() {
+                    for (uint32_t i = 0U; i < kPerThread; ++i) {
+                        PERF_SCOPE("merge_outer_case");
+                        PERF_SCOPE("merge_inner_case");
+                    }
+                });
+            }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+
+            const ExportStats stats = Runtime::instance().finalize({bin_path.c_str(), site_path.c_str()});
+            expect(stats.success, "finalize should succeed with a small merge budget");
+            expect(stats.exported_samples == 2U * kThreads * kPerThread, "merged export count mismatch");
+            expect(stats.dropped_samples == 0U, "merge case should fit in its queues");
+
+            PerfbinContents contents;
+            expect(perf_duration_trace::read_perfbin(bin_path.c_str(), contents), "reader should load merged files");
+            expect(!contents.truncated, "merged file should be complete");
+            expect(contents.header.record_count == stats.exported_samples, "merged header count mismatch");
+            if (format == SampleFormat::fixed) {
+                expect_records_sorted(contents.records);
+            }
+            expect_dense_sequences(contents.records, kThreads, 2U * kPerThread);
+        }
+    }
+}
+
 void test_finalize_after_async_stop_keeps_export_count_stable() {
     reset_runtime(4U, 128U);
     const std::string async_bin_path = "/tmp/perf_duration_trace_sorted_async.perfbin";
@@ -538,6 +1812,60 @@ void test_concurrent_distinct_static_site_registration() {
     }
 }
 
+void test_concurrent_site_table_registration() {
+    reset_runtime();
+    const std::string bin_path = "/tmp/perf_duration_trace_site_table.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_site_table.sites.tsv";
+    std::remove(bin_path.c_str());
+    std::remove(site_path.c_str());
+
+    constexpr int kThreads = 8;
+    constexpr int kSitesPerThread = 1500;
+    std::vector<std::vector<const perf_duration_trace::SiteRef*>> registered(kThreads);
+    std::atomic<bool> go {false};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&registered, &go, t]() {
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (int i = 0; i < kSitesPerThread; ++i) {
+                const perf_duration_trace::SiteDesc desc {
+                    "site_table_case", __FILE__, "site_table_thread", static_cast<uint32_t>(t * kSitesPerThread + i)};
+                registered[static_cast<size_t>(t)].push_back(&Runtime::instance().register_site(desc));
+            }
+        });
+    }
+    go.store(true, std::memory_order_release);
+    // A rule published mid-registration must reach every matching site, however the
+    // registrations interleave with it.
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+    (void)Runtime::instance().set_site_sampling("site_table_case", perf_duration_trace::kSiteOff);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::vector<uint32_t> ids;
+    for (const auto& sites : registered) {
+        for (const perf_duration_trace::SiteRef* site : sites) {
+            expect(site->id != 0U, "site table should not overflow");
+            expect(site->control.load() == perf_duration_trace::kSiteOff,
+                   "a concurrent glob rule should reach every matching site");
+            ids.push_back(site->id);
+        }
+    }
+    std::sort(ids.begin(), ids.end());
+    expect(std::adjacent_find(ids.begin(), ids.end()) == ids.end(), "site ids should be unique");
+    expect(ids.back() - ids.front() + 1U == ids.size(), "concurrently registered ids should be dense");
+
+    const ExportStats stats = Runtime::instance().finalize({bin_path.c_str(), site_path.c_str()});
+    expect(stats.success, "site table finalize should succeed");
+    const auto site_lines = read_lines(site_path);
+    expect(count_lines_with_substring(site_lines, "site_table_case") == ids.size(),
+           "every concurrently registered site should be listed");
+    expect(stats.registered_sites + 1U == site_lines.size(), "registered site count should match the file");
+}
+
 void test_multi_translation_unit_site_registration() {
     reset_runtime();
     const std::string bin_path = "/tmp/perf_duration_trace_multi_tu.perfbin";
@@ -559,6 +1887,73 @@ void test_multi_translation_unit_site_registration() {
            "expected the second translation unit site metadata");
 }
 
+void test_cpu_hint_and_thread_table() {
+    const std::string bin_path = "/tmp/perf_duration_trace_cpu.perfbin";
+    const std::string site_path = "/tmp/perf_duration_trace_cpu.sites.tsv";
+    const std::string thread_path = "/tmp/perf_duration_trace_cpu.threads.tsv";
+    const std::string json_path = "/tmp/perf_duration_trace_cpu.json";
+
+    for (const CpuHintSource source : {CpuHintSource::rdtscp, CpuHintSource::getcpu}) {
+        perf_duration_trace::Config config {4U, 1024U};
+        config.cpu_hint_source = source;
+        config.cpu_hint_interval = 4U;
+        config.thread_table = true;
+        Runtime::instance().reset_for_tests(config);
+        std::remove(bin_path.c_str());
+        std::remove(site_path.c_str());
+        std::remove(thread_path.c_str());
+        std::remove(json_path.c_str());
+
+        std::thread worker([]() {
+#if defined(__linux__)
+            (void)pthread_setname_np(pthread_self(), "pdt_cpu_worker");
+#endif
+            for (int i = 0; i < 100; ++i) {
+                PERF_SCOPE("cpu_hint_case");
+            }
+        });
+        worker.join();
+
+        const ExportStats stats = Runtime::instance().finalize({bin_path.c_str(), site_path.c_str()});
+        expect(stats.success, "cpu hint finalize should succeed");
+        const std::vector<SampleRecord> records = read_records(bin_path);
+        expect(records.size() == 100U, "cpu hint export should keep every sample");
+#if defined(__linux__)
+        for (const SampleRecord& record : records) {
+            expect(record.cpu_hint != 0U, "cpu hint should be captured on Linux");
+        }
+#endif
+
+        const auto thread_lines = read_lines(thread_path);
+        expect(thread_lines.size() == 2U, "thread table should list the single producer thread");
+        expect(thread_lines[0] == "tid_hash\ttid\tname\tfirst_seen_ns", "thread table header mismatch");
+        expect(thread_lines[1].rfind(std::to_string(records.front().tid_hash) + "\t", 0) == 0U,
+               "thread table should be keyed by tid_hash");
+#if defined(__linux__)
+        expect(thread_lines[1].find("\tpdt_cpu_worker\t") != std::string::npos,
+               "thread table should record the thread name");
+#endif
+    }
+
+    const std::string command = "python3 projects/perf_duration_trace/tools/perf_duration_analyze.py " + bin_path +
+                                " " + site_path + " --json > " + json_path;
+    expect(std::system(command.c_str()) == 0, "analyzer command should succeed with a thread table");
+    std::ifstream in(json_path);
+    std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    expect(content.find("\"migration\"") != std::string::npos, "analyzer should report migration counts");
+#if defined(__linux__)
+    expect(content.find("\"name\": \"pdt_cpu_worker\"") != std::string::npos,
+           "analyzer should join samples with the thread table");
+#endif
+
+    reset_runtime(4U, 1024U);
+    std::remove(thread_path.c_str());
+    std::thread([]() { PERF_SCOPE("cpu_hint_case"); }).join();
+    const ExportStats stats = Runtime::instance().finalize({bin_path.c_str(), site_path.c_str()});
+    expect(stats.success, "finalize without a thread table should succeed");
+    expect(!file_exists(thread_path), "the thread table should be opt-in");
+}
+
 void test_binary_header_round_trip_matches_python_parser() {
     reset_runtime(4U, 128U);
     const std::string bin_path = "/tmp/perf_duration_trace_roundtrip.perfbin";
@@ -598,16 +1993,41 @@ int main() {
         test_cross_function_manual_token();
         test_cross_thread_manual_token();
         test_multithread_capture();
+        test_staged_enqueue();
+        test_per_thread_sequence_numbers();
         test_drop_newest_when_full();
+        test_site_sampling_controls();
+        test_site_rule_parsing();
+        test_thread_ring_multithread_capture();
+        test_thread_ring_reuses_exited_thread_rings();
+        test_thread_ring_drop_newest_when_full();
+        test_thread_ring_async_export();
+        test_flight_recorder_keeps_latest_samples();
+        test_flight_recorder_triggers();
+        test_tsc_clock_source();
+        test_nested_spans();
+        test_span_arguments();
+        test_histogram_capture_mode();
+        test_histogram_async_export();
         test_async_export();
+        test_staged_async_export();
+        test_mmap_async_export();
+        test_async_export_rotation();
+        test_compressed_block_round_trip();
+        test_compressed_export();
+        test_compressed_async_export();
         test_finalize_stops_async_export();
         test_export_records_are_sorted();
+        test_sample_run_set_merges_spilled_runs();
+        test_finalize_merges_with_small_memory_budget();
         test_finalize_after_async_stop_keeps_export_count_stable();
         test_failed_async_start_clears_cached_async_stats();
         test_concurrent_stop_async_export();
         test_concurrent_static_site_registration();
         test_concurrent_distinct_static_site_registration();
+        test_concurrent_site_table_registration();
         test_multi_translation_unit_site_registration();
+        test_cpu_hint_and_thread_table();
         test_binary_header_round_trip_matches_python_parser();
     } catch (const std::exception& ex) {
         std::fprintf(stderr, "perf_duration_trace_test failed: %s\n", ex.what());
@@ -1,6 +1,7 @@
 #!/usr/bin/env python3
 import argparse
 import csv
+import glob
 import json
 import math
 import statistics
@@ -9,7 +10,24 @@ import sys
 from collections import defaultdict
 
 HEADER_STRUCT = struct.Struct("<8sIIQQQII")
+HEADER_V2_STRUCT = struct.Struct("<IIQQd")
 RECORD_STRUCT = struct.Struct("<QQIIIHH")
+BLOCK_HEADER_STRUCT = struct.Struct("<IIIIQQIHH")
+HISTOGRAM_HEADER_STRUCT = struct.Struct("<8sIIIIQQQ")
+HISTOGRAM_SITE_STRUCT = struct.Struct("<IIQQQQ")
+HISTOGRAM_ENTRY_STRUCT = struct.Struct("<IQ")
+
+CLOCK_SOURCES = {0: "monotonic", 1: "tsc"}
+CLOCK_TSC = 1
+
+DEPTH_MASK = 0x3F
+ARG_COUNT_SHIFT = 6
+ARG_COUNT_MASK = 0x3 << ARG_COUNT_SHIFT
+ARGUMENT = 1 << 14
+DROP_MARKER = 1 << 15
+
+BLOCK_HAS_CPU_HINT = 1 << 0
+BLOCK_HAS_FLAGS = 1 << 1
 
 
 def load_sites(path):
@@ -21,6 +39,199 @@ def load_sites(path):
     return sites
 
 
+def thread_path_for(site_path):
+    suffix = ".sites.tsv"
+    base = site_path[: -len(suffix)] if site_path.endswith(suffix) else site_path
+    return base + ".threads.tsv"
+
+
+def load_threads(path):
+    threads = {}
+    try:
+        with open(path, newline="", encoding="utf-8") as fh:
+            reader = csv.DictReader(fh, delimiter="\t")
+            for row in reader:
+                # A recycled thread id hashes the same; keep the first sighting.
+                threads.setdefault(int(row["tid_hash"]), row)
+    except FileNotFoundError:
+        pass
+    return threads
+
+
+def load_samples(path):
+    paths = sorted(glob.glob(path)) if glob.has_magic(path) else [path]
+    if not paths:
+        raise ValueError(f"no segment matches {path}")
+    blobs = []
+    for segment in paths:
+        with open(segment, "rb") as fh:
+            magic = fh.read(8)
+        if magic.rstrip(b"\0") == b"PDTHST1":
+            if len(paths) != 1:
+                raise ValueError("histogram files cannot be combined")
+            return load_histograms(segment)
+        blobs.append(load_records(segment))
+    return merge_segments(blobs)
+
+
+def merge_segments(blobs):
+    """Concatenates rotated async segments (run.000000.perfbin, ...) in file-name order."""
+    merged = dict(blobs[0])
+    if len(blobs) == 1:
+        return merged
+    if any(blob["format"] != merged["format"] for blob in blobs):
+        raise ValueError("segments mix fixed and compressed formats")
+    for key in ("records", "drop_intervals", "arguments"):
+        merged[key] = [item for blob in blobs for item in blob[key]]
+    for key in ("record_count", "parsed_record_count", "overwritten", "dropped"):
+        merged[key] = sum(blob[key] for blob in blobs)
+    merged["truncated"] = any(blob["truncated"] for blob in blobs)
+    return merged
+
+
+def bucket_bounds(index, sub_bucket_bits):
+    sub_bucket_count = 1 << sub_bucket_bits
+    if index < 2 * sub_bucket_count:
+        return index, index + 1
+    exponent = index // sub_bucket_count - 1
+    lower = (index - exponent * sub_bucket_count) << exponent
+    return lower, lower + (1 << exponent)
+
+
+def load_histograms(path):
+    with open(path, "rb") as fh:
+        header_blob = fh.read(HISTOGRAM_HEADER_STRUCT.size)
+        if len(header_blob) != HISTOGRAM_HEADER_STRUCT.size:
+            raise ValueError("truncated histogram header")
+        (
+            _magic,
+            version,
+            header_size,
+            sub_bucket_bits,
+            bucket_count,
+            site_count,
+            sample_count,
+            dropped,
+        ) = HISTOGRAM_HEADER_STRUCT.unpack(header_blob)
+        fh.seek(header_size)
+
+        histograms = {}
+        truncated = False
+        for _ in range(site_count):
+            raw = fh.read(HISTOGRAM_SITE_STRUCT.size)
+            if len(raw) != HISTOGRAM_SITE_STRUCT.size:
+                truncated = True
+                break
+            site_id, bucket_entries, count, sum_ns, min_ns, max_ns = HISTOGRAM_SITE_STRUCT.unpack(raw)
+            raw = fh.read(HISTOGRAM_ENTRY_STRUCT.size * bucket_entries)
+            if len(raw) != HISTOGRAM_ENTRY_STRUCT.size * bucket_entries:
+                truncated = True
+                break
+            buckets = []
+            for index, bucket_total in HISTOGRAM_ENTRY_STRUCT.iter_unpack(raw):
+                if index >= bucket_count:
+                    raise ValueError("histogram bucket index out of range")
+                buckets.append((index, bucket_total))
+            histograms[site_id] = {
+                "count": count,
+                "sum_ns": sum_ns,
+                "min_ns": min_ns,
+                "max_ns": max_ns,
+                "buckets": buckets,
+            }
+
+    return {
+        "format": "histogram",
+        "version": version,
+        "clock_source": CLOCK_SOURCES[0],
+        "record_count": sample_count,
+        "parsed_record_count": sum(item["count"] for item in histograms.values()),
+        "overwritten": 0,
+        "dropped": dropped,
+        "shard_count": 0,
+        "capacity_per_shard": 0,
+        "truncated": truncated,
+        "sub_bucket_bits": sub_bucket_bits,
+        "histograms": histograms,
+    }
+
+
+def read_varint(blob, pos):
+    value = 0
+    shift = 0
+    while True:
+        if pos >= len(blob) or shift >= 64:
+            raise ValueError("malformed varint")
+        byte = blob[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        if byte < 0x80:
+            return value, pos
+        shift += 7
+
+
+def decode_block(header, payload, records):
+    _, record_count, tid_hash, first_seq, first_start, _, site_count, flags, _ = header
+    pos = 0
+    dictionary = []
+    site_id = 0
+    for _ in range(site_count):
+        delta, pos = read_varint(payload, pos)
+        site_id += delta
+        dictionary.append(site_id)
+
+    has_cpu_hint = flags & BLOCK_HAS_CPU_HINT
+    has_flags = flags & BLOCK_HAS_FLAGS
+    previous_start = first_start
+    previous_seq = (first_seq - 1) & 0xFFFFFFFF
+    for _ in range(record_count):
+        start_delta, pos = read_varint(payload, pos)
+        duration, pos = read_varint(payload, pos)
+        site_index = 0
+        if site_count > 1:
+            site_index, pos = read_varint(payload, pos)
+        seq_delta, pos = read_varint(payload, pos)
+        cpu_hint = 0
+        record_flags = 0
+        if has_cpu_hint:
+            cpu_hint, pos = read_varint(payload, pos)
+        if has_flags:
+            record_flags, pos = read_varint(payload, pos)
+
+        start = previous_start + start_delta
+        seq_no = (previous_seq + 1 + ((seq_delta >> 1) ^ -(seq_delta & 1))) & 0xFFFFFFFF
+        records.append((start, duration, dictionary[site_index], tid_hash, seq_no, cpu_hint, record_flags))
+        previous_start = start
+        previous_seq = seq_no
+    if pos != len(payload):
+        raise ValueError("block payload size mismatch")
+
+
+def read_blocks(fh, record_count, records):
+    while len(records) < record_count:
+        raw = fh.read(BLOCK_HEADER_STRUCT.size)
+        if len(raw) != BLOCK_HEADER_STRUCT.size:
+            return True
+        header = BLOCK_HEADER_STRUCT.unpack(raw)
+        payload = fh.read(header[0])
+        if len(payload) != header[0]:
+            return True
+        try:
+            decode_block(header, payload, records)
+        except (ValueError, IndexError):
+            return True
+    return False
+
+
+def read_fixed_records(fh, record_count, records):
+    for _ in range(record_count):
+        raw = fh.read(RECORD_STRUCT.size)
+        if len(raw) != RECORD_STRUCT.size:
+            return True
+        records.append(RECORD_STRUCT.unpack(raw))
+    return False
+
+
 def load_records(path):
     with open(path, "rb") as fh:
         header_blob = fh.read(HEADER_STRUCT.size)
@@ -30,33 +241,65 @@ def load_records(path):
         magic, version, record_size, record_count, overwritten, dropped, shard_count, capacity = (
             HEADER_STRUCT.unpack(header_blob)
         )
-        if magic.rstrip(b"\0") != b"PDTBIN1":
+        magic = magic.rstrip(b"\0")
+        if magic not in (b"PDTBIN1", b"PDTBIN2"):
             raise ValueError("unexpected perfbin magic")
         if record_size != RECORD_STRUCT.size:
             raise ValueError("unexpected record size")
 
+        clock_source = 0
+        if version >= 2:
+            ext_blob = fh.read(HEADER_V2_STRUCT.size)
+            if len(ext_blob) != HEADER_V2_STRUCT.size:
+                raise ValueError("truncated perfbin v2 header")
+            header_size, clock_source, tsc_base_ticks, tsc_base_ns, tsc_ns_per_tick = (
+                HEADER_V2_STRUCT.unpack(ext_blob)
+            )
+            if clock_source not in CLOCK_SOURCES:
+                raise ValueError("unknown clock source")
+            fh.seek(header_size)
+
         records = []
-        truncated = False
-        for _ in range(record_count):
-            raw = fh.read(RECORD_STRUCT.size)
-            if len(raw) == 0:
-                truncated = True
-                break
-            if len(raw) != RECORD_STRUCT.size:
-                truncated = True
-                break
-            records.append(RECORD_STRUCT.unpack(raw))
+        if magic == b"PDTBIN2":
+            truncated = read_blocks(fh, record_count, records)
+        else:
+            truncated = read_fixed_records(fh, record_count, records)
+
+        if clock_source == CLOCK_TSC:
+            # An argument record's duration_ns field is its value, not a tick count.
+            records = [
+                (
+                    tsc_base_ns + round((record[0] - tsc_base_ticks) * tsc_ns_per_tick),
+                    record[1] if record[6] & ARGUMENT else round(record[1] * tsc_ns_per_tick),
+                )
+                + record[2:]
+                for record in records
+            ]
+
+    parsed_record_count = len(records)
+    drop_intervals = [
+        {"start_ns": record[0], "duration_ns": record[1], "dropped": record[4]}
+        for record in records
+        if record[6] & DROP_MARKER
+    ]
+    arguments = [record for record in records if record[6] & ARGUMENT and not record[6] & DROP_MARKER]
+    if drop_intervals or arguments:
+        records = [record for record in records if not record[6] & (DROP_MARKER | ARGUMENT)]
 
     return {
+        "format": "compressed" if magic == b"PDTBIN2" else "records",
         "version": version,
+        "clock_source": CLOCK_SOURCES[clock_source],
         "record_count": record_count,
-        "parsed_record_count": len(records),
+        "parsed_record_count": parsed_record_count,
         "overwritten": overwritten,
         "dropped": dropped,
         "shard_count": shard_count,
         "capacity_per_shard": capacity,
         "truncated": truncated,
         "records": records,
+        "drop_intervals": drop_intervals,
+        "arguments": arguments,
     }
 
 
@@ -71,10 +314,78 @@ def trimmed_mean(values, ratio):
     return statistics.mean(ordered[trim : count - trim])
 
 
-def summarize(records, sites):
+def link_spans(records):
+    """Return (parent, self_ns) lists aligned with records.
+
+    Walking one thread's spans in start order, the parent of a span at depth d is the most
+    recent span at depth d - 1 that still contains it. A span whose parent was not exported
+    (dropped, or ended on another thread) becomes a root.
+    """
+    order = sorted(
+        range(len(records)),
+        key=lambda i: (records[i][3], records[i][0], records[i][6] & DEPTH_MASK, records[i][4]),
+    )
+    parent = [None] * len(records)
+    self_ns = [record[1] for record in records]
+    open_by_depth = defaultdict(list)
+    current_tid = None
+    for index in order:
+        start_ns, duration_ns, _, tid_hash, _, _, flags = records[index]
+        if tid_hash != current_tid:
+            open_by_depth.clear()
+            current_tid = tid_hash
+        depth = flags & DEPTH_MASK
+        end_ns = start_ns + duration_ns
+        if depth > 0:
+            candidates = open_by_depth[depth - 1]
+            while candidates and sum(records[candidates[-1]][:2]) < start_ns:
+                candidates.pop()
+            for candidate in reversed(candidates):
+                if sum(records[candidate][:2]) >= end_ns:
+                    parent[index] = candidate
+                    self_ns[candidate] = max(0, self_ns[candidate] - duration_ns)
+                    break
+        open_by_depth[depth].append(index)
+    return parent, self_ns
+
+
+def build_call_tree(records, parent, self_ns, sites):
+    nodes = {}
+    paths = {}
+    # Parents start no later than their children and sit one level up, so this order
+    # always visits a parent before any of its children.
+    order = sorted(range(len(records)), key=lambda i: (records[i][3], records[i][0], records[i][6] & DEPTH_MASK))
+    for index in order:
+        site_id = records[index][2]
+        parent_index = parent[index]
+        path = (paths[parent_index] if parent_index is not None else ()) + (site_id,)
+        paths[index] = path
+        node = nodes.setdefault(path, {"count": 0, "inclusive_ns": 0, "self_ns": 0})
+        node["count"] += 1
+        node["inclusive_ns"] += records[index][1]
+        node["self_ns"] += self_ns[index]
+
+    tree = []
+    for path in sorted(nodes):
+        node = nodes[path]
+        tree.append(
+            {
+                "path": [sites.get(site_id, {}).get("label", f"site_{site_id}") for site_id in path],
+                "depth": len(path) - 1,
+                "count": node["count"],
+                "inclusive_ns": node["inclusive_ns"],
+                "self_ns": node["self_ns"],
+            }
+        )
+    return tree
+
+
+def summarize(records, sites, self_ns):
     grouped = defaultdict(list)
-    for start_ns, duration_ns, site_id, tid_hash, seq_no, cpu_hint, flags in records:
+    self_totals = defaultdict(int)
+    for index, (start_ns, duration_ns, site_id, tid_hash, seq_no, cpu_hint, flags) in enumerate(records):
         grouped[site_id].append(duration_ns)
+        self_totals[site_id] += self_ns[index]
 
     summaries = []
     for site_id, durations in grouped.items():
@@ -89,9 +400,200 @@ def summarize(records, sites):
                 "p50_ns": durations[len(durations) // 2],
                 "p90_ns": durations[min(len(durations) - 1, int(len(durations) * 0.90))],
                 "p99_ns": durations[min(len(durations) - 1, int(len(durations) * 0.99))],
+                "p999_ns": durations[min(len(durations) - 1, int(len(durations) * 0.999))],
                 "mean_ns": statistics.mean(durations),
                 "trimmed_mean_ns": trimmed_mean(durations, 0.05),
                 "max_ns": durations[-1],
+                "inclusive_total_ns": sum(durations),
+                "self_total_ns": self_totals[site_id],
+                "self_mean_ns": self_totals[site_id] / len(durations),
+            }
+        )
+    return sorted(summaries, key=lambda item: item["p50_ns"], reverse=True)
+
+
+def duration_stats(durations):
+    durations.sort()
+    return {
+        "count": len(durations),
+        "p50_ns": durations[len(durations) // 2],
+        "p99_ns": durations[min(len(durations) - 1, int(len(durations) * 0.99))],
+        "mean_ns": statistics.mean(durations),
+    }
+
+
+def summarize_threads_and_cpus(records, threads):
+    """Per-thread and per-CPU latency breakdowns plus CPU migration counts.
+
+    cpu_hint stores the CPU number plus one; 0 means it was not captured. A migration is
+    a change of CPU between consecutive samples of one thread (in start order).
+    """
+    by_thread = defaultdict(list)
+    by_cpu = defaultdict(list)
+    for record in records:
+        by_thread[record[3]].append(record)
+        if record[5]:
+            by_cpu[record[5] - 1].append(record[1])
+
+    thread_rows = []
+    transitions = 0
+    migrations = 0
+    for tid_hash, thread_records in by_thread.items():
+        thread_records.sort(key=lambda item: (item[0], item[4]))
+        thread_transitions = 0
+        thread_migrations = 0
+        previous_cpu = 0
+        for record in thread_records:
+            cpu = record[5]
+            if cpu and previous_cpu:
+                thread_transitions += 1
+                if cpu != previous_cpu:
+                    thread_migrations += 1
+            if cpu:
+                previous_cpu = cpu
+        transitions += thread_transitions
+        migrations += thread_migrations
+        info = threads.get(tid_hash, {})
+        row = {
+            "tid_hash": tid_hash,
+            "tid": int(info["tid"]) if info.get("tid") else None,
+            "name": info.get("name", ""),
+            "cpus": len({record[5] for record in thread_records if record[5]}),
+            "migrations": thread_migrations,
+        }
+        row.update(duration_stats([record[1] for record in thread_records]))
+        thread_rows.append(row)
+
+    cpu_rows = []
+    for cpu, durations in by_cpu.items():
+        row = {"cpu": cpu}
+        row.update(duration_stats(durations))
+        cpu_rows.append(row)
+
+    migration = {
+        "transitions": transitions,
+        "migrations": migrations,
+        "rate": migrations / transitions if transitions else 0.0,
+    }
+    return (
+        sorted(thread_rows, key=lambda item: item["count"], reverse=True),
+        sorted(cpu_rows, key=lambda item: item["cpu"]),
+        migration,
+    )
+
+
+def summarize_args(records, arguments, sites):
+    """Span durations per (site, argument index), bucketed by the argument's power of two.
+
+    An argument record joins the sample with the same (tid_hash, seq_no, site_id, start_ns).
+    ns_per_unit is the total duration over the total argument, e.g. ns per byte.
+    """
+    owners = {
+        (record[3], record[4], record[2], record[0]): record[1]
+        for record in records
+        if record[6] & ARG_COUNT_MASK
+    }
+    grouped = defaultdict(lambda: defaultdict(list))
+    for start_ns, value, site_id, tid_hash, seq_no, index, _ in arguments:
+        duration_ns = owners.get((tid_hash, seq_no, site_id, start_ns))
+        if duration_ns is not None:
+            grouped[(site_id, index)][value.bit_length()].append((value, duration_ns))
+
+    def per_unit(duration_ns, arg_total):
+        return duration_ns / arg_total if arg_total else None
+
+    rows = []
+    for (site_id, index), buckets in sorted(grouped.items()):
+        bucket_rows = []
+        for bucket in sorted(buckets):
+            pairs = buckets[bucket]
+            values = [value for value, _ in pairs]
+            durations = sorted(duration_ns for _, duration_ns in pairs)
+            bucket_rows.append(
+                {
+                    "arg_min": min(values),
+                    "arg_max": max(values),
+                    "count": len(durations),
+                    "p50_ns": durations[len(durations) // 2],
+                    "p99_ns": durations[min(len(durations) - 1, int(len(durations) * 0.99))],
+                    "mean_ns": statistics.mean(durations),
+                    "ns_per_unit": per_unit(sum(durations), sum(values)),
+                }
+            )
+        pairs = [pair for bucket in buckets.values() for pair in bucket]
+        arg_total = sum(value for value, _ in pairs)
+        durations = sorted(duration_ns for _, duration_ns in pairs)
+        duration_total = sum(durations)
+        rows.append(
+            {
+                "site_id": site_id,
+                "label": sites.get(site_id, {}).get("label", f"site_{site_id}"),
+                "arg": index,
+                "count": len(durations),
+                "p50_ns": durations[len(durations) // 2],
+                "p99_ns": durations[min(len(durations) - 1, int(len(durations) * 0.99))],
+                "arg_total": arg_total,
+                "duration_total_ns": duration_total,
+                "ns_per_unit": per_unit(duration_total, arg_total),
+                "buckets": bucket_rows,
+            }
+        )
+    return rows
+
+
+def histogram_quantile(histogram, sub_bucket_bits, rank):
+    # Values inside a bucket are unknown; report the bucket midpoint clamped to the
+    # exact extremes, which bounds the error by half a bucket width.
+    seen = 0
+    for index, bucket_total in histogram["buckets"]:
+        seen += bucket_total
+        if seen > rank:
+            lower, upper = bucket_bounds(index, sub_bucket_bits)
+            midpoint = (lower + upper - 1) // 2
+            return min(max(midpoint, histogram["min_ns"]), histogram["max_ns"])
+    return histogram["max_ns"]
+
+
+def histogram_trimmed_mean(histogram, sub_bucket_bits, ratio):
+    count = histogram["count"]
+    trim = int(count * ratio)
+    if trim == 0 or trim * 2 >= count:
+        return histogram["sum_ns"] / count
+    total = 0
+    kept = 0
+    seen = 0
+    for index, bucket_total in histogram["buckets"]:
+        lower, upper = bucket_bounds(index, sub_bucket_bits)
+        midpoint = min(max((lower + upper - 1) / 2, histogram["min_ns"]), histogram["max_ns"])
+        begin = max(seen, trim)
+        end = min(seen + bucket_total, count - trim)
+        if end > begin:
+            total += midpoint * (end - begin)
+            kept += end - begin
+        seen += bucket_total
+    return total / kept
+
+
+def summarize_histograms(histograms, sub_bucket_bits, sites):
+    summaries = []
+    for site_id, histogram in histograms.items():
+        count = histogram["count"]
+        if count == 0:
+            continue
+        label = sites.get(site_id, {}).get("label", f"site_{site_id}")
+        summaries.append(
+            {
+                "site_id": site_id,
+                "label": label,
+                "count": count,
+                "min_ns": histogram["min_ns"],
+                "p50_ns": histogram_quantile(histogram, sub_bucket_bits, count // 2),
+                "p90_ns": histogram_quantile(histogram, sub_bucket_bits, min(count - 1, int(count * 0.90))),
+                "p99_ns": histogram_quantile(histogram, sub_bucket_bits, min(count - 1, int(count * 0.99))),
+                "p999_ns": histogram_quantile(histogram, sub_bucket_bits, min(count - 1, int(count * 0.999))),
+                "mean_ns": histogram["sum_ns"] / count,
+                "trimmed_mean_ns": histogram_trimmed_mean(histogram, sub_bucket_bits, 0.05),
+                "max_ns": histogram["max_ns"],
             }
         )
     return sorted(summaries, key=lambda item: item["p50_ns"], reverse=True)
@@ -99,21 +601,49 @@ def summarize(records, sites):
 
 def main():
     parser = argparse.ArgumentParser(description="Analyze perf_duration_trace exports")
-    parser.add_argument("sample_path", help="Path to .perfbin file")
+    parser.add_argument(
+        "sample_path", help="Path to .perfbin or histogram file, or a glob of rotated segments"
+    )
     parser.add_argument("site_path", help="Path to .sites.tsv file")
     parser.add_argument("--json", action="store_true", help="Print JSON instead of table")
+    parser.add_argument("--tree", action="store_true", help="Also print the call tree with self time")
+    parser.add_argument(
+        "--breakdown", action="store_true", help="Also print per-thread and per-CPU latency breakdowns"
+    )
+    parser.add_argument(
+        "--args", action="store_true", help="Also print span durations bucketed by their numeric arguments"
+    )
+    parser.add_argument(
+        "--threads", dest="thread_path", help="Path to .threads.tsv (default: derived from site_path)"
+    )
     args = parser.parse_args()
 
     try:
-        sample_blob = load_records(args.sample_path)
+        sample_blob = load_samples(args.sample_path)
         sites = load_sites(args.site_path)
+        threads = load_threads(args.thread_path or thread_path_for(args.site_path))
     except (OSError, ValueError) as exc:
         print(f"error: {exc}", file=sys.stderr)
         return 2
 
-    summaries = summarize(sample_blob["records"], sites)
+    call_tree = []
+    thread_rows = []
+    cpu_rows = []
+    migration = {"transitions": 0, "migrations": 0, "rate": 0.0}
+    arg_rows = []
+    if sample_blob["format"] == "histogram":
+        summaries = summarize_histograms(sample_blob["histograms"], sample_blob["sub_bucket_bits"], sites)
+    else:
+        records = sample_blob["records"]
+        parent, self_ns = link_spans(records)
+        summaries = summarize(records, sites, self_ns)
+        call_tree = build_call_tree(records, parent, self_ns, sites)
+        thread_rows, cpu_rows, migration = summarize_threads_and_cpus(records, threads)
+        arg_rows = summarize_args(records, sample_blob["arguments"], sites)
 
     payload = {
+        "format": sample_blob["format"],
+        "clock_source": sample_blob["clock_source"],
         "record_count": sample_blob["record_count"],
         "parsed_record_count": sample_blob["parsed_record_count"],
         "overwritten": sample_blob["overwritten"],
@@ -121,7 +651,13 @@ def main():
         "shard_count": sample_blob["shard_count"],
         "capacity_per_shard": sample_blob["capacity_per_shard"],
         "truncated": sample_blob["truncated"],
+        "drop_intervals": sample_blob.get("drop_intervals", []),
         "sites": summaries,
+        "call_tree": call_tree,
+        "threads": thread_rows,
+        "cpus": cpu_rows,
+        "migration": migration,
+        "args": arg_rows,
     }
 
     if args.json:
@@ -131,12 +667,56 @@ def main():
     if sample_blob["truncated"]:
         print("warning\tpartial record stream parsed", file=sys.stderr)
 
-    print("label\tcount\tmin_ns\tp50_ns\tp90_ns\tp99_ns\tmean_ns\ttrimmed_mean_ns\tmax_ns")
+    print("label\tcount\tmin_ns\tp50_ns\tp90_ns\tp99_ns\tp999_ns\tmean_ns\ttrimmed_mean_ns\tmax_ns")
     for row in summaries:
         print(
             f"{row['label']}\t{row['count']}\t{row['min_ns']}\t{row['p50_ns']}\t{row['p90_ns']}\t"
-            f"{row['p99_ns']}\t{row['mean_ns']:.2f}\t{row['trimmed_mean_ns']:.2f}\t{row['max_ns']}"
+            f"{row['p99_ns']}\t{row['p999_ns']}\t{row['mean_ns']:.2f}\t{row['trimmed_mean_ns']:.2f}\t{row['max_ns']}"
         )
+
+    if args.breakdown and thread_rows:
+        print()
+        print("thread\ttid\tname\tcount\tp50_ns\tp99_ns\tmean_ns\tcpus\tmigrations")
+        for row in thread_rows:
+            print(
+                f"{row['tid_hash']:08x}\t{row['tid'] if row['tid'] is not None else '-'}\t{row['name'] or '-'}\t"
+                f"{row['count']}\t{row['p50_ns']}\t{row['p99_ns']}\t{row['mean_ns']:.2f}\t{row['cpus']}\t"
+                f"{row['migrations']}"
+            )
+    if args.breakdown and cpu_rows:
+        print()
+        print("cpu\tcount\tp50_ns\tp99_ns\tmean_ns")
+        for row in cpu_rows:
+            print(f"{row['cpu']}\t{row['count']}\t{row['p50_ns']}\t{row['p99_ns']}\t{row['mean_ns']:.2f}")
+        print(
+            f"migration_rate\t{migration['rate']:.4f}\t({migration['migrations']} of "
+            f"{migration['transitions']} consecutive samples changed CPU)"
+        )
+
+    if args.args and arg_rows:
+        print()
+        print("args\targ\targ_range\tcount\tp50_ns\tmean_ns\tns_per_unit")
+
+        def per_unit_text(value):
+            return "-" if value is None else f"{value:.4f}"
+
+        for row in arg_rows:
+            print(
+                f"{row['label']}\t{row['arg']}\tall\t{row['count']}\t{row['p50_ns']}\t"
+                f"{row['duration_total_ns'] / row['count']:.2f}\t"
+                f"{per_unit_text(row['ns_per_unit'])}"
+            )
+            for bucket in row["buckets"]:
+                print(
+                    f"  {row['label']}\t{row['arg']}\t{bucket['arg_min']}-{bucket['arg_max']}\t{bucket['count']}\t"
+                    f"{bucket['p50_ns']}\t{bucket['mean_ns']:.2f}\t{per_unit_text(bucket['ns_per_unit'])}"
+                )
+
+    if args.tree and call_tree:
+        print()
+        print("call_tree\tcount\tinclusive_ns\tself_ns")
+        for node in call_tree:
+            print(f"{'  ' * node['depth']}{node['path'][-1]}\t{node['count']}\t{node['inclusive_ns']}\t{node['self_ns']}")
     return 0
 
 
@@ -0,0 +1,1992 @@
+// Native counterpart of perf_duration_analyze.py for exports too large for Python.
+//
+//   perf_duration_trace_analyze <sample|glob> <sites.tsv> [--json] [--tree] [--breakdown] [--args]
+//                               [--threads <threads.tsv>] [--jobs <n>]
+//   perf_duration_trace_analyze --compare <base.perfbin> <base.sites.tsv> <cand.perfbin>
+//                               <cand.sites.tsv> [--metric p50|p90|p99|p999|mean]
+//                               [--threshold <pct>] [--alpha <p>] [--min-count <n>] [--json]
+//
+// Prints the same table and --json layout as the Python tool. The sample file is mapped
+// read-only; a quoted glob ("run.*.perfbin") analyzes the segments of a rotated async export
+// as one trace. Fixed records are bucketed by thread over file ranges in parallel; compressed
+// blocks already name their thread, so only block headers are scanned. Workers then take
+// whole threads, walk them in start order (span linking, call tree, CPU migrations) and feed
+// per-site, per-thread and per-CPU log-linear sketches that are merged at the end.
+//
+// Counts, sums, min/max, self time and the call tree are exact. Quantiles and trimmed means
+// come from the sketches: values below 256 ns are exact, larger ones are reported as the
+// bucket midpoint, within 1/256 of the true value.
+//
+// Argument records (PERF_SCOPE_ARG / PERF_END_ARG) are joined to their span by (tid_hash,
+// seq_no, site_id, start_ns). --args prints, per site and argument, the span durations
+// bucketed by the argument's power of two together with the cost per unit (total ns / total
+// argument), e.g. ns per byte; --json always carries the same data under "args".
+//
+// --compare matches sites of two runs by (label, file, function, line) and reports quantile
+// deltas with a one-sided Mann-Whitney test computed from the sketches. It exits with 1 when
+// a site's metric grew by more than the threshold with p < alpha, so it can gate CI jobs.
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "perf_duration_trace_format.h"
+
+namespace {
+
+using perf_duration_trace::SampleRecord;
+namespace detail = perf_duration_trace::detail;
+
+constexpr uint32_t kSketchSubBucketBits = 7U;
+constexpr double kTrimRatio = 0.05;
+constexpr size_t kDepthLevels = detail::kRecordDepthMask + 1U;
+// Fixed records are bucketed in ranges of at most this many, so offsets fit in 32 bits.
+constexpr uint64_t kMaxRangeRecords = uint64_t {1} << 31U;
+
+// ---- Input -----------------------------------------------------------------------------
+
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (base_ != nullptr) {
+            ::munmap(base_, size_);
+        }
+    }
+
+    [[nodiscard]] bool open(const char* path) {
+        const int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info {};
+        bool ok = ::fstat(fd, &info) == 0;
+        size_ = ok ? static_cast<size_t>(info.st_size) : 0U;
+        if (ok && size_ != 0U) {
+            void* mapped = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            ok = mapped != MAP_FAILED;
+            base_ = ok ? static_cast<unsigned char*>(mapped) : nullptr;
+            if (ok) {
+                (void)::madvise(base_, size_, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+        return ok;
+    }
+
+    [[nodiscard]] const unsigned char* data() const noexcept { return base_; }
+    [[nodiscard]] size_t size() const noexcept { return size_; }
+
+private:
+    unsigned char* base_ = nullptr;
+    size_t size_ = 0U;
+};
+
+struct SiteInfo {
+    std::string label;
+    std::string file;
+    std::string function;
+    std::string line;
+};
+
+struct ThreadInfo {
+    std::string tid;
+    std::string name;
+};
+
+std::vector<std::string> split_tabs(const std::string& line) {
+    std::vector<std::string> fields;
+    size_t begin = 0U;
+    for (;;) {
+        const size_t end = line.find('\t', begin);
+        fields.push_back(line.substr(begin, end == std::string::npos ? std::string::npos : end - begin));
+        if (end == std::string::npos) {
+            return fields;
+        }
+        begin = end + 1U;
+    }
+}
+
+// Reads a TSV with a header row into (key column -> row). Returns false when the file cannot be
+// opened; rows whose key does not parse are skipped. keep_first mirrors the Python tools:
+// sites take the last row per id, threads the first.
+bool load_table(const std::string& path, const char* key_column,
+                std::unordered_map<uint32_t, std::map<std::string, std::string>>& rows, bool keep_first) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    if (!std::getline(in, line)) {
+        return true;
+    }
+    const std::vector<std::string> columns = split_tabs(line);
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        const std::vector<std::string> fields = split_tabs(line);
+        std::map<std::string, std::string> row;
+        for (size_t i = 0; i < columns.size() && i < fields.size(); ++i) {
+            row[columns[i]] = fields[i];
+        }
+        const auto key = row.find(key_column);
+        if (key == row.end()) {
+            continue;
+        }
+        try {
+            const auto id = static_cast<uint32_t>(std::stoull(key->second));
+            if (keep_first) {
+                rows.emplace(id, std::move(row));
+            } else {
+                rows[id] = std::move(row);
+            }
+        } catch (const std::exception&) {
+            continue;
+        }
+    }
+    return true;
+}
+
+bool load_sites(const std::string& path, std::unordered_map<uint32_t, SiteInfo>& sites) {
+    std::unordered_map<uint32_t, std::map<std::string, std::string>> rows;
+    if (!load_table(path, "site_id", rows, false)) {
+        return false;
+    }
+    for (auto& entry : rows) {
+        SiteInfo& site = sites[entry.first];
+        site.label = entry.second["label"];
+        site.file = entry.second["file"];
+        site.function = entry.second["function"];
+        site.line = entry.second["line"];
+    }
+    return true;
+}
+
+void load_threads(const std::string& path, std::unordered_map<uint32_t, ThreadInfo>& threads) {
+    std::unordered_map<uint32_t, std::map<std::string, std::string>> rows;
+    if (!load_table(path, "tid_hash", rows, true)) {
+        return;
+    }
+    for (auto& entry : rows) {
+        ThreadInfo& info = threads[entry.first];
+        info.tid = entry.second["tid"];
+        info.name = entry.second["name"];
+    }
+}
+
+std::string thread_path_for(const std::string& site_path) {
+    const std::string suffix = ".sites.tsv";
+    const bool has_suffix =
+        site_path.size() >= suffix.size() && site_path.compare(site_path.size() - suffix.size(), suffix.size(), suffix) == 0;
+    return (has_suffix ? site_path.substr(0U, site_path.size() - suffix.size()) : site_path) + ".threads.tsv";
+}
+
+// ---- Sketches --------------------------------------------------------------------------
+
+// Python's statistics.mean() of integers: an int when the division is exact, a float otherwise.
+struct Mean {
+    double value = 0.0;
+    bool integral = false;
+};
+
+[[nodiscard]] Mean exact_mean(uint64_t sum, uint64_t count) noexcept {
+    if (count == 0U) {
+        return {std::nan(""), false};
+    }
+    return {static_cast<double>(static_cast<long double>(sum) / static_cast<long double>(count)), sum % count == 0U};
+}
+
+// Mergeable log-linear histogram with exact count, sum, min and max. Only the bucket window
+// between the smallest and largest value seen is allocated.
+class DurationSketch {
+public:
+    explicit DurationSketch(uint32_t sub_bucket_bits = kSketchSubBucketBits) noexcept
+        : sub_bucket_bits_(sub_bucket_bits) {}
+
+    void add(uint64_t value) {
+        add_bucket(detail::log_linear_bucket_index(value, sub_bucket_bits_), 1U);
+        ++count_;
+        sum_ += value;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+    }
+
+    void add_bucket(uint32_t index, uint64_t total) {
+        if (buckets_.empty()) {
+            first_ = index;
+            buckets_.assign(1U, 0U);
+        } else if (index < first_) {
+            buckets_.insert(buckets_.begin(), first_ - index, 0U);
+            first_ = index;
+        } else if (index - first_ >= buckets_.size()) {
+            buckets_.resize(index - first_ + 1U, 0U);
+        }
+        buckets_[index - first_] += total;
+    }
+
+    // Histogram exports carry their own totals.
+    void set_totals(uint64_t count, uint64_t sum, uint64_t min, uint64_t max) noexcept {
+        count_ = count;
+        sum_ = sum;
+        min_ = min;
+        max_ = max;
+    }
+
+    void merge(const DurationSketch& other) {
+        for (size_t i = 0; i < other.buckets_.size(); ++i) {
+            if (other.buckets_[i] != 0U) {
+                add_bucket(other.first_ + static_cast<uint32_t>(i), other.buckets_[i]);
+            }
+        }
+        count_ += other.count_;
+        sum_ += other.sum_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+    }
+
+    [[nodiscard]] uint64_t count() const noexcept { return count_; }
+    [[nodiscard]] uint64_t sum() const noexcept { return sum_; }
+    [[nodiscard]] uint64_t min() const noexcept { return min_; }
+    [[nodiscard]] uint64_t max() const noexcept { return max_; }
+    [[nodiscard]] uint32_t sub_bucket_bits() const noexcept { return sub_bucket_bits_; }
+    [[nodiscard]] uint32_t first_bucket() const noexcept { return first_; }
+    [[nodiscard]] uint32_t end_bucket() const noexcept { return first_ + static_cast<uint32_t>(buckets_.size()); }
+
+    [[nodiscard]] uint64_t bucket(uint32_t index) const noexcept {
+        return index >= first_ && index - first_ < buckets_.size() ? buckets_[index - first_] : 0U;
+    }
+
+    // Re-buckets onto a coarser grid; every fine bucket lies inside one coarse bucket.
+    [[nodiscard]] DurationSketch coarsened(uint32_t sub_bucket_bits) const {
+        DurationSketch coarse(sub_bucket_bits);
+        for (size_t i = 0; i < buckets_.size(); ++i) {
+            if (buckets_[i] != 0U) {
+                const detail::BucketBounds bounds = detail::log_linear_bucket_bounds(first_ + i, sub_bucket_bits_);
+                coarse.add_bucket(detail::log_linear_bucket_index(bounds.lower, sub_bucket_bits), buckets_[i]);
+            }
+        }
+        coarse.set_totals(count_, sum_, min_, max_);
+        return coarse;
+    }
+
+    // Python's rank for quantile q: min(count - 1, int(count * q)); p50 uses count // 2.
+    [[nodiscard]] uint64_t rank(double q) const noexcept {
+        return std::min(count_ - 1U, static_cast<uint64_t>(static_cast<double>(count_) * q));
+    }
+
+    // Bucket midpoint clamped to the exact extremes, as in the Python histogram path.
+    [[nodiscard]] uint64_t quantile(uint64_t rank) const noexcept {
+        uint64_t seen = 0U;
+        for (size_t i = 0; i < buckets_.size(); ++i) {
+            seen += buckets_[i];
+            if (seen > rank) {
+                const detail::BucketBounds bounds = detail::log_linear_bucket_bounds(first_ + i, sub_bucket_bits_);
+                const uint64_t midpoint = bounds.lower + (bounds.width - 1U) / 2U;
+                return std::min(std::max(midpoint, min_), max_);
+            }
+        }
+        return max_;
+    }
+
+    [[nodiscard]] Mean trimmed_mean(double ratio) const noexcept {
+        const auto trim = static_cast<uint64_t>(static_cast<double>(count_) * ratio);
+        if (trim == 0U || trim * 2U >= count_) {
+            return exact_mean(sum_, count_);
+        }
+        double total = 0.0;
+        uint64_t kept = 0U;
+        uint64_t seen = 0U;
+        for (size_t i = 0; i < buckets_.size(); ++i) {
+            const detail::BucketBounds bounds = detail::log_linear_bucket_bounds(first_ + i, sub_bucket_bits_);
+            const double midpoint =
+                std::min(std::max(static_cast<double>(bounds.lower) + static_cast<double>(bounds.width - 1U) / 2.0,
+                                  static_cast<double>(min_)),
+                         static_cast<double>(max_));
+            const uint64_t begin = std::max(seen, trim);
+            const uint64_t end = std::min(seen + buckets_[i], count_ - trim);
+            if (end > begin) {
+                total += midpoint * static_cast<double>(end - begin);
+                kept += end - begin;
+            }
+            seen += buckets_[i];
+        }
+        const double value = total / static_cast<double>(kept);
+        return {value, value == std::floor(value)};
+    }
+
+private:
+    uint32_t sub_bucket_bits_;
+    uint32_t first_ = 0U;
+    std::vector<uint64_t> buckets_;
+    uint64_t count_ = 0U;
+    uint64_t sum_ = 0U;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0U;
+};
+
+// ---- Per-thread analysis ---------------------------------------------------------------
+
+struct Span {
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    uint64_t ordinal;
+    uint32_t site_id;
+    uint32_t seq_no;
+    uint16_t depth;
+    uint16_t cpu_hint;
+};
+
+struct SiteTotals {
+    DurationSketch durations;
+    uint64_t self_ns = 0U;
+    uint64_t first_seen = UINT64_MAX;
+};
+
+// Call paths as a trie; node 0 is the root.
+class CallTree {
+public:
+    struct Node {
+        uint32_t site_id = 0U;
+        uint64_t count = 0U;
+        uint64_t inclusive_ns = 0U;
+        uint64_t self_ns = 0U;
+        std::map<uint32_t, uint32_t> children;
+    };
+
+    CallTree() : nodes_(1U) {}
+
+    [[nodiscard]] uint32_t child(uint32_t parent, uint32_t site_id) {
+        const auto found = nodes_[parent].children.find(site_id);
+        if (found != nodes_[parent].children.end()) {
+            return found->second;
+        }
+        const auto index = static_cast<uint32_t>(nodes_.size());
+        nodes_[parent].children.emplace(site_id, index);
+        nodes_.emplace_back();
+        nodes_.back().site_id = site_id;
+        return index;
+    }
+
+    [[nodiscard]] Node& node(uint32_t index) noexcept { return nodes_[index]; }
+    [[nodiscard]] const Node& node(uint32_t index) const noexcept { return nodes_[index]; }
+
+    void merge(const CallTree& other) { merge_node(other, 0U, 0U); }
+
+private:
+    void merge_node(const CallTree& other, uint32_t from, uint32_t into) {
+        for (const auto& entry : other.nodes_[from].children) {
+            const uint32_t target = child(into, entry.first);
+            const Node& source = other.nodes_[entry.second];
+            nodes_[target].count += source.count;
+            nodes_[target].inclusive_ns += source.inclusive_ns;
+            nodes_[target].self_ns += source.self_ns;
+            merge_node(other, entry.second, target);
+        }
+    }
+
+    std::vector<Node> nodes_;
+};
+
+struct ThreadRow {
+    uint32_t tid_hash = 0U;
+    uint64_t first_seen = 0U;
+    size_t cpus = 0U;
+    uint64_t migrations = 0U;
+    DurationSketch durations;
+};
+
+struct DropInterval {
+    uint64_t ordinal;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    uint32_t dropped;
+};
+
+// Spans whose argument falls into [2^(bucket - 1), 2^bucket); bucket 0 holds the value 0.
+struct ArgBucket {
+    DurationSketch durations;
+    uint64_t arg_min = UINT64_MAX;
+    uint64_t arg_max = 0U;
+    uint64_t arg_total = 0U;
+
+    void add(uint64_t value, uint64_t duration_ns) {
+        durations.add(duration_ns);
+        arg_min = std::min(arg_min, value);
+        arg_max = std::max(arg_max, value);
+        arg_total += value;
+    }
+
+    void merge(const ArgBucket& other) {
+        durations.merge(other.durations);
+        arg_min = std::min(arg_min, other.arg_min);
+        arg_max = std::max(arg_max, other.arg_max);
+        arg_total += other.arg_total;
+    }
+};
+
+[[nodiscard]] uint32_t arg_bucket(uint64_t value) noexcept {
+    return value == 0U ? 0U : static_cast<uint32_t>(64 - __builtin_clzll(value));
+}
+
+// (site_id, argument index) -> bucket -> totals.
+using ArgTotals = std::map<std::pair<uint32_t, uint32_t>, std::map<uint32_t, ArgBucket>>;
+
+struct Totals {
+    std::unordered_map<uint32_t, SiteTotals> sites;
+    ArgTotals args;
+    std::map<uint32_t, DurationSketch> cpus;
+    CallTree tree;
+    std::vector<ThreadRow> threads;
+    std::vector<DropInterval> drop_intervals;
+    uint64_t transitions = 0U;
+    uint64_t migrations = 0U;
+    uint64_t failed_records = 0U;
+
+    void merge(Totals& other) {
+        for (auto& entry : other.sites) {
+            SiteTotals& site = sites[entry.first];
+            site.durations.merge(entry.second.durations);
+            site.self_ns += entry.second.self_ns;
+            site.first_seen = std::min(site.first_seen, entry.second.first_seen);
+        }
+        for (auto& entry : other.cpus) {
+            cpus[entry.first].merge(entry.second);
+        }
+        for (const auto& entry : other.args) {
+            auto& buckets = args[entry.first];
+            for (const auto& bucket : entry.second) {
+                buckets[bucket.first].merge(bucket.second);
+            }
+        }
+        tree.merge(other.tree);
+        std::move(other.threads.begin(), other.threads.end(), std::back_inserter(threads));
+        drop_intervals.insert(drop_intervals.end(), other.drop_intervals.begin(), other.drop_intervals.end());
+        transitions += other.transitions;
+        migrations += other.migrations;
+        failed_records += other.failed_records;
+    }
+};
+
+// Consumes one thread's spans in start order. Spans with the same start are buffered and
+// ordered by (depth, seq_no) so a parent always precedes its children, matching the Python
+// tool's (start_ns, depth, seq_no) order. Open spans are kept per depth exactly like
+// link_spans(); a span whose end lies before the current start can never become a parent
+// again, so it is retired and its self time is booked.
+class ThreadWalker {
+public:
+    ThreadWalker(Totals& totals, ThreadRow& row) : totals_(totals), row_(row) {}
+
+    void add(const Span& span) {
+        if (!group_.empty() && group_.front().start_ns != span.start_ns) {
+            flush_group();
+        }
+        group_.push_back(span);
+    }
+
+    void finish() {
+        flush_group();
+        for (auto& level : open_) {
+            for (const OpenSpan& open : level) {
+                retire(open);
+            }
+            level.clear();
+        }
+        row_.cpus = seen_cpus_.size();
+    }
+
+private:
+    struct OpenSpan {
+        uint64_t end_ns;
+        uint64_t self_ns;
+        SiteTotals* site;
+        uint32_t node;
+    };
+
+    void flush_group() {
+        if (group_.size() > 1U) {
+            std::stable_sort(group_.begin(), group_.end(), [](const Span& lhs, const Span& rhs) {
+                if (lhs.depth != rhs.depth) {
+                    return lhs.depth < rhs.depth;
+                }
+                return lhs.seq_no < rhs.seq_no;
+            });
+        }
+        for (const Span& span : group_) {
+            process(span);
+        }
+        group_.clear();
+    }
+
+    void process(const Span& span) {
+        const uint64_t end_ns = span.start_ns + span.duration_ns;
+        uint32_t parent_node = 0U;
+        if (span.depth > 0U) {
+            std::vector<OpenSpan>& candidates = open_[span.depth - 1U];
+            retire_ended(candidates, span.start_ns);
+            for (auto it = candidates.rbegin(); it != candidates.rend(); ++it) {
+                if (it->end_ns >= end_ns) {
+                    it->self_ns = it->self_ns > span.duration_ns ? it->self_ns - span.duration_ns : 0U;
+                    parent_node = it->node;
+                    break;
+                }
+            }
+        }
+
+        const uint32_t node = totals_.tree.child(parent_node, span.site_id);
+        CallTree::Node& tree_node = totals_.tree.node(node);
+        ++tree_node.count;
+        tree_node.inclusive_ns += span.duration_ns;
+
+        if (site_ == nullptr || site_id_ != span.site_id) {
+            site_ = &totals_.sites[span.site_id];
+            site_id_ = span.site_id;
+        }
+        site_->durations.add(span.duration_ns);
+        site_->first_seen = std::min(site_->first_seen, span.ordinal);
+        row_.durations.add(span.duration_ns);
+
+        if (span.cpu_hint != 0U) {
+            totals_.cpus[static_cast<uint32_t>(span.cpu_hint - 1U)].add(span.duration_ns);
+            if (previous_cpu_ != 0U) {
+                ++totals_.transitions;
+                if (span.cpu_hint != previous_cpu_) {
+                    ++totals_.migrations;
+                    ++row_.migrations;
+                }
+            }
+            previous_cpu_ = span.cpu_hint;
+            if (std::find(seen_cpus_.begin(), seen_cpus_.end(), span.cpu_hint) == seen_cpus_.end()) {
+                seen_cpus_.push_back(span.cpu_hint);
+            }
+        }
+
+        std::vector<OpenSpan>& level = open_[span.depth];
+        retire_ended(level, span.start_ns);
+        level.push_back({end_ns, span.duration_ns, site_, node});
+    }
+
+    void retire_ended(std::vector<OpenSpan>& level, uint64_t start_ns) {
+        while (!level.empty() && level.back().end_ns < start_ns) {
+            retire(level.back());
+            level.pop_back();
+        }
+    }
+
+    void retire(const OpenSpan& open) {
+        open.site->self_ns += open.self_ns;
+        totals_.tree.node(open.node).self_ns += open.self_ns;
+    }
+
+    Totals& totals_;
+    ThreadRow& row_;
+    std::vector<Span> group_;
+    std::vector<OpenSpan> open_[kDepthLevels];
+    std::vector<uint16_t> seen_cpus_;
+    SiteTotals* site_ = nullptr;
+    uint32_t site_id_ = 0U;
+    uint16_t previous_cpu_ = 0U;
+};
+
+// ---- Trace layout ----------------------------------------------------------------------
+
+class Trace {
+public:
+    [[nodiscard]] bool open(const char* path, std::string& error) {
+        if (!file_.open(path)) {
+            error = std::string("cannot read ") + path;
+            return false;
+        }
+        const unsigned char* data = file_.data();
+        const size_t size = file_.size();
+        if (size >= 8U && std::memcmp(data, detail::kHistogramFileMagic, 8U) == 0) {
+            histogram_ = true;
+            return true;
+        }
+        if (size < detail::kFileHeaderV1Size) {
+            error = "truncated perfbin header";
+            return false;
+        }
+        std::memcpy(&header_, data, detail::kFileHeaderV1Size);
+        compressed_ = std::memcmp(header_.magic, detail::kBlockFileMagic, 8U) == 0;
+        if (!compressed_ && std::memcmp(header_.magic, detail::kFileMagic, 8U) != 0) {
+            error = "unexpected perfbin magic";
+            return false;
+        }
+        if (header_.record_size != sizeof(SampleRecord)) {
+            error = "unexpected record size";
+            return false;
+        }
+        if (header_.version >= 2U) {
+            if (size < sizeof(detail::FileHeader)) {
+                error = "truncated perfbin v2 header";
+                return false;
+            }
+            std::memcpy(&header_, data, sizeof(detail::FileHeader));
+            if (header_.clock_source > detail::kTscClockSource) {
+                error = "unknown clock source";
+                return false;
+            }
+        } else {
+            header_.header_size = static_cast<uint32_t>(detail::kFileHeaderV1Size);
+            header_.clock_source = 0U;
+        }
+        return true;
+    }
+
+    [[nodiscard]] bool histogram() const noexcept { return histogram_; }
+    [[nodiscard]] bool compressed() const noexcept { return compressed_; }
+    [[nodiscard]] const detail::FileHeader& header() const noexcept { return header_; }
+    [[nodiscard]] const MappedFile& file() const noexcept { return file_; }
+
+    [[nodiscard]] uint64_t convert_start(uint64_t value) const noexcept {
+        if (header_.clock_source != detail::kTscClockSource) {
+            return value;
+        }
+        const double ticks = static_cast<double>(static_cast<int64_t>(value - header_.tsc_base_ticks));
+        return header_.tsc_base_ns + static_cast<uint64_t>(static_cast<int64_t>(std::nearbyint(ticks * header_.tsc_ns_per_tick)));
+    }
+
+    [[nodiscard]] uint64_t convert_duration(uint64_t value) const noexcept {
+        if (header_.clock_source != detail::kTscClockSource) {
+            return value;
+        }
+        return static_cast<uint64_t>(std::nearbyint(static_cast<double>(value) * header_.tsc_ns_per_tick));
+    }
+
+    [[nodiscard]] Span to_span(const SampleRecord& record, uint64_t ordinal) const noexcept {
+        return {convert_start(record.start_ns), convert_duration(record.duration_ns), ordinal, record.site_id,
+                record.seq_no, detail::record_depth(record), record.cpu_hint};
+    }
+
+    [[nodiscard]] const SampleRecord* fixed_records() const noexcept {
+        return reinterpret_cast<const SampleRecord*>(file_.data() + header_.header_size);
+    }
+
+private:
+    MappedFile file_;
+    detail::FileHeader header_ {};
+    bool histogram_ = false;
+    bool compressed_ = false;
+};
+
+// One export: a single file, or the rotated async segments a glob such as "run.*.perfbin"
+// matches, taken in file-name order. Header counts are summed over the segments.
+class TraceSet {
+public:
+    [[nodiscard]] bool open(const std::string& pattern, std::string& error) {
+        std::vector<std::string> paths;
+        if (pattern.find_first_of("*?[") == std::string::npos) {
+            paths.push_back(pattern);
+        } else {
+            glob_t matches {};
+            if (::glob(pattern.c_str(), 0, nullptr, &matches) == 0) {
+                paths.assign(matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+            }
+            ::globfree(&matches);
+            if (paths.empty()) {
+                error = "no segment matches " + pattern;
+                return false;
+            }
+        }
+        for (const std::string& path : paths) {
+            segments_.push_back(std::make_unique<Trace>());
+            if (!segments_.back()->open(path.c_str(), error)) {
+                return false;
+            }
+            const Trace& trace = *segments_.back();
+            if (segments_.size() > 1U && (trace.histogram() || front().histogram())) {
+                error = "histogram files cannot be combined";
+                return false;
+            }
+            if (trace.compressed() != front().compressed()) {
+                error = "segments mix fixed and compressed formats";
+                return false;
+            }
+            record_count_ += trace.header().record_count;
+            overwritten_ += trace.header().overwritten_samples;
+            dropped_ += trace.header().dropped_samples;
+        }
+        return true;
+    }
+
+    [[nodiscard]] const Trace& front() const noexcept { return *segments_.front(); }
+    [[nodiscard]] const std::vector<std::unique_ptr<Trace>>& segments() const noexcept { return segments_; }
+    [[nodiscard]] bool histogram() const noexcept { return front().histogram(); }
+    [[nodiscard]] bool compressed() const noexcept { return front().compressed(); }
+    [[nodiscard]] uint64_t record_count() const noexcept { return record_count_; }
+    [[nodiscard]] uint64_t overwritten() const noexcept { return overwritten_; }
+    [[nodiscard]] uint64_t dropped() const noexcept { return dropped_; }
+
+private:
+    std::vector<std::unique_ptr<Trace>> segments_;
+    uint64_t record_count_ = 0U;
+    uint64_t overwritten_ = 0U;
+    uint64_t dropped_ = 0U;
+};
+
+// Ordinals number records across all segments of a rotated export, in file-name order.
+struct FixedPart {
+    const Trace* trace;
+    uint64_t first_ordinal;
+    uint64_t base;
+    std::vector<uint32_t> offsets;
+};
+
+struct BlockRef {
+    const Trace* trace;
+    size_t offset;
+    uint64_t first_ordinal;
+    detail::BlockHeader header;
+};
+
+// Everything one worker needs to walk a thread in file order.
+struct ThreadWork {
+    uint32_t tid_hash = 0U;
+    uint64_t first_seen = UINT64_MAX;
+    uint64_t records = 0U;
+    std::vector<const FixedPart*> parts;
+    std::vector<const BlockRef*> blocks;
+};
+
+using WorkIndex = std::unordered_map<uint32_t, size_t>;
+
+ThreadWork& thread_work(uint32_t tid_hash, std::vector<ThreadWork>& work, WorkIndex& work_index) {
+    auto inserted = work_index.emplace(tid_hash, work.size());
+    if (inserted.second) {
+        work.emplace_back();
+        work.back().tid_hash = tid_hash;
+    }
+    return work[inserted.first->second];
+}
+
+// Runs fn(worker_index) on jobs threads (the calling thread is worker 0).
+template <typename Fn>
+void run_workers(size_t jobs, Fn&& fn) {
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < jobs; ++i) {
+        threads.emplace_back([&fn, i]() { fn(i); });
+    }
+    fn(0U);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+struct RecordSummary {
+    uint64_t parsed = 0U;
+    bool truncated = false;
+    Totals totals;
+};
+
+// Splits fixed records into per-thread offset lists, one range per worker.
+void partition_fixed(const Trace& trace, uint64_t count, uint64_t first_ordinal, size_t jobs,
+                     std::vector<std::unique_ptr<FixedPart>>& parts, std::vector<ThreadWork>& work,
+                     WorkIndex& work_index, std::vector<DropInterval>& drops) {
+    const uint64_t ranges =
+        std::max<uint64_t>(jobs, (count + kMaxRangeRecords - 1U) / kMaxRangeRecords);
+    const uint64_t per_range = count == 0U ? 0U : (count + ranges - 1U) / ranges;
+    struct RangeResult {
+        std::unordered_map<uint32_t, std::unique_ptr<FixedPart>> threads;
+        std::vector<uint32_t> order;
+        std::vector<DropInterval> drops;
+    };
+    std::vector<RangeResult> results(static_cast<size_t>(ranges));
+    const SampleRecord* records = trace.fixed_records();
+    std::atomic<uint64_t> next_range {0U};
+    run_workers(jobs, [&](size_t) {
+        for (uint64_t range = next_range++; range < ranges; range = next_range++) {
+            RangeResult& result = results[static_cast<size_t>(range)];
+            const uint64_t begin = std::min(count, range * per_range);
+            const uint64_t end = std::min(count, begin + per_range);
+            FixedPart* current = nullptr;
+            uint32_t current_tid = 0U;
+            for (uint64_t i = begin; i < end; ++i) {
+                const SampleRecord& record = records[i];
+                if (detail::is_drop_marker(record)) {
+                    result.drops.push_back({first_ordinal + i, trace.convert_start(record.start_ns),
+                                            trace.convert_duration(record.duration_ns), record.seq_no});
+                    continue;
+                }
+                if (current == nullptr || record.tid_hash != current_tid) {
+                    auto& slot = result.threads[record.tid_hash];
+                    if (!slot) {
+                        slot.reset(new FixedPart {&trace, first_ordinal, begin, {}});
+                        result.order.push_back(record.tid_hash);
+                    }
+                    current = slot.get();
+                    current_tid = record.tid_hash;
+                }
+                current->offsets.push_back(static_cast<uint32_t>(i - begin));
+            }
+        }
+    });
+
+    for (RangeResult& result : results) {
+        for (const uint32_t tid : result.order) {
+            ThreadWork& thread = thread_work(tid, work, work_index);
+            std::unique_ptr<FixedPart>& part = result.threads[tid];
+            thread.first_seen = std::min(thread.first_seen, first_ordinal + part->base + part->offsets.front());
+            thread.records += part->offsets.size();
+            thread.parts.push_back(part.get());
+            parts.push_back(std::move(part));
+        }
+        drops.insert(drops.end(), result.drops.begin(), result.drops.end());
+    }
+}
+
+// Walks block headers up to record_count records, like the Python reader, and groups them
+// by thread. Payloads are decoded later by the worker that owns the thread. Returns the
+// number of records covered by complete blocks.
+uint64_t partition_blocks(const Trace& trace, uint64_t first_ordinal, std::deque<BlockRef>& blocks,
+                          std::vector<ThreadWork>& work, WorkIndex& work_index, RecordSummary& summary) {
+    const unsigned char* data = trace.file().data();
+    const size_t size = trace.file().size();
+    size_t offset = trace.header().header_size;
+    uint64_t ordinal = 0U;
+    const size_t first_block = blocks.size();
+    while (ordinal < trace.header().record_count) {
+        if (offset > size || size - offset < sizeof(detail::BlockHeader)) {
+            summary.truncated = true;
+            break;
+        }
+        BlockRef block {};
+        std::memcpy(&block.header, data + offset, sizeof(detail::BlockHeader));
+        block.trace = &trace;
+        block.offset = offset + sizeof(detail::BlockHeader);
+        block.first_ordinal = first_ordinal + ordinal;
+        if (size - block.offset < block.header.payload_bytes) {
+            summary.truncated = true;
+            break;
+        }
+        offset = block.offset + block.header.payload_bytes;
+        ordinal += block.header.record_count;
+        blocks.push_back(block);
+    }
+
+    for (size_t i = first_block; i < blocks.size(); ++i) {
+        const BlockRef& block = blocks[i];
+        ThreadWork& thread = thread_work(block.header.tid_hash, work, work_index);
+        thread.first_seen = std::min(thread.first_seen, block.first_ordinal);
+        thread.records += block.header.record_count;
+        thread.blocks.push_back(&block);
+    }
+    return ordinal;
+}
+
+// Pairs one thread's argument records with their samples. Records arrive in file order, in
+// which an argument may precede its sample (async exports sort each flush separately), so
+// arguments are matched once the whole thread has been seen.
+class ArgJoin {
+public:
+    // Returns false for argument records, which are not spans.
+    [[nodiscard]] bool take(const SampleRecord& record, const Trace& trace) {
+        if (detail::is_argument(record)) {
+            args_.push_back(record);
+            return false;
+        }
+        if (detail::record_arg_count(record) != 0U) {
+            owners_.emplace(key(record), std::make_pair(record.start_ns, trace.convert_duration(record.duration_ns)));
+        }
+        return true;
+    }
+
+    void finish(ArgTotals& totals) const {
+        for (const SampleRecord& arg : args_) {
+            const auto owners = owners_.equal_range(key(arg));
+            const auto owner = std::find_if(owners.first, owners.second,
+                                            [&arg](const auto& entry) { return entry.second.first == arg.start_ns; });
+            if (owner == owners.second) {
+                continue;
+            }
+            totals[{arg.site_id, arg.cpu_hint}][arg_bucket(arg.duration_ns)].add(arg.duration_ns, owner->second.second);
+        }
+    }
+
+private:
+    [[nodiscard]] static uint64_t key(const SampleRecord& record) noexcept {
+        return (static_cast<uint64_t>(record.seq_no) << 32U) | record.site_id;
+    }
+
+    // (seq_no, site_id) -> (raw start, duration in ns) of samples that carry arguments. A
+    // thread id reused by a later thread restarts seq_no, so keys may repeat; start decides.
+    std::unordered_multimap<uint64_t, std::pair<uint64_t, uint64_t>> owners_;
+    std::vector<SampleRecord> args_;
+};
+
+// Feeds one thread's records to walker in start order. Files written by finalize() are
+// already in start order per thread; async exports only within each flush, so such threads
+// are collected and sorted first.
+void walk_thread(const ThreadWork& thread, Totals& totals, ThreadRow& row) {
+    ThreadWalker walker(totals, row);
+    std::vector<Span> spans;
+    std::vector<SampleRecord> decoded;
+    ArgJoin args;
+    bool sorted = true;
+    if (thread.blocks.empty()) {
+        uint64_t previous = 0U;
+        for (const FixedPart* part : thread.parts) {
+            const SampleRecord* records = part->trace->fixed_records();
+            for (const uint32_t offset : part->offsets) {
+                const uint64_t start = records[part->base + offset].start_ns;
+                sorted = sorted && start >= previous;
+                previous = start;
+            }
+        }
+        for (const FixedPart* part : thread.parts) {
+            const Trace& trace = *part->trace;
+            const SampleRecord* records = trace.fixed_records();
+            for (const uint32_t offset : part->offsets) {
+                const SampleRecord& record = records[part->base + offset];
+                if (!args.take(record, trace)) {
+                    continue;
+                }
+                const Span span = trace.to_span(record, part->first_ordinal + part->base + offset);
+                if (sorted) {
+                    walker.add(span);
+                } else {
+                    spans.push_back(span);
+                }
+            }
+        }
+    } else {
+        uint64_t previous = 0U;
+        for (const BlockRef* block : thread.blocks) {
+            sorted = sorted && block->header.first_start_ns >= previous;
+            previous = block->header.last_start_ns;
+        }
+        for (const BlockRef* block : thread.blocks) {
+            const Trace& trace = *block->trace;
+            decoded.clear();
+            if (!detail::decode_block(block->header, trace.file().data() + block->offset, decoded)) {
+                totals.failed_records += block->header.record_count;
+                continue;
+            }
+            for (size_t i = 0; i < decoded.size(); ++i) {
+                const uint64_t ordinal = block->first_ordinal + i;
+                if (detail::is_drop_marker(decoded[i])) {
+                    totals.drop_intervals.push_back({ordinal, trace.convert_start(decoded[i].start_ns),
+                                                     trace.convert_duration(decoded[i].duration_ns),
+                                                     decoded[i].seq_no});
+                    continue;
+                }
+                if (!args.take(decoded[i], trace)) {
+                    continue;
+                }
+                const Span span = trace.to_span(decoded[i], ordinal);
+                if (sorted) {
+                    walker.add(span);
+                } else {
+                    spans.push_back(span);
+                }
+            }
+        }
+    }
+    if (!sorted) {
+        std::stable_sort(spans.begin(), spans.end(),
+                         [](const Span& lhs, const Span& rhs) { return lhs.start_ns < rhs.start_ns; });
+        for (const Span& span : spans) {
+            walker.add(span);
+        }
+    }
+    walker.finish();
+    args.finish(totals.args);
+}
+
+void analyze_records(const TraceSet& traces, size_t jobs, RecordSummary& summary) {
+    std::vector<std::unique_ptr<FixedPart>> parts;
+    std::deque<BlockRef> blocks;
+    std::vector<ThreadWork> work;
+    WorkIndex work_index;
+    for (const auto& segment : traces.segments()) {
+        const Trace& trace = *segment;
+        if (trace.compressed()) {
+            summary.parsed += partition_blocks(trace, summary.parsed, blocks, work, work_index, summary);
+            continue;
+        }
+        const size_t available = (trace.file().size() - std::min<size_t>(trace.file().size(), trace.header().header_size)) /
+                                 sizeof(SampleRecord);
+        const uint64_t count = std::min<uint64_t>(trace.header().record_count, available);
+        summary.truncated = summary.truncated || count < trace.header().record_count;
+        partition_fixed(trace, count, summary.parsed, jobs, parts, work, work_index, summary.totals.drop_intervals);
+        summary.parsed += count;
+    }
+
+    // Largest threads first keeps the workers evenly loaded.
+    std::vector<size_t> order(work.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&work](size_t lhs, size_t rhs) { return work[lhs].records > work[rhs].records; });
+
+    std::vector<Totals> worker_totals(jobs);
+    std::atomic<size_t> next_thread {0U};
+    run_workers(jobs, [&](size_t worker) {
+        Totals& totals = worker_totals[worker];
+        for (size_t i = next_thread++; i < order.size(); i = next_thread++) {
+            const ThreadWork& thread = work[order[i]];
+            totals.threads.emplace_back();
+            ThreadRow& row = totals.threads.back();
+            row.tid_hash = thread.tid_hash;
+            row.first_seen = thread.first_seen;
+            walk_thread(thread, totals, row);
+            if (row.durations.count() == 0U) {
+                // A thread made only of drop markers.
+                totals.threads.pop_back();
+            }
+        }
+    });
+    for (Totals& totals : worker_totals) {
+        summary.totals.merge(totals);
+    }
+    if (summary.totals.failed_records != 0U) {
+        summary.truncated = true;
+        summary.parsed -= summary.totals.failed_records;
+    }
+}
+
+struct HistogramSite {
+    uint32_t site_id;
+    DurationSketch sketch;
+};
+
+struct HistogramSummary {
+    uint32_t version = 0U;
+    uint64_t sample_count = 0U;
+    uint64_t dropped = 0U;
+    uint64_t parsed = 0U;
+    bool truncated = false;
+    std::vector<HistogramSite> sites;
+};
+
+bool load_histograms(const Trace& trace, HistogramSummary& summary, std::string& error) {
+    const unsigned char* data = trace.file().data();
+    const size_t size = trace.file().size();
+    detail::HistogramFileHeader header {};
+    if (size < sizeof(header)) {
+        error = "truncated histogram header";
+        return false;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    summary.version = header.version;
+    summary.sample_count = header.sample_count;
+    summary.dropped = header.dropped_samples;
+    size_t offset = header.header_size;
+    constexpr size_t kEntrySize = sizeof(uint32_t) + sizeof(uint64_t);
+    for (uint64_t i = 0; i < header.site_count; ++i) {
+        detail::HistogramSiteHeader site {};
+        if (offset > size || size - offset < sizeof(site)) {
+            summary.truncated = true;
+            break;
+        }
+        std::memcpy(&site, data + offset, sizeof(site));
+        offset += sizeof(site);
+        if ((size - offset) / kEntrySize < site.bucket_entries) {
+            summary.truncated = true;
+            break;
+        }
+        HistogramSite entry {site.site_id, DurationSketch(header.sub_bucket_bits)};
+        for (uint32_t b = 0; b < site.bucket_entries; ++b) {
+            uint32_t index = 0U;
+            uint64_t total = 0U;
+            std::memcpy(&index, data + offset, sizeof(index));
+            std::memcpy(&total, data + offset + sizeof(index), sizeof(total));
+            offset += kEntrySize;
+            if (index >= header.bucket_count) {
+                error = "histogram bucket index out of range";
+                return false;
+            }
+            entry.sketch.add_bucket(index, total);
+        }
+        entry.sketch.set_totals(site.count, site.sum_ns, site.min_ns, site.max_ns);
+        summary.parsed += site.count;
+        summary.sites.push_back(std::move(entry));
+    }
+    return true;
+}
+
+// ---- Output ----------------------------------------------------------------------------
+
+// A JSON value printed the way Python's json.dumps(indent=2) prints it.
+class Json {
+public:
+    enum class Kind { null, boolean, integer, real, string, array, object };
+
+    Json() = default;
+    static Json boolean(bool value) { return make(Kind::boolean, value ? "true" : "false"); }
+    static Json integer(uint64_t value) { return make(Kind::integer, std::to_string(value)); }
+    static Json real(double value) { return make(Kind::real, python_float(value)); }
+    static Json mean(const Mean& mean) {
+        return mean.integral ? make(Kind::integer, std::to_string(static_cast<uint64_t>(mean.value)))
+                             : real(mean.value);
+    }
+    static Json string(const std::string& value) { return make(Kind::string, quote(value)); }
+    static Json array() { return make(Kind::array, ""); }
+    static Json object() { return make(Kind::object, ""); }
+
+    Json& set(const std::string& key, Json value) {
+        keys_.push_back(key);
+        items_.push_back(std::move(value));
+        return *this;
+    }
+
+    void push(Json value) { items_.push_back(std::move(value)); }
+
+    void dump(std::string& out, size_t level = 0U) const {
+        if (kind_ != Kind::array && kind_ != Kind::object) {
+            out += text_;
+            return;
+        }
+        const bool object = kind_ == Kind::object;
+        if (items_.empty()) {
+            out += object ? "{}" : "[]";
+            return;
+        }
+        out += object ? "{\n" : "[\n";
+        for (size_t i = 0; i < items_.size(); ++i) {
+            out.append((level + 1U) * 2U, ' ');
+            if (object) {
+                out += quote(keys_[i]);
+                out += ": ";
+            }
+            items_[i].dump(out, level + 1U);
+            out += i + 1U < items_.size() ? ",\n" : "\n";
+        }
+        out.append(level * 2U, ' ');
+        out += object ? "}" : "]";
+    }
+
+private:
+    static Json make(Kind kind, std::string text) {
+        Json value;
+        value.kind_ = kind;
+        value.text_ = std::move(text);
+        return value;
+    }
+
+    // repr(float): the shortest digits that round-trip, in exponent form outside 1e-4..1e16.
+    static std::string python_float(double value) {
+        if (std::isnan(value)) {
+            return "NaN";
+        }
+        if (std::isinf(value)) {
+            return value > 0.0 ? "Infinity" : "-Infinity";
+        }
+        char buffer[40];
+        for (int precision = 1; precision <= 17; ++precision) {
+            std::snprintf(buffer, sizeof(buffer), "%.*e", precision - 1, value);
+            if (std::strtod(buffer, nullptr) == value) {
+                break;
+            }
+        }
+        std::string text(buffer);
+        const size_t e = text.find('e');
+        const int exponent = std::atoi(text.c_str() + e + 1U);
+        std::string sign;
+        std::string digits;
+        for (size_t i = 0; i < e; ++i) {
+            if (text[i] == '-') {
+                sign = "-";
+            } else if (text[i] != '.') {
+                digits += text[i];
+            }
+        }
+        while (digits.size() > 1U && digits.back() == '0') {
+            digits.pop_back();
+        }
+        if (exponent < -4 || exponent >= 16) {
+            std::string mantissa = digits.substr(0U, 1U);
+            if (digits.size() > 1U) {
+                mantissa += "." + digits.substr(1U);
+            }
+            char exp_text[16];
+            std::snprintf(exp_text, sizeof(exp_text), "e%c%02d", exponent < 0 ? '-' : '+', std::abs(exponent));
+            return sign + mantissa + exp_text;
+        }
+        if (exponent < 0) {
+            return sign + "0." + std::string(static_cast<size_t>(-exponent - 1), '0') + digits;
+        }
+        const auto integer_digits = static_cast<size_t>(exponent) + 1U;
+        if (digits.size() <= integer_digits) {
+            return sign + digits + std::string(integer_digits - digits.size(), '0') + ".0";
+        }
+        return sign + digits.substr(0U, integer_digits) + "." + digits.substr(integer_digits);
+    }
+
+    // ensure_ascii quoting: everything outside printable ASCII becomes \uXXXX (UTF-16).
+    static std::string quote(const std::string& text) {
+        std::string out = "\"";
+        char escaped[16];
+        for (size_t i = 0; i < text.size();) {
+            const auto ch = static_cast<unsigned char>(text[i]);
+            uint32_t code = ch;
+            size_t length = 1U;
+            if (ch >= 0xF0U && i + 3U < text.size()) {
+                code = ((ch & 0x07U) << 18U) | ((static_cast<unsigned char>(text[i + 1U]) & 0x3FU) << 12U) |
+                       ((static_cast<unsigned char>(text[i + 2U]) & 0x3FU) << 6U) |
+                       (static_cast<unsigned char>(text[i + 3U]) & 0x3FU);
+                length = 4U;
+            } else if (ch >= 0xE0U && i + 2U < text.size()) {
+                code = ((ch & 0x0FU) << 12U) | ((static_cast<unsigned char>(text[i + 1U]) & 0x3FU) << 6U) |
+                       (static_cast<unsigned char>(text[i + 2U]) & 0x3FU);
+                length = 3U;
+            } else if (ch >= 0xC0U && i + 1U < text.size()) {
+                code = ((ch & 0x1FU) << 6U) | (static_cast<unsigned char>(text[i + 1U]) & 0x3FU);
+                length = 2U;
+            }
+            i += length;
+            switch (code) {
+            case '"':
+                out += "\\\"";
+                continue;
+            case '\\':
+                out += "\\\\";
+                continue;
+            case '\n':
+                out += "\\n";
+                continue;
+            case '\r':
+                out += "\\r";
+                continue;
+            case '\t':
+                out += "\\t";
+                continue;
+            case '\b':
+                out += "\\b";
+                continue;
+            case '\f':
+                out += "\\f";
+                continue;
+            default:
+                break;
+            }
+            if (code >= 0x20U && code < 0x7FU) {
+                out += static_cast<char>(code);
+            } else if (code < 0x10000U) {
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", code);
+                out += escaped;
+            } else {
+                code -= 0x10000U;
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x\\u%04x", 0xD800U + (code >> 10U),
+                              0xDC00U + (code & 0x3FFU));
+                out += escaped;
+            }
+        }
+        out += "\"";
+        return out;
+    }
+
+    Kind kind_ = Kind::null;
+    std::string text_ = "null";
+    std::vector<std::string> keys_;
+    std::vector<Json> items_;
+};
+
+struct SiteRow {
+    uint32_t site_id;
+    uint64_t first_seen;
+    std::string label;
+    const DurationSketch* sketch;
+    const SiteTotals* totals;  // null for histogram exports
+};
+
+std::string site_label(const std::unordered_map<uint32_t, SiteInfo>& sites, uint32_t site_id) {
+    const auto it = sites.find(site_id);
+    return it != sites.end() ? it->second.label : "site_" + std::to_string(site_id);
+}
+
+// Python's %.2f on an int or float.
+std::string fixed2(double value) {
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "%.2f", value);
+    return buffer;
+}
+
+void append_quantiles(Json& row, const DurationSketch& sketch, bool p90, bool p999) {
+    row.set("p50_ns", Json::integer(sketch.quantile(sketch.count() / 2U)));
+    if (p90) {
+        row.set("p90_ns", Json::integer(sketch.quantile(sketch.rank(0.90))));
+    }
+    row.set("p99_ns", Json::integer(sketch.quantile(sketch.rank(0.99))));
+    if (p999) {
+        row.set("p999_ns", Json::integer(sketch.quantile(sketch.rank(0.999))));
+    }
+}
+
+// ---- Regression comparison -------------------------------------------------------------
+
+// Site ids depend on registration order, so runs are matched by where a site is declared.
+struct SiteKey {
+    std::string label;
+    std::string file;
+    std::string function;
+    std::string line;
+
+    bool operator<(const SiteKey& other) const {
+        return std::tie(label, file, function, line) < std::tie(other.label, other.file, other.function, other.line);
+    }
+};
+
+struct RunProfile {
+    std::map<SiteKey, DurationSketch> sites;
+};
+
+bool load_profile(const std::string& sample_path, const std::string& site_path, size_t jobs, RunProfile& profile,
+                  std::string& error) {
+    TraceSet traces;
+    std::unordered_map<uint32_t, SiteInfo> sites;
+    if (!traces.open(sample_path, error)) {
+        return false;
+    }
+    if (!load_sites(site_path, sites)) {
+        error = "cannot read site table " + site_path;
+        return false;
+    }
+    const auto add = [&sites, &profile](uint32_t site_id, const DurationSketch& sketch) {
+        const auto info = sites.find(site_id);
+        const SiteKey key = info != sites.end()
+                                ? SiteKey {info->second.label, info->second.file, info->second.function, info->second.line}
+                                : SiteKey {"site_" + std::to_string(site_id), "", "", ""};
+        auto slot = profile.sites.emplace(key, DurationSketch(sketch.sub_bucket_bits())).first;
+        slot->second.merge(sketch);
+    };
+    if (traces.histogram()) {
+        HistogramSummary histograms;
+        if (!load_histograms(traces.front(), histograms, error)) {
+            return false;
+        }
+        for (const HistogramSite& site : histograms.sites) {
+            if (site.sketch.count() != 0U) {
+                add(site.site_id, site.sketch);
+            }
+        }
+    } else {
+        RecordSummary records;
+        analyze_records(traces, jobs, records);
+        for (const auto& entry : records.totals.sites) {
+            add(entry.first, entry.second.durations);
+        }
+    }
+    return true;
+}
+
+struct RankTest {
+    // P(candidate > baseline) + P(tie) / 2.
+    double superiority = 0.5;
+    double p_slower = 1.0;
+    double p_faster = 1.0;
+};
+
+// Mann-Whitney U from two sketches on the same bucket grid, with the normal approximation
+// and tie correction. Values sharing a bucket count as ties, which only makes the test more
+// conservative. Cost is linear in the number of buckets, not samples.
+RankTest mann_whitney(const DurationSketch& baseline, const DurationSketch& candidate) {
+    RankTest result;
+    const auto n1 = static_cast<long double>(baseline.count());
+    const auto n2 = static_cast<long double>(candidate.count());
+    if (baseline.count() == 0U || candidate.count() == 0U) {
+        return result;
+    }
+    long double u = 0.0L;
+    long double below = 0.0L;
+    long double ties = 0.0L;
+    const uint32_t end = std::max(baseline.end_bucket(), candidate.end_bucket());
+    for (uint32_t i = std::min(baseline.first_bucket(), candidate.first_bucket()); i < end; ++i) {
+        const auto b = static_cast<long double>(baseline.bucket(i));
+        const auto c = static_cast<long double>(candidate.bucket(i));
+        u += c * (below + b / 2.0L);
+        below += b;
+        const long double t = b + c;
+        ties += t * t * t - t;
+    }
+    const long double n = n1 + n2;
+    result.superiority = static_cast<double>(u / (n1 * n2));
+    const long double variance = n1 * n2 / 12.0L * ((n + 1.0L) - ties / (n * (n - 1.0L)));
+    if (variance <= 0.0L) {
+        return result;
+    }
+    const auto z = static_cast<double>((u - n1 * n2 / 2.0L) / std::sqrt(variance));
+    result.p_slower = 0.5 * std::erfc(z / std::sqrt(2.0));
+    result.p_faster = 0.5 * std::erfc(-z / std::sqrt(2.0));
+    return result;
+}
+
+constexpr const char* kCompareMetrics[] = {"p50", "p90", "p99", "p999", "mean"};
+
+[[nodiscard]] double metric_value(const DurationSketch& sketch, const std::string& metric) {
+    if (metric == "mean") {
+        return static_cast<double>(sketch.sum()) / static_cast<double>(sketch.count());
+    }
+    const double q = metric == "p50" ? 0.5 : metric == "p90" ? 0.90 : metric == "p99" ? 0.99 : 0.999;
+    return static_cast<double>(sketch.quantile(metric == "p50" ? sketch.count() / 2U : sketch.rank(q)));
+}
+
+[[nodiscard]] double delta_pct(double baseline, double candidate) noexcept {
+    return (candidate - baseline) / std::max(baseline, 1.0) * 100.0;
+}
+
+Json site_key_json(const SiteKey& key) {
+    return Json::object()
+        .set("label", Json::string(key.label))
+        .set("file", Json::string(key.file))
+        .set("function", Json::string(key.function))
+        .set("line", Json::integer(std::strtoull(key.line.c_str(), nullptr, 10)));
+}
+
+Json profile_json(const DurationSketch& sketch) {
+    Json row = Json::object();
+    row.set("count", Json::integer(sketch.count()));
+    append_quantiles(row, sketch, true, true);
+    row.set("mean_ns", Json::real(metric_value(sketch, "mean")));
+    return row;
+}
+
+struct Options {
+    std::string sample_path;
+    std::string site_path;
+    std::string thread_path;
+    bool json = false;
+    bool tree = false;
+    bool breakdown = false;
+    bool args = false;
+    size_t jobs = 0U;
+    // --compare: sample_path / site_path are the baseline run.
+    bool compare = false;
+    std::string candidate_sample_path;
+    std::string candidate_site_path;
+    std::string metric = "p50";
+    double threshold_pct = 5.0;
+    double alpha = 0.01;
+    uint64_t min_count = 30U;
+};
+
+bool parse_options(int argc, char** argv, Options& options) {
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--json") {
+            options.json = true;
+        } else if (arg == "--tree") {
+            options.tree = true;
+        } else if (arg == "--breakdown") {
+            options.breakdown = true;
+        } else if (arg == "--args") {
+            options.args = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.thread_path = argv[++i];
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            options.jobs = static_cast<size_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--compare") {
+            options.compare = true;
+        } else if (arg == "--metric" && i + 1 < argc) {
+            options.metric = argv[++i];
+            if (std::find(std::begin(kCompareMetrics), std::end(kCompareMetrics), options.metric) ==
+                std::end(kCompareMetrics)) {
+                return false;
+            }
+        } else if (arg == "--threshold" && i + 1 < argc) {
+            options.threshold_pct = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--alpha" && i + 1 < argc) {
+            options.alpha = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--min-count" && i + 1 < argc) {
+            options.min_count = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg.rfind("--threads=", 0U) == 0U) {
+            options.thread_path = arg.substr(10U);
+        } else if (arg.rfind("--jobs=", 0U) == 0U) {
+            options.jobs = static_cast<size_t>(std::strtoul(arg.c_str() + 7, nullptr, 10));
+        } else if (!arg.empty() && arg[0] == '-') {
+            return false;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() != (options.compare ? 4U : 2U)) {
+        return false;
+    }
+    options.sample_path = positional[0];
+    options.site_path = positional[1];
+    if (options.compare) {
+        options.candidate_sample_path = positional[2];
+        options.candidate_site_path = positional[3];
+    }
+    if (options.jobs == 0U) {
+        options.jobs = std::max(1U, std::thread::hardware_concurrency());
+    }
+    return true;
+}
+
+int run_compare(const Options& options) {
+    RunProfile baseline;
+    RunProfile candidate;
+    std::string error;
+    if (!load_profile(options.sample_path, options.site_path, options.jobs, baseline, error) ||
+        !load_profile(options.candidate_sample_path, options.candidate_site_path, options.jobs, candidate, error)) {
+        std::fprintf(stderr, "error: %s\n", error.c_str());
+        return 2;
+    }
+
+    struct CompareRow {
+        const SiteKey* key;
+        DurationSketch baseline;
+        DurationSketch candidate;
+        double deltas[std::size(kCompareMetrics)];
+        double delta;
+        RankTest test;
+        const char* verdict;
+    };
+    std::vector<CompareRow> rows;
+    std::vector<const SiteKey*> only_baseline;
+    std::vector<const SiteKey*> only_candidate;
+    size_t regressions = 0U;
+    size_t improvements = 0U;
+    for (const auto& entry : baseline.sites) {
+        const auto match = candidate.sites.find(entry.first);
+        if (match == candidate.sites.end()) {
+            only_baseline.push_back(&entry.first);
+            continue;
+        }
+        // Histogram exports use coarser buckets; compare on the common grid.
+        const uint32_t bits = std::min(entry.second.sub_bucket_bits(), match->second.sub_bucket_bits());
+        CompareRow row {&entry.first, entry.second.coarsened(bits), match->second.coarsened(bits), {}, 0.0, {}, "unchanged"};
+        for (size_t m = 0; m < std::size(kCompareMetrics); ++m) {
+            row.deltas[m] = delta_pct(metric_value(row.baseline, kCompareMetrics[m]),
+                                      metric_value(row.candidate, kCompareMetrics[m]));
+        }
+        row.delta = delta_pct(metric_value(row.baseline, options.metric), metric_value(row.candidate, options.metric));
+        row.test = mann_whitney(row.baseline, row.candidate);
+        if (row.baseline.count() < options.min_count || row.candidate.count() < options.min_count) {
+            row.verdict = "low_count";
+        } else if (row.delta > options.threshold_pct && row.test.p_slower < options.alpha) {
+            row.verdict = "regressed";
+            ++regressions;
+        } else if (row.delta < -options.threshold_pct && row.test.p_faster < options.alpha) {
+            row.verdict = "improved";
+            ++improvements;
+        }
+        rows.push_back(std::move(row));
+    }
+    for (const auto& entry : candidate.sites) {
+        if (baseline.sites.find(entry.first) == baseline.sites.end()) {
+            only_candidate.push_back(&entry.first);
+        }
+    }
+    std::stable_sort(rows.begin(), rows.end(),
+                     [](const CompareRow& lhs, const CompareRow& rhs) { return lhs.delta > rhs.delta; });
+
+    if (options.json) {
+        Json sites = Json::array();
+        for (const CompareRow& row : rows) {
+            Json deltas = Json::object();
+            for (size_t m = 0; m < std::size(kCompareMetrics); ++m) {
+                deltas.set(kCompareMetrics[m], Json::real(row.deltas[m]));
+            }
+            Json site = site_key_json(*row.key);
+            site.set("baseline", profile_json(row.baseline))
+                .set("candidate", profile_json(row.candidate))
+                .set("delta_pct", std::move(deltas))
+                .set("superiority", Json::real(row.test.superiority))
+                .set("p_slower", Json::real(row.test.p_slower))
+                .set("p_faster", Json::real(row.test.p_faster))
+                .set("verdict", Json::string(row.verdict));
+            sites.push(std::move(site));
+        }
+        Json missing_baseline = Json::array();
+        for (const SiteKey* key : only_baseline) {
+            missing_baseline.push(site_key_json(*key));
+        }
+        Json missing_candidate = Json::array();
+        for (const SiteKey* key : only_candidate) {
+            missing_candidate.push(site_key_json(*key));
+        }
+        Json payload = Json::object();
+        payload.set("metric", Json::string(options.metric))
+            .set("threshold_pct", Json::real(options.threshold_pct))
+            .set("alpha", Json::real(options.alpha))
+            .set("min_count", Json::integer(options.min_count))
+            .set("regressions", Json::integer(regressions))
+            .set("improvements", Json::integer(improvements))
+            .set("sites", std::move(sites))
+            .set("only_in_baseline", std::move(missing_baseline))
+            .set("only_in_candidate", std::move(missing_candidate));
+        std::string out;
+        payload.dump(out);
+        out += "\n";
+        std::fwrite(out.data(), 1U, out.size(), stdout);
+    } else {
+        std::printf("label\tbaseline_count\tcandidate_count\tbaseline_%s_ns\tcandidate_%s_ns\tp50_delta_pct\t"
+                    "p90_delta_pct\tp99_delta_pct\tp999_delta_pct\tmean_delta_pct\tp_value\tverdict\n",
+                    options.metric.c_str(), options.metric.c_str());
+        for (const CompareRow& row : rows) {
+            std::printf("%s\t%" PRIu64 "\t%" PRIu64 "\t%.2f\t%.2f\t%+.2f\t%+.2f\t%+.2f\t%+.2f\t%+.2f\t%.3g\t%s\n",
+                        row.key->label.c_str(), row.baseline.count(), row.candidate.count(),
+                        metric_value(row.baseline, options.metric), metric_value(row.candidate, options.metric),
+                        row.deltas[0], row.deltas[1], row.deltas[2], row.deltas[3], row.deltas[4],
+                        row.delta >= 0.0 ? row.test.p_slower : row.test.p_faster, row.verdict);
+        }
+        for (const SiteKey* key : only_baseline) {
+            std::printf("only_in_baseline\t%s\t%s:%s\n", key->label.c_str(), key->file.c_str(), key->line.c_str());
+        }
+        for (const SiteKey* key : only_candidate) {
+            std::printf("only_in_candidate\t%s\t%s:%s\n", key->label.c_str(), key->file.c_str(), key->line.c_str());
+        }
+        std::printf("regressions\t%zu\t(%s > %+.2f%% with p < %g)\n", regressions, options.metric.c_str(),
+                    options.threshold_pct, options.alpha);
+    }
+    return regressions != 0U ? 1 : 0;
+}
+
+int run_summary(const Options& options) {
+    TraceSet traces;
+    std::string error;
+    std::unordered_map<uint32_t, SiteInfo> sites;
+    std::unordered_map<uint32_t, ThreadInfo> thread_infos;
+    if (!traces.open(options.sample_path, error)) {
+        std::fprintf(stderr, "error: %s\n", error.c_str());
+        return 2;
+    }
+    if (!load_sites(options.site_path, sites)) {
+        std::fprintf(stderr, "error: cannot read site table %s\n", options.site_path.c_str());
+        return 2;
+    }
+    load_threads(options.thread_path.empty() ? thread_path_for(options.site_path) : options.thread_path, thread_infos);
+
+    RecordSummary records;
+    HistogramSummary histograms;
+    std::vector<SiteRow> site_rows;
+    if (traces.histogram()) {
+        if (!load_histograms(traces.front(), histograms, error)) {
+            std::fprintf(stderr, "error: %s\n", error.c_str());
+            return 2;
+        }
+        for (size_t i = 0; i < histograms.sites.size(); ++i) {
+            const HistogramSite& site = histograms.sites[i];
+            if (site.sketch.count() != 0U) {
+                site_rows.push_back({site.site_id, i, site_label(sites, site.site_id), &site.sketch, nullptr});
+            }
+        }
+    } else {
+        analyze_records(traces, options.jobs, records);
+        for (const auto& entry : records.totals.sites) {
+            site_rows.push_back({entry.first, entry.second.first_seen, site_label(sites, entry.first),
+                                 &entry.second.durations, &entry.second});
+        }
+    }
+    std::vector<uint64_t> site_p50(site_rows.size());
+    std::vector<size_t> site_order(site_rows.size());
+    for (size_t i = 0; i < site_rows.size(); ++i) {
+        site_p50[i] = site_rows[i].sketch->quantile(site_rows[i].sketch->count() / 2U);
+        site_order[i] = i;
+    }
+    std::sort(site_order.begin(), site_order.end(), [&](size_t lhs, size_t rhs) {
+        if (site_p50[lhs] != site_p50[rhs]) {
+            return site_p50[lhs] > site_p50[rhs];
+        }
+        return site_rows[lhs].first_seen < site_rows[rhs].first_seen;
+    });
+
+    Totals& totals = records.totals;
+    std::sort(totals.threads.begin(), totals.threads.end(), [](const ThreadRow& lhs, const ThreadRow& rhs) {
+        if (lhs.durations.count() != rhs.durations.count()) {
+            return lhs.durations.count() > rhs.durations.count();
+        }
+        return lhs.first_seen < rhs.first_seen;
+    });
+    std::sort(totals.drop_intervals.begin(), totals.drop_intervals.end(),
+              [](const DropInterval& lhs, const DropInterval& rhs) { return lhs.ordinal < rhs.ordinal; });
+    const double migration_rate =
+        totals.transitions != 0U ? static_cast<double>(totals.migrations) / static_cast<double>(totals.transitions) : 0.0;
+
+    const detail::FileHeader& header = traces.front().header();
+    Json payload = Json::object();
+    if (traces.histogram()) {
+        payload.set("format", Json::string("histogram"))
+            .set("clock_source", Json::string("monotonic"))
+            .set("record_count", Json::integer(histograms.sample_count))
+            .set("parsed_record_count", Json::integer(histograms.parsed))
+            .set("overwritten", Json::integer(0U))
+            .set("dropped", Json::integer(histograms.dropped))
+            .set("shard_count", Json::integer(0U))
+            .set("capacity_per_shard", Json::integer(0U))
+            .set("truncated", Json::boolean(histograms.truncated));
+    } else {
+        payload.set("format", Json::string(traces.compressed() ? "compressed" : "records"))
+            .set("clock_source", Json::string(header.clock_source == detail::kTscClockSource ? "tsc" : "monotonic"))
+            .set("record_count", Json::integer(traces.record_count()))
+            .set("parsed_record_count", Json::integer(records.parsed))
+            .set("overwritten", Json::integer(traces.overwritten()))
+            .set("dropped", Json::integer(traces.dropped()))
+            .set("shard_count", Json::integer(header.shard_count))
+            .set("capacity_per_shard", Json::integer(header.capacity_per_shard))
+            .set("truncated", Json::boolean(records.truncated));
+    }
+
+    Json drop_intervals = Json::array();
+    for (const DropInterval& interval : totals.drop_intervals) {
+        drop_intervals.push(Json::object()
+                                .set("start_ns", Json::integer(interval.start_ns))
+                                .set("duration_ns", Json::integer(interval.duration_ns))
+                                .set("dropped", Json::integer(interval.dropped)));
+    }
+    payload.set("drop_intervals", std::move(drop_intervals));
+
+    Json site_json = Json::array();
+    for (const size_t index : site_order) {
+        const SiteRow& site = site_rows[index];
+        const DurationSketch& sketch = *site.sketch;
+        Json row = Json::object();
+        row.set("site_id", Json::integer(site.site_id))
+            .set("label", Json::string(site.label))
+            .set("count", Json::integer(sketch.count()))
+            .set("min_ns", Json::integer(sketch.min()));
+        append_quantiles(row, sketch, true, true);
+        if (site.totals == nullptr) {
+            row.set("mean_ns", Json::real(static_cast<double>(sketch.sum()) / static_cast<double>(sketch.count())))
+                .set("trimmed_mean_ns", Json::real(sketch.trimmed_mean(kTrimRatio).value))
+                .set("max_ns", Json::integer(sketch.max()));
+        } else {
+            row.set("mean_ns", Json::mean(exact_mean(sketch.sum(), sketch.count())))
+                .set("trimmed_mean_ns", Json::mean(sketch.trimmed_mean(kTrimRatio)))
+                .set("max_ns", Json::integer(sketch.max()))
+                .set("inclusive_total_ns", Json::integer(sketch.sum()))
+                .set("self_total_ns", Json::integer(site.totals->self_ns))
+                .set("self_mean_ns", Json::real(static_cast<double>(site.totals->self_ns) /
+                                                static_cast<double>(sketch.count())));
+        }
+        site_json.push(std::move(row));
+    }
+    payload.set("sites", std::move(site_json));
+
+    // Preorder with ascending site ids is the Python tool's sorted(path) order.
+    struct TreeLine {
+        std::string label;
+        size_t depth;
+        const CallTree::Node* node;
+    };
+    std::vector<TreeLine> tree_lines;
+    Json tree_json = Json::array();
+    std::vector<std::string> path;
+    const auto visit = [&](const auto& self, const CallTree::Node& node) -> void {
+        for (const auto& entry : node.children) {
+            const CallTree::Node& child = totals.tree.node(entry.second);
+            path.push_back(site_label(sites, child.site_id));
+            Json labels = Json::array();
+            for (const std::string& label : path) {
+                labels.push(Json::string(label));
+            }
+            tree_json.push(Json::object()
+                               .set("path", std::move(labels))
+                               .set("depth", Json::integer(path.size() - 1U))
+                               .set("count", Json::integer(child.count))
+                               .set("inclusive_ns", Json::integer(child.inclusive_ns))
+                               .set("self_ns", Json::integer(child.self_ns)));
+            tree_lines.push_back({path.back(), path.size() - 1U, &child});
+            self(self, child);
+            path.pop_back();
+        }
+    };
+    visit(visit, totals.tree.node(0U));
+    payload.set("call_tree", std::move(tree_json));
+
+    Json thread_json = Json::array();
+    for (const ThreadRow& thread : totals.threads) {
+        const auto info = thread_infos.find(thread.tid_hash);
+        const bool has_tid = info != thread_infos.end() && !info->second.tid.empty();
+        Json row = Json::object();
+        row.set("tid_hash", Json::integer(thread.tid_hash))
+            .set("tid", has_tid ? Json::integer(std::strtoull(info->second.tid.c_str(), nullptr, 10)) : Json())
+            .set("name", Json::string(info != thread_infos.end() ? info->second.name : ""))
+            .set("cpus", Json::integer(thread.cpus))
+            .set("migrations", Json::integer(thread.migrations))
+            .set("count", Json::integer(thread.durations.count()));
+        append_quantiles(row, thread.durations, false, false);
+        row.set("mean_ns", Json::mean(exact_mean(thread.durations.sum(), thread.durations.count())));
+        thread_json.push(std::move(row));
+    }
+    payload.set("threads", std::move(thread_json));
+
+    Json cpu_json = Json::array();
+    for (const auto& entry : totals.cpus) {
+        Json row = Json::object();
+        row.set("cpu", Json::integer(entry.first)).set("count", Json::integer(entry.second.count()));
+        append_quantiles(row, entry.second, false, false);
+        row.set("mean_ns", Json::mean(exact_mean(entry.second.sum(), entry.second.count())));
+        cpu_json.push(std::move(row));
+    }
+    payload.set("cpus", std::move(cpu_json));
+    payload.set("migration", Json::object()
+                                 .set("transitions", Json::integer(totals.transitions))
+                                 .set("migrations", Json::integer(totals.migrations))
+                                 .set("rate", Json::real(migration_rate)));
+
+    const auto per_unit = [](uint64_t duration_ns, uint64_t arg_total) {
+        return arg_total != 0U ? Json::real(static_cast<double>(duration_ns) / static_cast<double>(arg_total)) : Json();
+    };
+    Json arg_json = Json::array();
+    for (const auto& entry : totals.args) {
+        ArgBucket all;
+        Json buckets = Json::array();
+        for (const auto& bucket : entry.second) {
+            const ArgBucket& data = bucket.second;
+            all.merge(data);
+            Json row = Json::object();
+            row.set("arg_min", Json::integer(data.arg_min))
+                .set("arg_max", Json::integer(data.arg_max))
+                .set("count", Json::integer(data.durations.count()));
+            append_quantiles(row, data.durations, false, false);
+            row.set("mean_ns", Json::mean(exact_mean(data.durations.sum(), data.durations.count())))
+                .set("ns_per_unit", per_unit(data.durations.sum(), data.arg_total));
+            buckets.push(std::move(row));
+        }
+        Json row = Json::object();
+        row.set("site_id", Json::integer(entry.first.first))
+            .set("label", Json::string(site_label(sites, entry.first.first)))
+            .set("arg", Json::integer(entry.first.second))
+            .set("count", Json::integer(all.durations.count()));
+        append_quantiles(row, all.durations, false, false);
+        row.set("arg_total", Json::integer(all.arg_total))
+            .set("duration_total_ns", Json::integer(all.durations.sum()))
+            .set("ns_per_unit", per_unit(all.durations.sum(), all.arg_total))
+            .set("buckets", std::move(buckets));
+        arg_json.push(std::move(row));
+    }
+    payload.set("args", std::move(arg_json));
+
+    if (options.json) {
+        std::string out;
+        payload.dump(out);
+        out += "\n";
+        std::fwrite(out.data(), 1U, out.size(), stdout);
+        return 0;
+    }
+
+    if (traces.histogram() ? histograms.truncated : records.truncated) {
+        std::fputs("warning\tpartial record stream parsed\n", stderr);
+    }
+    std::puts("label\tcount\tmin_ns\tp50_ns\tp90_ns\tp99_ns\tp999_ns\tmean_ns\ttrimmed_mean_ns\tmax_ns");
+    for (const size_t index : site_order) {
+        const DurationSketch& sketch = *site_rows[index].sketch;
+        std::printf("%s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%s\t%s\t%" PRIu64 "\n",
+                    site_rows[index].label.c_str(), sketch.count(), sketch.min(), site_p50[index],
+                    sketch.quantile(sketch.rank(0.90)), sketch.quantile(sketch.rank(0.99)),
+                    sketch.quantile(sketch.rank(0.999)),
+                    fixed2(static_cast<double>(sketch.sum()) / static_cast<double>(sketch.count())).c_str(),
+                    fixed2(sketch.trimmed_mean(kTrimRatio).value).c_str(), sketch.max());
+    }
+
+    if (options.breakdown && !totals.threads.empty()) {
+        std::puts("");
+        std::puts("thread\ttid\tname\tcount\tp50_ns\tp99_ns\tmean_ns\tcpus\tmigrations");
+        for (const ThreadRow& thread : totals.threads) {
+            const auto info = thread_infos.find(thread.tid_hash);
+            const std::string tid = info != thread_infos.end() && !info->second.tid.empty()
+                                        ? std::to_string(std::strtoull(info->second.tid.c_str(), nullptr, 10))
+                                        : "-";
+            const std::string name =
+                info != thread_infos.end() && !info->second.name.empty() ? info->second.name : "-";
+            const DurationSketch& sketch = thread.durations;
+            std::printf("%08" PRIx32 "\t%s\t%s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%s\t%zu\t%" PRIu64 "\n",
+                        thread.tid_hash, tid.c_str(), name.c_str(), sketch.count(), sketch.quantile(sketch.count() / 2U),
+                        sketch.quantile(sketch.rank(0.99)),
+                        fixed2(static_cast<double>(sketch.sum()) / static_cast<double>(sketch.count())).c_str(),
+                        thread.cpus, thread.migrations);
+        }
+    }
+    if (options.breakdown && !totals.cpus.empty()) {
+        std::puts("");
+        std::puts("cpu\tcount\tp50_ns\tp99_ns\tmean_ns");
+        for (const auto& entry : totals.cpus) {
+            const DurationSketch& sketch = entry.second;
+            std::printf("%" PRIu32 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%s\n", entry.first, sketch.count(),
+                        sketch.quantile(sketch.count() / 2U), sketch.quantile(sketch.rank(0.99)),
+                        fixed2(static_cast<double>(sketch.sum()) / static_cast<double>(sketch.count())).c_str());
+        }
+        std::printf("migration_rate\t%.4f\t(%" PRIu64 " of %" PRIu64 " consecutive samples changed CPU)\n",
+                    migration_rate, totals.migrations, totals.transitions);
+    }
+
+    if (options.args && !totals.args.empty()) {
+        const auto per_unit_text = [](uint64_t duration_ns, uint64_t arg_total) {
+            char buffer[64];
+            if (arg_total == 0U) {
+                return std::string("-");
+            }
+            std::snprintf(buffer, sizeof(buffer), "%.4f", static_cast<double>(duration_ns) / static_cast<double>(arg_total));
+            return std::string(buffer);
+        };
+        std::puts("");
+        std::puts("args\targ\targ_range\tcount\tp50_ns\tmean_ns\tns_per_unit");
+        for (const auto& entry : totals.args) {
+            ArgBucket all;
+            for (const auto& bucket : entry.second) {
+                all.merge(bucket.second);
+            }
+            const std::string label = site_label(sites, entry.first.first);
+            const DurationSketch& sketch = all.durations;
+            std::printf("%s\t%" PRIu32 "\tall\t%" PRIu64 "\t%" PRIu64 "\t%s\t%s\n", label.c_str(), entry.first.second,
+                        sketch.count(), sketch.quantile(sketch.count() / 2U),
+                        fixed2(static_cast<double>(sketch.sum()) / static_cast<double>(sketch.count())).c_str(),
+                        per_unit_text(sketch.sum(), all.arg_total).c_str());
+            for (const auto& bucket : entry.second) {
+                const DurationSketch& durations = bucket.second.durations;
+                std::printf("  %s\t%" PRIu32 "\t%" PRIu64 "-%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%s\t%s\n",
+                            label.c_str(), entry.first.second, bucket.second.arg_min, bucket.second.arg_max,
+                            durations.count(), durations.quantile(durations.count() / 2U),
+                            fixed2(static_cast<double>(durations.sum()) / static_cast<double>(durations.count())).c_str(),
+                            per_unit_text(durations.sum(), bucket.second.arg_total).c_str());
+            }
+        }
+    }
+
+    if (options.tree && !tree_lines.empty()) {
+        std::puts("");
+        std::puts("call_tree\tcount\tinclusive_ns\tself_ns");
+        for (const TreeLine& line : tree_lines) {
+            std::printf("%s%s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n", std::string(line.depth * 2U, ' ').c_str(),
+                        line.label.c_str(), line.node->count, line.node->inclusive_ns, line.node->self_ns);
+        }
+    }
+    return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        std::fprintf(stderr,
+                     "usage: %s <sample.perfbin|glob> <sites.tsv> [--json] [--tree] [--breakdown] [--args] "
+                     "[--threads <threads.tsv>] [--jobs <n>]\n"
+                     "       %s --compare <base.perfbin> <base.sites.tsv> <cand.perfbin> <cand.sites.tsv> "
+                     "[--metric p50|p90|p99|p999|mean] [--threshold <pct>] [--alpha <p>] [--min-count <n>] "
+                     "[--json] [--jobs <n>]\n",
+                     argv[0], argv[0]);
+        return 2;
+    }
+    return options.compare ? run_compare(options) : run_summary(options);
+}
@@ -0,0 +1,340 @@
+// Converts a .perfbin export plus its .sites.tsv into Chrome Trace Event Format JSON that
+// chrome://tracing and ui.perfetto.dev can open.
+//
+//   perf_duration_trace_chrome <sample.perfbin> <sites.tsv> <out.json>
+//
+// Every sample becomes a complete ("X") event on the track of its producing thread; drop
+// markers written by async export become a "dropped_samples" counter track. The file is
+// streamed one block at a time, so memory stays bounded by the site table, one batch and
+// the samples still waiting for their argument records.
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "perf_duration_trace_reader.h"
+
+namespace {
+
+using perf_duration_trace::PerfbinReader;
+using perf_duration_trace::SampleRecord;
+using perf_duration_trace::detail::kTscClockSource;
+
+// A sample still missing arguments after this many later argument-carrying samples from the
+// same thread is written without them. Arguments lost to a full ring or staging buffer then
+// cost bounded memory, while those that an async export writes a flush later still attach.
+constexpr size_t kPendingWindow = 4096U;
+
+std::string json_escape(const std::string& text) {
+    std::string out;
+    out.reserve(text.size());
+    for (const char ch : text) {
+        switch (ch) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        default:
+            if (static_cast<unsigned char>(ch) < 0x20U) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(ch));
+                out += escaped;
+            } else {
+                out += ch;
+            }
+            break;
+        }
+    }
+    return out;
+}
+
+// site_id -> label; the header row and malformed lines are skipped.
+bool load_site_labels(const char* path, std::unordered_map<uint32_t, std::string>& labels) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    std::getline(in, line);
+    while (std::getline(in, line)) {
+        const size_t id_end = line.find('\t');
+        if (id_end == std::string::npos || id_end == 0U) {
+            continue;
+        }
+        const size_t label_end = line.find('\t', id_end + 1U);
+        try {
+            const auto site_id = static_cast<uint32_t>(std::stoul(line.substr(0U, id_end)));
+            labels[site_id] = line.substr(id_end + 1U, label_end == std::string::npos ? std::string::npos
+                                                                                      : label_end - id_end - 1U);
+        } catch (const std::exception&) {
+            continue;
+        }
+    }
+    return true;
+}
+
+class ChromeTraceWriter {
+public:
+    ChromeTraceWriter(FILE* out, const perf_duration_trace::detail::FileHeader& header,
+                      const std::unordered_map<uint32_t, std::string>& labels)
+        : out_(out), header_(header), labels_(labels) {}
+
+    void begin() { std::fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", out_); }
+
+    // Samples whose arguments never arrived (lost to a full ring) are written without them.
+    void end() {
+        for (const auto& thread : pending_order_) {
+            for (const SpanKey& key : thread.second) {
+                expire(key);
+            }
+        }
+        pending_order_.clear();
+        std::fputs("\n]}\n", out_);
+    }
+
+    // A sample that announces arguments (record_arg_count) is held back until its argument
+    // records arrive. They usually follow it directly, but an async export can write them in
+    // a later flush, so they are matched on (tid_hash, seq_no, site_id, start_ns) like the
+    // analyzer does. Arguments without their sample are skipped.
+    void write(const SampleRecord& record) {
+        if (perf_duration_trace::detail::is_argument(record)) {
+            attach_argument(record);
+            return;
+        }
+        if (perf_duration_trace::detail::is_drop_marker(record)) {
+            write_drop_interval(record);
+            return;
+        }
+        PendingSpan span {record, {}, 0U, 0U};
+        if (perf_duration_trace::detail::record_arg_count(record) == 0U) {
+            write_span(span);
+            return;
+        }
+        const SpanKey key = key_of(record);
+        const auto inserted = pending_.try_emplace(key, span);
+        if (!inserted.second) {
+            write_span(inserted.first->second);
+            inserted.first->second = span;
+        }
+        std::deque<SpanKey>& order = pending_order_[record.tid_hash];
+        order.push_back(key);
+        if (order.size() > kPendingWindow) {
+            expire(order.front());
+            order.pop_front();
+        }
+    }
+
+private:
+    struct SpanKey {
+        uint64_t start_ns;
+        uint32_t tid_hash;
+        uint32_t seq_no;
+        uint32_t site_id;
+
+        bool operator==(const SpanKey& other) const noexcept {
+            return start_ns == other.start_ns && tid_hash == other.tid_hash && seq_no == other.seq_no &&
+                   site_id == other.site_id;
+        }
+    };
+
+    struct SpanKeyHash {
+        size_t operator()(const SpanKey& key) const noexcept {
+            uint64_t hash = key.start_ns * 0x9E3779B97F4A7C15ULL;
+            hash ^= (static_cast<uint64_t>(key.tid_hash) << 32U | key.seq_no) + (hash << 6U) + (hash >> 2U);
+            hash ^= key.site_id + (hash << 6U) + (hash >> 2U);
+            return static_cast<size_t>(hash);
+        }
+    };
+
+    struct PendingSpan {
+        SampleRecord sample;
+        uint64_t args[perf_duration_trace::detail::kMaxRecordArgs];
+        // Bit i is set once argument i has arrived.
+        uint32_t present;
+        uint32_t received;
+    };
+
+    static SpanKey key_of(const SampleRecord& record) noexcept {
+        return SpanKey {record.start_ns, record.tid_hash, record.seq_no, record.site_id};
+    }
+
+    // A completed span leaves its key in pending_order_; it ages out of the window unused.
+    void attach_argument(const SampleRecord& record) {
+        if (record.cpu_hint >= perf_duration_trace::detail::kMaxRecordArgs) {
+            return;
+        }
+        const auto span = pending_.find(key_of(record));
+        if (span == pending_.end() || (span->second.present & (1U << record.cpu_hint)) != 0U) {
+            return;
+        }
+        PendingSpan& pending = span->second;
+        pending.args[record.cpu_hint] = record.duration_ns;
+        pending.present |= 1U << record.cpu_hint;
+        if (++pending.received < perf_duration_trace::detail::record_arg_count(pending.sample)) {
+            return;
+        }
+        write_span(pending);
+        pending_.erase(span);
+    }
+
+    // Writes the span with whatever arguments it has, if it is still waiting.
+    void expire(const SpanKey& key) {
+        const auto span = pending_.find(key);
+        if (span == pending_.end()) {
+            return;
+        }
+        write_span(span->second);
+        pending_.erase(span);
+    }
+
+    void write_span(const PendingSpan& span) {
+        const SampleRecord& record = span.sample;
+        if (seen_tids_.insert(record.tid_hash).second) {
+            separator();
+            std::fprintf(out_,
+                         "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%" PRIu32
+                         ",\"args\":{\"name\":\"thread %08" PRIx32 "\"}}",
+                         record.tid_hash, record.tid_hash);
+        }
+        separator();
+        std::fprintf(out_,
+                     "{\"ph\":\"X\",\"name\":\"%s\",\"cat\":\"perf\",\"pid\":1,\"tid\":%" PRIu32
+                     ",\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"site_id\":%" PRIu32 ",\"seq\":%" PRIu32
+                     ",\"depth\":%u",
+                     label(record.site_id).c_str(), record.tid_hash, to_us(start_ns(record.start_ns)),
+                     to_us(duration_ns(record.duration_ns)), record.site_id, record.seq_no,
+                     static_cast<unsigned>(perf_duration_trace::detail::record_depth(record)));
+        for (uint32_t i = 0U; i < perf_duration_trace::detail::kMaxRecordArgs; ++i) {
+            if ((span.present & (1U << i)) != 0U) {
+                std::fprintf(out_, ",\"arg%u\":%" PRIu64, static_cast<unsigned>(i), span.args[i]);
+            }
+        }
+        std::fputs("}}", out_);
+    }
+
+    void write_drop_interval(const SampleRecord& record) {
+        const double begin_us = to_us(start_ns(record.start_ns));
+        const double end_us = begin_us + to_us(duration_ns(record.duration_ns));
+        separator();
+        std::fprintf(out_,
+                     "{\"ph\":\"C\",\"name\":\"dropped_samples\",\"pid\":1,\"ts\":%.3f,"
+                     "\"args\":{\"dropped\":%" PRIu32 "}}",
+                     begin_us, record.seq_no);
+        separator();
+        std::fprintf(out_,
+                     "{\"ph\":\"C\",\"name\":\"dropped_samples\",\"pid\":1,\"ts\":%.3f,"
+                     "\"args\":{\"dropped\":0}}",
+                     end_us);
+    }
+
+    void separator() {
+        if (!first_event_) {
+            std::fputs(",\n", out_);
+        }
+        first_event_ = false;
+    }
+
+    const std::string& label(uint32_t site_id) {
+        auto it = escaped_labels_.find(site_id);
+        if (it == escaped_labels_.end()) {
+            const auto source = labels_.find(site_id);
+            const std::string raw =
+                source != labels_.end() ? source->second : "site_" + std::to_string(site_id);
+            it = escaped_labels_.emplace(site_id, json_escape(raw)).first;
+        }
+        return it->second;
+    }
+
+    [[nodiscard]] double start_ns(uint64_t value) const noexcept {
+        if (header_.clock_source != kTscClockSource) {
+            return static_cast<double>(value);
+        }
+        const double ticks = value >= header_.tsc_base_ticks
+                                 ? static_cast<double>(value - header_.tsc_base_ticks)
+                                 : -static_cast<double>(header_.tsc_base_ticks - value);
+        return static_cast<double>(header_.tsc_base_ns) + ticks * header_.tsc_ns_per_tick;
+    }
+
+    [[nodiscard]] double duration_ns(uint64_t value) const noexcept {
+        const double ns = static_cast<double>(value);
+        return header_.clock_source == kTscClockSource ? ns * header_.tsc_ns_per_tick : ns;
+    }
+
+    static double to_us(double ns) noexcept { return ns / 1000.0; }
+
+    FILE* out_;
+    const perf_duration_trace::detail::FileHeader& header_;
+    const std::unordered_map<uint32_t, std::string>& labels_;
+    std::unordered_map<uint32_t, std::string> escaped_labels_;
+    std::unordered_set<uint32_t> seen_tids_;
+    bool first_event_ = true;
+    // Samples still waiting for argument records, and per tid_hash the keys of the last
+    // kPendingWindow samples that announced arguments, oldest first.
+    std::unordered_map<SpanKey, PendingSpan, SpanKeyHash> pending_;
+    std::unordered_map<uint32_t, std::deque<SpanKey>> pending_order_;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc != 4) {
+        std::fprintf(stderr, "usage: %s <sample.perfbin> <sites.tsv> <out.json>\n", argv[0]);
+        return 2;
+    }
+
+    PerfbinReader reader;
+    if (!reader.open(argv[1])) {
+        std::fprintf(stderr, "error: cannot read perfbin export %s\n", argv[1]);
+        return 2;
+    }
+    std::unordered_map<uint32_t, std::string> labels;
+    if (!load_site_labels(argv[2], labels)) {
+        std::fprintf(stderr, "error: cannot read site table %s\n", argv[2]);
+        return 2;
+    }
+    FILE* out = std::fopen(argv[3], "wb");
+    if (out == nullptr) {
+        std::fprintf(stderr, "error: cannot open %s for writing\n", argv[3]);
+        return 2;
+    }
+
+    ChromeTraceWriter writer(out, reader.header(), labels);
+    writer.begin();
+    std::vector<SampleRecord> batch;
+    while (reader.next(batch)) {
+        for (const SampleRecord& record : batch) {
+            writer.write(record);
+        }
+    }
+    writer.end();
+
+    const bool write_ok = std::ferror(out) == 0;
+    const bool close_ok = std::fclose(out) == 0;
+    if (!write_ok || !close_ok) {
+        std::fprintf(stderr, "error: failed writing %s\n", argv[3]);
+        return 2;
+    }
+    if (reader.truncated()) {
+        std::fprintf(stderr, "warning: partial record stream converted (%" PRIu64 " of %" PRIu64 ")\n",
+                     reader.records_read(), reader.header().record_count);
+    }
+    return 0;
+}
@@ -0,0 +1,317 @@
+// Attaches to the live shared-memory segment of a running process
+// (AsyncExportConfig::live_shm_name) and prints rolling per-site latency percentiles.
+//
+//   perf_duration_trace_live <shm_name> [--interval-ms N] [--window N] [--iterations N]
+//
+// Every interval (default 1000 ms) the records published since the previous pass are
+// copied out of the ring and a table of count, rate, p50/p90/p99 and max per site over the
+// last `window` intervals (default 10) is printed. The first pass starts at the oldest
+// record still in the ring. The segment is mapped read-only and the writer never waits for
+// readers, so records this reader was too slow for are counted as lost instead of slowing
+// the traced process. Runs until the writer closes the segment, or for --iterations passes.
+// Percentiles come from log-linear buckets (32 per power of two) and are exact below 64 ns.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "perf_duration_trace_live.h"
+
+namespace {
+
+using perf_duration_trace::SampleRecord;
+using perf_duration_trace::detail::LiveHeader;
+using perf_duration_trace::detail::LiveSiteEntry;
+using perf_duration_trace::detail::BucketBounds;
+using perf_duration_trace::detail::LiveSlot;
+using perf_duration_trace::detail::kTscClockSource;
+using perf_duration_trace::detail::log_linear_bucket_bounds;
+using perf_duration_trace::detail::log_linear_bucket_index;
+
+constexpr uint32_t kSubBucketBits = 5U;
+// A writer that has not published for this many intervals is reported as stalled.
+constexpr uint64_t kStalledIntervals = 5U;
+
+// Midpoint of the bucket, which is the value itself for the exact buckets.
+uint64_t bucket_value(uint32_t index) {
+    const BucketBounds bounds = log_linear_bucket_bounds(index, kSubBucketBits);
+    return bounds.lower + (bounds.width >> 1U);
+}
+
+struct SiteWindow {
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+    uint64_t max_ns = 0;
+    std::map<uint32_t, uint64_t> buckets;
+
+    void add(uint64_t duration_ns) {
+        ++count;
+        sum_ns += duration_ns;
+        max_ns = std::max(max_ns, duration_ns);
+        ++buckets[log_linear_bucket_index(duration_ns, kSubBucketBits)];
+    }
+
+    void merge(const SiteWindow& other) {
+        count += other.count;
+        sum_ns += other.sum_ns;
+        max_ns = std::max(max_ns, other.max_ns);
+        for (const auto& entry : other.buckets) {
+            buckets[entry.first] += entry.second;
+        }
+    }
+
+    [[nodiscard]] uint64_t quantile(double q) const {
+        const auto rank = static_cast<uint64_t>(q * static_cast<double>(count - 1U));
+        uint64_t seen = 0U;
+        for (const auto& entry : buckets) {
+            seen += entry.second;
+            if (seen > rank) {
+                return std::min(bucket_value(entry.first), max_ns);
+            }
+        }
+        return max_ns;
+    }
+};
+
+using Interval = std::unordered_map<uint32_t, SiteWindow>;
+
+struct Options {
+    const char* name = nullptr;
+    uint32_t interval_ms = 1000U;
+    uint32_t window = 10U;
+    uint64_t iterations = 0U;
+};
+
+bool parse_count(const char* text, uint64_t& value) {
+    char* end = nullptr;
+    const unsigned long long parsed = std::strtoull(text, &end, 10);
+    if (end == text || *end != '\0') {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+bool parse_options(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        uint64_t value = 0U;
+        if ((arg == "--interval-ms" || arg == "--window" || arg == "--iterations") && i + 1 < argc) {
+            if (!parse_count(argv[++i], value)) {
+                return false;
+            }
+            if (arg == "--interval-ms") {
+                options.interval_ms = static_cast<uint32_t>(std::max<uint64_t>(value, 1U));
+            } else if (arg == "--window") {
+                options.window = static_cast<uint32_t>(std::max<uint64_t>(value, 1U));
+            } else {
+                options.iterations = value;
+            }
+        } else if (options.name == nullptr && arg.compare(0U, 2U, "--") != 0) {
+            options.name = argv[i];
+        } else {
+            return false;
+        }
+    }
+    return options.name != nullptr;
+}
+
+uint64_t monotonic_ns() {
+    struct timespec ts {};
+    if (clock_gettime(CLOCK_MONOTONIC_RAW, &ts) != 0) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+    }
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+class LiveReader {
+public:
+    LiveReader() = default;
+    LiveReader(const LiveReader&) = delete;
+    LiveReader& operator=(const LiveReader&) = delete;
+    ~LiveReader() {
+        if (base_ != nullptr) {
+            ::munmap(base_, size_);
+        }
+    }
+
+    bool attach(const char* name, std::string& error) {
+        const int fd = ::shm_open(name, O_RDONLY, 0);
+        if (fd < 0) {
+            error = std::string("cannot open shared memory ") + name + ": " + std::strerror(errno);
+            return false;
+        }
+        struct stat st {};
+        void* mapped = MAP_FAILED;
+        if (::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(LiveHeader)) {
+            size_ = static_cast<size_t>(st.st_size);
+            mapped = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            error = std::string("cannot map shared memory ") + name;
+            return false;
+        }
+        base_ = mapped;
+        header_ = static_cast<const LiveHeader*>(base_);
+        namespace detail = perf_duration_trace::detail;
+        // The acquire pairs with the writer's release store of the magic, which comes last.
+        if (header_->magic.load(std::memory_order_acquire) != detail::live_magic_word() ||
+            header_->version != detail::kLiveFormatVersion || header_->header_size != sizeof(LiveHeader) ||
+            header_->record_capacity == 0U ||
+            (header_->record_capacity & (header_->record_capacity - 1U)) != 0U ||
+            detail::live_segment_size(header_->record_capacity, header_->site_capacity) > size_) {
+            error = std::string(name) + " is not a perf_duration_trace live segment";
+            return false;
+        }
+        sites_ = detail::live_sites(base_);
+        slots_ = detail::live_slots(base_, header_->site_capacity);
+        const uint64_t written = header_->write_position.load(std::memory_order_acquire);
+        cursor_ = written > header_->record_capacity ? written - header_->record_capacity : 0U;
+        return true;
+    }
+
+    // Copies every record published since the previous call into interval.
+    void poll(Interval& interval) {
+        const uint64_t written = header_->write_position.load(std::memory_order_acquire);
+        const uint64_t capacity = header_->record_capacity;
+        if (written - cursor_ > capacity) {
+            lost_ += written - capacity - cursor_;
+            cursor_ = written - capacity;
+        }
+        const double ns_per_tick = header_->clock_source == kTscClockSource ? header_->ns_per_tick : 1.0;
+        for (; cursor_ < written; ++cursor_) {
+            SampleRecord record {};
+            if (!perf_duration_trace::detail::live_read_slot(slots_[cursor_ & (capacity - 1U)], cursor_, record)) {
+                ++lost_;
+                continue;
+            }
+            if (perf_duration_trace::detail::is_drop_marker(record) ||
+                perf_duration_trace::detail::is_argument(record)) {
+                continue;
+            }
+            const auto duration_ns = ns_per_tick == 1.0
+                                         ? record.duration_ns
+                                         : static_cast<uint64_t>(static_cast<double>(record.duration_ns) * ns_per_tick);
+            interval[record.site_id].add(duration_ns);
+            ++records_;
+        }
+    }
+
+    [[nodiscard]] std::string label(uint32_t site_id) const {
+        if (site_id != 0U && site_id <= header_->site_capacity) {
+            const LiveSiteEntry& entry = sites_[site_id - 1U];
+            if (entry.ready.load(std::memory_order_acquire) != 0U) {
+                return std::string(entry.label, strnlen(entry.label, sizeof(entry.label)));
+            }
+        }
+        return "site#" + std::to_string(site_id);
+    }
+
+    [[nodiscard]] const LiveHeader& header() const { return *header_; }
+    [[nodiscard]] uint64_t records() const { return records_; }
+    [[nodiscard]] uint64_t lost() const { return lost_; }
+
+private:
+    void* base_ = nullptr;
+    size_t size_ = 0U;
+    const LiveHeader* header_ = nullptr;
+    const LiveSiteEntry* sites_ = nullptr;
+    const LiveSlot* slots_ = nullptr;
+    uint64_t cursor_ = 0U;
+    uint64_t records_ = 0U;
+    uint64_t lost_ = 0U;
+};
+
+void print_window(const LiveReader& reader, const std::deque<Interval>& intervals, const Options& options,
+                  double elapsed_s, const char* writer_state) {
+    std::unordered_map<uint32_t, SiteWindow> sites;
+    for (const Interval& interval : intervals) {
+        for (const auto& entry : interval) {
+            sites[entry.first].merge(entry.second);
+        }
+    }
+    std::vector<std::pair<uint32_t, const SiteWindow*>> rows;
+    rows.reserve(sites.size());
+    for (const auto& entry : sites) {
+        rows.emplace_back(entry.first, &entry.second);
+    }
+    // Heaviest sites by total time first.
+    std::sort(rows.begin(), rows.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.second->sum_ns != rhs.second->sum_ns ? lhs.second->sum_ns > rhs.second->sum_ns
+                                                        : lhs.first < rhs.first;
+    });
+
+    const double window_s = static_cast<double>(intervals.size()) * options.interval_ms / 1000.0;
+    std::printf("# t=%.1fs window=%.1fs records=%" PRIu64 " lost=%" PRIu64 " dropped=%" PRIu64 " writer=%s\n",
+                elapsed_s, window_s, reader.records(), reader.lost(),
+                reader.header().dropped_samples.load(std::memory_order_relaxed), writer_state);
+    std::printf("label\tcount\trate_per_s\tp50_ns\tp90_ns\tp99_ns\tmax_ns\n");
+    for (const auto& row : rows) {
+        const SiteWindow& site = *row.second;
+        std::printf("%s\t%" PRIu64 "\t%.1f\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n",
+                    reader.label(row.first).c_str(), site.count, static_cast<double>(site.count) / window_s,
+                    site.quantile(0.50), site.quantile(0.90), site.quantile(0.99), site.max_ns);
+    }
+    std::printf("\n");
+    std::fflush(stdout);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        std::fprintf(stderr, "usage: %s <shm_name> [--interval-ms N] [--window N] [--iterations N]\n", argv[0]);
+        return 2;
+    }
+
+    LiveReader reader;
+    std::string error;
+    if (!reader.attach(options.name, error)) {
+        std::fprintf(stderr, "error: %s\n", error.c_str());
+        return 2;
+    }
+
+    const uint64_t started_ns = monotonic_ns();
+    const uint64_t interval_ns = static_cast<uint64_t>(options.interval_ms) * 1000000ULL;
+    std::deque<Interval> intervals(1U);
+    reader.poll(intervals.back());
+    for (uint64_t pass = 1U;; ++pass) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(options.interval_ms));
+        reader.poll(intervals.back());
+
+        const bool closed = reader.header().closed.load(std::memory_order_acquire) != 0U;
+        const uint64_t now_ns = monotonic_ns();
+        const uint64_t heartbeat_ns = reader.header().heartbeat_ns.load(std::memory_order_acquire);
+        const bool stalled = now_ns > heartbeat_ns && now_ns - heartbeat_ns > kStalledIntervals * interval_ns;
+        const char* writer_state = closed ? "closed" : (stalled ? "stalled" : "alive");
+        print_window(reader, intervals, options, static_cast<double>(now_ns - started_ns) / 1e9, writer_state);
+
+        if (closed || (options.iterations != 0U && pass >= options.iterations)) {
+            break;
+        }
+        intervals.emplace_back();
+        while (intervals.size() > options.window) {
+            intervals.pop_front();
+        }
+    }
+    return 0;
+}